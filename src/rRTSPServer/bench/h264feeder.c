@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Synthetic h264grabber for the benchmarks: writes an H.264 stream to
+ * the fifo of rRTSPServer at the camera frame rate and bitrate.
+ * The stream is generated (valid SPS/PPS and slice headers, filler
+ * slice data) or looped from a file.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+
+#define RESOLUTION_LOW  360
+#define RESOLUTION_HIGH 1080
+
+#define FIFO_NAME_LOW "/tmp/h264_low_fifo"
+#define FIFO_NAME_HIGH "/tmp/h264_high_fifo"
+
+// The IDR is this many times bigger than a P frame
+#define IDR_WEIGHT 8
+
+#define MAX_NAL_SIZE 1048576
+
+unsigned char NAL_START[] = {0x00, 0x00, 0x00, 0x01};
+
+struct bit_writer {
+    unsigned char buf[64];
+    int bits;
+};
+
+void put_bits(struct bit_writer *bw, unsigned int value, int n)
+{
+    int i;
+
+    for (i = n - 1; i >= 0; i--) {
+        if (value & (1U << i)) bw->buf[bw->bits >> 3] |= 0x80 >> (bw->bits & 7);
+        bw->bits++;
+    }
+}
+
+void put_ue(struct bit_writer *bw, unsigned int value)
+{
+    int n = 0;
+    unsigned int v = value + 1;
+
+    while ((v >> n) > 1) n++;
+    put_bits(bw, 0, n);
+    put_bits(bw, v, n + 1);
+}
+
+// rbsp_trailing_bits and emulation prevention, returns the NAL size
+int finish_nal(struct bit_writer *bw, unsigned char *nal, int trailing)
+{
+    int i, size = 0, zeros = 0;
+    int bytes;
+
+    if (trailing) {
+        put_bits(bw, 1, 1);
+        while (bw->bits & 7) put_bits(bw, 0, 1);
+    }
+    bytes = (bw->bits + 7) >> 3;
+    for (i = 0; i < bytes; i++) {
+        if ((zeros == 2) && (bw->buf[i] <= 3)) {
+            nal[size++] = 3;
+            zeros = 0;
+        }
+        nal[size++] = bw->buf[i];
+        zeros = (bw->buf[i] == 0) ? zeros + 1 : 0;
+    }
+
+    return size;
+}
+
+int make_sps(unsigned char *nal, int width, int height)
+{
+    struct bit_writer bw;
+    int width_mbs = (width + 15) / 16;
+    int height_mbs = (height + 15) / 16;
+
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x67, 8);
+    put_bits(&bw, 66, 8);       // baseline
+    put_bits(&bw, 0xC0, 8);     // constraint_set0 and 1
+    put_bits(&bw, 40, 8);       // level 4.0
+    put_ue(&bw, 0);             // seq_parameter_set_id
+    put_ue(&bw, 0);             // log2_max_frame_num_minus4
+    put_ue(&bw, 2);             // pic_order_cnt_type
+    put_ue(&bw, 1);             // max_num_ref_frames
+    put_bits(&bw, 0, 1);        // gaps_in_frame_num_value_allowed_flag
+    put_ue(&bw, width_mbs - 1);
+    put_ue(&bw, height_mbs - 1);
+    put_bits(&bw, 1, 1);        // frame_mbs_only_flag
+    put_bits(&bw, 1, 1);        // direct_8x8_inference_flag
+    if ((width_mbs * 16 != width) || (height_mbs * 16 != height)) {
+        put_bits(&bw, 1, 1);
+        put_ue(&bw, 0);
+        put_ue(&bw, (width_mbs * 16 - width) / 2);
+        put_ue(&bw, 0);
+        put_ue(&bw, (height_mbs * 16 - height) / 2);
+    } else {
+        put_bits(&bw, 0, 1);
+    }
+    put_bits(&bw, 0, 1);        // vui_parameters_present_flag
+
+    return finish_nal(&bw, nal, 1);
+}
+
+int make_pps(unsigned char *nal)
+{
+    struct bit_writer bw;
+
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x68, 8);
+    put_ue(&bw, 0);             // pic_parameter_set_id
+    put_ue(&bw, 0);             // seq_parameter_set_id
+    put_bits(&bw, 0, 1);        // entropy_coding_mode_flag
+    put_bits(&bw, 0, 1);        // bottom_field_pic_order_in_frame_present_flag
+    put_ue(&bw, 0);             // num_slice_groups_minus1
+    put_ue(&bw, 0);             // num_ref_idx_l0_default_active_minus1
+    put_ue(&bw, 0);             // num_ref_idx_l1_default_active_minus1
+    put_bits(&bw, 0, 1);        // weighted_pred_flag
+    put_bits(&bw, 0, 2);        // weighted_bipred_idc
+    put_ue(&bw, 0);             // pic_init_qp_minus26 (se 0)
+    put_ue(&bw, 0);             // pic_init_qs_minus26 (se 0)
+    put_ue(&bw, 0);             // chroma_qp_index_offset (se 0)
+    put_bits(&bw, 1, 1);        // deblocking_filter_control_present_flag
+    put_bits(&bw, 0, 1);        // constrained_intra_pred_flag
+    put_bits(&bw, 0, 1);        // redundant_pic_cnt_present_flag
+
+    return finish_nal(&bw, nal, 1);
+}
+
+// A slice with a valid header (so that the framer finds the access
+// units) and filler data without zero bytes
+int make_slice(unsigned char *nal, int size, int idr, int frame_num, int idr_id)
+{
+    struct bit_writer bw;
+    int header_size, i;
+
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, idr ? 0x65 : 0x41, 8);
+    put_ue(&bw, 0);             // first_mb_in_slice
+    put_ue(&bw, idr ? 7 : 5);   // slice_type I or P
+    put_ue(&bw, 0);             // pic_parameter_set_id
+    put_bits(&bw, frame_num & 0x0F, 4);
+    if (idr) {
+        put_ue(&bw, idr_id);
+        put_bits(&bw, 0, 1);    // no_output_of_prior_pics_flag
+        put_bits(&bw, 0, 1);    // long_term_reference_flag
+    } else {
+        put_bits(&bw, 0, 1);    // num_ref_idx_active_override_flag
+        put_bits(&bw, 0, 1);    // ref_pic_list_modification_flag_l0
+        put_bits(&bw, 0, 1);    // adaptive_ref_pic_marking_mode_flag
+    }
+    put_ue(&bw, 0);             // slice_qp_delta (se 0)
+    put_ue(&bw, 1);             // disable_deblocking_filter_idc
+    // Make sure the header doesn't end with zero bytes
+    while (bw.bits & 7) put_bits(&bw, 1, 1);
+
+    header_size = finish_nal(&bw, nal, 0);
+    for (i = header_size; i < size; i++) {
+        nal[i] = 1 + (rand() % 255);
+    }
+
+    return (size > header_size) ? size : header_size;
+}
+
+int64_t now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sigpipe_handler(int unused)
+{
+    // Do nothing
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s [-r RES] [-o FILE] [-f FPS] [-b KBPS] [-g GOP] [-s WxH] [-i FILE] [-d]\n\n", progname);
+    fprintf(stderr, "\t-r RES,  --resolution RES\n");
+    fprintf(stderr, "\t\tfifo to feed: low or high (default high)\n");
+    fprintf(stderr, "\t-o FILE, --output FILE\n");
+    fprintf(stderr, "\t\twrite to FILE instead of the fifo, - for stdout\n");
+    fprintf(stderr, "\t-f FPS,  --fps FPS\n");
+    fprintf(stderr, "\t\tframes per second (default 20)\n");
+    fprintf(stderr, "\t-b KBPS, --bitrate KBPS\n");
+    fprintf(stderr, "\t\tbitrate (default 1500 high, 300 low)\n");
+    fprintf(stderr, "\t-g GOP,  --gop GOP\n");
+    fprintf(stderr, "\t\tframes between two IDR (default 40)\n");
+    fprintf(stderr, "\t-s WxH,  --size WxH\n");
+    fprintf(stderr, "\t\tpicture size in the SPS (default 1920x1080 high, 640x360 low)\n");
+    fprintf(stderr, "\t-i FILE, --input FILE\n");
+    fprintf(stderr, "\t\tloop the H.264 stream in FILE instead of generating one\n");
+    fprintf(stderr, "\t-d,      --debug\n");
+    fprintf(stderr, "\t\tenable debug\n");
+    fprintf(stderr, "\t-h,      --help\n");
+    fprintf(stderr, "\t\tprint this help\n");
+}
+
+int write_nal(FILE *fOut, unsigned char *nal, int size)
+{
+    if (fwrite(NAL_START, 1, sizeof(NAL_START), fOut) != sizeof(NAL_START)) return -1;
+    if (fwrite(nal, 1, size, fOut) != (size_t) size) return -1;
+    return 0;
+}
+
+// Next NAL unit of the input file, looping at the end
+int read_nal(FILE *fIn, unsigned char *nal, int max_size)
+{
+    int c, zeros = 0, size = 0, started = 0, looped = 0;
+
+    while (1) {
+        c = fgetc(fIn);
+        if (c == EOF) {
+            if (started && (size > 0)) return size;
+            if (looped) return -1;
+            rewind(fIn);
+            looped = 1;
+            zeros = 0;
+            continue;
+        }
+        if ((zeros >= 2) && (c == 1)) {
+            if (started) {
+                // Back to the start code of the next NAL unit
+                fseek(fIn, -(zeros > 3 ? 4 : zeros + 1), SEEK_CUR);
+                size -= (zeros > 3 ? 3 : zeros);
+                return size;
+            }
+            started = 1;
+            zeros = 0;
+            size = 0;
+            continue;
+        }
+        zeros = (c == 0) ? zeros + 1 : 0;
+        if (started && (size < max_size)) nal[size++] = c;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fOut = NULL;
+    FILE *fIn = NULL;
+    unsigned char *nal;
+    int nal_size;
+    int c;
+    char *endptr;
+    long value;
+    mode_t mode = 0755;
+
+    int resolution = RESOLUTION_HIGH;
+    char *output = NULL;
+    char *input = NULL;
+    int fps = 20;
+    int kbps = 0;
+    int gop = 40;
+    int width = 0, height = 0;
+    int debug = 0;
+
+    int frame = 0, idr_id = 0;
+    int p_size, idr_size;
+    int64_t frame_us, next_us;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"resolution",  required_argument, 0, 'r'},
+            {"output",  required_argument, 0, 'o'},
+            {"fps",  required_argument, 0, 'f'},
+            {"bitrate",  required_argument, 0, 'b'},
+            {"gop",  required_argument, 0, 'g'},
+            {"size",  required_argument, 0, 's'},
+            {"input",  required_argument, 0, 'i'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "r:o:f:b:g:s:i:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'r':
+            if (strcasecmp("low", optarg) == 0) {
+                resolution = RESOLUTION_LOW;
+            } else if (strcasecmp("high", optarg) == 0) {
+                resolution = RESOLUTION_HIGH;
+            }
+            break;
+
+        case 'o':
+            output = optarg;
+            break;
+
+        case 'f':
+        case 'b':
+        case 'g':
+            errno = 0;    /* To distinguish success/failure after call */
+            value = strtol(optarg, &endptr, 10);
+            if ((errno != 0) || (endptr == optarg) || (value <= 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (c == 'f') {
+                fps = value;
+            } else if (c == 'b') {
+                kbps = value;
+            } else {
+                gop = value;
+            }
+            break;
+
+        case 's':
+            if ((sscanf(optarg, "%dx%d", &width, &height) != 2) || (width <= 0) || (height <= 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'i':
+            input = optarg;
+            break;
+
+        case 'd':
+            fprintf (stderr, "debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (width == 0) {
+        width = (resolution == RESOLUTION_HIGH) ? 1920 : 640;
+        height = (resolution == RESOLUTION_HIGH) ? 1080 : 360;
+    }
+    if (kbps == 0) kbps = (resolution == RESOLUTION_HIGH) ? 1500 : 300;
+
+    // Bytes of a GOP shared between the IDR and the P frames
+    p_size = (int) ((int64_t) kbps * 1000 / 8 * gop / fps / (gop - 1 + IDR_WEIGHT));
+    if (p_size < 16) p_size = 16;
+    idr_size = p_size * IDR_WEIGHT;
+    if (idr_size > MAX_NAL_SIZE) idr_size = MAX_NAL_SIZE;
+    frame_us = 1000000 / fps;
+
+    nal = (unsigned char *) malloc(MAX_NAL_SIZE + 64);
+    if (nal == NULL) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return -1;
+    }
+
+    if (input != NULL) {
+        fIn = fopen(input, "r");
+        if (fIn == NULL) {
+            fprintf(stderr, "Error opening %s\n", input);
+            return -1;
+        }
+    }
+
+    if ((output != NULL) && (strcmp(output, "-") == 0)) {
+        fOut = stdout;
+    } else {
+        sigaction(SIGPIPE, &(struct sigaction){{sigpipe_handler}}, NULL);
+
+        if (output == NULL) {
+            output = (resolution == RESOLUTION_LOW) ? FIFO_NAME_LOW : FIFO_NAME_HIGH;
+            unlink(output);
+            if (mkfifo(output, mode) < 0) {
+                fprintf(stderr, "mkfifo failed for file %s\n", output);
+                return -1;
+            }
+        }
+        // Blocks until rRTSPServer opens the fifo
+        fOut = fopen(output, "w");
+        if (fOut == NULL) {
+            fprintf(stderr, "Error opening %s\n", output);
+            return -1;
+        }
+    }
+
+    if (debug) fprintf(stderr, "%dx%d, %d fps, %d kbps, gop %d: idr %d bytes, p %d bytes\n",
+                       width, height, fps, kbps, gop, idr_size, p_size);
+
+    next_us = now_us();
+    for (;;) {
+        if (fIn != NULL) {
+            // Write up to the next slice, then wait for the next frame
+            do {
+                nal_size = read_nal(fIn, nal, MAX_NAL_SIZE);
+                if (nal_size < 0) {
+                    fprintf(stderr, "No H.264 data in %s\n", input);
+                    return -1;
+                }
+                if (write_nal(fOut, nal, nal_size) < 0) goto write_error;
+            } while (((nal[0] & 0x1F) < 1) || ((nal[0] & 0x1F) > 5));
+        } else if (frame % gop == 0) {
+            // Every IDR is preceded by SPS and PPS, as on the camera
+            nal_size = make_sps(nal, width, height);
+            if (write_nal(fOut, nal, nal_size) < 0) goto write_error;
+            nal_size = make_pps(nal);
+            if (write_nal(fOut, nal, nal_size) < 0) goto write_error;
+            nal_size = make_slice(nal, idr_size, 1, 0, idr_id);
+            idr_id = (idr_id + 1) & 0xFF;
+            if (write_nal(fOut, nal, nal_size) < 0) goto write_error;
+        } else {
+            nal_size = make_slice(nal, p_size, 0, frame % gop, 0);
+            if (write_nal(fOut, nal, nal_size) < 0) goto write_error;
+        }
+        fflush(fOut);
+        frame++;
+
+        next_us += frame_us;
+        if (next_us > now_us()) {
+            usleep(next_us - now_us());
+        } else if (now_us() - next_us > 1000000) {
+            // Too late: the reader stalled, don't burst
+            next_us = now_us();
+        }
+    }
+
+write_error:
+    // The reader closed the fifo
+    fprintf(stderr, "Write error, exiting\n");
+    fclose(fOut);
+    if (fIn != NULL) fclose(fIn);
+    free(nal);
+
+    return 0;
+}
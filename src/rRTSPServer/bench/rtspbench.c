@@ -0,0 +1,901 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTSP load generator: N clients (RTP over UDP or interleaved in the
+ * RTSP connection) play a stream of rRTSPServer. Reports throughput and
+ * loss of every client, time to the first IDR and the CPU and RSS of
+ * the server, in JSON.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+
+#define MAX_CLIENTS 512
+#define IN_BUFFER_SIZE 70000
+#define OUT_BUFFER_SIZE 2048
+#define KEEPALIVE_US 30000000LL
+#define SAMPLE_US 1000000LL
+
+#define TRANSPORT_UDP   0
+#define TRANSPORT_TCP   1
+#define TRANSPORT_MIXED 2
+
+#define STATE_CONNECTING 0
+#define STATE_OPTIONS    1
+#define STATE_DESCRIBE   2
+#define STATE_SETUP      3
+#define STATE_PLAY       4
+#define STATE_PLAYING    5
+#define STATE_REFUSED    6
+#define STATE_FAILED     7
+
+char const *state_names[] = { "connecting", "options", "describe", "setup", "play", "playing", "refused", "failed" };
+
+struct client {
+    int id;
+    int tcp;
+    int state;
+    int sock;
+    int rtp_sock;
+    int rtcp_sock;
+    unsigned short rtp_port;
+
+    char in[IN_BUFFER_SIZE];
+    int in_size;
+    char out[OUT_BUFFER_SIZE];
+    int out_size;
+    int out_sent;
+    int cseq;
+    int status;
+    char session[128];
+    char base[512];
+    char control[800];
+    char error[64];
+
+    int64_t start_us;
+    int64_t play_us;
+    int64_t ttff_us;
+    int64_t last_keepalive_us;
+    int64_t end_us;
+
+    // RTP
+    int have_seq;
+    uint32_t base_seq;
+    uint32_t max_seq;
+    uint64_t packets;
+    uint64_t bytes;
+    int au_has_idr;
+};
+
+char *url;
+char host[256];
+int port = 554;
+int debug = 0;
+
+int64_t now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void print_usage(char *progname)
+{
+    fprintf(stderr, "\nUsage: %s -u URL [-n CLIENTS] [-m MODE] [-t SECONDS] [-r MS] [-P PID] [-o FILE] [-d]\n\n", progname);
+    fprintf(stderr, "\t-u URL,     --url URL\n");
+    fprintf(stderr, "\t\tstream to play, e.g. rtsp://127.0.0.1/ch0_0.h264\n");
+    fprintf(stderr, "\t-n CLIENTS, --clients CLIENTS\n");
+    fprintf(stderr, "\t\tnumber of clients (default 1, max %d)\n", MAX_CLIENTS);
+    fprintf(stderr, "\t-m MODE,    --mode MODE\n");
+    fprintf(stderr, "\t\tRTP transport: udp, tcp or mixed (default udp)\n");
+    fprintf(stderr, "\t-t SECONDS, --time SECONDS\n");
+    fprintf(stderr, "\t\tduration of the test (default 30)\n");
+    fprintf(stderr, "\t-r MS,      --ramp MS\n");
+    fprintf(stderr, "\t\tdelay between two client starts (default 0)\n");
+    fprintf(stderr, "\t-P PID,     --pid PID\n");
+    fprintf(stderr, "\t\tserver process for CPU and RSS (default: the process named rRTSPServer)\n");
+    fprintf(stderr, "\t-o FILE,    --output FILE\n");
+    fprintf(stderr, "\t\twrite the JSON report to FILE (default stdout)\n");
+    fprintf(stderr, "\t-d,         --debug\n");
+    fprintf(stderr, "\t\tenable debug\n");
+    fprintf(stderr, "\t-h,         --help\n");
+    fprintf(stderr, "\t\tprint this help\n");
+}
+
+////////// Server process //////////
+
+int find_pid(char const *name)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char path[300];
+    char comm[64];
+    FILE *f;
+    int pid = -1;
+
+    dir = opendir("/proc");
+    if (dir == NULL) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if ((entry->d_name[0] < '0') || (entry->d_name[0] > '9')) continue;
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        f = fopen(path, "r");
+        if (f == NULL) continue;
+        if ((fgets(comm, sizeof(comm), f) != NULL) && (strncmp(comm, name, strlen(name)) == 0) &&
+                ((comm[strlen(name)] == '\n') || (comm[strlen(name)] == '\0'))) {
+            pid = atoi(entry->d_name);
+        }
+        fclose(f);
+        if (pid > 0) break;
+    }
+    closedir(dir);
+
+    return pid;
+}
+
+// utime + stime in clock ticks
+long long process_ticks(int pid)
+{
+    char path[64];
+    char buf[1024];
+    char *p;
+    unsigned long utime, stime;
+    FILE *f;
+    int n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    f = fopen(path, "r");
+    if (f == NULL) return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    // After the command name: state is field 3, utime and stime 14 and 15
+    p = strrchr(buf, ')');
+    if ((p == NULL) || (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                               &utime, &stime) != 2)) {
+        return -1;
+    }
+
+    return (long long) utime + stime;
+}
+
+long process_rss_kb(int pid)
+{
+    char path[64];
+    char line[128];
+    long rss = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    f = fopen(path, "r");
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld", &rss) == 1) break;
+    }
+    fclose(f);
+
+    return rss;
+}
+
+////////// RTSP //////////
+
+int parse_url(char const *u)
+{
+    char const *p, *end;
+
+    if (strncmp(u, "rtsp://", 7) != 0) return -1;
+    p = u + 7;
+    end = p + strcspn(p, ":/");
+    if ((end == p) || (end - p >= (int) sizeof(host))) return -1;
+    memcpy(host, p, end - p);
+    host[end - p] = '\0';
+    if (*end == ':') port = atoi(end + 1);
+
+    return (port > 0) ? 0 : -1;
+}
+
+void fail(struct client *cl, int state, char const *error)
+{
+    if (debug) fprintf(stderr, "client %d: %s\n", cl->id, error);
+    cl->state = state;
+    snprintf(cl->error, sizeof(cl->error), "%s", error);
+    if (cl->sock >= 0) close(cl->sock);
+    if (cl->rtp_sock >= 0) close(cl->rtp_sock);
+    if (cl->rtcp_sock >= 0) close(cl->rtcp_sock);
+    cl->sock = cl->rtp_sock = cl->rtcp_sock = -1;
+    cl->end_us = now_us();
+}
+
+void send_request(struct client *cl, char const *method, char const *uri, char const *headers)
+{
+    cl->cseq++;
+    cl->out_size = snprintf(cl->out, sizeof(cl->out),
+                            "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: rtspbench\r\n%s%s%s%s\r\n",
+                            method, uri, cl->cseq,
+                            (cl->session[0] != '\0') ? "Session: " : "", cl->session,
+                            (cl->session[0] != '\0') ? "\r\n" : "", headers);
+    cl->out_sent = 0;
+}
+
+// Two adjacent UDP ports, RTP even
+int open_rtp_sockets(struct client *cl)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        cl->rtp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        cl->rtcp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if ((cl->rtp_sock < 0) || (cl->rtcp_sock < 0)) return -1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        if ((bind(cl->rtp_sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) &&
+                (getsockname(cl->rtp_sock, (struct sockaddr *) &addr, &len) == 0) &&
+                ((ntohs(addr.sin_port) & 1) == 0)) {
+            cl->rtp_port = ntohs(addr.sin_port);
+            addr.sin_port = htons(cl->rtp_port + 1);
+            if (bind(cl->rtcp_sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+                int size = 1024 * 1024;
+
+                setsockopt(cl->rtp_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+                fcntl(cl->rtp_sock, F_SETFL, O_NONBLOCK);
+                fcntl(cl->rtcp_sock, F_SETFL, O_NONBLOCK);
+                return 0;
+            }
+        }
+        close(cl->rtp_sock);
+        close(cl->rtcp_sock);
+        cl->rtp_sock = cl->rtcp_sock = -1;
+    }
+
+    return -1;
+}
+
+void start_client(struct client *cl, struct sockaddr_in *server)
+{
+    int flag = 1;
+
+    cl->start_us = now_us();
+    cl->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (cl->sock < 0) {
+        fail(cl, STATE_FAILED, "socket");
+        return;
+    }
+    fcntl(cl->sock, F_SETFL, O_NONBLOCK);
+    setsockopt(cl->sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (cl->tcp) {
+        int size = 1024 * 1024;
+        setsockopt(cl->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    cl->state = STATE_CONNECTING;
+    if ((connect(cl->sock, (struct sockaddr *) server, sizeof(*server)) < 0) && (errno != EINPROGRESS)) {
+        fail(cl, STATE_FAILED, "connect");
+        return;
+    }
+}
+
+// Control URL of the first video track
+void parse_sdp(struct client *cl, char const *sdp)
+{
+    char const *video = strstr(sdp, "m=video");
+    char const *control;
+    char value[256];
+
+    snprintf(cl->control, sizeof(cl->control), "%s", cl->base);
+    if (video == NULL) return;
+    control = strstr(video, "a=control:");
+    if ((control == NULL) || (sscanf(control + 10, "%255s", value) != 1)) return;
+
+    if (strncmp(value, "rtsp://", 7) == 0) {
+        snprintf(cl->control, sizeof(cl->control), "%s", value);
+    } else if (strcmp(value, "*") != 0) {
+        snprintf(cl->control, sizeof(cl->control), "%s%s%s", cl->base,
+                 (cl->base[strlen(cl->base) - 1] == '/') ? "" : "/", value);
+    }
+}
+
+void handle_response(struct client *cl, char *header, char *body)
+{
+    char *p;
+    char headers[256];
+
+    if (sscanf(header, "RTSP/1.0 %d", &cl->status) != 1) {
+        fail(cl, STATE_FAILED, "bad response");
+        return;
+    }
+    if (cl->state == STATE_PLAYING) return;    // keep alive
+
+    if (cl->status == 453) {
+        fail(cl, STATE_REFUSED, "453 Not Enough Bandwidth");
+        return;
+    }
+    if (cl->status != 200) {
+        char error[32];
+
+        snprintf(error, sizeof(error), "%s %d", state_names[cl->state], cl->status);
+        fail(cl, STATE_FAILED, error);
+        return;
+    }
+
+    switch (cl->state) {
+    case STATE_OPTIONS:
+        cl->state = STATE_DESCRIBE;
+        send_request(cl, "DESCRIBE", url, "Accept: application/sdp\r\n");
+        break;
+
+    case STATE_DESCRIBE:
+        p = strstr(header, "\nContent-Base:");
+        if ((p == NULL) || (sscanf(p + 14, " %511s", cl->base) != 1)) {
+            snprintf(cl->base, sizeof(cl->base), "%s", url);
+        }
+        parse_sdp(cl, body);
+        if (cl->tcp) {
+            snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+        } else {
+            if (open_rtp_sockets(cl) < 0) {
+                fail(cl, STATE_FAILED, "udp ports");
+                return;
+            }
+            snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n",
+                     cl->rtp_port, cl->rtp_port + 1);
+        }
+        cl->state = STATE_SETUP;
+        send_request(cl, "SETUP", cl->control, headers);
+        break;
+
+    case STATE_SETUP:
+        p = strstr(header, "\nSession:");
+        if ((p == NULL) || (sscanf(p + 9, " %127[^;\r\n]", cl->session) != 1)) {
+            fail(cl, STATE_FAILED, "no session");
+            return;
+        }
+        cl->state = STATE_PLAY;
+        send_request(cl, "PLAY", cl->base, "Range: npt=0.000-\r\n");
+        break;
+
+    case STATE_PLAY:
+        cl->state = STATE_PLAYING;
+        cl->play_us = now_us();
+        cl->last_keepalive_us = cl->play_us;
+        if (debug) fprintf(stderr, "client %d: playing after %lld ms\n", cl->id,
+                           (long long) (cl->play_us - cl->start_us) / 1000);
+        break;
+    }
+}
+
+////////// RTP //////////
+
+void handle_rtp(struct client *cl, unsigned char *p, int size)
+{
+    int header = 12;
+    uint16_t seq;
+    int marker;
+    int type;
+
+    if ((size < 12) || ((p[0] >> 6) != 2)) return;
+
+    header += (p[0] & 0x0F) * 4;
+    if (p[0] & 0x10) {
+        if (size < header + 4) return;
+        header += 4 + ((p[header + 2] << 8) | p[header + 3]) * 4;
+    }
+    if (p[0] & 0x20) size -= p[size - 1];
+    if (size <= header) return;
+
+    marker = p[1] & 0x80;
+    seq = (p[2] << 8) | p[3];
+    cl->packets++;
+    cl->bytes += size;
+
+    // Extended sequence number, for the loss
+    if (!cl->have_seq) {
+        cl->have_seq = 1;
+        cl->base_seq = cl->max_seq = seq;
+    } else {
+        uint16_t delta = seq - (uint16_t) cl->max_seq;
+
+        if (delta < 0x8000) cl->max_seq += delta;
+    }
+
+    // H.264 payload: the IDR can be single, aggregated or fragmented
+    p += header;
+    size -= header;
+    type = p[0] & 0x1F;
+    if (type == 5) {
+        cl->au_has_idr = 1;
+    } else if ((type == 24) && (size > 3)) {
+        int pos = 1;
+
+        while (pos + 2 < size) {
+            int len = (p[pos] << 8) | p[pos + 1];
+            if ((p[pos + 2] & 0x1F) == 5) cl->au_has_idr = 1;
+            pos += 2 + len;
+        }
+    } else if ((type == 28) && (size > 2) && ((p[1] & 0x1F) == 5)) {
+        cl->au_has_idr = 1;
+    }
+
+    // The marker ends the access unit: the IDR is complete
+    if (marker) {
+        if (cl->au_has_idr && (cl->ttff_us < 0)) {
+            cl->ttff_us = now_us() - cl->start_us;
+            if (debug) fprintf(stderr, "client %d: first IDR after %lld ms\n", cl->id,
+                               (long long) cl->ttff_us / 1000);
+        }
+        cl->au_has_idr = 0;
+    }
+}
+
+void read_udp(struct client *cl)
+{
+    unsigned char buf[2048];
+    int n;
+
+    while ((n = recv(cl->rtp_sock, buf, sizeof(buf), 0)) > 0) {
+        handle_rtp(cl, buf, n);
+    }
+    while (recv(cl->rtcp_sock, buf, sizeof(buf), 0) > 0);
+}
+
+void read_tcp(struct client *cl)
+{
+    int n, pos;
+    char *end;
+
+    n = recv(cl->sock, cl->in + cl->in_size, sizeof(cl->in) - cl->in_size - 1, 0);
+    if (n == 0) {
+        fail(cl, STATE_FAILED, "closed by the server");
+        return;
+    }
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) fail(cl, STATE_FAILED, "read");
+        return;
+    }
+    cl->in_size += n;
+
+    pos = 0;
+    while ((pos < cl->in_size) && (cl->sock >= 0)) {
+        if (cl->in[pos] == '$') {
+            // Interleaved RTP/RTCP
+            int len;
+
+            if (cl->in_size - pos < 4) break;
+            len = ((unsigned char) cl->in[pos + 2] << 8) | (unsigned char) cl->in[pos + 3];
+            if (cl->in_size - pos < 4 + len) break;
+            if (cl->in[pos + 1] == 0) handle_rtp(cl, (unsigned char *) cl->in + pos + 4, len);
+            pos += 4 + len;
+        } else {
+            int header_size, content_length = 0;
+            char *p;
+
+            cl->in[cl->in_size] = '\0';
+            end = strstr(cl->in + pos, "\r\n\r\n");
+            if (end == NULL) break;
+            header_size = end + 4 - (cl->in + pos);
+            p = strcasestr(cl->in + pos, "\nContent-Length:");
+            if ((p != NULL) && (p < end)) content_length = atoi(p + 16);
+            if (cl->in_size - pos < header_size + content_length) break;
+
+            {
+                char saved = cl->in[pos + header_size + content_length];
+
+                cl->in[pos + header_size + content_length] = '\0';
+                end[2] = '\0';
+                handle_response(cl, cl->in + pos, cl->in + pos + header_size);
+                if (cl->sock < 0) return;
+                cl->in[pos + header_size + content_length] = saved;
+            }
+            pos += header_size + content_length;
+        }
+    }
+
+    memmove(cl->in, cl->in + pos, cl->in_size - pos);
+    cl->in_size -= pos;
+    if (cl->in_size >= (int) sizeof(cl->in) - 1) fail(cl, STATE_FAILED, "response too big");
+}
+
+void write_tcp(struct client *cl)
+{
+    int n;
+
+    if (cl->state == STATE_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if ((getsockopt(cl->sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || (err != 0)) {
+            fail(cl, STATE_FAILED, "connect");
+            return;
+        }
+        cl->state = STATE_OPTIONS;
+        send_request(cl, "OPTIONS", url, "");
+    }
+
+    if (cl->out_sent >= cl->out_size) return;
+    n = send(cl->sock, cl->out + cl->out_sent, cl->out_size - cl->out_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) fail(cl, STATE_FAILED, "write");
+        return;
+    }
+    cl->out_sent += n;
+}
+
+////////// Report //////////
+
+int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank
+double percentile_ms(int64_t *sorted, int n, int p)
+{
+    int rank;
+
+    if (n == 0) return -1;
+    rank = (p * n + 99) / 100;
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1] / 1000.0;
+}
+
+void report(FILE *f, struct client *clients, int n, int mode, int seconds,
+            int pid, double server_cpu, long rss_max, long rss_end, double bench_cpu)
+{
+    int64_t ttff[MAX_CLIENTS];
+    int num_ttff = 0;
+    int playing = 0, refused = 0, failed = 0;
+    uint64_t packets = 0, expected = 0, bytes = 0;
+    double kbps_total = 0;
+    int i;
+
+    fprintf(f, "{\n  \"url\": \"%s\",\n  \"clients\": %d,\n  \"mode\": \"%s\",\n  \"duration_s\": %d,\n",
+            url, n, (mode == TRANSPORT_UDP) ? "udp" : (mode == TRANSPORT_TCP) ? "tcp" : "mixed", seconds);
+    fprintf(f, "  \"clients_detail\": [\n");
+    for (i = 0; i < n; i++) {
+        struct client *cl = &clients[i];
+        uint64_t exp = cl->have_seq ? cl->max_seq - cl->base_seq + 1 : 0;
+        uint64_t lost = (exp > cl->packets) ? exp - cl->packets : 0;
+        double secs = (cl->play_us > 0) ? (cl->end_us - cl->play_us) / 1000000.0 : 0;
+        double kbps = (secs > 0) ? cl->bytes * 8 / secs / 1000 : 0;
+
+        if (cl->state == STATE_PLAYING) playing++;
+        if (cl->state == STATE_REFUSED) refused++;
+        if (cl->state == STATE_FAILED) failed++;
+        if (cl->ttff_us >= 0) ttff[num_ttff++] = cl->ttff_us;
+        packets += cl->packets;
+        expected += exp;
+        bytes += cl->bytes;
+        kbps_total += kbps;
+
+        fprintf(f, "    {\"id\": %d, \"transport\": \"%s\", \"state\": \"%s\", \"error\": \"%s\", "
+                   "\"setup_ms\": %.1f, \"ttff_ms\": %.1f, \"kbps\": %.1f, \"packets\": %llu, "
+                   "\"lost\": %llu, \"loss_percent\": %.3f}%s\n",
+                cl->id, cl->tcp ? "tcp" : "udp", state_names[cl->state], cl->error,
+                (cl->play_us > 0) ? (cl->play_us - cl->start_us) / 1000.0 : -1.0,
+                (cl->ttff_us >= 0) ? cl->ttff_us / 1000.0 : -1.0, kbps,
+                (unsigned long long) cl->packets, (unsigned long long) lost,
+                (exp > 0) ? 100.0 * lost / exp : 0.0, (i < n - 1) ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+
+    qsort(ttff, num_ttff, sizeof(int64_t), compare_int64);
+    fprintf(f, "  \"summary\": {\n");
+    fprintf(f, "    \"playing\": %d,\n    \"refused\": %d,\n    \"failed\": %d,\n", playing, refused, failed);
+    fprintf(f, "    \"got_idr\": %d,\n", num_ttff);
+    fprintf(f, "    \"ttff_ms_p50\": %.1f,\n    \"ttff_ms_p99\": %.1f,\n    \"ttff_ms_max\": %.1f,\n",
+            percentile_ms(ttff, num_ttff, 50), percentile_ms(ttff, num_ttff, 99),
+            percentile_ms(ttff, num_ttff, 100));
+    fprintf(f, "    \"kbps_total\": %.1f,\n    \"bytes_total\": %llu,\n", kbps_total, (unsigned long long) bytes);
+    fprintf(f, "    \"loss_percent\": %.3f\n  },\n",
+            (expected > 0) ? 100.0 * (expected > packets ? expected - packets : 0) / expected : 0.0);
+    fprintf(f, "  \"server\": {\"pid\": %d, \"cpu_percent\": %.1f, \"rss_kb_max\": %ld, \"rss_kb_end\": %ld},\n",
+            pid, server_cpu, rss_max, rss_end);
+    fprintf(f, "  \"bench\": {\"cpu_percent\": %.1f}\n}\n", bench_cpu);
+}
+
+int main(int argc, char **argv)
+{
+    struct client *clients;
+    struct pollfd *pfds;
+    int *owners;
+    struct sockaddr_in server;
+    struct addrinfo hints, *res;
+    struct rlimit limit;
+    struct rusage usage;
+    FILE *fOut = stdout;
+    int c, i, n;
+    char *endptr;
+    long value;
+
+    int num_clients = 1;
+    int mode = TRANSPORT_UDP;
+    int seconds = 30;
+    int ramp_ms = 0;
+    int pid = -1;
+    char *output = NULL;
+
+    int started = 0;
+    int64_t t0, t_end, now, last_sample = 0;
+    long long ticks0 = -1, ticks1 = -1;
+    double bench_cpu0, bench_cpu1;
+    long rss, rss_max = -1, rss_end = -1;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"url",  required_argument, 0, 'u'},
+            {"clients",  required_argument, 0, 'n'},
+            {"mode",  required_argument, 0, 'm'},
+            {"time",  required_argument, 0, 't'},
+            {"ramp",  required_argument, 0, 'r'},
+            {"pid",  required_argument, 0, 'P'},
+            {"output",  required_argument, 0, 'o'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "u:n:m:t:r:P:o:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'u':
+            url = optarg;
+            break;
+
+        case 'n':
+        case 't':
+        case 'r':
+        case 'P':
+            errno = 0;    /* To distinguish success/failure after call */
+            value = strtol(optarg, &endptr, 10);
+            if ((errno != 0) || (endptr == optarg) || (value < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (c == 'n') {
+                num_clients = value;
+            } else if (c == 't') {
+                seconds = value;
+            } else if (c == 'r') {
+                ramp_ms = value;
+            } else {
+                pid = value;
+            }
+            break;
+
+        case 'm':
+            if (strcasecmp("udp", optarg) == 0) {
+                mode = TRANSPORT_UDP;
+            } else if (strcasecmp("tcp", optarg) == 0) {
+                mode = TRANSPORT_TCP;
+            } else if (strcasecmp("mixed", optarg) == 0) {
+                mode = TRANSPORT_MIXED;
+            }
+            break;
+
+        case 'o':
+            output = optarg;
+            break;
+
+        case 'd':
+            fprintf (stderr, "debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if ((url == NULL) || (parse_url(url) < 0) || (num_clients < 1) || (num_clients > MAX_CLIENTS)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((getaddrinfo(host, NULL, &hints, &res) != 0) || (res == NULL)) {
+        fprintf(stderr, "Unable to resolve %s\n", host);
+        return -1;
+    }
+    memcpy(&server, res->ai_addr, sizeof(server));
+    server.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    // 3 sockets per client
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pid < 0) pid = find_pid("rRTSPServer");
+    if (pid < 0) fprintf(stderr, "rRTSPServer process not found, no server metrics\n");
+
+    clients = (struct client *) calloc(num_clients, sizeof(struct client));
+    pfds = (struct pollfd *) calloc(3 * num_clients, sizeof(struct pollfd));
+    owners = (int *) calloc(3 * num_clients, sizeof(int));
+    if ((clients == NULL) || (pfds == NULL) || (owners == NULL)) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        return -1;
+    }
+    for (i = 0; i < num_clients; i++) {
+        clients[i].id = i;
+        clients[i].tcp = (mode == TRANSPORT_TCP) || ((mode == TRANSPORT_MIXED) && (i & 1));
+        clients[i].sock = clients[i].rtp_sock = clients[i].rtcp_sock = -1;
+        clients[i].ttff_us = -1;
+    }
+
+    t0 = now_us();
+    t_end = t0 + (int64_t) seconds * 1000000;
+    if (pid > 0) ticks0 = process_ticks(pid);
+    getrusage(RUSAGE_SELF, &usage);
+    bench_cpu0 = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                 (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+
+    while ((now = now_us()) < t_end) {
+        // Ramp up
+        while ((started < num_clients) && (t0 + (int64_t) started * ramp_ms * 1000 <= now)) {
+            start_client(&clients[started], &server);
+            started++;
+        }
+
+        // Keep the sessions alive
+        for (i = 0; i < started; i++) {
+            struct client *cl = &clients[i];
+
+            if ((cl->state == STATE_PLAYING) && (now - cl->last_keepalive_us >= KEEPALIVE_US) &&
+                    (cl->out_sent >= cl->out_size)) {
+                send_request(cl, "GET_PARAMETER", cl->base, "");
+                cl->last_keepalive_us = now;
+            }
+        }
+
+        if ((pid > 0) && (now - last_sample >= SAMPLE_US)) {
+            rss = process_rss_kb(pid);
+            if (rss > rss_max) rss_max = rss;
+            last_sample = now;
+        }
+
+        n = 0;
+        for (i = 0; i < started; i++) {
+            struct client *cl = &clients[i];
+
+            if (cl->sock < 0) continue;
+            pfds[n].fd = cl->sock;
+            pfds[n].events = POLLIN;
+            if ((cl->state == STATE_CONNECTING) || (cl->out_sent < cl->out_size)) pfds[n].events |= POLLOUT;
+            owners[n++] = i;
+            if (cl->rtp_sock >= 0) {
+                pfds[n].fd = cl->rtp_sock;
+                pfds[n].events = POLLIN;
+                owners[n++] = i;
+            }
+        }
+
+        if (poll(pfds, n, 100) <= 0) continue;
+
+        for (i = 0; i < n; i++) {
+            struct client *cl = &clients[owners[i]];
+
+            if (pfds[i].revents == 0) continue;
+            if (pfds[i].fd == cl->rtp_sock) {
+                read_udp(cl);
+                continue;
+            }
+            if (pfds[i].fd != cl->sock) continue;
+            if (pfds[i].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                if (cl->state == STATE_CONNECTING) {
+                    write_tcp(cl);
+                    continue;
+                }
+                if (pfds[i].revents & POLLOUT) write_tcp(cl);
+            }
+            if ((cl->sock >= 0) && (pfds[i].revents & (POLLIN | POLLERR | POLLHUP))) read_tcp(cl);
+            // The next request is sent with the following poll
+        }
+    }
+
+    // Stop the clients
+    now = now_us();
+    if (pid > 0) {
+        ticks1 = process_ticks(pid);
+        rss_end = process_rss_kb(pid);
+        if (rss_end > rss_max) rss_max = rss_end;
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    bench_cpu1 = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                 (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+
+    for (i = 0; i < started; i++) {
+        struct client *cl = &clients[i];
+
+        if (cl->sock < 0) continue;
+        if (cl->end_us == 0) cl->end_us = now;
+        if (cl->state == STATE_PLAYING) {
+            send_request(cl, "TEARDOWN", cl->base, "");
+            send(cl->sock, cl->out, cl->out_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        close(cl->sock);
+        if (cl->rtp_sock >= 0) close(cl->rtp_sock);
+        if (cl->rtcp_sock >= 0) close(cl->rtcp_sock);
+    }
+
+    if (output != NULL) {
+        fOut = fopen(output, "w");
+        if (fOut == NULL) {
+            fprintf(stderr, "Error opening %s\n", output);
+            return -1;
+        }
+    }
+    report(fOut, clients, num_clients, mode, seconds, pid,
+           ((ticks0 >= 0) && (ticks1 >= 0)) ?
+               100.0 * (ticks1 - ticks0) / sysconf(_SC_CLK_TCK) / ((now - t0) / 1000000.0) : -1.0,
+           rss_max, rss_end,
+           100.0 * (bench_cpu1 - bench_cpu0) / ((now - t0) / 1000000.0));
+    if (fOut != stdout) fclose(fOut);
+
+    free(clients);
+    free(pfds);
+    free(owners);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Runs rRTSPServer fed by two h264feeder (synthetic high and low streams)
+# and measures it with rtspbench for several numbers of clients and both
+# transports. One JSON report per run in OUTPUT_DIR.
+#
+# Usage: run_bench.sh RRTSPSERVER [OUTPUT_DIR]
+# CLIENTS, MODES, RUN_SECONDS, RAMP_MS and PORT can be set in the environment.
+
+SCRIPT_DIR=$(cd `dirname $0` && pwd)
+
+RRTSPSERVER=$1
+OUTPUT_DIR=${2:-./bench_results}
+
+CLIENTS=${CLIENTS:-"1 5 10 20"}
+MODES=${MODES:-"udp tcp"}
+RUN_SECONDS=${RUN_SECONDS:-30}
+RAMP_MS=${RAMP_MS:-100}
+PORT=${PORT:-8554}
+
+if [ -z "$RRTSPSERVER" ] || [ ! -x "$RRTSPSERVER" ]; then
+    echo "Usage: $0 RRTSPSERVER [OUTPUT_DIR]"
+    exit 1
+fi
+
+make -C $SCRIPT_DIR || exit 1
+mkdir -p $OUTPUT_DIR || exit 1
+
+cleanup() {
+    kill $SERVER_PID $HIGH_PID $LOW_PID 2> /dev/null
+    wait 2> /dev/null
+}
+trap cleanup EXIT
+
+# The feeders create the fifos and block until rRTSPServer opens them
+$SCRIPT_DIR/h264feeder -r high &
+HIGH_PID=$!
+$SCRIPT_DIR/h264feeder -r low &
+LOW_PID=$!
+sleep 1
+
+$RRTSPSERVER -r both -p $PORT &
+SERVER_PID=$!
+sleep 2
+
+for MODE in $MODES; do
+    for N in $CLIENTS; do
+        for STREAM in ch0_0 ch0_1; do
+            OUT=$OUTPUT_DIR/${STREAM}_${MODE}_${N}.json
+            echo "$STREAM, $MODE, $N clients -> $OUT"
+            $SCRIPT_DIR/rtspbench -u rtsp://127.0.0.1:$PORT/$STREAM.h264 -n $N -m $MODE \
+                -t $RUN_SECONDS -r $RAMP_MS -P $SERVER_PID -o $OUT || exit 1
+            # Let the server reclaim the sessions
+            sleep 2
+        done
+    done
+done
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Source for the adaptive stream, switching between the high and the
+ * low resolution streams.
+ */
+
+#include "AdaptiveH264Source.hh"
+#include "GroupsockHelper.hh"
+
+#define NAL_TYPE_SPS 7
+#define DEFAULT_FRAME_DURATION_US 40000
+
+static char const* inputName(int index) {
+    return (index == ADAPTIVE_HIGH) ? "high" : "low";
+}
+
+AdaptiveH264Source* AdaptiveH264Source::createNew(UsageEnvironment& env, FramedSource* highSource,
+                                                  FramedSource* lowSource, int startInput) {
+    return new AdaptiveH264Source(env, highSource, lowSource, startInput);
+}
+
+AdaptiveH264Source::AdaptiveH264Source(UsageEnvironment& env, FramedSource* highSource,
+                                       FramedSource* lowSource, int startInput)
+    : FramedSource(env), fActive(startInput), fPending(-1), fHeldSize(0),
+      fOffsetUs(0), fLastOutputUs(0), fFrameDurationUs(DEFAULT_FRAME_DURATION_US),
+      fHaveReport(False), fLastPacketNum(0), fLastLost(0), fLastPacketsSent(0), fLastReportUs(0),
+      fBadReports(0), fGoodReports(0), fHoldoffUs(ADAPTIVE_MIN_HOLDOFF_US) {
+    int i;
+
+    fInputs[ADAPTIVE_HIGH].source = highSource;
+    fInputs[ADAPTIVE_LOW].source = lowSource;
+    for (i = 0; i < 2; i++) {
+        fInputs[i].owner = this;
+        fInputs[i].index = i;
+        fInputs[i].toSink = False;
+        fInputs[i].readTask = NULL;
+    }
+    fLastSwitchUs = nowUs();
+}
+
+AdaptiveH264Source::~AdaptiveH264Source() {
+    int i;
+
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    for (i = 0; i < 2; i++) {
+        envir().taskScheduler().unscheduleDelayedTask(fInputs[i].readTask);
+        Medium::close(fInputs[i].source);
+    }
+}
+
+int64_t AdaptiveH264Source::nowUs() {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+void AdaptiveH264Source::doGetNextFrame() {
+    struct inputState* active = &fInputs[fActive];
+
+    if (fHeldSize > 0) {
+        // First the SPS that started the switch
+        fFrameSize = (fHeldSize <= fMaxSize) ? fHeldSize : fMaxSize;
+        fNumTruncatedBytes = fHeldSize - fFrameSize;
+        memcpy(fTo, fHeld, fFrameSize);
+        restamp(fHeldTime);
+        fDurationInMicroseconds = 0;
+        fHeldSize = 0;
+
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*) FramedSource::afterGetting, this);
+    } else {
+        // The active input writes straight into the sink's buffer
+        active->toSink = True;
+        active->source->getNextFrame(fTo, fMaxSize, afterGettingFrame, active,
+                                     onInputClosure, this);
+    }
+
+    // Keep the other input flowing: the replicator waits for every replica
+    scheduleInactiveRead(&fInputs[1 - fActive]);
+}
+
+void AdaptiveH264Source::doStopGettingFrames() {
+    int i;
+
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    for (i = 0; i < 2; i++) {
+        envir().taskScheduler().unscheduleDelayedTask(fInputs[i].readTask);
+        if (fInputs[i].source->isCurrentlyAwaitingData()) {
+            fInputs[i].source->stopGettingFrames();
+        }
+        fInputs[i].toSink = False;
+    }
+}
+
+void AdaptiveH264Source::scheduleInactiveRead(struct inputState* input) {
+    if ((input->readTask != NULL) || input->source->isCurrentlyAwaitingData()) return;
+
+    input->readTask = envir().taskScheduler().scheduleDelayedTask(0, readInactive, input);
+}
+
+void AdaptiveH264Source::readInactive(void* clientData) {
+    struct inputState* input = (struct inputState*) clientData;
+    AdaptiveH264Source* source = input->owner;
+
+    input->readTask = NULL;
+    if ((input->index == source->fActive) || input->source->isCurrentlyAwaitingData()) return;
+
+    // Only the first bytes matter: the NAL type and the SPS/PPS
+    input->toSink = False;
+    input->source->getNextFrame(input->scratch, ADAPTIVE_SCRATCH_SIZE,
+                                afterGettingFrame, input, onInputClosure, source);
+}
+
+void AdaptiveH264Source::afterGettingFrame(void* clientData, unsigned frameSize,
+                                           unsigned numTruncatedBytes,
+                                           struct timeval presentationTime,
+                                           unsigned /*durationInMicroseconds*/) {
+    struct inputState* input = (struct inputState*) clientData;
+    input->owner->afterGettingFrame1(input, frameSize, numTruncatedBytes, presentationTime);
+}
+
+void AdaptiveH264Source::afterGettingFrame1(struct inputState* input, unsigned frameSize,
+                                            unsigned numTruncatedBytes, struct timeval presentationTime) {
+    if (input->toSink) {
+        input->toSink = False;
+
+        fFrameSize = frameSize;
+        fNumTruncatedBytes = numTruncatedBytes;
+        restamp(presentationTime);
+        fDurationInMicroseconds = 0;
+        afterGetting(this);
+        return;
+    }
+
+    // Switch when the pending input starts a new IDR access unit
+    if ((input->index == fPending) && (frameSize > 0) && (numTruncatedBytes == 0) &&
+            ((input->scratch[0] & 0x1F) == NAL_TYPE_SPS)) {
+        switchInput(input, frameSize, presentationTime);
+        return;
+    }
+
+    scheduleInactiveRead(input);
+}
+
+void AdaptiveH264Source::onInputClosure(void* clientData) {
+    AdaptiveH264Source* source = (AdaptiveH264Source*) clientData;
+    source->handleClosure();
+}
+
+void AdaptiveH264Source::switchInput(struct inputState* input, unsigned spsSize,
+                                     struct timeval presentationTime) {
+    struct inputState* old = &fInputs[fActive];
+    Boolean sinkWaiting = isCurrentlyAwaitingData();
+
+    if (old->source->isCurrentlyAwaitingData()) {
+        old->source->stopGettingFrames();
+    }
+    old->toSink = False;
+
+    // The first frame of the new input follows the last one we sent
+    if (fLastOutputUs != 0) {
+        fOffsetUs = fLastOutputUs + fFrameDurationUs
+                    - (presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec);
+    }
+
+    envir() << "AdaptiveH264Source: switching from " << inputName(fActive)
+            << " to " << inputName(input->index) << "\n";
+
+    fActive = input->index;
+    fPending = -1;
+    fLastSwitchUs = nowUs();
+    fBadReports = 0;
+    fGoodReports = 0;
+
+    memcpy(fHeld, input->scratch, spsSize);
+    fHeldSize = spsSize;
+    fHeldTime = presentationTime;
+
+    if (sinkWaiting) {
+        doGetNextFrame();
+    } else {
+        scheduleInactiveRead(old);
+    }
+}
+
+void AdaptiveH264Source::restamp(struct timeval presentationTime) {
+    int64_t us = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec + fOffsetUs;
+    int64_t duration;
+
+    // Never go back in time, the NAL units of a picture share the time
+    if (us < fLastOutputUs) us = fLastOutputUs;
+    if ((fLastOutputUs != 0) && (us > fLastOutputUs)) {
+        duration = us - fLastOutputUs;
+        if ((duration >= 10000) && (duration <= 200000)) fFrameDurationUs = duration;
+    }
+    fLastOutputUs = us;
+
+    fPresentationTime.tv_sec = us / 1000000;
+    fPresentationTime.tv_usec = us % 1000000;
+}
+
+void AdaptiveH264Source::requestSwitch(int index) {
+    if (fActive == index) {
+        fPending = -1;
+        return;
+    }
+    if (fPending == index) return;
+
+    envir() << "AdaptiveH264Source: switching to " << inputName(index) << " at the next IDR\n";
+    fPending = index;
+}
+
+void AdaptiveH264Source::rrHandler(void* clientData) {
+    RTPSink* sink = (RTPSink*) clientData;
+    FramedSource* source = sink->source();
+
+    if (source == NULL) return;
+    ((AdaptiveH264Source*) source)->noteReceiverReport(sink);
+}
+
+void AdaptiveH264Source::noteReceiverReport(RTPSink* sink) {
+    RTPTransmissionStatsDB::Iterator iter(sink->transmissionStatsDB());
+    RTPTransmissionStats* stats;
+    unsigned loss, rttMs;
+    unsigned packetNum, lost, sent;
+    unsigned expected, lostNow, sentNow, received;
+    unsigned deliveryPct = 100;
+    unsigned achievedKbps = 0;
+    unsigned packetSize;
+    int64_t now = nowUs();
+    Boolean bad, good;
+
+    // One receiver per sink: the adaptive stream doesn't reuse its source
+    stats = iter.next();
+    if (stats == NULL) return;
+
+    loss = stats->packetLossRatio();
+    rttMs = (unsigned) (((u_int64_t) stats->roundTripDelay() * 1000) >> 16);
+    packetNum = stats->lastPacketNumReceived();
+    lost = stats->totNumPacketsLost();
+    sent = sink->packetCount();
+
+    // Packets received compared to the packets sent since the last report
+    if (fHaveReport) {
+        expected = packetNum - fLastPacketNum;
+        lostNow = lost - fLastLost;
+        sentNow = sent - fLastPacketsSent;
+        received = (expected > lostNow) ? expected - lostNow : 0;
+        if (sentNow > 0) {
+            deliveryPct = (received >= sentNow) ? 100 : received * 100 / sentNow;
+        }
+        if ((sent > 0) && (now > fLastReportUs)) {
+            packetSize = sink->octetCount() / sent + 12;
+            achievedKbps = (unsigned) ((int64_t) received * packetSize * 8000 / (now - fLastReportUs));
+        }
+    }
+    fHaveReport = True;
+    fLastPacketNum = packetNum;
+    fLastLost = lost;
+    fLastPacketsSent = sent;
+    fLastReportUs = now;
+
+    bad = (loss > ADAPTIVE_DOWN_LOSS) || (rttMs > ADAPTIVE_DOWN_RTT_MS) ||
+          (deliveryPct < ADAPTIVE_DOWN_DELIVERY_PCT);
+    good = (loss < ADAPTIVE_UP_LOSS) && (rttMs < ADAPTIVE_UP_RTT_MS) &&
+           (deliveryPct >= ADAPTIVE_UP_DELIVERY_PCT);
+
+    if (bad) {
+        envir() << "AdaptiveH264Source: " << inputName(fActive) << " stream, loss " << loss * 100 / 256
+                << "%, rtt " << rttMs << " ms, throughput " << achievedKbps << " kbps ("
+                << deliveryPct << "% delivered)\n";
+    }
+
+    if (fActive == ADAPTIVE_HIGH) {
+        fGoodReports = 0;
+        if (!bad) {
+            fBadReports = 0;
+        } else if (++fBadReports >= ADAPTIVE_DOWN_REPORTS) {
+            // Back off longer if the high stream failed right after a switch up
+            if (now - fLastSwitchUs < ADAPTIVE_PROBE_WINDOW_US) {
+                fHoldoffUs *= 2;
+                if (fHoldoffUs > ADAPTIVE_MAX_HOLDOFF_US) fHoldoffUs = ADAPTIVE_MAX_HOLDOFF_US;
+            } else {
+                fHoldoffUs = ADAPTIVE_MIN_HOLDOFF_US;
+            }
+            requestSwitch(ADAPTIVE_LOW);
+        }
+    } else {
+        fBadReports = 0;
+        if (!good) {
+            fGoodReports = 0;
+        } else if ((++fGoodReports >= ADAPTIVE_UP_REPORTS) && (now - fLastSwitchUs >= fHoldoffUs)) {
+            requestSwitch(ADAPTIVE_HIGH);
+        }
+    }
+}
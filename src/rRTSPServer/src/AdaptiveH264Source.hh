@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Source for the adaptive stream: it reads the NAL units of both the
+ * high and the low resolution streams and forwards the ones of the
+ * stream that suits the client.
+ * The switch happens at the SPS that starts every IDR access unit, so
+ * the client gets the new SPS/PPS and an IDR frame right away.
+ * The presentation times are restamped to stay continuous across the
+ * switches: the two streams are timed by two independent framers.
+ * The choice is driven by the RTCP receiver reports of the client:
+ * fraction lost, round trip time and achieved throughput.
+ */
+
+#ifndef _ADAPTIVE_H264_SOURCE_HH
+#define _ADAPTIVE_H264_SOURCE_HH
+
+#include "liveMedia.hh"
+
+#define ADAPTIVE_HIGH 0
+#define ADAPTIVE_LOW  1
+
+// Enough for the SPS/PPS of the stream we are not forwarding, the
+// other NAL units of that stream are read truncated and dropped
+#define ADAPTIVE_SCRATCH_SIZE 512
+
+// Switch down after 2 bad reports with more than 5% loss (fraction
+// lost is in 1/256), more than 400 ms RTT or less than 75% of the
+// packets received
+#define ADAPTIVE_DOWN_REPORTS      2
+#define ADAPTIVE_DOWN_LOSS         13
+#define ADAPTIVE_DOWN_RTT_MS       400
+#define ADAPTIVE_DOWN_DELIVERY_PCT 75
+// Switch up after 3 good reports with less than 1% loss and 250 ms RTT
+#define ADAPTIVE_UP_REPORTS        3
+#define ADAPTIVE_UP_LOSS           3
+#define ADAPTIVE_UP_RTT_MS         250
+#define ADAPTIVE_UP_DELIVERY_PCT   95
+// Wait at least this long on the low stream, doubled every time the
+// high stream fails again within the probe window
+#define ADAPTIVE_MIN_HOLDOFF_US    20000000LL
+#define ADAPTIVE_MAX_HOLDOFF_US    300000000LL
+#define ADAPTIVE_PROBE_WINDOW_US   30000000LL
+
+class AdaptiveH264Source: public FramedSource {
+public:
+    static AdaptiveH264Source* createNew(UsageEnvironment& env, FramedSource* highSource,
+                                         FramedSource* lowSource, int startInput = ADAPTIVE_LOW);
+
+    // RTCP RR handler, clientData is the RTPSink fed by this source
+    static void rrHandler(void* clientData);
+    void noteReceiverReport(RTPSink* sink);
+
+protected:
+    AdaptiveH264Source(UsageEnvironment& env, FramedSource* highSource,
+                       FramedSource* lowSource, int startInput);
+    virtual ~AdaptiveH264Source();
+
+protected: // redefined virtual functions
+    virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
+
+private:
+    struct inputState {
+        AdaptiveH264Source* owner;
+        int index;
+        FramedSource* source;
+        Boolean toSink;
+        unsigned char scratch[ADAPTIVE_SCRATCH_SIZE];
+        TaskToken readTask;
+    };
+
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(struct inputState* input, unsigned frameSize,
+                            unsigned numTruncatedBytes, struct timeval presentationTime);
+    static void onInputClosure(void* clientData);
+    static void readInactive(void* clientData);
+    void scheduleInactiveRead(struct inputState* input);
+    void switchInput(struct inputState* input, unsigned spsSize, struct timeval presentationTime);
+    void restamp(struct timeval presentationTime);
+    void requestSwitch(int index);
+    static int64_t nowUs();
+
+private:
+    struct inputState fInputs[2];
+    int fActive;
+    int fPending;
+
+    // The SPS that triggered a switch, when the sink wasn't waiting
+    unsigned char fHeld[ADAPTIVE_SCRATCH_SIZE];
+    unsigned fHeldSize;
+    struct timeval fHeldTime;
+
+    int64_t fOffsetUs;
+    int64_t fLastOutputUs;
+    int64_t fFrameDurationUs;
+
+    // Receiver report history
+    Boolean fHaveReport;
+    unsigned fLastPacketNum;
+    unsigned fLastLost;
+    unsigned fLastPacketsSent;
+    int64_t fLastReportUs;
+    unsigned fBadReports;
+    unsigned fGoodReports;
+    int64_t fLastSwitchUs;
+    int64_t fHoldoffUs;
+};
+
+#endif
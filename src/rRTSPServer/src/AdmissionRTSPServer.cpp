@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * RTSP server with admission control.
+ */
+
+#include "AdmissionRTSPServer.hh"
+#include "TimeshiftServerMediaSubsession.hh"
+
+// Looks for "Range: npt=-N", the start of a timeshift session N seconds ago
+static Boolean parseTimeshiftRange(char const* fullRequestStr, unsigned& secondsAgo) {
+    char const* line = fullRequestStr;
+    double seconds;
+
+    while (line != NULL) {
+        if (strncasecmp(line, "Range:", 6) == 0) {
+            if ((sscanf(line + 6, " npt = -%lf", &seconds) == 1) && (seconds > 0)) {
+                secondsAgo = (unsigned) seconds;
+                return True;
+            }
+            return False;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) line++;
+    }
+
+    return False;
+}
+
+AdmissionRTSPServer* AdmissionRTSPServer::createNew(UsageEnvironment& env, Port ourPort,
+                                                    UserAuthenticationDatabase* authDatabase,
+                                                    unsigned maxTotalKbps,
+                                                    unsigned reclamationSeconds) {
+    int ourSocket = setUpOurSocket(env, ourPort);
+    if (ourSocket == -1) return NULL;
+
+    return new AdmissionRTSPServer(env, ourSocket, ourPort, authDatabase,
+                                   maxTotalKbps, reclamationSeconds);
+}
+
+AdmissionRTSPServer* AdmissionRTSPServer::createNewWithSocket(UsageEnvironment& env, int ourSocket,
+                                                              Port ourPort,
+                                                              UserAuthenticationDatabase* authDatabase,
+                                                              unsigned maxTotalKbps,
+                                                              unsigned reclamationSeconds) {
+    if (ourSocket < 0) return NULL;
+
+    return new AdmissionRTSPServer(env, ourSocket, ourPort, authDatabase,
+                                   maxTotalKbps, reclamationSeconds);
+}
+
+AdmissionRTSPServer::AdmissionRTSPServer(UsageEnvironment& env, int ourSocket, Port ourPort,
+                                         UserAuthenticationDatabase* authDatabase,
+                                         unsigned maxTotalKbps, unsigned reclamationSeconds)
+    : RTSPServer(env, ourSocket, ourPort, authDatabase, reclamationSeconds),
+      fMaxTotalKbps(maxTotalKbps), fNumStreams(0), fNumPriorityAddresses(0),
+      fPriorityReservedKbps(0) {
+    memset(fStreams, 0, sizeof(fStreams));
+}
+
+AdmissionRTSPServer::~AdmissionRTSPServer() {
+    unsigned i;
+
+    // Delete the sessions now: their destructors update our counters
+    cleanup();
+
+    for (i = 0; i < fNumStreams; i++) {
+        delete[] fStreams[i].streamName;
+        delete[] fStreams[i].fallbackStreamName;
+    }
+}
+
+void AdmissionRTSPServer::stopAccepting() {
+    envir().taskScheduler().turnOffBackgroundReadHandling(fServerSocket);
+}
+
+Boolean AdmissionRTSPServer::setStreamLimits(char const* streamName, unsigned maxSessions,
+                                             unsigned estimatedKbps,
+                                             H264VideoLiveServerMediaSubsession* rateSource,
+                                             char const* fallbackStreamName) {
+    struct streamLimits* stream;
+
+    stream = lookupStream(streamName);
+    if (stream == NULL) {
+        if (fNumStreams >= ADMISSION_MAX_STREAMS) return False;
+        stream = &fStreams[fNumStreams++];
+        stream->streamName = strDup(streamName);
+        stream->numSessions = 0;
+        stream->numPrioritySessions = 0;
+    }
+    delete[] stream->fallbackStreamName;
+    stream->fallbackStreamName = strDup(fallbackStreamName);
+    stream->maxSessions = maxSessions;
+    stream->estimatedKbps = estimatedKbps;
+    stream->rateSource = rateSource;
+
+    return True;
+}
+
+Boolean AdmissionRTSPServer::addPriorityAddress(netAddressBits address) {
+    if (fNumPriorityAddresses >= ADMISSION_MAX_PRIORITY_ADDRESSES) return False;
+
+    fPriorityAddresses[fNumPriorityAddresses++] = address;
+    return True;
+}
+
+struct AdmissionRTSPServer::streamLimits* AdmissionRTSPServer::lookupStream(char const* streamName) {
+    unsigned i;
+
+    if (streamName == NULL) return NULL;
+
+    for (i = 0; i < fNumStreams; i++) {
+        if (strcmp(fStreams[i].streamName, streamName) == 0) return &fStreams[i];
+    }
+    return NULL;
+}
+
+unsigned AdmissionRTSPServer::streamKbps(struct streamLimits const* stream) const {
+    unsigned measured = 0;
+
+    if (stream->rateSource != NULL) measured = stream->rateSource->measuredKbps();
+
+    return (measured > 0) ? measured : stream->estimatedKbps;
+}
+
+unsigned AdmissionRTSPServer::usedKbps() const {
+    unsigned i;
+    unsigned used = 0;
+
+    // Every unicast client gets its own copy of the stream
+    for (i = 0; i < fNumStreams; i++) {
+        used += fStreams[i].numSessions * streamKbps(&fStreams[i]);
+    }
+    return used;
+}
+
+unsigned AdmissionRTSPServer::priorityUsedKbps() const {
+    unsigned i;
+    unsigned used = 0;
+
+    for (i = 0; i < fNumStreams; i++) {
+        used += fStreams[i].numPrioritySessions * streamKbps(&fStreams[i]);
+    }
+    return used;
+}
+
+Boolean AdmissionRTSPServer::fits(struct streamLimits const* stream) const {
+    unsigned reserved = 0;
+
+    if ((stream->maxSessions > 0) && (stream->numSessions >= stream->maxSessions)) return False;
+
+    // The priority sessions running use their reservation, the rest of it
+    // is still kept free
+    if (fPriorityReservedKbps > priorityUsedKbps()) reserved = fPriorityReservedKbps - priorityUsedKbps();
+    if ((fMaxTotalKbps > 0) && (usedKbps() + reserved + streamKbps(stream) > fMaxTotalKbps)) return False;
+
+    return True;
+}
+
+Boolean AdmissionRTSPServer::isPriorityAddress(netAddressBits address) const {
+    unsigned i;
+
+    for (i = 0; i < fNumPriorityAddresses; i++) {
+        if (fPriorityAddresses[i] == address) return True;
+    }
+    return False;
+}
+
+int AdmissionRTSPServer::checkAdmission(char const* streamName, netAddressBits clientAddress,
+                                        char const*& fallbackStreamName) {
+    struct streamLimits* stream;
+    struct streamLimits* fallback;
+
+    fallbackStreamName = NULL;
+
+    // The priority clients are counted in the budget but never limited
+    if (isPriorityAddress(clientAddress)) return ADMISSION_ADMIT;
+
+    stream = lookupStream(streamName);
+    if (stream == NULL) return ADMISSION_ADMIT;
+    if (fits(stream)) return ADMISSION_ADMIT;
+
+    fallback = lookupStream(stream->fallbackStreamName);
+    if ((fallback != NULL) && (fallback != stream) && fits(fallback)) {
+        fallbackStreamName = fallback->streamName;
+        return ADMISSION_REDIRECT;
+    }
+
+    return ADMISSION_REFUSE;
+}
+
+void AdmissionRTSPServer::noteSessionStart(char const* streamName, Boolean priority) {
+    struct streamLimits* stream = lookupStream(streamName);
+
+    if (stream == NULL) return;
+    stream->numSessions++;
+    if (priority) stream->numPrioritySessions++;
+}
+
+void AdmissionRTSPServer::noteSessionEnd(char const* streamName, Boolean priority) {
+    struct streamLimits* stream = lookupStream(streamName);
+
+    if (stream == NULL) return;
+    if (stream->numSessions > 0) stream->numSessions--;
+    if (priority && (stream->numPrioritySessions > 0)) stream->numPrioritySessions--;
+}
+
+GenericMediaServer::ClientConnection* AdmissionRTSPServer::createNewClientConnection(int clientSocket,
+                                                                                    struct sockaddr_in clientAddr) {
+    return new AdmissionClientConnection(*this, clientSocket, clientAddr);
+}
+
+GenericMediaServer::ClientSession* AdmissionRTSPServer::createNewClientSession(u_int32_t sessionId) {
+    return new AdmissionClientSession(*this, sessionId);
+}
+
+////////// AdmissionRTSPServer::AdmissionClientConnection //////////
+
+AdmissionRTSPServer::AdmissionClientConnection::AdmissionClientConnection(AdmissionRTSPServer& ourServer,
+                                                                          int clientSocket,
+                                                                          struct sockaddr_in clientAddr)
+    : RTSPClientConnection(ourServer, clientSocket, clientAddr),
+      fOurAdmissionServer(ourServer) {
+}
+
+AdmissionRTSPServer::AdmissionClientConnection::~AdmissionClientConnection() {
+}
+
+netAddressBits AdmissionRTSPServer::AdmissionClientConnection::clientAddress() const {
+    return fClientAddr.sin_addr.s_addr;
+}
+
+void AdmissionRTSPServer::AdmissionClientConnection::refuseNotEnoughBandwidth() {
+    setRTSPResponse("453 Not Enough Bandwidth");
+}
+
+void AdmissionRTSPServer::AdmissionClientConnection::handleCmd_DESCRIBE(char const* urlPreSuffix,
+                                                                       char const* urlSuffix,
+                                                                       char const* fullRequestStr) {
+    char streamName[2 * RTSP_PARAM_STRING_MAX];
+    char const* fallbackStreamName;
+    int admission;
+
+    // Same stream name that RTSPClientConnection::handleCmd_DESCRIBE() looks for
+    if (strlen(urlPreSuffix) + strlen(urlSuffix) + 2 > sizeof(streamName)) {
+        handleCmd_bad();
+        return;
+    }
+    streamName[0] = '\0';
+    if (urlPreSuffix[0] != '\0') {
+        strcat(streamName, urlPreSuffix);
+        strcat(streamName, "/");
+    }
+    strcat(streamName, urlSuffix);
+
+    admission = fOurAdmissionServer.checkAdmission(streamName, clientAddress(), fallbackStreamName);
+    if (admission == ADMISSION_REDIRECT) {
+        // The SDP's Content-Base points to the fallback stream, so the
+        // client sends its SETUP there
+        envir() << "Stream \"" << streamName << "\" is full, redirecting the client to \""
+                << fallbackStreamName << "\"\n";
+        RTSPClientConnection::handleCmd_DESCRIBE("", fallbackStreamName, fullRequestStr);
+    } else if (admission == ADMISSION_REFUSE) {
+        envir() << "Stream \"" << streamName << "\" is full, client refused\n";
+        refuseNotEnoughBandwidth();
+    } else {
+        RTSPClientConnection::handleCmd_DESCRIBE(urlPreSuffix, urlSuffix, fullRequestStr);
+    }
+}
+
+////////// AdmissionRTSPServer::AdmissionClientSession //////////
+
+AdmissionRTSPServer::AdmissionClientSession::AdmissionClientSession(AdmissionRTSPServer& ourServer,
+                                                                    u_int32_t sessionId)
+    : RTSPClientSession(ourServer, sessionId),
+      fOurAdmissionServer(ourServer), fAdmittedStreamName(NULL), fPriority(False) {
+}
+
+AdmissionRTSPServer::AdmissionClientSession::~AdmissionClientSession() {
+    if (fAdmittedStreamName != NULL) {
+        fOurAdmissionServer.noteSessionEnd(fAdmittedStreamName, fPriority);
+        delete[] fAdmittedStreamName;
+    }
+}
+
+void AdmissionRTSPServer::AdmissionClientSession::handleCmd_SETUP(RTSPClientConnection* ourClientConnection,
+                                                                 char const* urlPreSuffix,
+                                                                 char const* urlSuffix,
+                                                                 char const* fullRequestStr) {
+    AdmissionClientConnection* connection = (AdmissionClientConnection*) ourClientConnection;
+    char const* streamName;
+    char const* fallbackStreamName;
+
+    // Check the clients that skipped the DESCRIBE too: the session is
+    // admitted with its first SETUP, the following tracks are free
+    if (fAdmittedStreamName == NULL) {
+        streamName = (urlPreSuffix[0] != '\0') ? urlPreSuffix : urlSuffix;
+        if (fOurAdmissionServer.checkAdmission(streamName, connection->clientAddress(),
+                                               fallbackStreamName) != ADMISSION_ADMIT) {
+            envir() << "Stream \"" << streamName << "\" is full, SETUP refused\n";
+            connection->refuseNotEnoughBandwidth();
+            return;
+        }
+    }
+
+    RTSPClientSession::handleCmd_SETUP(ourClientConnection, urlPreSuffix, urlSuffix, fullRequestStr);
+
+    if ((fAdmittedStreamName == NULL) && (fOurServerMediaSession != NULL)) {
+        fAdmittedStreamName = strDup(fOurServerMediaSession->streamName());
+        fPriority = fOurAdmissionServer.isPriorityAddress(connection->clientAddress());
+        fOurAdmissionServer.noteSessionStart(fAdmittedStreamName, fPriority);
+    }
+}
+
+void AdmissionRTSPServer::AdmissionClientSession::handleCmd_PLAY(RTSPClientConnection* ourClientConnection,
+                                                                ServerMediaSubsession* subsession,
+                                                                char const* fullRequestStr) {
+    TimeshiftServerMediaSubsession* timeshift;
+    unsigned secondsAgo;
+    unsigned i;
+
+    // live555 clamps a negative npt to 0: tell the timeshift sources
+    // where to start before the streams are started
+    if (parseTimeshiftRange(fullRequestStr, secondsAgo)) {
+        for (i = 0; i < fNumStreamStates; i++) {
+            if ((subsession != NULL) && (subsession != fStreamStates[i].subsession)) continue;
+
+            timeshift = TimeshiftServerMediaSubsession::lookup(fStreamStates[i].subsession);
+            if (timeshift != NULL) timeshift->setSecondsAgo(fOurSessionId, secondsAgo);
+        }
+    }
+
+    RTSPClientSession::handleCmd_PLAY(ourClientConnection, subsession, fullRequestStr);
+}
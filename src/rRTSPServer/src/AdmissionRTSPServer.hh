@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * RTSP server with admission control: a maximum number of sessions per
+ * stream and a total egress bandwidth budget.
+ * Clients that don't fit are redirected to a fallback stream (the low
+ * resolution one) when they ask for a DESCRIBE, or refused with
+ * "453 Not Enough Bandwidth".
+ * Clients from the priority addresses (e.g. the NVR) are always admitted,
+ * and part of the budget is kept for them: the other clients only get
+ * what is left once the priority reservation not in use is subtracted.
+ * The sessions also handle the "Range: npt=-N" of the timeshift streams.
+ */
+
+#ifndef _ADMISSION_RTSP_SERVER_HH
+#define _ADMISSION_RTSP_SERVER_HH
+
+#include "liveMedia.hh"
+#include "H264VideoLiveServerMediaSubsession.hh"
+
+#define ADMISSION_MAX_STREAMS 4
+#define ADMISSION_MAX_PRIORITY_ADDRESSES 4
+
+#define ADMISSION_ADMIT    0
+#define ADMISSION_REDIRECT 1
+#define ADMISSION_REFUSE   2
+
+class AdmissionRTSPServer: public RTSPServer {
+public:
+    static AdmissionRTSPServer* createNew(UsageEnvironment& env, Port ourPort = 554,
+                                          UserAuthenticationDatabase* authDatabase = NULL,
+                                          unsigned maxTotalKbps = 0,
+                                          unsigned reclamationSeconds = 65);
+    // Same with a listening socket inherited from another process
+    static AdmissionRTSPServer* createNewWithSocket(UsageEnvironment& env, int ourSocket, Port ourPort,
+                                                    UserAuthenticationDatabase* authDatabase = NULL,
+                                                    unsigned maxTotalKbps = 0,
+                                                    unsigned reclamationSeconds = 65);
+
+    int serverSocket() const { return fServerSocket; }
+    // Leaves the new connections to the process that took over the socket
+    void stopAccepting();
+
+    // maxSessions = 0 means no limit.
+    // estimatedKbps is used until rateSource has measured the real bitrate.
+    Boolean setStreamLimits(char const* streamName, unsigned maxSessions,
+                            unsigned estimatedKbps,
+                            H264VideoLiveServerMediaSubsession* rateSource,
+                            char const* fallbackStreamName = NULL);
+    Boolean addPriorityAddress(netAddressBits address);
+    // Bandwidth of the budget kept for the priority clients
+    void setPriorityReservation(unsigned kbps) { fPriorityReservedKbps = kbps; }
+
+    int checkAdmission(char const* streamName, netAddressBits clientAddress,
+                       char const*& fallbackStreamName);
+    void noteSessionStart(char const* streamName, Boolean priority);
+    void noteSessionEnd(char const* streamName, Boolean priority);
+
+protected:
+    AdmissionRTSPServer(UsageEnvironment& env, int ourSocket, Port ourPort,
+                        UserAuthenticationDatabase* authDatabase,
+                        unsigned maxTotalKbps, unsigned reclamationSeconds);
+    virtual ~AdmissionRTSPServer();
+
+protected: // redefined virtual functions
+    virtual ClientConnection* createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr);
+    virtual ClientSession* createNewClientSession(u_int32_t sessionId);
+
+public:
+    class AdmissionClientConnection: public RTSPServer::RTSPClientConnection {
+    public:
+        AdmissionClientConnection(AdmissionRTSPServer& ourServer, int clientSocket,
+                                  struct sockaddr_in clientAddr);
+        virtual ~AdmissionClientConnection();
+
+        netAddressBits clientAddress() const;
+        void refuseNotEnoughBandwidth();
+
+    protected: // redefined virtual functions
+        virtual void handleCmd_DESCRIBE(char const* urlPreSuffix, char const* urlSuffix,
+                                        char const* fullRequestStr);
+
+    private:
+        AdmissionRTSPServer& fOurAdmissionServer;
+    };
+
+    class AdmissionClientSession: public RTSPServer::RTSPClientSession {
+    public:
+        AdmissionClientSession(AdmissionRTSPServer& ourServer, u_int32_t sessionId);
+        virtual ~AdmissionClientSession();
+
+    protected: // redefined virtual functions
+        virtual void handleCmd_SETUP(RTSPClientConnection* ourClientConnection,
+                                     char const* urlPreSuffix, char const* urlSuffix,
+                                     char const* fullRequestStr);
+        virtual void handleCmd_PLAY(RTSPClientConnection* ourClientConnection,
+                                    ServerMediaSubsession* subsession, char const* fullRequestStr);
+
+    private:
+        AdmissionRTSPServer& fOurAdmissionServer;
+        char* fAdmittedStreamName;
+        Boolean fPriority;
+    };
+
+private:
+    struct streamLimits {
+        char* streamName;
+        char* fallbackStreamName;
+        unsigned maxSessions;
+        unsigned estimatedKbps;
+        H264VideoLiveServerMediaSubsession* rateSource;
+        unsigned numSessions;
+        unsigned numPrioritySessions;
+    };
+
+    struct streamLimits* lookupStream(char const* streamName);
+    unsigned streamKbps(struct streamLimits const* stream) const;
+    unsigned usedKbps() const;
+    unsigned priorityUsedKbps() const;
+    Boolean fits(struct streamLimits const* stream) const;
+    Boolean isPriorityAddress(netAddressBits address) const;
+
+    unsigned fMaxTotalKbps;
+    struct streamLimits fStreams[ADMISSION_MAX_STREAMS];
+    unsigned fNumStreams;
+    netAddressBits fPriorityAddresses[ADMISSION_MAX_PRIORITY_ADDRESSES];
+    unsigned fNumPriorityAddresses;
+    unsigned fPriorityReservedKbps;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Subsession for the adaptive stream.
+ */
+
+#include "H264AdaptiveServerMediaSubsession.hh"
+#include "AdaptiveH264Source.hh"
+#include "LiveStreamInput.hh"
+
+H264AdaptiveServerMediaSubsession* H264AdaptiveServerMediaSubsession::createNew(UsageEnvironment& env,
+                                                                                char const* highFileName,
+                                                                                char const* lowFileName,
+                                                                                unsigned nackHistorySize) {
+    return new H264AdaptiveServerMediaSubsession(env, highFileName, lowFileName, nackHistorySize);
+}
+
+H264AdaptiveServerMediaSubsession::H264AdaptiveServerMediaSubsession(UsageEnvironment& env,
+                                                                     char const* highFileName,
+                                                                     char const* lowFileName,
+                                                                     unsigned nackHistorySize)
+    // No shared source: the stream depends on the client. No FEC: the
+    // encoder can only protect one packet sequence
+    : H264VideoLiveServerMediaSubsession(env, highFileName, False, nackHistorySize, NULL) {
+    fLowFileName = strDup(lowFileName);
+}
+
+H264AdaptiveServerMediaSubsession::~H264AdaptiveServerMediaSubsession() {
+    delete[] fLowFileName;
+}
+
+FramedSource* H264AdaptiveServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/,
+                                                                       unsigned& estBitrate) {
+    LiveStreamInput* highInput;
+    LiveStreamInput* lowInput;
+    FramedSource* highSource;
+    FramedSource* lowSource;
+
+    estBitrate = 500; // kbps, estimate
+
+    highInput = LiveStreamInput::forFile(envir(), fFileName);
+    lowInput = LiveStreamInput::forFile(envir(), fLowFileName);
+    if ((highInput == NULL) || (lowInput == NULL)) return NULL;
+
+    highSource = highInput->createReplica();
+    if (highSource == NULL) return NULL;
+    lowSource = lowInput->createReplica();
+    if (lowSource == NULL) {
+        Medium::close(highSource);
+        return NULL;
+    }
+
+    // Start low and move up when the receiver reports are good
+    return AdaptiveH264Source::createNew(envir(), highSource, lowSource, ADAPTIVE_LOW);
+}
+
+RTCPInstance* H264AdaptiveServerMediaSubsession::createRTCP(Groupsock* RTCPgs, unsigned totSessionBW,
+                                                            unsigned char const* cname, RTPSink* sink) {
+    RTCPInstance* rtcp = H264VideoLiveServerMediaSubsession::createRTCP(RTCPgs, totSessionBW, cname, sink);
+
+    if ((rtcp != NULL) && (sink != NULL)) {
+        rtcp->setRRHandler(AdaptiveH264Source::rrHandler, sink);
+    }
+
+    return rtcp;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Subsession for the adaptive stream: every client gets its own source
+ * and sink, switching between the high and the low resolution streams.
+ */
+
+#ifndef _H264_ADAPTIVE_SERVER_MEDIA_SUBSESSION_HH
+#define _H264_ADAPTIVE_SERVER_MEDIA_SUBSESSION_HH
+
+#include "H264VideoLiveServerMediaSubsession.hh"
+
+class H264AdaptiveServerMediaSubsession: public H264VideoLiveServerMediaSubsession {
+public:
+    static H264AdaptiveServerMediaSubsession* createNew(UsageEnvironment& env,
+                                                        char const* highFileName,
+                                                        char const* lowFileName,
+                                                        unsigned nackHistorySize = 0);
+
+protected:
+    H264AdaptiveServerMediaSubsession(UsageEnvironment& env, char const* highFileName,
+                                      char const* lowFileName, unsigned nackHistorySize);
+    virtual ~H264AdaptiveServerMediaSubsession();
+
+protected: // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual RTCPInstance* createRTCP(Groupsock* RTCPgs, unsigned totSessionBW,
+                                     unsigned char const* cname, RTPSink* sink);
+
+private:
+    char* fLowFileName;
+};
+
+#endif
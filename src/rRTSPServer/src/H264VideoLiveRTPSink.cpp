@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP sink for the live H.264 streams.
+ */
+
+#include "H264VideoLiveRTPSink.hh"
+#include "GroupsockHelper.hh"
+
+#define RTP_HEADER_SIZE 12
+#define FU_A_HEADER_SIZE 2
+#define NAL_TYPE_FU_A 28
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define RTCP_PT_RTPFB 205
+#define RTCP_FMT_GENERIC_NACK 1
+#define BITRATE_PERIOD_US 2000000
+
+H264VideoLiveRTPSink* H264VideoLiveRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                                                      unsigned char rtpPayloadFormat,
+                                                      unsigned nalBufferSize,
+                                                      unsigned nackHistorySize,
+                                                      ULPFECEncoder* fecEncoder,
+                                                      NALBufferPool* bufferPool) {
+    return new H264VideoLiveRTPSink(env, RTPgs, rtpPayloadFormat, nalBufferSize,
+                                    nackHistorySize, fecEncoder, bufferPool);
+}
+
+H264VideoLiveRTPSink::H264VideoLiveRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+                                           unsigned char rtpPayloadFormat,
+                                           unsigned nalBufferSize,
+                                           unsigned nackHistorySize,
+                                           ULPFECEncoder* fecEncoder,
+                                           NALBufferPool* bufferPool)
+    : RTPSink(env, RTPgs, rtpPayloadFormat, 90000, "H264", 1),
+      fNALBuffer(NULL), fNALBufferSize(0), fBufferPool(bufferPool),
+      fSPS(NULL), fSPSSize(0), fPPS(NULL), fPPSSize(0), fFmtpSDPLine(NULL),
+      fRetransmissionBuffer(NULL), fFECEncoder(fecEncoder),
+      fBitrateReport(NULL), fMaxNALSizeReport(NULL), fBitrateOctets(0), fWaitIDR(False) {
+    allocateNALBuffer(nalBufferSize);
+
+    // With FEC enabled, leave room for the FEC headers in the FEC packets
+    fMaxPacketSize = (fFECEncoder != NULL) ? ULPFEC_MAX_MEDIA_PACKET_SIZE : H264_LIVE_MAX_PACKET_SIZE;
+
+    if (nackHistorySize > 0) {
+        fRetransmissionBuffer = new RetransmissionBuffer(nackHistorySize, fMaxPacketSize);
+    }
+
+    gettimeofday(&fBitrateStart, NULL);
+}
+
+H264VideoLiveRTPSink::~H264VideoLiveRTPSink() {
+    stopPlaying();
+
+    delete fRetransmissionBuffer;
+    delete[] fFmtpSDPLine;
+    delete[] fPPS;
+    delete[] fSPS;
+    freeNALBuffer();
+}
+
+void H264VideoLiveRTPSink::allocateNALBuffer(unsigned size) {
+    if (fBufferPool != NULL) {
+        fNALBuffer = fBufferPool->allocate(size, fNALBufferSize);
+    } else {
+        fNALBufferSize = NALBufferPool::roundSize(size);
+        fNALBuffer = new unsigned char[fNALBufferSize];
+    }
+}
+
+void H264VideoLiveRTPSink::freeNALBuffer() {
+    if (fBufferPool != NULL) {
+        fBufferPool->release(fNALBuffer, fNALBufferSize);
+    } else {
+        delete[] fNALBuffer;
+    }
+    fNALBuffer = NULL;
+    fNALBufferSize = 0;
+}
+
+void H264VideoLiveRTPSink::setBitrateReport(unsigned* kbps) {
+    fBitrateReport = kbps;
+}
+
+void H264VideoLiveRTPSink::setMaxNALSizeReport(unsigned* size) {
+    fMaxNALSizeReport = size;
+}
+
+char const* H264VideoLiveRTPSink::sdpMediaType() const {
+    return "video";
+}
+
+char const* H264VideoLiveRTPSink::auxSDPLine() {
+    char* sps64;
+    char* pps64;
+    char const* fmtFmtp;
+    char const* fmtNack;
+    unsigned profileLevelId;
+    unsigned lineSize;
+
+    if (fFmtpSDPLine != NULL) return fFmtpSDPLine;
+
+    // We need the parameter sets from the stream before we can describe it
+    if ((fSPS == NULL) || (fPPS == NULL) || (fSPSSize < 4)) return NULL;
+
+    profileLevelId = (fSPS[1] << 16) | (fSPS[2] << 8) | fSPS[3];
+    sps64 = base64Encode((char const*) fSPS, fSPSSize);
+    pps64 = base64Encode((char const*) fPPS, fPPSSize);
+
+    fmtFmtp = "a=fmtp:%d packetization-mode=1;profile-level-id=%06X;sprop-parameter-sets=%s,%s\r\n";
+    fmtNack = "a=rtcp-fb:%d nack\r\n";
+    lineSize = strlen(fmtFmtp) + 3 + 6 + strlen(sps64) + strlen(pps64) + strlen(fmtNack) + 3 + 1;
+    fFmtpSDPLine = new char[lineSize];
+    sprintf(fFmtpSDPLine, fmtFmtp, rtpPayloadType(), profileLevelId, sps64, pps64);
+    if (fRetransmissionBuffer != NULL) {
+        // Tell the clients that they can ask for retransmissions
+        sprintf(fFmtpSDPLine + strlen(fFmtpSDPLine), fmtNack, rtpPayloadType());
+    }
+
+    delete[] sps64;
+    delete[] pps64;
+
+    return fFmtpSDPLine;
+}
+
+Boolean H264VideoLiveRTPSink::continuePlaying() {
+    if (fSource == NULL) return False;
+
+    fSource->getNextFrame(fNALBuffer, fNALBufferSize,
+                          afterGettingFrame, this,
+                          onSourceClosure, this);
+    return True;
+}
+
+void H264VideoLiveRTPSink::afterGettingFrame(void* clientData, unsigned frameSize,
+                                             unsigned numTruncatedBytes,
+                                             struct timeval presentationTime,
+                                             unsigned /*durationInMicroseconds*/) {
+    H264VideoLiveRTPSink* sink = (H264VideoLiveRTPSink*) clientData;
+    sink->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void H264VideoLiveRTPSink::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                              struct timeval presentationTime) {
+    Boolean endOfAccessUnit;
+    u_int8_t nal_unit_type;
+
+    if ((fMaxNALSizeReport != NULL) && (frameSize + numTruncatedBytes > *fMaxNALSizeReport)) {
+        *fMaxNALSizeReport = frameSize + numTruncatedBytes;
+    }
+
+    if (numTruncatedBytes > 0) {
+        envir() << "H264VideoLiveRTPSink: NAL unit of " << frameSize + numTruncatedBytes
+                << " bytes doesn't fit in the " << fNALBufferSize << " bytes buffer, dropped\n";
+
+        // A truncated slice would corrupt the pictures up to the next
+        // keyframe: drop them all and restart from it
+        if (frameSize > 0) {
+            nal_unit_type = fNALBuffer[0] & 0x1F;
+            if ((nal_unit_type >= 1) && (nal_unit_type <= 5)) fWaitIDR = True;
+        }
+        if (fSource->isH264VideoStreamFramer()) {
+            ((H264or5VideoStreamFramer*) fSource)->pictureEndMarker() = False;
+        }
+
+        // Make room for the next ones, with some margin
+        if (fNALBufferSize < NAL_BUFFER_MAX_SIZE) {
+            freeNALBuffer();
+            allocateNALBuffer((frameSize + numTruncatedBytes) * 5 / 4);
+        }
+    } else if (frameSize > 0) {
+        nal_unit_type = fNALBuffer[0] & 0x1F;
+        if (fSource->isH264VideoStreamFramer()) {
+            // The framer knows when a NAL unit is the last one of a picture,
+            // the base class is the one of the discrete framer too
+            H264or5VideoStreamFramer* framer = (H264or5VideoStreamFramer*) fSource;
+            endOfAccessUnit = framer->pictureEndMarker();
+            framer->pictureEndMarker() = False;
+        } else {
+            // The camera sends one slice per picture
+            endOfAccessUnit = (nal_unit_type >= 1) && (nal_unit_type <= 5);
+        }
+
+        if (nal_unit_type == NAL_TYPE_IDR) fWaitIDR = False;
+        if (!fWaitIDR || (nal_unit_type < 1) || (nal_unit_type > 5)) {
+            noteParameterSet(fNALBuffer, frameSize);
+            sendNALUnit(fNALBuffer, frameSize, presentationTime, endOfAccessUnit);
+        }
+    }
+
+    // Don't recurse if the source delivers synchronously
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*) sendNext, this);
+}
+
+void H264VideoLiveRTPSink::sendNext(void* firstArg) {
+    H264VideoLiveRTPSink* sink = (H264VideoLiveRTPSink*) firstArg;
+    sink->continuePlaying();
+}
+
+void H264VideoLiveRTPSink::noteParameterSet(unsigned char const* nal, unsigned nalSize) {
+    u_int8_t nal_unit_type = nal[0] & 0x1F;
+
+    if (nal_unit_type == NAL_TYPE_SPS) {
+        if ((fSPS != NULL) && (fSPSSize == nalSize) && (memcmp(fSPS, nal, nalSize) == 0)) return;
+        delete[] fSPS;
+        fSPS = new u_int8_t[nalSize];
+        memcpy(fSPS, nal, nalSize);
+        fSPSSize = nalSize;
+    } else if (nal_unit_type == NAL_TYPE_PPS) {
+        if ((fPPS != NULL) && (fPPSSize == nalSize) && (memcmp(fPPS, nal, nalSize) == 0)) return;
+        delete[] fPPS;
+        fPPS = new u_int8_t[nalSize];
+        memcpy(fPPS, nal, nalSize);
+        fPPSSize = nalSize;
+    }
+}
+
+void H264VideoLiveRTPSink::sendNALUnit(unsigned char const* nal, unsigned nalSize,
+                                       struct timeval presentationTime, Boolean endOfAccessUnit) {
+    unsigned maxPayloadSize = fMaxPacketSize - RTP_HEADER_SIZE;
+    u_int32_t rtpTimestamp = convertToRTPTimestamp(presentationTime);
+    unsigned char fuHeader[FU_A_HEADER_SIZE];
+    unsigned char const* p;
+    unsigned remaining, chunk;
+
+    fCurrentTimestamp = rtpTimestamp;
+    fMostRecentPresentationTime = presentationTime;
+    if ((fInitialPresentationTime.tv_sec == 0) && (fInitialPresentationTime.tv_usec == 0)) {
+        fInitialPresentationTime = presentationTime;
+    }
+
+    if (nalSize <= maxPayloadSize) {
+        // Single NAL unit packet
+        sendPacket(NULL, 0, nal, nalSize, endOfAccessUnit, rtpTimestamp);
+        return;
+    }
+
+    // FU-A fragmentation: the NAL header is replaced by the FU indicator and header
+    fuHeader[0] = (nal[0] & 0xE0) | NAL_TYPE_FU_A;
+    fuHeader[1] = 0x80 | (nal[0] & 0x1F);    // start bit
+    p = nal + 1;
+    remaining = nalSize - 1;
+    while (remaining > 0) {
+        chunk = maxPayloadSize - FU_A_HEADER_SIZE;
+        if (remaining <= chunk) {
+            chunk = remaining;
+            fuHeader[1] |= 0x40;    // end bit
+        }
+        sendPacket(fuHeader, FU_A_HEADER_SIZE, p, chunk,
+                   endOfAccessUnit && (remaining == chunk), rtpTimestamp);
+        fuHeader[1] &= ~0x80;
+        p += chunk;
+        remaining -= chunk;
+    }
+}
+
+void H264VideoLiveRTPSink::sendPacket(unsigned char const* header, unsigned headerSize,
+                                      unsigned char const* payload, unsigned payloadSize,
+                                      Boolean marker, u_int32_t rtpTimestamp) {
+    u_int32_t ssrc = SSRC();
+    u_int16_t seqNo = fSeqNo++;
+    unsigned packetSize = RTP_HEADER_SIZE + headerSize + payloadSize;
+
+    fPacket[0] = 0x80;    // version 2, no padding, no extension, no CSRCs
+    fPacket[1] = (marker ? 0x80 : 0x00) | rtpPayloadType();
+    fPacket[2] = seqNo >> 8;
+    fPacket[3] = seqNo & 0xFF;
+    fPacket[4] = rtpTimestamp >> 24;
+    fPacket[5] = (rtpTimestamp >> 16) & 0xFF;
+    fPacket[6] = (rtpTimestamp >> 8) & 0xFF;
+    fPacket[7] = rtpTimestamp & 0xFF;
+    fPacket[8] = ssrc >> 24;
+    fPacket[9] = (ssrc >> 16) & 0xFF;
+    fPacket[10] = (ssrc >> 8) & 0xFF;
+    fPacket[11] = ssrc & 0xFF;
+    if (headerSize > 0) memcpy(&fPacket[RTP_HEADER_SIZE], header, headerSize);
+    memcpy(&fPacket[RTP_HEADER_SIZE + headerSize], payload, payloadSize);
+
+    if (fRetransmissionBuffer != NULL) {
+        fRetransmissionBuffer->addPacket(seqNo, fPacket, packetSize);
+    }
+    if (fFECEncoder != NULL) {
+        fFECEncoder->addMediaPacket(fPacket, packetSize);
+    }
+
+    fRTPInterface.sendPacket(fPacket, packetSize);
+
+    ++fPacketCount;
+    fTotalOctetCount += packetSize;
+    fOctetCount += packetSize - RTP_HEADER_SIZE;
+
+    updateBitrate(packetSize);
+}
+
+void H264VideoLiveRTPSink::updateBitrate(unsigned packetSize) {
+    struct timeval now;
+    int64_t elapsed;
+    unsigned kbps;
+
+    if (fBitrateReport == NULL) return;
+
+    fBitrateOctets += packetSize;
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - fBitrateStart.tv_sec) * 1000000LL + (now.tv_usec - fBitrateStart.tv_usec);
+    if (elapsed < BITRATE_PERIOD_US) return;
+
+    // Smooth over a few periods: the I frames make the rate very bursty
+    kbps = (unsigned) (((int64_t) fBitrateOctets * 8000) / elapsed);
+    if (*fBitrateReport == 0) {
+        *fBitrateReport = kbps;
+    } else {
+        *fBitrateReport = (*fBitrateReport * 3 + kbps) / 4;
+    }
+    fBitrateOctets = 0;
+    fBitrateStart = now;
+}
+
+void H264VideoLiveRTPSink::resendPacket(u_int16_t seqNo) {
+    unsigned char* packet;
+    unsigned packetSize;
+
+    if (fRetransmissionBuffer == NULL) return;
+
+    packet = fRetransmissionBuffer->lookupForResend(seqNo, packetSize);
+    if (packet == NULL) return;
+
+    // Retransmissions use the original sequence number and SSRC (RFC 4585):
+    // live555 builds the "m=" line from a single payload type, so a separate
+    // RFC 4588 "rtx" payload type can't be announced.
+    // With a shared source the packet goes to every client of the stream.
+    fRTPInterface.sendPacket(packet, packetSize);
+}
+
+void H264VideoLiveRTPSink::incomingRTCPHandler(void* clientData, unsigned char* packet, unsigned& packetSize) {
+    H264VideoLiveRTPSink* sink = (H264VideoLiveRTPSink*) clientData;
+    sink->handleIncomingRTCP(packet, packetSize);
+}
+
+void H264VideoLiveRTPSink::handleIncomingRTCP(unsigned char const* packet, unsigned packetSize) {
+    unsigned length;
+    unsigned i, bit;
+    u_int32_t mediaSSRC;
+    u_int16_t pid, blp;
+
+    // Walk the compound packet
+    while (packetSize >= 4) {
+        if ((packet[0] & 0xC0) != 0x80) return;    // bad version
+        length = (((packet[2] << 8) | packet[3]) + 1) * 4;
+        if (length > packetSize) return;
+
+        // Generic NACK: header, sender SSRC, media SSRC, then PID/BLP pairs
+        if ((packet[1] == RTCP_PT_RTPFB) && ((packet[0] & 0x1F) == RTCP_FMT_GENERIC_NACK) && (length >= 16)) {
+            mediaSSRC = (packet[8] << 24) | (packet[9] << 16) | (packet[10] << 8) | packet[11];
+            if (mediaSSRC == SSRC()) {
+                for (i = 12; i + 4 <= length; i += 4) {
+                    pid = (packet[i] << 8) | packet[i + 1];
+                    blp = (packet[i + 2] << 8) | packet[i + 3];
+                    resendPacket(pid);
+                    for (bit = 0; bit < 16; bit++) {
+                        if (blp & (1 << bit)) resendPacket(pid + bit + 1);
+                    }
+                }
+            }
+        }
+
+        packet += length;
+        packetSize -= length;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP sink for the live H.264 streams.
+ * It packetizes the NAL units itself (RFC 6184, single NAL unit and FU-A
+ * packets) so that every packet it sends can be kept for retransmission
+ * and fed to the FEC encoder: live555's H264VideoRTPSink doesn't give
+ * access to the packets it builds.
+ */
+
+#ifndef _H264_VIDEO_LIVE_RTP_SINK_HH
+#define _H264_VIDEO_LIVE_RTP_SINK_HH
+
+#include "liveMedia.hh"
+#include "RetransmissionBuffer.hh"
+#include "ULPFECSource.hh"
+#include "NALBufferPool.hh"
+
+#define H264_LIVE_MAX_PACKET_SIZE 1456
+
+class H264VideoLiveRTPSink: public RTPSink {
+public:
+    static H264VideoLiveRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs,
+                                           unsigned char rtpPayloadFormat,
+                                           unsigned nalBufferSize,
+                                           unsigned nackHistorySize = 0,
+                                           ULPFECEncoder* fecEncoder = NULL,
+                                           NALBufferPool* bufferPool = NULL);
+
+    // Looks for RTCP generic NACKs in an incoming RTCP compound packet and
+    // retransmits the packets they ask for.
+    void handleIncomingRTCP(unsigned char const* packet, unsigned packetSize);
+    static void incomingRTCPHandler(void* clientData, unsigned char* packet, unsigned& packetSize);
+
+    // The sink keeps *kbps updated with the smoothed bitrate it sends to
+    // each destination, the variable must outlive the sink.
+    void setBitrateReport(unsigned* kbps);
+    // Same for the size of the biggest NAL unit received from the source.
+    void setMaxNALSizeReport(unsigned* size);
+
+protected:
+    H264VideoLiveRTPSink(UsageEnvironment& env, Groupsock* RTPgs,
+                         unsigned char rtpPayloadFormat, unsigned nalBufferSize,
+                         unsigned nackHistorySize, ULPFECEncoder* fecEncoder,
+                         NALBufferPool* bufferPool);
+    virtual ~H264VideoLiveRTPSink();
+
+protected: // redefined virtual functions
+    virtual char const* sdpMediaType() const;
+    virtual char const* auxSDPLine();
+    virtual Boolean continuePlaying();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    static void sendNext(void* firstArg);
+
+    void allocateNALBuffer(unsigned size);
+    void freeNALBuffer();
+    void noteParameterSet(unsigned char const* nal, unsigned nalSize);
+    void sendNALUnit(unsigned char const* nal, unsigned nalSize,
+                     struct timeval presentationTime, Boolean endOfAccessUnit);
+    void sendPacket(unsigned char const* header, unsigned headerSize,
+                    unsigned char const* payload, unsigned payloadSize,
+                    Boolean marker, u_int32_t rtpTimestamp);
+    void resendPacket(u_int16_t seqNo);
+    void updateBitrate(unsigned packetSize);
+
+private:
+    unsigned char* fNALBuffer;
+    unsigned fNALBufferSize;
+    NALBufferPool* fBufferPool;
+    unsigned fMaxPacketSize;
+    unsigned char fPacket[H264_LIVE_MAX_PACKET_SIZE];
+    u_int8_t* fSPS;
+    unsigned fSPSSize;
+    u_int8_t* fPPS;
+    unsigned fPPSSize;
+    char* fFmtpSDPLine;
+    RetransmissionBuffer* fRetransmissionBuffer;
+    ULPFECEncoder* fFECEncoder;
+    unsigned* fBitrateReport;
+    unsigned* fMaxNALSizeReport;
+    unsigned fBitrateOctets;
+    struct timeval fBitrateStart;
+    // A slice was truncated, the slices are dropped up to the next IDR
+    Boolean fWaitIDR;
+};
+
+#endif
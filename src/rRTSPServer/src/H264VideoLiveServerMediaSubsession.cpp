@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsession for the live H.264 streams read from the h264grabber fifos.
+ */
+
+#include "H264VideoLiveServerMediaSubsession.hh"
+#include "H264VideoLiveRTPSink.hh"
+#include "LiveStreamInput.hh"
+
+#include <stdio.h>
+#include <unistd.h>
+
+// Resident set size of the process, to see what every session costs
+static unsigned long rssKiB() {
+    FILE *fp;
+    unsigned long size, resident;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return 0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fp);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+H264VideoLiveServerMediaSubsession* H264VideoLiveServerMediaSubsession::createNew(UsageEnvironment& env,
+                                                                                  char const* fileName,
+                                                                                  Boolean reuseFirstSource,
+                                                                                  unsigned nackHistorySize,
+                                                                                  ULPFECEncoder* fecEncoder) {
+    return new H264VideoLiveServerMediaSubsession(env, fileName, reuseFirstSource,
+                                                  nackHistorySize, fecEncoder);
+}
+
+H264VideoLiveServerMediaSubsession::H264VideoLiveServerMediaSubsession(UsageEnvironment& env,
+                                                                       char const* fileName,
+                                                                       Boolean reuseFirstSource,
+                                                                       unsigned nackHistorySize,
+                                                                       ULPFECEncoder* fecEncoder)
+    : H264VideoFileServerMediaSubsession(env, fileName, reuseFirstSource),
+      fNACKHistorySize(nackHistorySize), fFECEncoder(fecEncoder), fMeasuredKbps(0),
+      fBufferPool(NULL), fDefaultBufferSize(OutPacketBuffer::maxSize), fStateFileName(NULL),
+      fMaxNALSize(0), fSavedMaxNALSize(0) {
+}
+
+H264VideoLiveServerMediaSubsession::~H264VideoLiveServerMediaSubsession() {
+    saveMaxNALSize();
+    delete[] fStateFileName;
+}
+
+void H264VideoLiveServerMediaSubsession::setBufferSizing(NALBufferPool* bufferPool, unsigned defaultSize,
+                                                         char const* stateFileName) {
+    FILE *fp;
+    unsigned size;
+
+    fBufferPool = bufferPool;
+    fDefaultBufferSize = defaultSize;
+    delete[] fStateFileName;
+    fStateFileName = strDup(stateFileName);
+
+    if (fStateFileName == NULL) return;
+
+    fp = fopen(fStateFileName, "r");
+    if (fp == NULL) return;
+    if ((fscanf(fp, "%u", &size) == 1) && (size <= NAL_BUFFER_MAX_SIZE)) {
+        fMaxNALSize = size;
+        fSavedMaxNALSize = size;
+    }
+    fclose(fp);
+}
+
+unsigned H264VideoLiveServerMediaSubsession::nalBufferSize() const {
+    if (fMaxNALSize == 0) return fDefaultBufferSize;
+
+    // Some margin: the I frames grow with the scene complexity
+    return fMaxNALSize + fMaxNALSize / 4;
+}
+
+void H264VideoLiveServerMediaSubsession::saveMaxNALSize() {
+    FILE *fp;
+
+    if ((fStateFileName == NULL) || (fMaxNALSize <= fSavedMaxNALSize)) return;
+
+    fp = fopen(fStateFileName, "w");
+    if (fp == NULL) return;
+    fprintf(fp, "%u\n", fMaxNALSize);
+    fclose(fp);
+    fSavedMaxNALSize = fMaxNALSize;
+}
+
+void H264VideoLiveServerMediaSubsession::getStreamParameters(unsigned clientSessionId,
+                                                             netAddressBits clientAddress,
+                                                             Port const& clientRTPPort,
+                                                             Port const& clientRTCPPort,
+                                                             int tcpSocketNum, unsigned char rtpChannelId,
+                                                             unsigned char rtcpChannelId,
+                                                             netAddressBits& destinationAddress,
+                                                             u_int8_t& destinationTTL,
+                                                             Boolean& isMulticast,
+                                                             Port& serverRTPPort, Port& serverRTCPPort,
+                                                             void*& streamToken) {
+    unsigned long rssBefore = rssKiB();
+
+    OnDemandServerMediaSubsession::getStreamParameters(clientSessionId, clientAddress,
+                                                       clientRTPPort, clientRTCPPort,
+                                                       tcpSocketNum, rtpChannelId, rtcpChannelId,
+                                                       destinationAddress, destinationTTL, isMulticast,
+                                                       serverRTPPort, serverRTCPPort, streamToken);
+
+    envir() << "Session " << clientSessionId << " started: RSS " << (unsigned) rssBefore
+            << " KiB -> " << (unsigned) rssKiB() << " KiB, NAL buffers "
+            << ((fBufferPool != NULL) ? fBufferPool->usedBytes() / 1024 : 0) << " KiB used, "
+            << ((fBufferPool != NULL) ? fBufferPool->freeBytes() / 1024 : 0) << " KiB pooled\n";
+}
+
+void H264VideoLiveServerMediaSubsession::deleteStream(unsigned clientSessionId, void*& streamToken) {
+    unsigned long rssBefore = rssKiB();
+
+    OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+    saveMaxNALSize();
+
+    envir() << "Session " << clientSessionId << " ended: RSS " << (unsigned) rssBefore
+            << " KiB -> " << (unsigned) rssKiB() << " KiB\n";
+}
+
+FramedSource* H264VideoLiveServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/,
+                                                                      unsigned& estBitrate) {
+    LiveStreamInput* input;
+    FramedSource* replica;
+
+    estBitrate = 500; // kbps, estimate
+
+    input = LiveStreamInput::forFile(envir(), fFileName);
+    if (input == NULL) return NULL;
+    replica = input->createReplica();
+    if (replica == NULL) return NULL;
+
+    // The replica delivers discrete NAL units
+    return H264VideoStreamDiscreteFramer::createNew(envir(), replica);
+}
+
+RTPSink* H264VideoLiveServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,
+                                                              unsigned char rtpPayloadTypeIfDynamic,
+                                                              FramedSource* /*inputSource*/) {
+    H264VideoLiveRTPSink* sink;
+
+    sink = H264VideoLiveRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic,
+                                           nalBufferSize(), fNACKHistorySize, fFECEncoder,
+                                           fBufferPool);
+    sink->setBitrateReport(&fMeasuredKbps);
+    sink->setMaxNALSizeReport(&fMaxNALSize);
+
+    return sink;
+}
+
+RTCPInstance* H264VideoLiveServerMediaSubsession::createRTCP(Groupsock* RTCPgs, unsigned totSessionBW,
+                                                             unsigned char const* cname, RTPSink* sink) {
+    RTCPInstance* rtcp = OnDemandServerMediaSubsession::createRTCP(RTCPgs, totSessionBW, cname, sink);
+
+    // Look at every incoming RTCP packet for NACKs
+    if ((rtcp != NULL) && (sink != NULL) && (fNACKHistorySize > 0)) {
+        rtcp->setAuxilliaryReadHandler(H264VideoLiveRTPSink::incomingRTCPHandler, sink);
+    }
+
+    return rtcp;
+}
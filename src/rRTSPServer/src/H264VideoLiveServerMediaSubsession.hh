@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsession for the live H.264 streams read from the h264grabber fifos.
+ * The fifos are read through LiveStreamInput, so the adaptive stream can
+ * share them with the fixed ones.
+ */
+
+#ifndef _H264_VIDEO_LIVE_SERVER_MEDIA_SUBSESSION_HH
+#define _H264_VIDEO_LIVE_SERVER_MEDIA_SUBSESSION_HH
+
+#include "liveMedia.hh"
+#include "ULPFECSource.hh"
+#include "NALBufferPool.hh"
+
+class H264VideoLiveServerMediaSubsession: public H264VideoFileServerMediaSubsession {
+public:
+    static H264VideoLiveServerMediaSubsession* createNew(UsageEnvironment& env, char const* fileName,
+                                                         Boolean reuseFirstSource,
+                                                         unsigned nackHistorySize = 0,
+                                                         ULPFECEncoder* fecEncoder = NULL);
+
+    // Bitrate sent to each client, 0 until the stream has been played
+    unsigned measuredKbps() const { return fMeasuredKbps; }
+
+    // The NAL buffers of the sinks come from bufferPool and are sized from
+    // the biggest NAL unit seen on the stream, remembered in stateFileName
+    // across restarts. defaultSize is used until the first one is seen.
+    void setBufferSizing(NALBufferPool* bufferPool, unsigned defaultSize,
+                         char const* stateFileName);
+
+    virtual void getStreamParameters(unsigned clientSessionId, netAddressBits clientAddress,
+                                     Port const& clientRTPPort, Port const& clientRTCPPort,
+                                     int tcpSocketNum, unsigned char rtpChannelId,
+                                     unsigned char rtcpChannelId,
+                                     netAddressBits& destinationAddress, u_int8_t& destinationTTL,
+                                     Boolean& isMulticast, Port& serverRTPPort, Port& serverRTCPPort,
+                                     void*& streamToken);
+    virtual void deleteStream(unsigned clientSessionId, void*& streamToken);
+
+protected:
+    H264VideoLiveServerMediaSubsession(UsageEnvironment& env, char const* fileName,
+                                       Boolean reuseFirstSource,
+                                       unsigned nackHistorySize, ULPFECEncoder* fecEncoder);
+    virtual ~H264VideoLiveServerMediaSubsession();
+
+protected: // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+    virtual RTCPInstance* createRTCP(Groupsock* RTCPgs, unsigned totSessionBW,
+                                     unsigned char const* cname, RTPSink* sink);
+
+private:
+    unsigned nalBufferSize() const;
+    void saveMaxNALSize();
+
+private:
+    unsigned fNACKHistorySize;
+    ULPFECEncoder* fFECEncoder;
+    unsigned fMeasuredKbps;
+    NALBufferPool* fBufferPool;
+    unsigned fDefaultBufferSize;
+    char* fStateFileName;
+    unsigned fMaxNALSize;
+    unsigned fSavedMaxNALSize;
+};
+
+#endif
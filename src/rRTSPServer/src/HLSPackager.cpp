@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Low latency HLS packager, fragmented MP4 parts and segments in memory.
+ */
+
+#include "HLSPackager.hh"
+#include "NALBufferPool.hh"
+
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+#define PLAYLIST_MAX_SIZE (1024 + HLS_SEGMENT_SLOTS * (HLS_MAX_PARTS + 2) * 96)
+
+#define SAMPLE_FLAGS_KEY     0x02000000
+#define SAMPLE_FLAGS_NON_KEY 0x01010000
+
+////////// HLSBuffer //////////
+
+HLSBuffer* HLSBuffer::createNew(unsigned size) {
+    return new HLSBuffer(size);
+}
+
+HLSBuffer::HLSBuffer(unsigned size)
+    : fRefCount(1), fSize(size) {
+    fData = new unsigned char[size > 0 ? size : 1];
+}
+
+HLSBuffer::~HLSBuffer() {
+    delete[] fData;
+}
+
+void HLSBuffer::unref() {
+    if (--fRefCount == 0) delete this;
+}
+
+////////// MP4 boxes //////////
+
+class MP4Writer {
+public:
+    MP4Writer(unsigned char* buffer, unsigned maxSize)
+        : fBuffer(buffer), fMaxSize(maxSize), fSize(0), fOverflow(False) {}
+
+    void u8(unsigned v) {
+        if (!room(1)) return;
+        fBuffer[fSize++] = v;
+    }
+    void u16(unsigned v) {
+        if (!room(2)) return;
+        fBuffer[fSize++] = v >> 8;
+        fBuffer[fSize++] = v;
+    }
+    void u24(u_int32_t v) {
+        if (!room(3)) return;
+        fBuffer[fSize++] = v >> 16;
+        fBuffer[fSize++] = v >> 8;
+        fBuffer[fSize++] = v;
+    }
+    void u32(u_int32_t v) {
+        if (!room(4)) return;
+        fBuffer[fSize++] = v >> 24;
+        fBuffer[fSize++] = v >> 16;
+        fBuffer[fSize++] = v >> 8;
+        fBuffer[fSize++] = v;
+    }
+    void u64(u_int64_t v) {
+        u32((u_int32_t) (v >> 32));
+        u32((u_int32_t) v);
+    }
+    void bytes(unsigned char const* p, unsigned n) {
+        if (!room(n)) return;
+        memcpy(&fBuffer[fSize], p, n);
+        fSize += n;
+    }
+    void zeros(unsigned n) {
+        if (!room(n)) return;
+        memset(&fBuffer[fSize], 0, n);
+        fSize += n;
+    }
+    void fourcc(char const* s) {
+        bytes((unsigned char const*) s, 4);
+    }
+    unsigned begin(char const* type) {
+        unsigned pos = fSize;
+
+        u32(0);
+        fourcc(type);
+        return pos;
+    }
+    unsigned beginFull(char const* type, unsigned version, u_int32_t flags) {
+        unsigned pos = begin(type);
+
+        u8(version);
+        u24(flags);
+        return pos;
+    }
+    void end(unsigned pos) {
+        if (fOverflow) return;
+        patch32(pos, fSize - pos);
+    }
+    void patch32(unsigned pos, u_int32_t v) {
+        if (pos + 4 > fSize) return;
+        fBuffer[pos] = v >> 24;
+        fBuffer[pos + 1] = v >> 16;
+        fBuffer[pos + 2] = v >> 8;
+        fBuffer[pos + 3] = v;
+    }
+    // Identity transformation matrix of mvhd and tkhd
+    void matrix() {
+        u32(0x00010000); u32(0); u32(0);
+        u32(0); u32(0x00010000); u32(0);
+        u32(0); u32(0); u32(0x40000000);
+    }
+
+    unsigned size() const { return fSize; }
+    Boolean overflow() const { return fOverflow; }
+
+private:
+    Boolean room(unsigned n) {
+        if (fSize + n > fMaxSize) fOverflow = True;
+        return !fOverflow;
+    }
+
+private:
+    unsigned char* fBuffer;
+    unsigned fMaxSize;
+    unsigned fSize;
+    Boolean fOverflow;
+};
+
+////////// SPS //////////
+
+class BitReader {
+public:
+    BitReader(unsigned char const* data, unsigned size)
+        : fData(data), fSize(size), fBit(0) {}
+
+    unsigned u(unsigned n) {
+        unsigned v = 0;
+
+        while (n-- > 0) {
+            v <<= 1;
+            if (fBit < fSize * 8) v |= (fData[fBit >> 3] >> (7 - (fBit & 7))) & 1;
+            fBit++;
+        }
+        return v;
+    }
+    unsigned ue() {
+        unsigned zeros = 0;
+
+        while ((u(1) == 0) && (zeros < 32)) zeros++;
+        return ((1U << zeros) - 1) + u(zeros);
+    }
+    int se() {
+        unsigned v = ue();
+        return (v & 1) ? (int) ((v + 1) / 2) : -(int) (v / 2);
+    }
+
+private:
+    unsigned char const* fData;
+    unsigned fSize;
+    unsigned fBit;
+};
+
+// Picture size from the SPS, for the avc1 sample entry
+static Boolean spsPictureSize(unsigned char const* sps, unsigned size,
+                              unsigned& width, unsigned& height) {
+    unsigned char* rbsp;
+    unsigned rbspSize = 0;
+    unsigned i, j;
+    unsigned profile, chromaFormat = 1;
+    unsigned widthMbs, heightMaps, frameMbsOnly;
+    unsigned cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+
+    if (size < 4) return False;
+
+    // Remove the emulation prevention bytes
+    rbsp = new unsigned char[size];
+    for (i = 1; i < size; i++) {
+        if ((i >= 3) && (sps[i] == 3) && (sps[i - 1] == 0) && (sps[i - 2] == 0)) continue;
+        rbsp[rbspSize++] = sps[i];
+    }
+
+    BitReader bits(rbsp, rbspSize);
+    profile = bits.u(8);
+    bits.u(16);
+    bits.ue();
+    if ((profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) ||
+            (profile == 44) || (profile == 83) || (profile == 86) || (profile == 118) ||
+            (profile == 128) || (profile == 138) || (profile == 139) || (profile == 134)) {
+        chromaFormat = bits.ue();
+        if (chromaFormat == 3) bits.u(1);
+        bits.ue();
+        bits.ue();
+        bits.u(1);
+        if (bits.u(1)) {
+            for (i = 0; i < ((chromaFormat != 3) ? 8U : 12U); i++) {
+                if (bits.u(1)) {
+                    int last = 8, next = 8;
+
+                    for (j = 0; j < ((i < 6) ? 16U : 64U); j++) {
+                        if (next != 0) next = (last + bits.se() + 256) % 256;
+                        if (next != 0) last = next;
+                    }
+                }
+            }
+        }
+    }
+    bits.ue();
+    switch (bits.ue()) {
+    case 0:
+        bits.ue();
+        break;
+    case 1:
+        bits.u(1);
+        bits.se();
+        bits.se();
+        for (i = bits.ue(); i > 0; i--) bits.se();
+        break;
+    default:
+        break;
+    }
+    bits.ue();
+    bits.u(1);
+    widthMbs = bits.ue() + 1;
+    heightMaps = bits.ue() + 1;
+    frameMbsOnly = bits.u(1);
+    if (!frameMbsOnly) bits.u(1);
+    bits.u(1);
+    if (bits.u(1)) {
+        cropLeft = bits.ue();
+        cropRight = bits.ue();
+        cropTop = bits.ue();
+        cropBottom = bits.ue();
+    }
+    delete[] rbsp;
+
+    width = widthMbs * 16;
+    height = (2 - frameMbsOnly) * heightMaps * 16;
+    if (chromaFormat == 1) {
+        width -= (cropLeft + cropRight) * 2;
+        height -= (cropTop + cropBottom) * 2 * (2 - frameMbsOnly);
+    }
+
+    return (width > 0) && (width <= 8192) && (height > 0) && (height <= 8192);
+}
+
+static char const* formatTicks(char* s, u_int64_t ticks) {
+    sprintf(s, "%u.%05u", (unsigned) (ticks / HLS_TIMESCALE),
+            (unsigned) ((ticks % HLS_TIMESCALE) * 100000 / HLS_TIMESCALE));
+    return s;
+}
+
+////////// HLSPackager //////////
+
+HLSPackager* HLSPackager::createNew(UsageEnvironment& env, FramedSource* input,
+                                    unsigned frameBufferSize) {
+    if (input == NULL) return NULL;
+
+    return new HLSPackager(env, input, frameBufferSize);
+}
+
+HLSPackager::HLSPackager(UsageEnvironment& env, FramedSource* input, unsigned frameBufferSize)
+    : fEnv(env), fInput(input), fReadTask(NULL),
+      fAUSize(0), fAUKeyframe(False),
+      fSPS(NULL), fSPSSize(0), fPPS(NULL), fPPSSize(0), fParameterSetsChanged(False),
+      fInit(NULL), fInitVersion(0),
+      fMdatSize(0), fNumSamples(0), fLastUs(0), fPartStartTicks(0), fNextTicks(0),
+      fFragmentSequence(1),
+      fStarted(False), fFirstMSN(0), fCurrentMSN(0), fMaxSegmentTicks(0),
+      fNumListeners(0) {
+    fAUMax = NALBufferPool::roundSize(frameBufferSize);
+    fAU = new unsigned char[fAUMax];
+    fMdatMax = fAUMax * 2;
+    fMdat = new unsigned char[fMdatMax];
+    memset(fSegments, 0, sizeof(fSegments));
+}
+
+HLSPackager::~HLSPackager() {
+    unsigned i, j;
+
+    fEnv.taskScheduler().unscheduleDelayedTask(fReadTask);
+    Medium::close(fInput);
+
+    for (i = 0; i < HLS_SEGMENT_SLOTS; i++) {
+        for (j = 0; j < fSegments[i].numParts; j++) fSegments[i].parts[j]->unref();
+        if (fSegments[i].init != NULL) fSegments[i].init->unref();
+    }
+    if (fInit != NULL) fInit->unref();
+    delete[] fAU;
+    delete[] fMdat;
+    delete[] fSPS;
+    delete[] fPPS;
+}
+
+void HLSPackager::start() {
+    readNext1();
+}
+
+////////// Input //////////
+
+void HLSPackager::readNext(void* clientData) {
+    HLSPackager* packager = (HLSPackager*) clientData;
+    packager->fReadTask = NULL;
+    packager->readNext1();
+}
+
+void HLSPackager::readNext1() {
+    if (fAUSize + 4 >= fAUMax) {
+        // Access unit too big, skip it
+        fAUSize = 0;
+        fAUKeyframe = False;
+    }
+    fInput->getNextFrame(&fAU[fAUSize + 4], fAUMax - fAUSize - 4,
+                         afterGettingFrame, this, onInputClosure, this);
+}
+
+void HLSPackager::afterGettingFrame(void* clientData, unsigned frameSize,
+                                    unsigned numTruncatedBytes,
+                                    struct timeval presentationTime,
+                                    unsigned /*durationInMicroseconds*/) {
+    HLSPackager* packager = (HLSPackager*) clientData;
+    packager->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void HLSPackager::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                     struct timeval presentationTime) {
+    unsigned char* nal = &fAU[fAUSize + 4];
+    unsigned nalType;
+
+    if (numTruncatedBytes > 0) {
+        // Grow the buffer for the next access units, this one is lost
+        unsigned newMax = NALBufferPool::roundSize((fAUSize + 4 + frameSize + numTruncatedBytes) * 5 / 4);
+
+        if (newMax > fAUMax) {
+            fEnv << "HLS: frame truncated, buffer increased to " << newMax << " bytes\n";
+            delete[] fAU;
+            fAU = new unsigned char[newMax];
+            fAUMax = newMax;
+        }
+        fAUSize = 0;
+        fAUKeyframe = False;
+        fReadTask = fEnv.taskScheduler().scheduleDelayedTask(0, readNext, this);
+        return;
+    }
+
+    if (frameSize > 0) {
+        nalType = nal[0] & 0x1F;
+        if (nalType == NAL_TYPE_SPS) {
+            if ((fSPS == NULL) || (fSPSSize != frameSize) || (memcmp(fSPS, nal, frameSize) != 0)) {
+                delete[] fSPS;
+                fSPS = new unsigned char[frameSize];
+                memcpy(fSPS, nal, frameSize);
+                fSPSSize = frameSize;
+                fParameterSetsChanged = True;
+            }
+        } else if (nalType == NAL_TYPE_PPS) {
+            if ((fPPS == NULL) || (fPPSSize != frameSize) || (memcmp(fPPS, nal, frameSize) != 0)) {
+                delete[] fPPS;
+                fPPS = new unsigned char[frameSize];
+                memcpy(fPPS, nal, frameSize);
+                fPPSSize = frameSize;
+                fParameterSetsChanged = True;
+            }
+        } else if ((nalType >= 1) && (nalType <= 5)) {
+            // One slice per picture: the slice ends the access unit
+            fAU[fAUSize] = frameSize >> 24;
+            fAU[fAUSize + 1] = frameSize >> 16;
+            fAU[fAUSize + 2] = frameSize >> 8;
+            fAU[fAUSize + 3] = frameSize;
+            fAUSize += 4 + frameSize;
+            if (nalType == NAL_TYPE_IDR) fAUKeyframe = True;
+            addAccessUnit((int64_t) presentationTime.tv_sec * 1000000 + presentationTime.tv_usec,
+                          fAUKeyframe);
+            fAUSize = 0;
+            fAUKeyframe = False;
+        }
+        // SPS/PPS are in the init segment, SEI and AUD are dropped
+    }
+
+    fReadTask = fEnv.taskScheduler().scheduleDelayedTask(0, readNext, this);
+}
+
+void HLSPackager::onInputClosure(void* clientData) {
+    HLSPackager* packager = (HLSPackager*) clientData;
+
+    packager->fEnv << "HLS: input closed\n";
+}
+
+////////// Packaging //////////
+
+void HLSPackager::addAccessUnit(int64_t us, Boolean isKeyframe) {
+    struct segment* seg = &fSegments[fCurrentMSN % HLS_SEGMENT_SLOTS];
+    Boolean flushed = False;
+
+    if (fNumSamples > 0) {
+        // The duration of the previous sample is known now
+        int64_t duration = (us - fLastUs) * 9 / 100;
+
+        if ((duration <= 0) || (duration > HLS_TIMESCALE)) {
+            duration = (fNumSamples > 1) ? fSamples[fNumSamples - 2].duration : HLS_TIMESCALE / 20;
+        }
+        fSamples[fNumSamples - 1].duration = (unsigned) duration;
+        fNextTicks += duration;
+    }
+
+    if (!fStarted) {
+        if (!isKeyframe || (fSPS == NULL) || (fPPS == NULL)) return;
+
+        updateInitSegment();
+        if (fInit == NULL) return;
+        fStarted = True;
+        openSegment(0);
+        seg = &fSegments[0];
+    } else {
+        u_int64_t partTicks = fNextTicks - fPartStartTicks;
+        unsigned lastTicks = (fNumSamples > 0) ? fSamples[fNumSamples - 1].duration : 0;
+        Boolean newSegment = isKeyframe &&
+                             ((seg->durationTicks + partTicks >= HLS_SEGMENT_TARGET_MS * (HLS_TIMESCALE / 1000)) ||
+                              fParameterSetsChanged);
+
+        // Close the part before the next sample makes it longer than
+        // the target; the last part of a segment takes what is left
+        if ((fNumSamples > 0) &&
+                (newSegment || (fNumSamples == HLS_MAX_SAMPLES) ||
+                 ((partTicks + lastTicks > HLS_PART_TARGET_MS * (HLS_TIMESCALE / 1000)) &&
+                  (seg->numParts < HLS_MAX_PARTS - 1)))) {
+            flushPart();
+            flushed = True;
+        }
+
+        if (newSegment) {
+            seg->complete = True;
+            if (seg->durationTicks > fMaxSegmentTicks) fMaxSegmentTicks = seg->durationTicks;
+            if (fParameterSetsChanged) updateInitSegment();
+            openSegment(fCurrentMSN + 1);
+            seg = &fSegments[fCurrentMSN % HLS_SEGMENT_SLOTS];
+        } else if ((seg->numParts == HLS_MAX_PARTS) || (fNumSamples == HLS_MAX_SAMPLES)) {
+            // GOP too long for the segment, skip to the next keyframe
+            if (flushed) notifyListeners();
+            return;
+        }
+    }
+
+    if (fMdatSize + fAUSize > fMdatMax) {
+        unsigned newMax = (fMdatSize + fAUSize) * 3 / 2;
+        unsigned char* mdat = new unsigned char[newMax];
+
+        memcpy(mdat, fMdat, fMdatSize);
+        delete[] fMdat;
+        fMdat = mdat;
+        fMdatMax = newMax;
+    }
+    memcpy(&fMdat[fMdatSize], fAU, fAUSize);
+    fMdatSize += fAUSize;
+    fSamples[fNumSamples].size = fAUSize;
+    fSamples[fNumSamples].duration = 0;
+    fSamples[fNumSamples].keyframe = isKeyframe;
+    fNumSamples++;
+    fLastUs = us;
+
+    if (flushed) notifyListeners();
+}
+
+void HLSPackager::updateInitSegment() {
+    unsigned width, height;
+    unsigned maxSize = 1024 + fSPSSize + fPPSSize;
+    unsigned char* buffer;
+    unsigned moov, trak, mdia, minf, dinf, stbl, stsd, avc1, avcC, mvex, box;
+
+    fParameterSetsChanged = False;
+    if ((fSPS == NULL) || (fPPS == NULL) || !spsPictureSize(fSPS, fSPSSize, width, height)) {
+        fEnv << "HLS: invalid SPS\n";
+        return;
+    }
+
+    buffer = new unsigned char[maxSize];
+    MP4Writer w(buffer, maxSize);
+
+    box = w.begin("ftyp");
+    w.fourcc("iso6");
+    w.u32(1);
+    w.fourcc("iso6");
+    w.fourcc("cmfc");
+    w.fourcc("avc1");
+    w.end(box);
+
+    moov = w.begin("moov");
+    box = w.beginFull("mvhd", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.u32(1000);
+    w.u32(0);
+    w.u32(0x00010000);
+    w.u16(0x0100);
+    w.zeros(10);
+    w.matrix();
+    w.zeros(24);
+    w.u32(2);
+    w.end(box);
+
+    trak = w.begin("trak");
+    box = w.beginFull("tkhd", 0, 3);
+    w.u32(0);
+    w.u32(0);
+    w.u32(1);
+    w.u32(0);
+    w.u32(0);
+    w.zeros(8);
+    w.u16(0);
+    w.u16(0);
+    w.u16(0);
+    w.u16(0);
+    w.matrix();
+    w.u32(width << 16);
+    w.u32(height << 16);
+    w.end(box);
+
+    mdia = w.begin("mdia");
+    box = w.beginFull("mdhd", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.u32(HLS_TIMESCALE);
+    w.u32(0);
+    w.u16(0x55C4);
+    w.u16(0);
+    w.end(box);
+
+    box = w.beginFull("hdlr", 0, 0);
+    w.u32(0);
+    w.fourcc("vide");
+    w.zeros(12);
+    w.bytes((unsigned char const*) "VideoHandler", 13);
+    w.end(box);
+
+    minf = w.begin("minf");
+    box = w.beginFull("vmhd", 0, 1);
+    w.zeros(8);
+    w.end(box);
+
+    dinf = w.begin("dinf");
+    box = w.beginFull("dref", 0, 0);
+    w.u32(1);
+    unsigned url = w.beginFull("url ", 0, 1);
+    w.end(url);
+    w.end(box);
+    w.end(dinf);
+
+    stbl = w.begin("stbl");
+    stsd = w.beginFull("stsd", 0, 0);
+    w.u32(1);
+    avc1 = w.begin("avc1");
+    w.zeros(6);
+    w.u16(1);
+    w.zeros(16);
+    w.u16(width);
+    w.u16(height);
+    w.u32(0x00480000);
+    w.u32(0x00480000);
+    w.u32(0);
+    w.u16(1);
+    w.zeros(32);
+    w.u16(0x0018);
+    w.u16(0xFFFF);
+
+    avcC = w.begin("avcC");
+    w.u8(1);
+    w.u8(fSPS[1]);
+    w.u8(fSPS[2]);
+    w.u8(fSPS[3]);
+    w.u8(0xFF);
+    w.u8(0xE1);
+    w.u16(fSPSSize);
+    w.bytes(fSPS, fSPSSize);
+    w.u8(1);
+    w.u16(fPPSSize);
+    w.bytes(fPPS, fPPSSize);
+    w.end(avcC);
+    w.end(avc1);
+    w.end(stsd);
+
+    // No samples in the moov, they are all in the fragments
+    box = w.beginFull("stts", 0, 0);
+    w.u32(0);
+    w.end(box);
+    box = w.beginFull("stsc", 0, 0);
+    w.u32(0);
+    w.end(box);
+    box = w.beginFull("stsz", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.end(box);
+    box = w.beginFull("stco", 0, 0);
+    w.u32(0);
+    w.end(box);
+    w.end(stbl);
+    w.end(minf);
+    w.end(mdia);
+    w.end(trak);
+
+    mvex = w.begin("mvex");
+    box = w.beginFull("trex", 0, 0);
+    w.u32(1);
+    w.u32(1);
+    w.u32(0);
+    w.u32(0);
+    w.u32(0);
+    w.end(box);
+    w.end(mvex);
+    w.end(moov);
+
+    if (!w.overflow()) {
+        if (fInit != NULL) fInit->unref();
+        fInit = HLSBuffer::createNew(w.size());
+        memcpy(fInit->data(), buffer, w.size());
+        fInitVersion++;
+        fEnv << "HLS: init segment " << fInitVersion << ", " << width << "x" << height << "\n";
+    }
+    delete[] buffer;
+}
+
+void HLSPackager::flushPart() {
+    struct segment* seg = &fSegments[fCurrentMSN % HLS_SEGMENT_SLOTS];
+    unsigned char moofBuffer[256 + 12 * HLS_MAX_SAMPLES];
+    unsigned moof, traf, box, dataOffset;
+    unsigned i;
+    u_int64_t partTicks = 0;
+    HLSBuffer* part;
+
+    MP4Writer w(moofBuffer, sizeof(moofBuffer));
+    moof = w.begin("moof");
+    box = w.beginFull("mfhd", 0, 0);
+    w.u32(fFragmentSequence);
+    w.end(box);
+
+    traf = w.begin("traf");
+    // The data offsets are relative to the moof
+    box = w.beginFull("tfhd", 0, 0x020000);
+    w.u32(1);
+    w.end(box);
+    box = w.beginFull("tfdt", 1, 0);
+    w.u64(fPartStartTicks);
+    w.end(box);
+
+    // Data offset, duration, size and flags of every sample
+    box = w.beginFull("trun", 0, 0x000701);
+    w.u32(fNumSamples);
+    dataOffset = w.size();
+    w.u32(0);
+    for (i = 0; i < fNumSamples; i++) {
+        w.u32(fSamples[i].duration);
+        w.u32(fSamples[i].size);
+        w.u32(fSamples[i].keyframe ? SAMPLE_FLAGS_KEY : SAMPLE_FLAGS_NON_KEY);
+        partTicks += fSamples[i].duration;
+    }
+    w.end(box);
+    w.end(traf);
+    w.end(moof);
+    w.patch32(dataOffset, w.size() + 8);
+
+    part = HLSBuffer::createNew(w.size() + 8 + fMdatSize);
+    memcpy(part->data(), moofBuffer, w.size());
+    MP4Writer mdat(part->data() + w.size(), 8);
+    mdat.u32(8 + fMdatSize);
+    mdat.fourcc("mdat");
+    memcpy(part->data() + w.size() + 8, fMdat, fMdatSize);
+
+    seg->parts[seg->numParts] = part;
+    seg->partTicks[seg->numParts] = (unsigned) partTicks;
+    seg->partIndependent[seg->numParts] = fSamples[0].keyframe;
+    seg->numParts++;
+    seg->durationTicks += partTicks;
+
+    fPartStartTicks = fNextTicks;
+    fFragmentSequence++;
+    fNumSamples = 0;
+    fMdatSize = 0;
+}
+
+void HLSPackager::openSegment(unsigned msn) {
+    struct segment* seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+    unsigned i;
+
+    // The oldest segment leaves the window, the connections still
+    // sending it keep their references
+    for (i = 0; i < seg->numParts; i++) seg->parts[i]->unref();
+    if (seg->init != NULL) seg->init->unref();
+    memset(seg, 0, sizeof(struct segment));
+    seg->msn = msn;
+    seg->initVersion = fInitVersion;
+    seg->init = fInit;
+    fInit->ref();
+
+    fCurrentMSN = msn;
+    if (msn >= HLS_SEGMENT_SLOTS) fFirstMSN = msn - HLS_SEGMENT_SLOTS + 1;
+}
+
+////////// Access //////////
+
+int HLSPackager::state(unsigned msn, int part) const {
+    struct segment const* seg;
+
+    if (!fStarted) return (msn <= 1) ? HLS_PENDING : HLS_GONE;
+    if (msn < fFirstMSN) return HLS_GONE;
+    if (msn > fCurrentMSN) return (msn <= fCurrentMSN + 2) ? HLS_PENDING : HLS_GONE;
+
+    seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+    if (part < 0) return seg->complete ? HLS_AVAILABLE : HLS_PENDING;
+    if ((unsigned) part < seg->numParts) return HLS_AVAILABLE;
+    return seg->complete ? HLS_GONE : HLS_PENDING;
+}
+
+HLSBuffer* HLSPackager::initSegment(unsigned version) {
+    struct segment* seg;
+    unsigned msn;
+
+    if (!fStarted) return NULL;
+
+    // The playlist may still list a segment of a previous version
+    for (msn = fFirstMSN; msn <= fCurrentMSN; msn++) {
+        seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+        if (seg->initVersion == version) {
+            seg->init->ref();
+            return seg->init;
+        }
+    }
+    return NULL;
+}
+
+HLSBuffer* HLSPackager::part(unsigned msn, unsigned part) {
+    struct segment* seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+
+    if (state(msn, part) != HLS_AVAILABLE) return NULL;
+
+    seg->parts[part]->ref();
+    return seg->parts[part];
+}
+
+unsigned HLSPackager::segment(unsigned msn, HLSBuffer** parts, unsigned maxParts) {
+    struct segment* seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+    unsigned i;
+
+    if ((state(msn, -1) != HLS_AVAILABLE) || (seg->numParts > maxParts)) return 0;
+
+    for (i = 0; i < seg->numParts; i++) {
+        seg->parts[i]->ref();
+        parts[i] = seg->parts[i];
+    }
+    return seg->numParts;
+}
+
+HLSBuffer* HLSPackager::playlist() {
+    char* text;
+    unsigned size = 0;
+    unsigned first, msn, i;
+    unsigned lastVersion = 0;
+    unsigned targetDuration;
+    struct segment* seg;
+    char duration[16];
+    HLSBuffer* buffer;
+
+    if (!fStarted) return NULL;
+
+    first = (fCurrentMSN > HLS_PLAYLIST_SEGMENTS) ? fCurrentMSN - HLS_PLAYLIST_SEGMENTS : 0;
+    if (first < fFirstMSN) first = fFirstMSN;
+    targetDuration = (unsigned) ((fMaxSegmentTicks + HLS_TIMESCALE - 1) / HLS_TIMESCALE);
+    if (targetDuration < (HLS_SEGMENT_TARGET_MS + 999) / 1000) targetDuration = (HLS_SEGMENT_TARGET_MS + 999) / 1000;
+
+    text = new char[PLAYLIST_MAX_SIZE];
+    size += sprintf(&text[size], "#EXTM3U\n#EXT-X-VERSION:6\n#EXT-X-TARGETDURATION:%u\n", targetDuration);
+    size += sprintf(&text[size], "#EXT-X-PART-INF:PART-TARGET=%u.%03u\n",
+                    HLS_PART_TARGET_MS / 1000, HLS_PART_TARGET_MS % 1000);
+    size += sprintf(&text[size], "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%u.%03u\n",
+                    3 * HLS_PART_TARGET_MS / 1000, 3 * HLS_PART_TARGET_MS % 1000);
+    size += sprintf(&text[size], "#EXT-X-MEDIA-SEQUENCE:%u\n", first);
+
+    for (msn = first; msn <= fCurrentMSN; msn++) {
+        seg = &fSegments[msn % HLS_SEGMENT_SLOTS];
+        if (seg->initVersion != lastVersion) {
+            size += sprintf(&text[size], "#EXT-X-MAP:URI=\"init-%u.mp4\"\n", seg->initVersion);
+            lastVersion = seg->initVersion;
+        }
+
+        // Parts only for the last segments
+        if (msn + HLS_PART_SEGMENTS >= fCurrentMSN) {
+            for (i = 0; i < seg->numParts; i++) {
+                size += sprintf(&text[size], "#EXT-X-PART:DURATION=%s,URI=\"part-%u.%u.m4s\"%s\n",
+                                formatTicks(duration, seg->partTicks[i]), msn, i,
+                                seg->partIndependent[i] ? ",INDEPENDENT=YES" : "");
+            }
+        }
+        if (seg->complete) {
+            size += sprintf(&text[size], "#EXTINF:%s,\nseg-%u.m4s\n",
+                            formatTicks(duration, seg->durationTicks), msn);
+        } else {
+            size += sprintf(&text[size], "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part-%u.%u.m4s\"\n",
+                            msn, seg->numParts);
+        }
+    }
+
+    buffer = HLSBuffer::createNew(size);
+    memcpy(buffer->data(), text, size);
+    delete[] text;
+
+    return buffer;
+}
+
+////////// Listeners //////////
+
+Boolean HLSPackager::addListener(TaskFunc* func, void* clientData) {
+    if (fNumListeners >= HLS_MAX_LISTENERS) return False;
+
+    fListeners[fNumListeners].func = func;
+    fListeners[fNumListeners].clientData = clientData;
+    fNumListeners++;
+    return True;
+}
+
+void HLSPackager::removeListener(void* clientData) {
+    unsigned i;
+
+    for (i = 0; i < fNumListeners; i++) {
+        if (fListeners[i].clientData == clientData) {
+            fListeners[i] = fListeners[--fNumListeners];
+            return;
+        }
+    }
+}
+
+void HLSPackager::notifyListeners() {
+    unsigned i;
+
+    for (i = 0; i < fNumListeners; i++) {
+        (*fListeners[i].func)(fListeners[i].clientData);
+    }
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Low latency HLS packager: the access units of a live input are put
+ * in fragmented MP4 (CMAF) parts and segments in memory, without
+ * re-encoding.
+ * A part is one moof/mdat fragment, a segment is the sequence of its
+ * parts and always starts with a keyframe. Only the last segments are
+ * kept.
+ * The parts are reference counted buffers: an HTTP connection sending
+ * a part keeps it alive after the packager has dropped it, so memory
+ * is bounded by the window plus what is being sent. Each segment
+ * references its init segment too, an older one stays available while
+ * a segment of the window needs it.
+ */
+
+#ifndef _HLS_PACKAGER_HH
+#define _HLS_PACKAGER_HH
+
+#include "liveMedia.hh"
+
+#define HLS_PART_TARGET_MS      500
+#define HLS_SEGMENT_TARGET_MS   2000
+#define HLS_SEGMENT_SLOTS       7
+#define HLS_PLAYLIST_SEGMENTS   5
+#define HLS_PART_SEGMENTS       3
+#define HLS_MAX_PARTS           32
+#define HLS_MAX_SAMPLES         128
+#define HLS_MAX_LISTENERS       4
+#define HLS_TIMESCALE           90000
+
+#define HLS_AVAILABLE 0
+#define HLS_PENDING   1
+#define HLS_GONE      2
+
+class HLSBuffer {
+public:
+    // The buffer starts with one reference
+    static HLSBuffer* createNew(unsigned size);
+
+    void ref() { fRefCount++; }
+    void unref();
+
+    unsigned char* data() { return fData; }
+    unsigned size() const { return fSize; }
+
+private:
+    HLSBuffer(unsigned size);
+    ~HLSBuffer();
+
+private:
+    unsigned fRefCount;
+    unsigned char* fData;
+    unsigned fSize;
+};
+
+class HLSPackager {
+public:
+    static HLSPackager* createNew(UsageEnvironment& env, FramedSource* input,
+                                  unsigned frameBufferSize);
+
+    void start();
+
+    // The media playlist, NULL before the first segment. unref() it.
+    HLSBuffer* playlist();
+
+    // HLS_AVAILABLE, HLS_PENDING or HLS_GONE. part -1 is the whole segment.
+    int state(unsigned msn, int part) const;
+
+    // The buffers are referenced, unref() them. NULL if not available,
+    // an init segment is while a segment of the window refers to it.
+    HLSBuffer* initSegment(unsigned version);
+    HLSBuffer* part(unsigned msn, unsigned part);
+    // The parts of a complete segment, 0 if not available
+    unsigned segment(unsigned msn, HLSBuffer** parts, unsigned maxParts);
+
+    // Called every time a part is completed
+    Boolean addListener(TaskFunc* func, void* clientData);
+    void removeListener(void* clientData);
+
+protected:
+    HLSPackager(UsageEnvironment& env, FramedSource* input, unsigned frameBufferSize);
+    virtual ~HLSPackager();
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    static void onInputClosure(void* clientData);
+    static void readNext(void* clientData);
+    void readNext1();
+
+    void addAccessUnit(int64_t us, Boolean isKeyframe);
+    void updateInitSegment();
+    void flushPart();
+    void openSegment(unsigned msn);
+    void notifyListeners();
+
+private:
+    UsageEnvironment& fEnv;
+    FramedSource* fInput;
+    TaskToken fReadTask;
+
+    // Access unit being read: NAL units with a 4 bytes length each
+    unsigned char* fAU;
+    unsigned fAUMax;
+    unsigned fAUSize;
+    Boolean fAUKeyframe;
+    unsigned char* fSPS;
+    unsigned fSPSSize;
+    unsigned char* fPPS;
+    unsigned fPPSSize;
+    Boolean fParameterSetsChanged;
+
+    // Current init segment
+    HLSBuffer* fInit;
+    unsigned fInitVersion;
+
+    // Part being built: the samples, their data and their duration
+    unsigned char* fMdat;
+    unsigned fMdatMax;
+    unsigned fMdatSize;
+    struct sample {
+        unsigned size;
+        unsigned duration;
+        Boolean keyframe;
+    } fSamples[HLS_MAX_SAMPLES];
+    unsigned fNumSamples;
+    int64_t fLastUs;
+    u_int64_t fPartStartTicks;
+    u_int64_t fNextTicks;
+    unsigned fFragmentSequence;
+
+    struct segment {
+        unsigned msn;
+        unsigned initVersion;
+        HLSBuffer* init;
+        Boolean complete;
+        u_int64_t durationTicks;
+        unsigned numParts;
+        HLSBuffer* parts[HLS_MAX_PARTS];
+        unsigned partTicks[HLS_MAX_PARTS];
+        Boolean partIndependent[HLS_MAX_PARTS];
+    } fSegments[HLS_SEGMENT_SLOTS];
+    Boolean fStarted;
+    unsigned fFirstMSN;
+    unsigned fCurrentMSN;
+    u_int64_t fMaxSegmentTicks;
+
+    struct listener {
+        TaskFunc* func;
+        void* clientData;
+    } fListeners[HLS_MAX_LISTENERS];
+    unsigned fNumListeners;
+};
+
+#endif
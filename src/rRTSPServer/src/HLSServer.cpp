@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * HTTP server for the low latency HLS streams.
+ */
+
+#include "HLSServer.hh"
+#include "GroupsockHelper.hh"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ctype.h>
+
+HLSServer* HLSServer::createNew(UsageEnvironment& env, Port port) {
+    int ourSocket = setupStreamSocket(env, port);
+
+    if (ourSocket < 0) return NULL;
+    if (listen(ourSocket, 20) < 0) {
+        env << "HLS: listen() failed\n";
+        close(ourSocket);
+        return NULL;
+    }
+
+    return new HLSServer(env, ourSocket);
+}
+
+HLSServer::HLSServer(UsageEnvironment& env, int ourSocket)
+    : fEnv(env), fSocket(ourSocket), fNumStreams(0) {
+    memset(fConnections, 0, sizeof(fConnections));
+    fEnv.taskScheduler().turnOnBackgroundReadHandling(fSocket, incomingConnectionHandler, this);
+}
+
+HLSServer::~HLSServer() {
+    unsigned i;
+
+    fEnv.taskScheduler().turnOffBackgroundReadHandling(fSocket);
+    close(fSocket);
+    for (i = 0; i < HLS_MAX_CONNECTIONS; i++) delete fConnections[i];
+    for (i = 0; i < fNumStreams; i++) fStreams[i].packager->removeListener(this);
+}
+
+Boolean HLSServer::addStream(char const* name, HLSPackager* packager) {
+    if ((fNumStreams >= HLS_MAX_STREAMS) || (strlen(name) >= sizeof(fStreams[0].name))) return False;
+    if (!packager->addListener(packagerUpdated, this)) return False;
+
+    strcpy(fStreams[fNumStreams].name, name);
+    fStreams[fNumStreams].packager = packager;
+    fNumStreams++;
+    return True;
+}
+
+HLSPackager* HLSServer::lookup(char const* name) const {
+    unsigned i;
+
+    for (i = 0; i < fNumStreams; i++) {
+        if (strcmp(fStreams[i].name, name) == 0) return fStreams[i].packager;
+    }
+    return NULL;
+}
+
+void HLSServer::incomingConnectionHandler(void* clientData, int /*mask*/) {
+    HLSServer* server = (HLSServer*) clientData;
+    server->incomingConnectionHandler1();
+}
+
+void HLSServer::incomingConnectionHandler1() {
+    int sock;
+    unsigned i;
+
+    sock = accept(fSocket, NULL, NULL);
+    if (sock < 0) return;
+
+    for (i = 0; i < HLS_MAX_CONNECTIONS; i++) {
+        if (fConnections[i] == NULL) break;
+    }
+    if (i == HLS_MAX_CONNECTIONS) {
+        // Too many clients
+        close(sock);
+        return;
+    }
+
+    makeSocketNonBlocking(sock);
+    fConnections[i] = new HLSConnection(*this, sock);
+}
+
+void HLSServer::closeConnection(HLSConnection* connection) {
+    unsigned i;
+
+    for (i = 0; i < HLS_MAX_CONNECTIONS; i++) {
+        if (fConnections[i] == connection) fConnections[i] = NULL;
+    }
+    delete connection;
+}
+
+void HLSServer::packagerUpdated(void* clientData) {
+    HLSServer* server = (HLSServer*) clientData;
+    unsigned i;
+
+    for (i = 0; i < HLS_MAX_CONNECTIONS; i++) {
+        if (server->fConnections[i] != NULL) server->fConnections[i]->checkHeld();
+    }
+}
+
+////////// HLSConnection //////////
+
+HLSServer::HLSConnection::HLSConnection(HLSServer& server, int socket)
+    : fServer(server), fSocket(socket), fRequestSize(0), fRequestEnd(0), fKeepAlive(True),
+      fPackager(NULL), fHeld(False), fHoldTask(NULL),
+      fHeaderSize(0), fHeaderSent(0), fNumBuffers(0), fBufferIndex(0), fBufferOffset(0),
+      fSending(False) {
+    fPath[0] = '\0';
+    updateHandling();
+}
+
+HLSServer::HLSConnection::~HLSConnection() {
+    unsigned i;
+
+    fServer.fEnv.taskScheduler().unscheduleDelayedTask(fHoldTask);
+    fServer.fEnv.taskScheduler().disableBackgroundHandling(fSocket);
+    close(fSocket);
+    for (i = 0; i < fNumBuffers; i++) fBuffers[i]->unref();
+}
+
+void HLSServer::HLSConnection::updateHandling() {
+    int conditions = 0;
+
+    // No reading while a response is sent, nor while one is held with
+    // the buffer full: the pipelined requests would stay readable and
+    // the loop would spin. responseDone() turns it back on.
+    if (fSending) {
+        conditions = SOCKET_WRITABLE;
+    } else if (!fHeld || (fRequestSize < sizeof(fRequest) - 1)) {
+        conditions = SOCKET_READABLE;
+    }
+    fServer.fEnv.taskScheduler().setBackgroundHandling(fSocket, conditions, socketHandler, this);
+}
+
+void HLSServer::HLSConnection::socketHandler(void* clientData, int mask) {
+    HLSConnection* connection = (HLSConnection*) clientData;
+
+    // Both handlers can delete the connection
+    if (mask & SOCKET_WRITABLE) {
+        connection->handleWritable();
+    } else if (mask & SOCKET_READABLE) {
+        connection->handleReadable();
+    }
+}
+
+void HLSServer::HLSConnection::handleReadable() {
+    char discard[256];
+    int n;
+
+    if (fRequestSize < sizeof(fRequest) - 1) {
+        n = recv(fSocket, &fRequest[fRequestSize], sizeof(fRequest) - 1 - fRequestSize, 0);
+    } else {
+        // The buffer is full without a request in it, unless the client
+        // went away
+        n = recv(fSocket, discard, sizeof(discard), MSG_PEEK);
+        if (n > 0) {
+            fKeepAlive = False;
+            sendStatus(400, "Bad Request");
+            return;
+        }
+    }
+    if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) return;
+    if (n <= 0) {
+        fServer.closeConnection(this);
+        return;
+    }
+    fRequestSize += n;
+    fRequest[fRequestSize] = '\0';
+
+    if (!fHeld) {
+        processRequest();
+    } else if (fRequestSize >= sizeof(fRequest) - 1) {
+        updateHandling();
+    }
+}
+
+void HLSServer::HLSConnection::processRequest() {
+    char* end;
+    char method[8];
+    char version[16];
+    char lower[HLS_REQUEST_SIZE];
+    unsigned i;
+
+    end = strstr(fRequest, "\r\n\r\n");
+    if (end == NULL) {
+        if (fRequestSize >= sizeof(fRequest) - 1) {
+            fKeepAlive = False;
+            fRequestEnd = fRequestSize;
+            sendStatus(400, "Bad Request");
+        }
+        return;
+    }
+    fRequestEnd = end + 4 - fRequest;
+
+    for (i = 0; i < fRequestEnd; i++) lower[i] = tolower(fRequest[i]);
+    lower[fRequestEnd] = '\0';
+
+    if (sscanf(fRequest, "%7s %127s %15s", method, fPath, version) != 3) {
+        fKeepAlive = False;
+        sendStatus(400, "Bad Request");
+        return;
+    }
+    if (strcmp(version, "HTTP/1.0") == 0) {
+        fKeepAlive = strstr(lower, "\r\nconnection: keep-alive") != NULL;
+    } else {
+        fKeepAlive = strstr(lower, "\r\nconnection: close") == NULL;
+    }
+    if (strcmp(method, "GET") != 0) {
+        sendStatus(405, "Method Not Allowed");
+        return;
+    }
+
+    if (!respond(False)) {
+        fHeld = True;
+        fHoldTask = fServer.fEnv.taskScheduler().scheduleDelayedTask(HLS_HOLD_TIMEOUT_US, holdTimeout, this);
+        updateHandling();
+    }
+}
+
+void HLSServer::HLSConnection::checkHeld() {
+    if (!fHeld) return;
+
+    if (respond(False)) {
+        fServer.fEnv.taskScheduler().unscheduleDelayedTask(fHoldTask);
+        fHeld = False;
+    }
+}
+
+void HLSServer::HLSConnection::holdTimeout(void* clientData) {
+    HLSConnection* connection = (HLSConnection*) clientData;
+
+    connection->fHoldTask = NULL;
+    connection->fHeld = False;
+    connection->respond(True);
+}
+
+Boolean HLSServer::HLSConnection::respond(Boolean timedOut) {
+    char name[32];
+    char const* file;
+    char const* query;
+    unsigned nameSize;
+    unsigned msn, part, version;
+    int state;
+    HLSBuffer* buffers[HLS_MAX_PARTS];
+    unsigned numBuffers;
+
+    // /NAME/FILE[?QUERY]
+    file = (fPath[0] == '/') ? strchr(&fPath[1], '/') : NULL;
+    if (file == NULL) {
+        sendStatus(404, "Not Found");
+        return True;
+    }
+    nameSize = file - &fPath[1];
+    if (nameSize >= sizeof(name)) {
+        sendStatus(404, "Not Found");
+        return True;
+    }
+    memcpy(name, &fPath[1], nameSize);
+    name[nameSize] = '\0';
+    file++;
+    query = strchr(file, '?');
+
+    fPackager = fServer.lookup(name);
+    if (fPackager == NULL) {
+        sendStatus(404, "Not Found");
+        return True;
+    }
+
+    if (strncmp(file, "index.m3u8", 10) == 0) {
+        // Blocking reload: wait for the segment or the part the client
+        // asks for
+        if ((query != NULL) && (strstr(query, "_HLS_msn=") != NULL) &&
+                (sscanf(strstr(query, "_HLS_msn=") + 9, "%u", &msn) == 1)) {
+            int partIndex = -1;
+
+            if ((strstr(query, "_HLS_part=") != NULL) &&
+                    (sscanf(strstr(query, "_HLS_part=") + 10, "%u", &part) == 1)) {
+                partIndex = part;
+            }
+            state = fPackager->state(msn, partIndex);
+            if (state == HLS_PENDING) {
+                if (!timedOut) return False;
+                sendStatus(503, "Service Unavailable");
+                return True;
+            }
+        }
+
+        buffers[0] = fPackager->playlist();
+        if (buffers[0] == NULL) {
+            // No segment yet
+            if (!timedOut) return False;
+            sendStatus(503, "Service Unavailable");
+            return True;
+        }
+        sendBuffers("application/vnd.apple.mpegurl", "no-cache", buffers, 1);
+    } else if (sscanf(file, "init-%u.mp4", &version) == 1) {
+        buffers[0] = fPackager->initSegment(version);
+        if (buffers[0] == NULL) {
+            sendStatus(404, "Not Found");
+            return True;
+        }
+        sendBuffers("video/mp4", "max-age=3600", buffers, 1);
+    } else if (sscanf(file, "part-%u.%u.m4s", &msn, &part) == 2) {
+        state = fPackager->state(msn, part);
+        if ((state == HLS_PENDING) && !timedOut) return False;
+        buffers[0] = (state == HLS_AVAILABLE) ? fPackager->part(msn, part) : NULL;
+        if (buffers[0] == NULL) {
+            sendStatus(404, "Not Found");
+            return True;
+        }
+        sendBuffers("video/iso.segment", "max-age=60", buffers, 1);
+    } else if (sscanf(file, "seg-%u.m4s", &msn) == 1) {
+        state = fPackager->state(msn, -1);
+        if ((state == HLS_PENDING) && !timedOut) return False;
+        numBuffers = (state == HLS_AVAILABLE) ? fPackager->segment(msn, buffers, HLS_MAX_PARTS) : 0;
+        if (numBuffers == 0) {
+            sendStatus(404, "Not Found");
+            return True;
+        }
+        sendBuffers("video/iso.segment", "max-age=60", buffers, numBuffers);
+    } else {
+        sendStatus(404, "Not Found");
+    }
+
+    return True;
+}
+
+void HLSServer::HLSConnection::sendStatus(unsigned code, char const* reason) {
+    fHeaderSize = snprintf(fHeader, sizeof(fHeader),
+                           "HTTP/1.1 %u %s\r\n"
+                           "Content-Length: 0\r\n"
+                           "Access-Control-Allow-Origin: *\r\n"
+                           "Connection: %s\r\n\r\n",
+                           code, reason, fKeepAlive ? "keep-alive" : "close");
+    fHeaderSent = 0;
+    fNumBuffers = 0;
+    fSending = True;
+    updateHandling();
+}
+
+void HLSServer::HLSConnection::sendBuffers(char const* contentType, char const* cacheControl,
+                                           HLSBuffer** buffers, unsigned numBuffers) {
+    unsigned contentLength = 0;
+    unsigned i;
+
+    // The buffers are already referenced
+    for (i = 0; i < numBuffers; i++) {
+        fBuffers[i] = buffers[i];
+        contentLength += buffers[i]->size();
+    }
+    fNumBuffers = numBuffers;
+    fBufferIndex = 0;
+    fBufferOffset = 0;
+
+    fHeaderSize = snprintf(fHeader, sizeof(fHeader),
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Length: %u\r\n"
+                           "Cache-Control: %s\r\n"
+                           "Access-Control-Allow-Origin: *\r\n"
+                           "Connection: %s\r\n\r\n",
+                           contentType, contentLength, cacheControl,
+                           fKeepAlive ? "keep-alive" : "close");
+    fHeaderSent = 0;
+    fSending = True;
+    updateHandling();
+}
+
+void HLSServer::HLSConnection::handleWritable() {
+    int n;
+
+    while (1) {
+        if (fHeaderSent < fHeaderSize) {
+            n = send(fSocket, &fHeader[fHeaderSent], fHeaderSize - fHeaderSent, MSG_NOSIGNAL);
+            if (n > 0) fHeaderSent += n;
+        } else if (fBufferIndex < fNumBuffers) {
+            HLSBuffer* buffer = fBuffers[fBufferIndex];
+
+            if (fBufferOffset >= buffer->size()) {
+                fBufferIndex++;
+                fBufferOffset = 0;
+                continue;
+            }
+            n = send(fSocket, buffer->data() + fBufferOffset, buffer->size() - fBufferOffset, MSG_NOSIGNAL);
+            if (n > 0) {
+                fBufferOffset += n;
+                if (fBufferOffset == buffer->size()) {
+                    fBufferIndex++;
+                    fBufferOffset = 0;
+                }
+            }
+        } else {
+            responseDone();
+            return;
+        }
+
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return;
+            fServer.closeConnection(this);
+            return;
+        }
+    }
+}
+
+void HLSServer::HLSConnection::responseDone() {
+    unsigned i;
+
+    for (i = 0; i < fNumBuffers; i++) fBuffers[i]->unref();
+    fNumBuffers = 0;
+    fSending = False;
+
+    if (!fKeepAlive) {
+        fServer.closeConnection(this);
+        return;
+    }
+
+    // Next pipelined request, if any
+    memmove(fRequest, &fRequest[fRequestEnd], fRequestSize - fRequestEnd);
+    fRequestSize -= fRequestEnd;
+    fRequest[fRequestSize] = '\0';
+    fRequestEnd = 0;
+    updateHandling();
+    if (fRequestSize > 0) processRequest();
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Minimal HTTP/1.1 server for the low latency HLS streams, on the
+ * live555 event loop.
+ * For every stream NAME it serves /NAME/index.m3u8 and the init
+ * segments, segments and parts the playlist refers to. Blocking
+ * playlist reloads (_HLS_msn, _HLS_part) and requests for a part not
+ * yet completed are held until the packager has it.
+ */
+
+#ifndef _HLS_SERVER_HH
+#define _HLS_SERVER_HH
+
+#include "HLSPackager.hh"
+
+#define HLS_MAX_STREAMS       4
+#define HLS_MAX_CONNECTIONS   16
+#define HLS_REQUEST_SIZE      2048
+#define HLS_HOLD_TIMEOUT_US   (3LL * HLS_SEGMENT_TARGET_MS * 1000)
+
+class HLSServer {
+public:
+    static HLSServer* createNew(UsageEnvironment& env, Port port);
+
+    Boolean addStream(char const* name, HLSPackager* packager);
+
+protected:
+    HLSServer(UsageEnvironment& env, int ourSocket);
+    virtual ~HLSServer();
+
+private:
+    class HLSConnection {
+    public:
+        HLSConnection(HLSServer& server, int socket);
+        ~HLSConnection();
+
+        // Answers a held request if the packager has what it waits for
+        void checkHeld();
+
+    private:
+        static void socketHandler(void* clientData, int mask);
+        void handleReadable();
+        void handleWritable();
+        void updateHandling();
+        void processRequest();
+        // Returns False if the request must be held
+        Boolean respond(Boolean timedOut);
+        void sendStatus(unsigned code, char const* reason);
+        void sendBuffers(char const* contentType, char const* cacheControl,
+                         HLSBuffer** buffers, unsigned numBuffers);
+        void responseDone();
+        static void holdTimeout(void* clientData);
+
+    private:
+        HLSServer& fServer;
+        int fSocket;
+        char fRequest[HLS_REQUEST_SIZE];
+        unsigned fRequestSize;
+        unsigned fRequestEnd;
+        Boolean fKeepAlive;
+
+        // Request being answered or held
+        HLSPackager* fPackager;
+        char fPath[128];
+        Boolean fHeld;
+        TaskToken fHoldTask;
+
+        // Response being sent
+        char fHeader[384];
+        unsigned fHeaderSize;
+        unsigned fHeaderSent;
+        HLSBuffer* fBuffers[HLS_MAX_PARTS];
+        unsigned fNumBuffers;
+        unsigned fBufferIndex;
+        unsigned fBufferOffset;
+        Boolean fSending;
+    };
+
+    static void incomingConnectionHandler(void* clientData, int mask);
+    void incomingConnectionHandler1();
+    static void packagerUpdated(void* clientData);
+    void closeConnection(HLSConnection* connection);
+    HLSPackager* lookup(char const* name) const;
+
+private:
+    UsageEnvironment& fEnv;
+    int fSocket;
+
+    struct stream {
+        char name[32];
+        HLSPackager* packager;
+    } fStreams[HLS_MAX_STREAMS];
+    unsigned fNumStreams;
+
+    HLSConnection* fConnections[HLS_MAX_CONNECTIONS];
+};
+
+#endif
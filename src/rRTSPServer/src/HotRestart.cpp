@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Hot restart with listening socket handoff.
+ */
+
+#include "HotRestart.hh"
+#include "GroupsockHelper.hh"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define DRAIN_CHECK_US 500000
+
+static Boolean setUnixAddress(struct sockaddr_un* addr, char const* path) {
+    if (strlen(path) >= sizeof(addr->sun_path)) return False;
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return True;
+}
+
+int HotRestart::takeOver(char const* path, unsigned drainSeconds) {
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char cmsgBuffer[CMSG_SPACE(sizeof(int))];
+    char byte;
+    int sock;
+    int fd = -1;
+    fd_set readSet;
+    struct timeval timeout;
+
+    if (!setUnixAddress(&addr, path)) return -1;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        // Nobody to take over
+        close(sock);
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgBuffer;
+    msg.msg_controllen = sizeof(cmsgBuffer);
+
+    if (recvmsg(sock, &msg, 0) == 1) {
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if (fd < 0) {
+        close(sock);
+        return -1;
+    }
+    fprintf(stderr, "Listening socket taken over, waiting for the old server to exit\n");
+
+    // The old server closes the connection when it exits
+    timeout.tv_sec = drainSeconds + 5;
+    timeout.tv_usec = 0;
+    while (1) {
+        FD_ZERO(&readSet);
+        FD_SET(sock, &readSet);
+        if (select(sock + 1, &readSet, NULL, NULL, &timeout) <= 0) {
+            fprintf(stderr, "The old server didn't exit in time\n");
+            break;
+        }
+        if (read(sock, &byte, 1) <= 0) break;
+    }
+    close(sock);
+
+    return fd;
+}
+
+HotRestart* HotRestart::createNew(UsageEnvironment& env, char const* path,
+                                  AdmissionRTSPServer* server, unsigned drainSeconds) {
+    struct sockaddr_un addr;
+    int sock;
+
+    if (!setUnixAddress(&addr, path)) return NULL;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return NULL;
+
+    // The previous server, if any, has already exited
+    unlink(path);
+    if ((bind(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) || (listen(sock, 1) < 0)) {
+        env << "Failed to listen on " << path << " for hot restarts\n";
+        close(sock);
+        return NULL;
+    }
+
+    return new HotRestart(env, sock, server, drainSeconds);
+}
+
+HotRestart::HotRestart(UsageEnvironment& env, int listenSocket, AdmissionRTSPServer* server,
+                       unsigned drainSeconds)
+    : fEnv(env), fListenSocket(listenSocket), fSuccessorSocket(-1),
+      fServer(server), fDrainSeconds(drainSeconds) {
+    fEnv.taskScheduler().turnOnBackgroundReadHandling(fListenSocket, incomingHandler, this);
+}
+
+HotRestart::~HotRestart() {
+    if (fListenSocket >= 0) {
+        fEnv.taskScheduler().turnOffBackgroundReadHandling(fListenSocket);
+        close(fListenSocket);
+    }
+    if (fSuccessorSocket >= 0) close(fSuccessorSocket);
+}
+
+void HotRestart::incomingHandler(void* clientData, int /*mask*/) {
+    HotRestart* hotRestart = (HotRestart*) clientData;
+    hotRestart->incomingHandler1();
+}
+
+void HotRestart::incomingHandler1() {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char cmsgBuffer[CMSG_SPACE(sizeof(int))];
+    char byte = 0;
+    int fd = fServer->serverSocket();
+
+    fSuccessorSocket = accept(fListenSocket, NULL, NULL);
+    if (fSuccessorSocket < 0) return;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cmsgBuffer, 0, sizeof(cmsgBuffer));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgBuffer;
+    msg.msg_controllen = sizeof(cmsgBuffer);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (sendmsg(fSuccessorSocket, &msg, 0) != 1) {
+        fEnv << "Hot restart: failed to send the listening socket\n";
+        close(fSuccessorSocket);
+        fSuccessorSocket = -1;
+        return;
+    }
+
+    // From now on the new process accepts the connections
+    fEnv << "Hot restart: listening socket handed over, draining the sessions\n";
+    fServer->stopAccepting();
+    fEnv.taskScheduler().turnOffBackgroundReadHandling(fListenSocket);
+    close(fListenSocket);
+    fListenSocket = -1;
+
+    gettimeofday(&fDrainStart, NULL);
+    drainCheck1();
+}
+
+void HotRestart::drainCheck(void* clientData) {
+    HotRestart* hotRestart = (HotRestart*) clientData;
+    hotRestart->drainCheck1();
+}
+
+void HotRestart::drainCheck1() {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    if ((fServer->numClientSessions() == 0) ||
+            ((unsigned) (now.tv_sec - fDrainStart.tv_sec) >= fDrainSeconds)) {
+        // Exiting closes the fifos and the connection to the new process,
+        // which then starts serving
+        fEnv << "Hot restart: exiting\n";
+        exit(0);
+    }
+
+    fEnv.taskScheduler().scheduleDelayedTask(DRAIN_CHECK_US, drainCheck, this);
+}
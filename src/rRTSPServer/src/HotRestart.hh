@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Hot restart: a new rRTSPServer takes the listening socket of the
+ * running one over a Unix socket (SCM_RIGHTS), so the RTSP port is
+ * never closed and no connection is refused.
+ * The old process stops accepting, lets its sessions drain for a few
+ * seconds and exits. The new process waits for that before opening the
+ * fifos (a fifo can have only one reader), the connections arriving in
+ * the meantime wait in the listen backlog.
+ */
+
+#ifndef _HOT_RESTART_HH
+#define _HOT_RESTART_HH
+
+#include "AdmissionRTSPServer.hh"
+
+#define HOT_RESTART_SOCKET "/tmp/rRTSPServer.sock"
+#define HOT_RESTART_DRAIN_SECONDS 3
+
+class HotRestart {
+public:
+    // Gets the listening socket of the running server and waits until it
+    // has exited. Returns -1 if there is no server to take over.
+    static int takeOver(char const* path, unsigned drainSeconds);
+
+    // Waits for the next process that wants to take over server
+    static HotRestart* createNew(UsageEnvironment& env, char const* path,
+                                 AdmissionRTSPServer* server, unsigned drainSeconds);
+
+protected:
+    HotRestart(UsageEnvironment& env, int listenSocket, AdmissionRTSPServer* server,
+               unsigned drainSeconds);
+    virtual ~HotRestart();
+
+private:
+    static void incomingHandler(void* clientData, int mask);
+    void incomingHandler1();
+    static void drainCheck(void* clientData);
+    void drainCheck1();
+
+private:
+    UsageEnvironment& fEnv;
+    int fListenSocket;
+    int fSuccessorSocket;
+    AdmissionRTSPServer* fServer;
+    unsigned fDrainSeconds;
+    struct timeval fDrainStart;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * One live H.264 input (a h264grabber fifo) shared by all the
+ * subsessions that stream it.
+ */
+
+#include "LiveStreamInput.hh"
+
+LiveStreamInput* LiveStreamInput::fInputs[LIVE_STREAM_MAX_INPUTS];
+unsigned LiveStreamInput::fNumInputs = 0;
+
+LiveStreamInput* LiveStreamInput::forFile(UsageEnvironment& env, char const* fileName) {
+    unsigned i;
+
+    for (i = 0; i < fNumInputs; i++) {
+        if (strcmp(fInputs[i]->fFileName, fileName) == 0) return fInputs[i];
+    }
+
+    if (fNumInputs >= LIVE_STREAM_MAX_INPUTS) return NULL;
+
+    fInputs[fNumInputs] = new LiveStreamInput(env, fileName);
+    return fInputs[fNumInputs++];
+}
+
+LiveStreamInput::LiveStreamInput(UsageEnvironment& env, char const* fileName)
+    : fEnv(env), fReplicator(NULL), fIdleCheckTask(NULL) {
+    fFileName = strDup(fileName);
+}
+
+LiveStreamInput::~LiveStreamInput() {
+    fEnv.taskScheduler().unscheduleDelayedTask(fIdleCheckTask);
+    Medium::close(fReplicator);
+    delete[] fFileName;
+}
+
+FramedSource* LiveStreamInput::createReplica() {
+    ByteStreamFileSource* fileSource;
+    H264VideoStreamFramer* framer;
+
+    // Open the fifo only when the first client arrives, as before: the
+    // open blocks until h264grabber is running
+    if (fReplicator == NULL) {
+        fileSource = ByteStreamFileSource::createNew(fEnv, fFileName);
+        if (fileSource == NULL) return NULL;
+
+        framer = H264VideoStreamFramer::createNew(fEnv, fileSource);
+        if (framer == NULL) {
+            Medium::close(fileSource);
+            return NULL;
+        }
+
+        // The replicator is closed by idleCheck() when the clients leave
+        fReplicator = StreamReplicator::createNew(fEnv, framer, False);
+        fIdleCheckTask = fEnv.taskScheduler().scheduleDelayedTask(LIVE_STREAM_IDLE_CHECK_US, idleCheck, this);
+    }
+
+    return fReplicator->createStreamReplica();
+}
+
+void LiveStreamInput::idleCheck(void* clientData) {
+    LiveStreamInput* input = (LiveStreamInput*) clientData;
+    input->fIdleCheckTask = NULL;
+    input->idleCheck1();
+}
+
+void LiveStreamInput::idleCheck1() {
+    if (fReplicator->numReplicas() == 0) {
+        // Closes the framer and the fifo too
+        Medium::close(fReplicator);
+        fReplicator = NULL;
+        return;
+    }
+
+    fIdleCheckTask = fEnv.taskScheduler().scheduleDelayedTask(LIVE_STREAM_IDLE_CHECK_US, idleCheck, this);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * One live H.264 input (a h264grabber fifo) shared by all the
+ * subsessions that stream it.
+ * A fifo can have only one reader: the NAL units are read once and
+ * replicated to every consumer (the fixed streams and the adaptive one).
+ * When no consumer is left the fifo is closed, so that h264grabber
+ * doesn't fill it for nobody, and opened again by the next one.
+ */
+
+#ifndef _LIVE_STREAM_INPUT_HH
+#define _LIVE_STREAM_INPUT_HH
+
+#include "liveMedia.hh"
+
+#define LIVE_STREAM_MAX_INPUTS 4
+// How often an input without replicas is looked for, and so how long it
+// stays open for a client that comes back (e.g. DESCRIBE then SETUP)
+#define LIVE_STREAM_IDLE_CHECK_US 5000000
+
+class LiveStreamInput {
+public:
+    // Returns the input reading fileName, created the first time
+    static LiveStreamInput* forFile(UsageEnvironment& env, char const* fileName);
+
+    // A new source of NAL units (without start codes), NULL on error.
+    // Close it with Medium::close().
+    FramedSource* createReplica();
+
+private:
+    LiveStreamInput(UsageEnvironment& env, char const* fileName);
+    virtual ~LiveStreamInput();
+
+    static void idleCheck(void* clientData);
+    void idleCheck1();
+
+private:
+    UsageEnvironment& fEnv;
+    char* fFileName;
+    StreamReplicator* fReplicator;
+    TaskToken fIdleCheckTask;
+
+    static LiveStreamInput* fInputs[LIVE_STREAM_MAX_INPUTS];
+    static unsigned fNumInputs;
+};
+
+#endif
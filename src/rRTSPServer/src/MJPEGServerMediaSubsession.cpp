@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsession for the MJPEG stream.
+ */
+
+#include "MJPEGServerMediaSubsession.hh"
+#include "MJPEGVideoSource.hh"
+#include "LiveStreamInput.hh"
+
+MJPEGServerMediaSubsession* MJPEGServerMediaSubsession::createNew(UsageEnvironment& env,
+                                                                  char const* fileName,
+                                                                  unsigned fps, unsigned nalBufferSize) {
+    return new MJPEGServerMediaSubsession(env, fileName, fps, nalBufferSize);
+}
+
+MJPEGServerMediaSubsession::MJPEGServerMediaSubsession(UsageEnvironment& env, char const* fileName,
+                                                       unsigned fps, unsigned nalBufferSize)
+    // One source and one encoder for all the clients
+    : OnDemandServerMediaSubsession(env, True),
+      fFileName(strDup(fileName)), fFPS(fps), fNALBufferSize(nalBufferSize) {
+}
+
+MJPEGServerMediaSubsession::~MJPEGServerMediaSubsession() {
+    delete[] fFileName;
+}
+
+FramedSource* MJPEGServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/,
+                                                                unsigned& estBitrate) {
+    LiveStreamInput* input;
+    FramedSource* replica;
+    FramedSource* source;
+
+    estBitrate = fFPS * 400; // kbps, estimate for 50 KB frames
+
+    input = LiveStreamInput::forFile(envir(), fFileName);
+    if (input == NULL) return NULL;
+    replica = input->createReplica();
+    if (replica == NULL) return NULL;
+
+    source = MJPEGVideoSource::createNew(envir(), replica, fFPS, fNALBufferSize);
+    if (source == NULL) Medium::close(replica);
+
+    return source;
+}
+
+RTPSink* MJPEGServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,
+                                                      unsigned char /*rtpPayloadTypeIfDynamic*/,
+                                                      FramedSource* /*inputSource*/) {
+    RTPSink* sink;
+    unsigned savedMaxSize;
+
+    // A JPEG frame is bigger than the default buffer
+    savedMaxSize = OutPacketBuffer::maxSize;
+    OutPacketBuffer::maxSize = MJPEG_MAX_FRAME_SIZE;
+    sink = JPEGVideoRTPSink::createNew(envir(), rtpGroupsock);
+    OutPacketBuffer::maxSize = savedMaxSize;
+
+    return sink;
+}
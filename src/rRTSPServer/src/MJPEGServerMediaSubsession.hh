@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Subsession for the MJPEG stream, for the clients that can't decode
+ * H.264. All the clients share one MJPEGVideoSource, created when the
+ * first one plays and closed when the last one leaves.
+ */
+
+#ifndef _MJPEG_SERVER_MEDIA_SUBSESSION_HH
+#define _MJPEG_SERVER_MEDIA_SUBSESSION_HH
+
+#include "liveMedia.hh"
+
+class MJPEGServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static MJPEGServerMediaSubsession* createNew(UsageEnvironment& env, char const* fileName,
+                                                 unsigned fps, unsigned nalBufferSize);
+
+protected:
+    MJPEGServerMediaSubsession(UsageEnvironment& env, char const* fileName,
+                               unsigned fps, unsigned nalBufferSize);
+    virtual ~MJPEGServerMediaSubsession();
+
+protected: // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic,
+                                      FramedSource* inputSource);
+
+private:
+    char* fFileName;
+    unsigned fFPS;
+    unsigned fNALBufferSize;
+};
+
+#endif
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * MJPEG source made from the keyframes of a live H.264 input.
+ */
+
+#include "MJPEGVideoSource.hh"
+#include "GroupsockHelper.hh"
+
+extern "C" {
+#include "h264dec.h"
+#include "convert2jpg.h"
+}
+
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOI  0xD8
+#define JPEG_MARKER_EOI  0xD9
+#define JPEG_MARKER_SOS  0xDA
+#define JPEG_MARKER_DQT  0xDB
+#define JPEG_MARKER_DRI  0xDD
+
+static int64_t nowUs() {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+MJPEGVideoSource* MJPEGVideoSource::createNew(UsageEnvironment& env, FramedSource* input,
+                                              unsigned fps, unsigned nalBufferSize) {
+    if ((input == NULL) || (fps == 0)) return NULL;
+
+    return new MJPEGVideoSource(env, input, fps, nalBufferSize);
+}
+
+MJPEGVideoSource::MJPEGVideoSource(UsageEnvironment& env, FramedSource* input,
+                                   unsigned fps, unsigned nalBufferSize)
+    : JPEGVideoSource(env), fInput(input), fFrameIntervalUs(1000000 / fps), fReading(False),
+      fNALBufferSize(nalBufferSize), fAULength(0), fAUHasParameterSets(False), fAUHasIDR(False),
+      fLastEncodeUs(0), fThreadStarted(False), fQuit(False), fBusy(False), fWorkAULength(0),
+      fJPEG(NULL), fJPEGLength(0), fFrameLength(0), fNewFrame(False),
+      fType(1), fWidth(0), fHeight(0), fQTablesLength(0) {
+    fNALBuffer = new unsigned char[fNALBufferSize];
+    // Room for the parameter sets and the start codes
+    fAUSize = fNALBufferSize + 1024;
+    fAU = new unsigned char[fAUSize];
+    fWorkAU = new unsigned char[fAUSize];
+    fFrame = new unsigned char[MJPEG_MAX_FRAME_SIZE];
+
+    pthread_mutex_init(&fMutex, NULL);
+    pthread_cond_init(&fCond, NULL);
+    fEncodedTrigger = envir().taskScheduler().createEventTrigger(encodedHandler);
+}
+
+MJPEGVideoSource::~MJPEGVideoSource() {
+    Medium::close(fInput);
+
+    if (fThreadStarted) {
+        pthread_mutex_lock(&fMutex);
+        fQuit = True;
+        pthread_cond_signal(&fCond);
+        pthread_mutex_unlock(&fMutex);
+        pthread_join(fThread, NULL);
+    }
+    envir().taskScheduler().deleteEventTrigger(fEncodedTrigger);
+
+    pthread_cond_destroy(&fCond);
+    pthread_mutex_destroy(&fMutex);
+
+    free(fJPEG);
+    delete[] fFrame;
+    delete[] fWorkAU;
+    delete[] fAU;
+    delete[] fNALBuffer;
+}
+
+void MJPEGVideoSource::doGetNextFrame() {
+    // The decoder is opened by the thread at the first keyframe
+    if (!fThreadStarted) {
+        if (pthread_create(&fThread, NULL, encoderThread, this) != 0) {
+            envir() << "MJPEGVideoSource: failed to start the encoder thread\n";
+            handleClosure();
+            return;
+        }
+        fThreadStarted = True;
+    }
+
+    if (!fReading) {
+        fReading = True;
+        readNAL();
+    }
+
+    if (fNewFrame) deliver();
+}
+
+void MJPEGVideoSource::doStopGettingFrames() {
+    // Nobody is watching: stop reading, the other readers of the input
+    // don't wait for us
+    fReading = False;
+    fInput->stopGettingFrames();
+    fAULength = 0;
+    fAUHasParameterSets = False;
+    fAUHasIDR = False;
+}
+
+u_int8_t MJPEGVideoSource::type() {
+    return fType;
+}
+
+u_int8_t MJPEGVideoSource::qFactor() {
+    // The tables of the encoder are sent in band
+    return 255;
+}
+
+u_int8_t MJPEGVideoSource::width() {
+    return fWidth;
+}
+
+u_int8_t MJPEGVideoSource::height() {
+    return fHeight;
+}
+
+u_int8_t const* MJPEGVideoSource::quantizationTables(u_int8_t& precision, u_int16_t& length) {
+    precision = 0;
+    length = fQTablesLength;
+    return fQTables;
+}
+
+////////// Input //////////
+
+void MJPEGVideoSource::readNAL() {
+    fInput->getNextFrame(fNALBuffer, fNALBufferSize, afterGettingNAL, this, onInputClosure, this);
+}
+
+void MJPEGVideoSource::afterGettingNAL(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime,
+                                       unsigned /*durationInMicroseconds*/) {
+    ((MJPEGVideoSource*) clientData)->afterGettingNAL1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void MJPEGVideoSource::afterGettingNAL1(unsigned frameSize, unsigned numTruncatedBytes,
+                                        struct timeval presentationTime) {
+    int nalType;
+
+    if ((frameSize == 0) || (numTruncatedBytes > 0)) {
+        // Wait for the next keyframe
+        fAULength = 0;
+        fAUHasParameterSets = False;
+        fAUHasIDR = False;
+    } else {
+        nalType = fNALBuffer[0] & 0x1F;
+
+        // The keyframe ends at the first NAL unit that is not one of its slices
+        if (fAUHasIDR && (nalType != NAL_TYPE_IDR)) {
+            encodeAccessUnit();
+            fAULength = 0;
+            fAUHasParameterSets = False;
+            fAUHasIDR = False;
+        }
+
+        if (nalType == NAL_TYPE_SPS) {
+            fAULength = 0;
+            fAUHasParameterSets = False;
+            appendNAL(fNALBuffer, frameSize);
+        } else if ((nalType == NAL_TYPE_PPS) && (fAULength > 0)) {
+            appendNAL(fNALBuffer, frameSize);
+            fAUHasParameterSets = True;
+        } else if ((nalType == NAL_TYPE_IDR) && fAUHasParameterSets) {
+            if (!fAUHasIDR) fAUTime = presentationTime;
+            appendNAL(fNALBuffer, frameSize);
+            fAUHasIDR = True;
+        }
+    }
+
+    if (fReading) readNAL();
+}
+
+void MJPEGVideoSource::onInputClosure(void* clientData) {
+    MJPEGVideoSource* source = (MJPEGVideoSource*) clientData;
+
+    source->fReading = False;
+    source->handleClosure();
+}
+
+void MJPEGVideoSource::appendNAL(unsigned char const* nal, unsigned size) {
+    if (fAULength + 4 + size > fAUSize) {
+        fAULength = 0;
+        fAUHasParameterSets = False;
+        fAUHasIDR = False;
+        return;
+    }
+
+    fAU[fAULength++] = 0;
+    fAU[fAULength++] = 0;
+    fAU[fAULength++] = 0;
+    fAU[fAULength++] = 1;
+    memcpy(fAU + fAULength, nal, size);
+    fAULength += size;
+}
+
+void MJPEGVideoSource::encodeAccessUnit() {
+    unsigned char* au;
+    int64_t now = nowUs();
+
+    if (now - fLastEncodeUs < fFrameIntervalUs) return;
+
+    pthread_mutex_lock(&fMutex);
+    // Still encoding the previous one: skip this keyframe
+    if (!fBusy) {
+        au = fWorkAU;
+        fWorkAU = fAU;
+        fAU = au;
+        fWorkAULength = fAULength;
+        fWorkTime = fAUTime;
+        fBusy = True;
+        fLastEncodeUs = now;
+        pthread_cond_signal(&fCond);
+    }
+    pthread_mutex_unlock(&fMutex);
+}
+
+////////// Encoder thread //////////
+
+void* MJPEGVideoSource::encoderThread(void* clientData) {
+    ((MJPEGVideoSource*) clientData)->encoderThread1();
+    return NULL;
+}
+
+void MJPEGVideoSource::encoderThread1() {
+    h264dec* dec = NULL;
+    unsigned char* planes[3];
+    int strides[3];
+    unsigned length;
+    unsigned char* jpeg;
+    unsigned long jpegLength;
+    int w, h;
+
+    pthread_mutex_lock(&fMutex);
+    while (1) {
+        while (!fQuit && (fWorkAULength == 0)) {
+            pthread_cond_wait(&fCond, &fMutex);
+        }
+        if (fQuit) break;
+        length = fWorkAULength;
+        pthread_mutex_unlock(&fMutex);
+
+        // fWorkAU belongs to this thread until fBusy is cleared
+        jpeg = NULL;
+        jpegLength = 0;
+        if (dec == NULL) dec = h264dec_open();
+        if ((dec != NULL) && (h264dec_decode(dec, fWorkAU, length, &w, &h) == 0) &&
+                (h264dec_planes(dec, planes, strides) == 0)) {
+            // The decoder planes go straight to libjpeg
+            if (I420toJPGMem(&jpeg, &jpegLength, planes, strides, w, h) < 0) {
+                jpeg = NULL;
+            }
+        }
+
+        pthread_mutex_lock(&fMutex);
+        fJPEG = jpeg;
+        fJPEGLength = jpegLength;
+        fWorkAULength = 0;
+        envir().taskScheduler().triggerEvent(fEncodedTrigger, this);
+    }
+    pthread_mutex_unlock(&fMutex);
+
+    h264dec_close(dec);
+}
+
+void MJPEGVideoSource::encodedHandler(void* clientData) {
+    ((MJPEGVideoSource*) clientData)->encodedHandler1();
+}
+
+void MJPEGVideoSource::encodedHandler1() {
+    unsigned char* jpeg;
+    unsigned long jpegLength;
+    struct timeval time;
+
+    pthread_mutex_lock(&fMutex);
+    jpeg = fJPEG;
+    jpegLength = fJPEGLength;
+    time = fWorkTime;
+    fJPEG = NULL;
+    fBusy = False;
+    pthread_mutex_unlock(&fMutex);
+
+    if (jpeg == NULL) return;
+    if (parseJPEG(jpeg, jpegLength)) {
+        fFrameTime = time;
+        fNewFrame = True;
+    } else {
+        envir() << "MJPEGVideoSource: unsupported JPEG frame\n";
+    }
+    free(jpeg);
+
+    if (fNewFrame && isCurrentlyAwaitingData()) deliver();
+}
+
+////////// Output //////////
+
+// Keeps what JPEGVideoRTPSink needs: the scan data and the parameters to
+// rebuild the headers (RFC 2435)
+Boolean MJPEGVideoSource::parseJPEG(unsigned char const* jpeg, unsigned long length) {
+    unsigned long i, segmentLength, scan;
+    unsigned char const* p;
+    unsigned char const* end;
+    unsigned w, h, tq;
+
+    if ((length < 4) || (jpeg[0] != 0xFF) || (jpeg[1] != JPEG_MARKER_SOI)) return False;
+
+    fQTablesLength = 0;
+    i = 2;
+    while (i + 4 <= length) {
+        if (jpeg[i] != 0xFF) return False;
+        segmentLength = (jpeg[i + 2] << 8) | jpeg[i + 3];
+        if (i + 2 + segmentLength > length) return False;
+        p = jpeg + i + 4;
+        end = jpeg + i + 2 + segmentLength;
+
+        switch (jpeg[i + 1]) {
+        case JPEG_MARKER_DQT:
+            for (; p + 65 <= end; p += 65) {
+                // Only 8 bit tables, 0 for Y and 1 for Cb and Cr
+                tq = p[0] & 0x0F;
+                if (((p[0] >> 4) != 0) || (tq > 1)) return False;
+                memcpy(fQTables + 64 * tq, p + 1, 64);
+                if (64 * tq + 64 > fQTablesLength) fQTablesLength = 64 * tq + 64;
+            }
+            break;
+
+        case JPEG_MARKER_SOF0:
+            if ((end - p < 15) || (p[5] != 3)) return False;
+            h = (p[1] << 8) | p[2];
+            w = (p[3] << 8) | p[4];
+            if ((w > 2040) || (h > 2040) || ((w % 8) != 0) || ((h % 8) != 0)) return False;
+            if ((p[10] != 0x11) || (p[13] != 0x11)) return False;
+            if (p[7] == 0x22) {
+                fType = 1; // 4:2:0
+            } else if (p[7] == 0x21) {
+                fType = 0; // 4:2:2
+            } else {
+                return False;
+            }
+            fWidth = w / 8;
+            fHeight = h / 8;
+            break;
+
+        case JPEG_MARKER_DRI:
+            if ((end - p >= 2) && ((p[0] != 0) || (p[1] != 0))) return False;
+            break;
+
+        case JPEG_MARKER_SOS:
+            scan = i + 2 + segmentLength;
+            if ((length >= scan + 2) && (jpeg[length - 2] == 0xFF) && (jpeg[length - 1] == JPEG_MARKER_EOI)) {
+                length -= 2;
+            }
+            if ((length <= scan) || (length - scan > MJPEG_MAX_FRAME_SIZE) || (fWidth == 0)) return False;
+            fFrameLength = length - scan;
+            memcpy(fFrame, jpeg + scan, fFrameLength);
+            return True;
+
+        default:
+            break;
+        }
+
+        i += 2 + segmentLength;
+    }
+
+    return False;
+}
+
+void MJPEGVideoSource::deliver() {
+    if (fFrameLength > fMaxSize) {
+        fFrameSize = fMaxSize;
+        fNumTruncatedBytes = fFrameLength - fMaxSize;
+    } else {
+        fFrameSize = fFrameLength;
+        fNumTruncatedBytes = 0;
+    }
+    memcpy(fTo, fFrame, fFrameSize);
+    fPresentationTime = fFrameTime;
+    fDurationInMicroseconds = 0;
+    fNewFrame = False;
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * MJPEG source made from the keyframes of a live H.264 input: every IDR
+ * is decoded and encoded again as JPEG with the snapshot pipeline, at
+ * most fps times per second.
+ * The decoder and the encoder run in a worker thread, so the event loop
+ * keeps serving the other streams. The input is read only while the source
+ * is playing: with reuseFirstSource all the clients share one source and
+ * every JPEG is encoded once.
+ */
+
+#ifndef _MJPEG_VIDEO_SOURCE_HH
+#define _MJPEG_VIDEO_SOURCE_HH
+
+#include "liveMedia.hh"
+
+#include <pthread.h>
+
+// Biggest JPEG frame, also the size of the RTP sink buffer
+#define MJPEG_MAX_FRAME_SIZE 250000
+
+class MJPEGVideoSource: public JPEGVideoSource {
+public:
+    // input delivers NAL units without start codes, up to nalBufferSize bytes
+    static MJPEGVideoSource* createNew(UsageEnvironment& env, FramedSource* input,
+                                       unsigned fps, unsigned nalBufferSize);
+
+protected:
+    MJPEGVideoSource(UsageEnvironment& env, FramedSource* input,
+                     unsigned fps, unsigned nalBufferSize);
+    virtual ~MJPEGVideoSource();
+
+protected: // redefined virtual functions
+    virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
+    virtual u_int8_t type();
+    virtual u_int8_t qFactor();
+    virtual u_int8_t width();
+    virtual u_int8_t height();
+    virtual u_int8_t const* quantizationTables(u_int8_t& precision, u_int16_t& length);
+
+private:
+    void readNAL();
+    static void afterGettingNAL(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                struct timeval presentationTime, unsigned durationInMicroseconds);
+    void afterGettingNAL1(unsigned frameSize, unsigned numTruncatedBytes,
+                          struct timeval presentationTime);
+    static void onInputClosure(void* clientData);
+    void appendNAL(unsigned char const* nal, unsigned size);
+    void encodeAccessUnit();
+
+    static void* encoderThread(void* clientData);
+    void encoderThread1();
+    static void encodedHandler(void* clientData);
+    void encodedHandler1();
+    Boolean parseJPEG(unsigned char const* jpeg, unsigned long length);
+    void deliver();
+
+private:
+    FramedSource* fInput;
+    unsigned fFrameIntervalUs;
+    Boolean fReading;
+
+    unsigned char* fNALBuffer;
+    unsigned fNALBufferSize;
+
+    // Access unit being assembled: SPS, PPS and IDR with start codes
+    unsigned char* fAU;
+    unsigned fAUSize;
+    unsigned fAULength;
+    Boolean fAUHasParameterSets;
+    Boolean fAUHasIDR;
+    struct timeval fAUTime;
+    int64_t fLastEncodeUs;
+
+    // Shared with the encoder thread, protected by fMutex
+    pthread_t fThread;
+    Boolean fThreadStarted;
+    pthread_mutex_t fMutex;
+    pthread_cond_t fCond;
+    EventTriggerId fEncodedTrigger;
+    Boolean fQuit;
+    Boolean fBusy;
+    unsigned char* fWorkAU;
+    unsigned fWorkAULength;
+    struct timeval fWorkTime;
+    unsigned char* fJPEG;
+    unsigned long fJPEGLength;
+
+    // Last JPEG, without headers, as sent by JPEGVideoRTPSink
+    unsigned char* fFrame;
+    unsigned fFrameLength;
+    struct timeval fFrameTime;
+    Boolean fNewFrame;
+    u_int8_t fType;
+    u_int8_t fWidth;
+    u_int8_t fHeight;
+    u_int8_t fQTables[128];
+    u_int16_t fQTablesLength;
+};
+
+#endif
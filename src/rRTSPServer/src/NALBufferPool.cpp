@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Pool of the NAL unit buffers used by the RTP sinks.
+ */
+
+#include "NALBufferPool.hh"
+
+#include <stddef.h>
+
+NALBufferPool::NALBufferPool()
+    : fNumFree(0), fUsedBytes(0), fFreeBytes(0) {
+}
+
+NALBufferPool::~NALBufferPool() {
+    unsigned i;
+
+    for (i = 0; i < fNumFree; i++) {
+        delete[] fFreeBuffers[i];
+    }
+}
+
+unsigned NALBufferPool::roundSize(unsigned size) {
+    if (size < NAL_BUFFER_MIN_SIZE) size = NAL_BUFFER_MIN_SIZE;
+    if (size > NAL_BUFFER_MAX_SIZE) size = NAL_BUFFER_MAX_SIZE;
+
+    return (size + NAL_BUFFER_GRANULARITY - 1) / NAL_BUFFER_GRANULARITY * NAL_BUFFER_GRANULARITY;
+}
+
+unsigned char* NALBufferPool::allocate(unsigned size, unsigned& allocatedSize) {
+    unsigned char* buffer;
+    unsigned i, best;
+
+    size = roundSize(size);
+
+    // Take the smallest free buffer that is big enough
+    best = fNumFree;
+    for (i = 0; i < fNumFree; i++) {
+        if ((fFreeSizes[i] >= size) && ((best == fNumFree) || (fFreeSizes[i] < fFreeSizes[best]))) {
+            best = i;
+        }
+    }
+
+    if (best < fNumFree) {
+        buffer = fFreeBuffers[best];
+        allocatedSize = fFreeSizes[best];
+        fFreeBytes -= allocatedSize;
+        fNumFree--;
+        fFreeBuffers[best] = fFreeBuffers[fNumFree];
+        fFreeSizes[best] = fFreeSizes[fNumFree];
+    } else {
+        buffer = new unsigned char[size];
+        allocatedSize = size;
+    }
+
+    fUsedBytes += allocatedSize;
+    return buffer;
+}
+
+void NALBufferPool::release(unsigned char* buffer, unsigned allocatedSize) {
+    unsigned i, smallest;
+
+    if (buffer == NULL) return;
+
+    fUsedBytes -= allocatedSize;
+
+    if (fNumFree < NAL_BUFFER_POOL_MAX_FREE) {
+        fFreeBuffers[fNumFree] = buffer;
+        fFreeSizes[fNumFree] = allocatedSize;
+        fNumFree++;
+        fFreeBytes += allocatedSize;
+        return;
+    }
+
+    // The pool is full: keep the biggest buffers, they fit every request
+    smallest = 0;
+    for (i = 1; i < fNumFree; i++) {
+        if (fFreeSizes[i] < fFreeSizes[smallest]) smallest = i;
+    }
+    if (fFreeSizes[smallest] < allocatedSize) {
+        delete[] fFreeBuffers[smallest];
+        fFreeBytes += allocatedSize - fFreeSizes[smallest];
+        fFreeBuffers[smallest] = buffer;
+        fFreeSizes[smallest] = allocatedSize;
+    } else {
+        delete[] buffer;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Pool of the NAL unit buffers used by the RTP sinks.
+ * The buffers are big (up to a few hundred KB for the I frames of the
+ * high resolution stream): instead of freeing them when a session ends
+ * we keep a few of them for the next sessions, this avoids fragmenting
+ * the heap of a 64 MB device.
+ */
+
+#ifndef _NAL_BUFFER_POOL_HH
+#define _NAL_BUFFER_POOL_HH
+
+#define NAL_BUFFER_POOL_MAX_FREE 4
+#define NAL_BUFFER_GRANULARITY   4096
+#define NAL_BUFFER_MIN_SIZE      16384
+#define NAL_BUFFER_MAX_SIZE      300000
+
+class NALBufferPool {
+public:
+    NALBufferPool();
+    virtual ~NALBufferPool();
+
+    // Returns a buffer of at least size bytes, allocatedSize is its real size
+    unsigned char* allocate(unsigned size, unsigned& allocatedSize);
+    void release(unsigned char* buffer, unsigned allocatedSize);
+
+    static unsigned roundSize(unsigned size);
+
+    unsigned usedBytes() const { return fUsedBytes; }
+    unsigned freeBytes() const { return fFreeBytes; }
+
+private:
+    unsigned char* fFreeBuffers[NAL_BUFFER_POOL_MAX_FREE];
+    unsigned fFreeSizes[NAL_BUFFER_POOL_MAX_FREE];
+    unsigned fNumFree;
+    unsigned fUsedBytes;
+    unsigned fFreeBytes;
+};
+
+#endif
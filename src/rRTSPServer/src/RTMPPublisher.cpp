@@ -0,0 +1,1111 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * RTMP push of a live stream to a relay.
+ */
+
+#include "RTMPPublisher.hh"
+#include "NALBufferPool.hh"
+#include "GroupsockHelper.hh"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define STATE_IDLE          0
+#define STATE_CONNECTING    1
+#define STATE_HANDSHAKE     2
+#define STATE_CONNECTED     3
+#define STATE_PUBLISHING    4
+
+#define CSID_CONTROL        2
+#define CSID_COMMAND        3
+#define CSID_DATA           4
+#define CSID_VIDEO          6
+
+#define MSG_SET_CHUNK_SIZE  1
+#define MSG_ACK             3
+#define MSG_USER_CONTROL    4
+#define MSG_WINDOW_ACK_SIZE 5
+#define MSG_VIDEO           9
+#define MSG_AMF0_DATA       18
+#define MSG_AMF0_COMMAND    20
+
+#define AMF0_NUMBER         0x00
+#define AMF0_BOOLEAN        0x01
+#define AMF0_STRING         0x02
+#define AMF0_OBJECT         0x03
+#define AMF0_NULL           0x05
+#define AMF0_UNDEFINED      0x06
+#define AMF0_ECMA_ARRAY     0x08
+#define AMF0_OBJECT_END     0x09
+
+#define TXN_CONNECT         1
+#define TXN_CREATE_STREAM   4
+#define TXN_PUBLISH         5
+
+// FLV video tag header: frame type and codec, AVC packet type,
+// composition time
+#define FLV_VIDEO_HEADER_SIZE 5
+
+static char const* stateNames[] = { "idle", "connecting", "handshake", "connected", "publishing" };
+
+static int64_t nowUs() {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void putBE16(unsigned char* p, unsigned v) {
+    p[0] = v >> 8; p[1] = v;
+}
+
+static void putBE24(unsigned char* p, u_int32_t v) {
+    p[0] = v >> 16; p[1] = v >> 8; p[2] = v;
+}
+
+static void putBE32(unsigned char* p, u_int32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static u_int32_t getBE24(unsigned char const* p) {
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static u_int32_t getBE32(unsigned char const* p) {
+    return ((u_int32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+////////// AMF0 encoding //////////
+
+class AMFWriter {
+public:
+    AMFWriter() : fSize(0) {}
+
+    void number(double v) {
+        unsigned char const* b = (unsigned char const*) &v;
+        unsigned i;
+
+        if (!room(9)) return;
+        fBuffer[fSize++] = AMF0_NUMBER;
+        // The double is big endian on the wire
+        for (i = 0; i < 8; i++) {
+            fBuffer[fSize + i] = b[isLittleEndian() ? 7 - i : i];
+        }
+        fSize += 8;
+    }
+    void boolean(Boolean v) {
+        if (!room(2)) return;
+        fBuffer[fSize++] = AMF0_BOOLEAN;
+        fBuffer[fSize++] = v ? 1 : 0;
+    }
+    void string(char const* s) {
+        if (!room(1)) return;
+        fBuffer[fSize++] = AMF0_STRING;
+        key(s);
+    }
+    void null() {
+        if (!room(1)) return;
+        fBuffer[fSize++] = AMF0_NULL;
+    }
+    void objectStart() {
+        if (!room(1)) return;
+        fBuffer[fSize++] = AMF0_OBJECT;
+    }
+    void key(char const* s) {
+        unsigned len = strlen(s);
+
+        if (!room(2 + len)) return;
+        putBE16(&fBuffer[fSize], len);
+        memcpy(&fBuffer[fSize + 2], s, len);
+        fSize += 2 + len;
+    }
+    void objectEnd() {
+        if (!room(3)) return;
+        fBuffer[fSize++] = 0;
+        fBuffer[fSize++] = 0;
+        fBuffer[fSize++] = AMF0_OBJECT_END;
+    }
+
+    unsigned char const* data() const { return fBuffer; }
+    unsigned size() const { return fSize; }
+
+private:
+    Boolean room(unsigned n) const { return fSize + n <= sizeof(fBuffer); }
+    static Boolean isLittleEndian() {
+        u_int16_t one = 1;
+        return *(unsigned char*) &one == 1;
+    }
+
+private:
+    unsigned char fBuffer[1024];
+    unsigned fSize;
+};
+
+////////// AMF0 decoding //////////
+
+class AMFReader {
+public:
+    AMFReader(unsigned char const* data, unsigned size)
+        : fData(data), fSize(size), fPos(0) {}
+
+    Boolean string(char* s, unsigned maxSize) {
+        if ((fPos >= fSize) || (fData[fPos] != AMF0_STRING)) return False;
+        fPos++;
+        return key(s, maxSize);
+    }
+    Boolean number(double* v) {
+        unsigned char* b = (unsigned char*) v;
+        u_int16_t one = 1;
+        Boolean littleEndian = *(unsigned char*) &one == 1;
+        unsigned i;
+
+        if ((fPos + 9 > fSize) || (fData[fPos] != AMF0_NUMBER)) return False;
+        for (i = 0; i < 8; i++) {
+            b[littleEndian ? 7 - i : i] = fData[fPos + 1 + i];
+        }
+        fPos += 9;
+        return True;
+    }
+    // Finds the string property name of the next object (or ECMA array)
+    Boolean objectProperty(char const* name, char* s, unsigned maxSize) {
+        char k[64];
+
+        if (fPos >= fSize) return False;
+        if (fData[fPos] == AMF0_ECMA_ARRAY) {
+            fPos += 5;
+        } else if (fData[fPos] == AMF0_OBJECT) {
+            fPos += 1;
+        } else {
+            return False;
+        }
+        while (fPos + 3 <= fSize) {
+            if ((fData[fPos] == 0) && (fData[fPos + 1] == 0) && (fData[fPos + 2] == AMF0_OBJECT_END)) {
+                fPos += 3;
+                return False;
+            }
+            if (!key(k, sizeof(k))) return False;
+            if ((strcmp(k, name) == 0) && string(s, maxSize)) return True;
+            if (!skip()) return False;
+        }
+        return False;
+    }
+    Boolean skip() {
+        char k[64];
+
+        if (fPos >= fSize) return False;
+        switch (fData[fPos]) {
+        case AMF0_NUMBER:
+            fPos += 9;
+            break;
+        case AMF0_BOOLEAN:
+            fPos += 2;
+            break;
+        case AMF0_STRING:
+            fPos += 1;
+            if (fPos + 2 > fSize) return False;
+            fPos += 2 + ((fData[fPos] << 8) | fData[fPos + 1]);
+            break;
+        case AMF0_NULL:
+        case AMF0_UNDEFINED:
+            fPos += 1;
+            break;
+        case AMF0_OBJECT:
+        case AMF0_ECMA_ARRAY:
+            fPos += (fData[fPos] == AMF0_OBJECT) ? 1 : 5;
+            while (fPos + 3 <= fSize) {
+                if ((fData[fPos] == 0) && (fData[fPos + 1] == 0) && (fData[fPos + 2] == AMF0_OBJECT_END)) {
+                    fPos += 3;
+                    return True;
+                }
+                if (!key(k, sizeof(k)) || !skip()) return False;
+            }
+            return False;
+        default:
+            return False;
+        }
+        return fPos <= fSize;
+    }
+
+private:
+    // A string without the type marker, truncated to maxSize
+    Boolean key(char* s, unsigned maxSize) {
+        unsigned len;
+
+        if (fPos + 2 > fSize) return False;
+        len = (fData[fPos] << 8) | fData[fPos + 1];
+        if (fPos + 2 + len > fSize) return False;
+        if (maxSize > 0) {
+            unsigned n = (len < maxSize - 1) ? len : maxSize - 1;
+            memcpy(s, &fData[fPos + 2], n);
+            s[n] = '\0';
+        }
+        fPos += 2 + len;
+        return True;
+    }
+
+private:
+    unsigned char const* fData;
+    unsigned fSize;
+    unsigned fPos;
+};
+
+////////// RTMPPublisher //////////
+
+RTMPPublisher* RTMPPublisher::createNew(UsageEnvironment& env, FramedSource* input,
+                                        char const* url, unsigned frameBufferSize) {
+    RTMPPublisher* publisher;
+
+    if (input == NULL) return NULL;
+
+    publisher = new RTMPPublisher(env, input, frameBufferSize);
+    if (!publisher->parseURL(url)) {
+        env << "Invalid RTMP url " << url << ", expected rtmp://host[:port]/app/stream\n";
+        delete publisher;
+        return NULL;
+    }
+
+    return publisher;
+}
+
+RTMPPublisher::RTMPPublisher(UsageEnvironment& env, FramedSource* input, unsigned frameBufferSize)
+    : fEnv(env), fInput(input), fReadTask(NULL),
+      fHost(NULL), fPort(RTMP_DEFAULT_PORT), fApp(NULL), fStreamName(NULL), fTcUrl(NULL),
+      fNumericHost(False), fResolving(False), fResolveOK(False),
+      fAUSize(FLV_VIDEO_HEADER_SIZE), fAUKeyframe(False),
+      fSPS(NULL), fSPSSize(0), fPPS(NULL), fPPSSize(0),
+      fSequenceHeaderSent(False), fWaitKeyframe(True), fFirstUs(-1),
+      fState(STATE_IDLE), fSocket(-1), fStreamId(0), fHandshakeReceived(0),
+      fConnectTask(NULL), fBackoffMs(RTMP_MIN_BACKOFF_MS), fPublishStartUs(0),
+      fQueueHead(0), fQueueTail(0),
+      fInSize(0), fInChunkSize(128), fBytesReceived(0), fLastAck(0), fWindowAckSize(0),
+      fNumChunkStreams(0),
+      fStatsTask(NULL), fQueuePeak(0), fBytesSent(0), fLastBytesSent(0),
+      fFramesSent(0), fFramesDropped(0), fReconnects(0) {
+    fAUMax = NALBufferPool::roundSize(frameBufferSize);
+    fAU = new unsigned char[fAUMax];
+    fQueue = new unsigned char[RTMP_QUEUE_SIZE];
+
+    memset(&fAddress, 0, sizeof(fAddress));
+    fResolvedTrigger = fEnv.taskScheduler().createEventTrigger(resolvedHandler);
+}
+
+RTMPPublisher::~RTMPPublisher() {
+    fEnv.taskScheduler().unscheduleDelayedTask(fReadTask);
+    fEnv.taskScheduler().unscheduleDelayedTask(fConnectTask);
+    fEnv.taskScheduler().unscheduleDelayedTask(fStatsTask);
+    if (fResolving) pthread_join(fResolverThread, NULL);
+    fEnv.taskScheduler().deleteEventTrigger(fResolvedTrigger);
+    if (fSocket >= 0) {
+        fEnv.taskScheduler().disableBackgroundHandling(fSocket);
+        close(fSocket);
+    }
+    Medium::close(fInput);
+
+    delete[] fHost;
+    delete[] fApp;
+    delete[] fStreamName;
+    delete[] fTcUrl;
+    delete[] fAU;
+    delete[] fSPS;
+    delete[] fPPS;
+    delete[] fQueue;
+}
+
+Boolean RTMPPublisher::parseURL(char const* url) {
+    char const* p;
+    char const* hostEnd;
+    char const* appEnd;
+    unsigned port = RTMP_DEFAULT_PORT;
+    char portString[8];
+
+    if (strncmp(url, "rtmp://", 7) != 0) return False;
+    p = url + 7;
+
+    hostEnd = strchr(p, '/');
+    if ((hostEnd == NULL) || (hostEnd == p)) return False;
+    fHost = new char[hostEnd - p + 1];
+    memcpy(fHost, p, hostEnd - p);
+    fHost[hostEnd - p] = '\0';
+    if (strchr(fHost, ':') != NULL) {
+        if ((sscanf(strchr(fHost, ':') + 1, "%u", &port) != 1) || (port == 0) || (port > 65535)) return False;
+        *strchr(fHost, ':') = '\0';
+    }
+    fPort = port;
+    fNumericHost = (inet_pton(AF_INET, fHost, &fAddress.sin_addr) == 1);
+
+    // The application is the first path element, the stream name the rest
+    p = hostEnd + 1;
+    appEnd = strchr(p, '/');
+    if ((appEnd == NULL) || (appEnd == p) || (appEnd[1] == '\0')) return False;
+    fApp = new char[appEnd - p + 1];
+    memcpy(fApp, p, appEnd - p);
+    fApp[appEnd - p] = '\0';
+    fStreamName = strDup(appEnd + 1);
+
+    sprintf(portString, "%u", fPort);
+    fTcUrl = new char[7 + strlen(fHost) + 1 + strlen(portString) + 1 + strlen(fApp) + 1];
+    sprintf(fTcUrl, "rtmp://%s:%s/%s", fHost, portString, fApp);
+
+    return True;
+}
+
+void RTMPPublisher::start() {
+    fEnv << "RTMP: publishing to " << fTcUrl << "/" << fStreamName << "\n";
+    connect();
+    readNext1();
+    fStatsTask = fEnv.taskScheduler().scheduleDelayedTask(RTMP_STATS_INTERVAL_US, statsTask, this);
+}
+
+////////// Input //////////
+
+void RTMPPublisher::readNext(void* clientData) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    publisher->fReadTask = NULL;
+    publisher->readNext1();
+}
+
+void RTMPPublisher::readNext1() {
+    unsigned offset = fAUSize + 4;
+
+    // The NAL unit is read in place, after room for its length
+    if (offset >= fAUMax) {
+        // Access unit too big, start again
+        fAUSize = FLV_VIDEO_HEADER_SIZE;
+        fAUKeyframe = False;
+        fWaitKeyframe = True;
+        offset = fAUSize + 4;
+    }
+    fInput->getNextFrame(&fAU[offset], fAUMax - offset,
+                         afterGettingFrame, this, onInputClosure, this);
+}
+
+void RTMPPublisher::afterGettingFrame(void* clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned /*durationInMicroseconds*/) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    publisher->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void RTMPPublisher::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime) {
+    unsigned char* nal = &fAU[fAUSize + 4];
+    unsigned nalType;
+
+    if (numTruncatedBytes > 0) {
+        // Grow the buffer for the next access units, this one is lost
+        unsigned newMax = NALBufferPool::roundSize((fAUSize + 4 + frameSize + numTruncatedBytes) * 5 / 4);
+
+        if (newMax > fAUMax) {
+            fEnv << "RTMP: frame truncated, buffer increased to " << newMax << " bytes\n";
+            delete[] fAU;
+            fAU = new unsigned char[newMax];
+            fAUMax = newMax;
+        }
+        fAUSize = FLV_VIDEO_HEADER_SIZE;
+        fAUKeyframe = False;
+        fWaitKeyframe = True;
+        fFramesDropped++;
+        fReadTask = fEnv.taskScheduler().scheduleDelayedTask(0, readNext, this);
+        return;
+    }
+
+    if (frameSize > 0) {
+        nalType = nal[0] & 0x1F;
+        if (nalType == 7) {
+            if ((fSPS == NULL) || (fSPSSize != frameSize) || (memcmp(fSPS, nal, frameSize) != 0)) {
+                delete[] fSPS;
+                fSPS = new unsigned char[frameSize];
+                memcpy(fSPS, nal, frameSize);
+                fSPSSize = frameSize;
+                fSequenceHeaderSent = False;
+            }
+        } else if (nalType == 8) {
+            if ((fPPS == NULL) || (fPPSSize != frameSize) || (memcmp(fPPS, nal, frameSize) != 0)) {
+                delete[] fPPS;
+                fPPS = new unsigned char[frameSize];
+                memcpy(fPPS, nal, frameSize);
+                fPPSSize = frameSize;
+                fSequenceHeaderSent = False;
+            }
+        } else if ((nalType >= 1) && (nalType <= 5)) {
+            // The camera encodes one slice per picture: the slice ends
+            // the access unit
+            putBE32(&fAU[fAUSize], frameSize);
+            fAUSize += 4 + frameSize;
+            if (nalType == 5) fAUKeyframe = True;
+            sendAccessUnit(presentationTime, fAUKeyframe);
+            fAUSize = FLV_VIDEO_HEADER_SIZE;
+            fAUKeyframe = False;
+        }
+        // SPS/PPS go in the sequence header, SEI and AUD are dropped
+    }
+
+    // Don't recurse if the replica delivers synchronously
+    fReadTask = fEnv.taskScheduler().scheduleDelayedTask(0, readNext, this);
+}
+
+void RTMPPublisher::onInputClosure(void* clientData) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+
+    publisher->fEnv << "RTMP: input closed, publishing stopped\n";
+    publisher->disconnect("input closed");
+    publisher->fEnv.taskScheduler().unscheduleDelayedTask(publisher->fConnectTask);
+}
+
+void RTMPPublisher::sendAccessUnit(struct timeval presentationTime, Boolean isKeyframe) {
+    int64_t us = (int64_t) presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
+    u_int32_t timestamp;
+
+    if (fState != STATE_PUBLISHING) return;
+
+    if (fWaitKeyframe) {
+        if (!isKeyframe) return;
+        fWaitKeyframe = False;
+    }
+
+    // Timestamps in ms from the start of the publication
+    if (fFirstUs < 0) fFirstUs = us;
+    timestamp = (us > fFirstUs) ? (u_int32_t) ((us - fFirstUs) / 1000) : 0;
+
+    if (isKeyframe && !fSequenceHeaderSent) {
+        if (!sendSequenceHeader(timestamp)) {
+            fFramesDropped++;
+            fWaitKeyframe = True;
+            return;
+        }
+    }
+    if (!fSequenceHeaderSent) return;
+
+    fAU[0] = isKeyframe ? 0x17 : 0x27;
+    fAU[1] = 1;
+    putBE24(&fAU[2], 0);
+    if (!sendMessage(CSID_VIDEO, MSG_VIDEO, fStreamId, timestamp, fAU, fAUSize)) {
+        // Queue full: the relay doesn't keep up, skip to the next keyframe
+        fFramesDropped++;
+        fWaitKeyframe = True;
+        return;
+    }
+    fFramesSent++;
+}
+
+Boolean RTMPPublisher::sendSequenceHeader(u_int32_t timestamp) {
+    unsigned char* tag;
+    unsigned size;
+    AMFWriter metadata;
+    Boolean ret;
+
+    if ((fSPS == NULL) || (fPPS == NULL) || (fSPSSize < 4)) return False;
+
+    metadata.string("@setDataFrame");
+    metadata.string("onMetaData");
+    metadata.objectStart();
+    metadata.key("videocodecid");
+    metadata.number(7);
+    metadata.key("encoder");
+    metadata.string("rRTSPServer");
+    metadata.objectEnd();
+    if (!sendMessage(CSID_DATA, MSG_AMF0_DATA, fStreamId, timestamp, metadata.data(), metadata.size())) {
+        return False;
+    }
+
+    // AVCDecoderConfigurationRecord
+    size = FLV_VIDEO_HEADER_SIZE + 11 + fSPSSize + fPPSSize;
+    tag = new unsigned char[size];
+    tag[0] = 0x17;
+    tag[1] = 0;
+    putBE24(&tag[2], 0);
+    tag[5] = 1;
+    tag[6] = fSPS[1];
+    tag[7] = fSPS[2];
+    tag[8] = fSPS[3];
+    tag[9] = 0xFF;
+    tag[10] = 0xE1;
+    putBE16(&tag[11], fSPSSize);
+    memcpy(&tag[13], fSPS, fSPSSize);
+    tag[13 + fSPSSize] = 1;
+    putBE16(&tag[14 + fSPSSize], fPPSSize);
+    memcpy(&tag[16 + fSPSSize], fPPS, fPPSSize);
+
+    ret = sendMessage(CSID_VIDEO, MSG_VIDEO, fStreamId, timestamp, tag, size);
+    delete[] tag;
+    if (ret) fSequenceHeaderSent = True;
+
+    return ret;
+}
+
+////////// Connection //////////
+
+void RTMPPublisher::connectTask(void* clientData) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    publisher->fConnectTask = NULL;
+    publisher->connect();
+}
+
+void RTMPPublisher::connect() {
+    if (fNumericHost) {
+        connectToAddress();
+        return;
+    }
+
+    // The socket is opened when the thread has the address
+    if (fResolving) return;
+    if (pthread_create(&fResolverThread, NULL, resolverThread, this) != 0) {
+        disconnect("can't start the resolver thread");
+        return;
+    }
+    fResolving = True;
+}
+
+void* RTMPPublisher::resolverThread(void* clientData) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    publisher->fResolveOK = False;
+    if ((getaddrinfo(publisher->fHost, NULL, &hints, &res) == 0) && (res != NULL)) {
+        memcpy(&publisher->fAddress, res->ai_addr, sizeof(publisher->fAddress));
+        publisher->fResolveOK = True;
+    }
+    if (res != NULL) freeaddrinfo(res);
+
+    publisher->fEnv.taskScheduler().triggerEvent(publisher->fResolvedTrigger, publisher);
+    return NULL;
+}
+
+void RTMPPublisher::resolvedHandler(void* clientData) {
+    ((RTMPPublisher*) clientData)->resolvedHandler1();
+}
+
+void RTMPPublisher::resolvedHandler1() {
+    pthread_join(fResolverThread, NULL);
+    fResolving = False;
+
+    if (!fResolveOK) {
+        disconnect("can't resolve the host");
+        return;
+    }
+    connectToAddress();
+}
+
+void RTMPPublisher::connectToAddress() {
+    struct sockaddr_in addr;
+    int flag = 1;
+
+    addr = fAddress;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(fPort);
+
+    fSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (fSocket < 0) {
+        disconnect("can't create the socket");
+        return;
+    }
+    makeSocketNonBlocking(fSocket);
+    setsockopt(fSocket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    fState = STATE_CONNECTING;
+    if (::connect(fSocket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        if ((errno != EINPROGRESS) && (errno != EWOULDBLOCK)) {
+            disconnect("can't connect");
+            return;
+        }
+    }
+    updateHandling();
+}
+
+void RTMPPublisher::disconnect(char const* reason) {
+    int64_t now = nowUs();
+
+    if (fState != STATE_IDLE) {
+        fEnv << "RTMP: disconnected from " << fHost << ": " << reason << "\n";
+    } else {
+        fEnv << "RTMP: connection to " << fHost << " failed: " << reason << "\n";
+    }
+
+    if (fSocket >= 0) {
+        fEnv.taskScheduler().disableBackgroundHandling(fSocket);
+        close(fSocket);
+        fSocket = -1;
+    }
+
+    // A publication that lasted resets the backoff
+    if ((fState == STATE_PUBLISHING) && (now - fPublishStartUs >= RTMP_STABLE_US)) {
+        fBackoffMs = RTMP_MIN_BACKOFF_MS;
+    }
+
+    fState = STATE_IDLE;
+    fQueueHead = fQueueTail = 0;
+    fInSize = 0;
+    fNumChunkStreams = 0;
+
+    fEnv.taskScheduler().unscheduleDelayedTask(fConnectTask);
+    fConnectTask = fEnv.taskScheduler().scheduleDelayedTask((int64_t) fBackoffMs * 1000, connectTask, this);
+    fReconnects++;
+    fBackoffMs *= 2;
+    if (fBackoffMs > RTMP_MAX_BACKOFF_MS) fBackoffMs = RTMP_MAX_BACKOFF_MS;
+}
+
+void RTMPPublisher::updateHandling() {
+    int conditions = SOCKET_READABLE | SOCKET_EXCEPTION;
+
+    if (fSocket < 0) return;
+    if ((fState == STATE_CONNECTING) || (fQueueTail > fQueueHead)) conditions |= SOCKET_WRITABLE;
+    fEnv.taskScheduler().setBackgroundHandling(fSocket, conditions, socketHandler, this);
+}
+
+void RTMPPublisher::socketHandler(void* clientData, int mask) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    publisher->socketHandler1(mask);
+}
+
+void RTMPPublisher::socketHandler1(int mask) {
+    if (fState == STATE_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if ((mask & (SOCKET_WRITABLE | SOCKET_EXCEPTION)) == 0) return;
+        if ((getsockopt(fSocket, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || (err != 0)) {
+            disconnect("can't connect");
+            return;
+        }
+
+        // C0 and C1: version, time, zero, random bytes
+        unsigned char c01[1 + RTMP_HANDSHAKE_SIZE];
+        unsigned i;
+
+        c01[0] = 3;
+        memset(&c01[1], 0, 8);
+        for (i = 9; i < sizeof(c01); i++) c01[i] = our_random() & 0xFF;
+        fState = STATE_HANDSHAKE;
+        fHandshakeReceived = 0;
+        appendRaw(c01, sizeof(c01));
+        updateHandling();
+        return;
+    }
+
+    if (mask & SOCKET_READABLE) {
+        handleReadable();
+        if (fSocket < 0) return;
+    }
+    if (mask & SOCKET_WRITABLE) {
+        handleWritable();
+    }
+}
+
+void RTMPPublisher::handleReadable() {
+    int n;
+
+    n = recv(fSocket, &fIn[fInSize], sizeof(fIn) - fInSize, 0);
+    if (n == 0) {
+        disconnect("closed by the server");
+        return;
+    }
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) disconnect("read error");
+        return;
+    }
+    fInSize += n;
+    fBytesReceived += n;
+
+    if (fState == STATE_HANDSHAKE) handleHandshake();
+    if ((fState == STATE_CONNECTED) || (fState == STATE_PUBLISHING)) parseChunks();
+    if (fSocket < 0) return;
+
+    if ((fWindowAckSize > 0) && (fBytesReceived - fLastAck >= fWindowAckSize)) {
+        sendControl(MSG_ACK, fBytesReceived);
+        fLastAck = fBytesReceived;
+    }
+    updateHandling();
+}
+
+void RTMPPublisher::handleWritable() {
+    int n;
+
+    if (fQueueTail == fQueueHead) {
+        updateHandling();
+        return;
+    }
+
+    n = send(fSocket, &fQueue[fQueueHead], fQueueTail - fQueueHead, MSG_NOSIGNAL);
+    if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) disconnect("write error");
+        return;
+    }
+    fQueueHead += n;
+    fBytesSent += n;
+    if (fQueueHead == fQueueTail) {
+        fQueueHead = fQueueTail = 0;
+        updateHandling();
+    }
+}
+
+void RTMPPublisher::handleHandshake() {
+    unsigned total = 1 + 2 * RTMP_HANDSHAKE_SIZE;
+    unsigned n = total - fHandshakeReceived;
+    Boolean hadS1 = fHandshakeReceived >= 1 + RTMP_HANDSHAKE_SIZE;
+
+    if (n > fInSize) n = fInSize;
+    memcpy(&fHandshake[fHandshakeReceived], fIn, n);
+    fHandshakeReceived += n;
+    memmove(fIn, &fIn[n], fInSize - n);
+    fInSize -= n;
+
+    if (fHandshake[0] != 3) {
+        disconnect("unsupported RTMP version");
+        return;
+    }
+
+    // C2 echoes S1
+    if (!hadS1 && (fHandshakeReceived >= 1 + RTMP_HANDSHAKE_SIZE)) {
+        appendRaw(&fHandshake[1], RTMP_HANDSHAKE_SIZE);
+    }
+
+    if (fHandshakeReceived == total) {
+        fState = STATE_CONNECTED;
+        fInChunkSize = 128;
+        fBytesReceived = fLastAck = fWindowAckSize = 0;
+        sendControl(MSG_SET_CHUNK_SIZE, RTMP_OUT_CHUNK_SIZE);
+        sendConnect();
+        sendCommand("releaseStream", 2, fStreamName);
+        sendCommand("FCPublish", 3, fStreamName);
+        sendCommand("createStream", TXN_CREATE_STREAM, NULL);
+    }
+}
+
+void RTMPPublisher::parseChunks() {
+    static unsigned const messageHeaderSizes[4] = { 11, 7, 3, 0 };
+    unsigned pos = 0;
+
+    while (pos < fInSize) {
+        unsigned char const* p = &fIn[pos];
+        unsigned avail = fInSize - pos;
+        unsigned fmt = p[0] >> 6;
+        unsigned csid = p[0] & 0x3F;
+        unsigned hdr = 1;
+        unsigned i, chunk;
+        u_int32_t ts = 0;
+        struct chunkStream* cs = NULL;
+
+        if (csid == 0) {
+            if (avail < 2) break;
+            csid = p[1] + 64;
+            hdr = 2;
+        } else if (csid == 1) {
+            if (avail < 3) break;
+            csid = p[1] + (p[2] << 8) + 64;
+            hdr = 3;
+        }
+        if (avail < hdr + messageHeaderSizes[fmt]) break;
+
+        for (i = 0; i < fNumChunkStreams; i++) {
+            if (fChunkStreams[i].csid == csid) {
+                cs = &fChunkStreams[i];
+                break;
+            }
+        }
+        if (cs == NULL) {
+            // The server uses only a few chunk streams
+            if (fNumChunkStreams < RTMP_IN_CHUNK_STREAMS) {
+                cs = &fChunkStreams[fNumChunkStreams++];
+            } else {
+                cs = &fChunkStreams[0];
+            }
+            memset(cs, 0, sizeof(struct chunkStream) - RTMP_IN_MESSAGE_SIZE);
+            cs->csid = csid;
+        }
+
+        p += hdr;
+        if (fmt <= 2) {
+            ts = getBE24(p);
+            cs->extended = ts == 0xFFFFFF;
+        }
+        if (fmt <= 1) {
+            cs->length = getBE24(p + 3);
+            cs->type = p[6];
+        }
+        if (fmt == 0) {
+            cs->streamId = p[7] | (p[8] << 8) | (p[9] << 16) | ((u_int32_t) p[10] << 24);
+        }
+        hdr += messageHeaderSizes[fmt];
+        if (cs->extended) {
+            if (avail < hdr + 4) break;
+            ts = getBE32(&fIn[pos + hdr]);
+            hdr += 4;
+        }
+        if (fmt == 0) {
+            cs->timestamp = ts;
+        } else if (fmt <= 2) {
+            cs->timestamp += ts;
+        }
+
+        chunk = cs->length - cs->received;
+        if (chunk > fInChunkSize) chunk = fInChunkSize;
+        if (avail < hdr + chunk) {
+            // Incomplete chunk, the headers are parsed again
+            if ((fmt <= 2) && (fmt > 0)) cs->timestamp -= ts;
+            break;
+        }
+
+        // Too big messages are consumed but not kept
+        if (cs->received + chunk <= RTMP_IN_MESSAGE_SIZE) {
+            memcpy(&cs->buffer[cs->received], &fIn[pos + hdr], chunk);
+        }
+        cs->received += chunk;
+        pos += hdr + chunk;
+
+        if (cs->received >= cs->length) {
+            if (cs->length <= RTMP_IN_MESSAGE_SIZE) {
+                handleMessage(cs->type, cs->streamId, cs->buffer, cs->length);
+                if (fSocket < 0) return;
+            }
+            cs->received = 0;
+        }
+    }
+
+    memmove(fIn, &fIn[pos], fInSize - pos);
+    fInSize -= pos;
+}
+
+void RTMPPublisher::handleMessage(unsigned type, u_int32_t /*streamId*/,
+                                  unsigned char const* payload, unsigned size) {
+    switch (type) {
+    case MSG_SET_CHUNK_SIZE:
+        if (size >= 4) fInChunkSize = getBE32(payload) & 0x7FFFFFFF;
+        if (fInChunkSize == 0) fInChunkSize = 128;
+        break;
+    case MSG_WINDOW_ACK_SIZE:
+        if (size >= 4) fWindowAckSize = getBE32(payload);
+        break;
+    case MSG_USER_CONTROL:
+        // Ping request: answer with the same timestamp
+        if ((size >= 6) && (payload[0] == 0) && (payload[1] == 6)) {
+            unsigned char pong[6];
+
+            pong[0] = 0;
+            pong[1] = 7;
+            memcpy(&pong[2], &payload[2], 4);
+            sendMessage(CSID_CONTROL, MSG_USER_CONTROL, 0, 0, pong, sizeof(pong));
+        }
+        break;
+    case MSG_AMF0_COMMAND:
+        handleCommand(payload, size);
+        break;
+    default:
+        break;
+    }
+}
+
+void RTMPPublisher::handleCommand(unsigned char const* payload, unsigned size) {
+    AMFReader reader(payload, size);
+    char name[32];
+    char code[64];
+    double transactionId = 0;
+    double streamId = 0;
+
+    if (!reader.string(name, sizeof(name))) return;
+    reader.number(&transactionId);
+
+    if (strcmp(name, "_result") == 0) {
+        if ((int) transactionId == TXN_CREATE_STREAM) {
+            // Command object (null), then the stream id
+            if (!reader.skip() || !reader.number(&streamId)) {
+                disconnect("invalid createStream result");
+                return;
+            }
+            fStreamId = (u_int32_t) streamId;
+            sendPublish();
+        }
+    } else if (strcmp(name, "_error") == 0) {
+        reader.skip();
+        if (!reader.objectProperty("code", code, sizeof(code))) strcpy(code, "unknown error");
+        disconnect(code);
+    } else if (strcmp(name, "onStatus") == 0) {
+        reader.skip();
+        if (!reader.objectProperty("code", code, sizeof(code))) return;
+        if (strcmp(code, "NetStream.Publish.Start") == 0) {
+            fEnv << "RTMP: publishing " << fStreamName << " on " << fHost << "\n";
+            fState = STATE_PUBLISHING;
+            fPublishStartUs = nowUs();
+            fFirstUs = -1;
+            fWaitKeyframe = True;
+            fSequenceHeaderSent = False;
+        } else if ((strstr(code, "Failed") != NULL) || (strstr(code, "BadName") != NULL) ||
+                   (strstr(code, "Rejected") != NULL)) {
+            disconnect(code);
+        }
+    }
+}
+
+////////// Output //////////
+
+Boolean RTMPPublisher::appendRaw(unsigned char const* data, unsigned size) {
+    if (fQueueTail + size > RTMP_QUEUE_SIZE) {
+        // Compact the queue before giving up
+        memmove(fQueue, &fQueue[fQueueHead], fQueueTail - fQueueHead);
+        fQueueTail -= fQueueHead;
+        fQueueHead = 0;
+        if (fQueueTail + size > RTMP_QUEUE_SIZE) return False;
+    }
+    memcpy(&fQueue[fQueueTail], data, size);
+    fQueueTail += size;
+    if (fQueueTail - fQueueHead > fQueuePeak) fQueuePeak = fQueueTail - fQueueHead;
+
+    return True;
+}
+
+Boolean RTMPPublisher::sendMessage(unsigned csid, unsigned type, u_int32_t streamId, u_int32_t timestamp,
+                                   unsigned char const* payload, unsigned size) {
+    unsigned char header[16];
+    unsigned numChunks = (size + RTMP_OUT_CHUNK_SIZE - 1) / RTMP_OUT_CHUNK_SIZE;
+    Boolean extended = timestamp >= 0xFFFFFF;
+    unsigned total, hdr, chunk, pos;
+
+    if (fSocket < 0) return False;
+    if (numChunks == 0) numChunks = 1;
+
+    // The whole message is queued or nothing
+    total = 12 + (numChunks - 1) + (extended ? 4 * numChunks : 0) + size;
+    if (fQueueTail - fQueueHead + total > RTMP_QUEUE_SIZE) return False;
+
+    // Type 0 chunk header, then type 3 continuations
+    header[0] = csid;
+    putBE24(&header[1], extended ? 0xFFFFFF : timestamp);
+    putBE24(&header[4], size);
+    header[7] = type;
+    header[8] = streamId;
+    header[9] = streamId >> 8;
+    header[10] = streamId >> 16;
+    header[11] = streamId >> 24;
+    hdr = 12;
+    if (extended) {
+        putBE32(&header[hdr], timestamp);
+        hdr += 4;
+    }
+
+    pos = 0;
+    do {
+        chunk = size - pos;
+        if (chunk > RTMP_OUT_CHUNK_SIZE) chunk = RTMP_OUT_CHUNK_SIZE;
+        appendRaw(header, hdr);
+        appendRaw(&payload[pos], chunk);
+        pos += chunk;
+
+        header[0] = 0xC0 | csid;
+        hdr = 1;
+        if (extended) {
+            putBE32(&header[hdr], timestamp);
+            hdr += 4;
+        }
+    } while (pos < size);
+
+    updateHandling();
+    return True;
+}
+
+void RTMPPublisher::sendCommand(char const* name, double transactionId, char const* arg) {
+    AMFWriter command;
+
+    command.string(name);
+    command.number(transactionId);
+    command.null();
+    if (arg != NULL) command.string(arg);
+    sendMessage(CSID_COMMAND, MSG_AMF0_COMMAND, 0, 0, command.data(), command.size());
+}
+
+void RTMPPublisher::sendConnect() {
+    AMFWriter command;
+
+    command.string("connect");
+    command.number(TXN_CONNECT);
+    command.objectStart();
+    command.key("app");
+    command.string(fApp);
+    command.key("type");
+    command.string("nonprivate");
+    command.key("flashVer");
+    command.string("FMLE/3.0 (compatible; rRTSPServer)");
+    command.key("tcUrl");
+    command.string(fTcUrl);
+    command.objectEnd();
+    sendMessage(CSID_COMMAND, MSG_AMF0_COMMAND, 0, 0, command.data(), command.size());
+}
+
+void RTMPPublisher::sendPublish() {
+    AMFWriter command;
+
+    command.string("publish");
+    command.number(TXN_PUBLISH);
+    command.null();
+    command.string(fStreamName);
+    command.string("live");
+    sendMessage(CSID_COMMAND, MSG_AMF0_COMMAND, fStreamId, 0, command.data(), command.size());
+}
+
+void RTMPPublisher::sendControl(unsigned type, u_int32_t value) {
+    unsigned char payload[4];
+
+    putBE32(payload, value);
+    sendMessage(CSID_CONTROL, type, 0, 0, payload, sizeof(payload));
+}
+
+////////// Metrics //////////
+
+void RTMPPublisher::statsTask(void* clientData) {
+    RTMPPublisher* publisher = (RTMPPublisher*) clientData;
+    publisher->statsTask1();
+}
+
+void RTMPPublisher::statsTask1() {
+    unsigned kbps = (unsigned) ((fBytesSent - fLastBytesSent) * 8 * 1000000 / RTMP_STATS_INTERVAL_US / 1000);
+    unsigned queued = fQueueTail - fQueueHead;
+    FILE* f;
+
+    fLastBytesSent = fBytesSent;
+
+    if (fState == STATE_PUBLISHING) {
+        fEnv << "RTMP: " << kbps << " kbps, queue " << queued << " bytes (peak " << fQueuePeak
+             << "), " << fFramesSent << " frames sent, " << fFramesDropped << " dropped\n";
+    }
+
+    f = fopen(RTMP_STATS_FILE, "w");
+    if (f != NULL) {
+        fprintf(f, "state=%s\n", stateNames[fState]);
+        fprintf(f, "kbps=%u\n", kbps);
+        fprintf(f, "queue_bytes=%u\n", queued);
+        fprintf(f, "queue_peak_bytes=%u\n", fQueuePeak);
+        fprintf(f, "queue_size=%u\n", RTMP_QUEUE_SIZE);
+        fprintf(f, "bytes_sent=%llu\n", (unsigned long long) fBytesSent);
+        fprintf(f, "frames_sent=%u\n", fFramesSent);
+        fprintf(f, "frames_dropped=%u\n", fFramesDropped);
+        fprintf(f, "reconnects=%u\n", fReconnects);
+        fclose(f);
+    }
+
+    fStatsTask = fEnv.taskScheduler().scheduleDelayedTask(RTMP_STATS_INTERVAL_US, statsTask, this);
+}
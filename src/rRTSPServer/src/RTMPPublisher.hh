@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Pushes one stream as FLV over RTMP to a relay, which then serves the
+ * viewers: the camera sends the stream only once.
+ * The NAL units come from a replica of the live input, they are grouped
+ * in access units and sent as AVC video tags, the SPS/PPS go in the AVC
+ * sequence header.
+ * The socket is non blocking and driven by the live555 event loop: the
+ * chunks are queued and written when the socket is writable. When the
+ * queue is full the frames are dropped until the next keyframe.
+ * On errors the publisher reconnects with exponential backoff.
+ * A host name is resolved by a thread at each connection, getaddrinfo
+ * would block the event loop; a numeric address is used as it is.
+ */
+
+#ifndef _RTMP_PUBLISHER_HH
+#define _RTMP_PUBLISHER_HH
+
+#include "liveMedia.hh"
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define RTMP_DEFAULT_PORT        1935
+#define RTMP_QUEUE_SIZE          524288
+#define RTMP_IN_BUFFER_SIZE      8192
+#define RTMP_IN_MESSAGE_SIZE     4096
+#define RTMP_IN_CHUNK_STREAMS    8
+#define RTMP_OUT_CHUNK_SIZE      4096
+#define RTMP_HANDSHAKE_SIZE      1536
+#define RTMP_MIN_BACKOFF_MS      1000
+#define RTMP_MAX_BACKOFF_MS      60000
+#define RTMP_STABLE_US           30000000LL
+#define RTMP_STATS_INTERVAL_US   10000000LL
+#define RTMP_STATS_FILE          "/tmp/rRTSPServer_rtmp.stats"
+
+class RTMPPublisher {
+public:
+    // url is rtmp://host[:port]/app/streamName
+    static RTMPPublisher* createNew(UsageEnvironment& env, FramedSource* input,
+                                    char const* url, unsigned frameBufferSize);
+
+    void start();
+
+protected:
+    RTMPPublisher(UsageEnvironment& env, FramedSource* input, unsigned frameBufferSize);
+    virtual ~RTMPPublisher();
+
+    Boolean parseURL(char const* url);
+
+private:
+    // Input
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                            struct timeval presentationTime);
+    static void onInputClosure(void* clientData);
+    static void readNext(void* clientData);
+    void readNext1();
+    void sendAccessUnit(struct timeval presentationTime, Boolean isKeyframe);
+    Boolean sendSequenceHeader(u_int32_t timestamp);
+
+    // Connection
+    static void connectTask(void* clientData);
+    void connect();
+    void connectToAddress();
+    static void* resolverThread(void* clientData);
+    static void resolvedHandler(void* clientData);
+    void resolvedHandler1();
+    void disconnect(char const* reason);
+    void updateHandling();
+    static void socketHandler(void* clientData, int mask);
+    void socketHandler1(int mask);
+    void handleReadable();
+    void handleWritable();
+    void handleHandshake();
+    void parseChunks();
+    void handleMessage(unsigned type, u_int32_t streamId, unsigned char const* payload, unsigned size);
+    void handleCommand(unsigned char const* payload, unsigned size);
+
+    // Output
+    Boolean appendRaw(unsigned char const* data, unsigned size);
+    Boolean sendMessage(unsigned csid, unsigned type, u_int32_t streamId, u_int32_t timestamp,
+                        unsigned char const* payload, unsigned size);
+    void sendCommand(char const* name, double transactionId, char const* arg);
+    void sendConnect();
+    void sendPublish();
+    void sendControl(unsigned type, u_int32_t value);
+
+    // Metrics
+    static void statsTask(void* clientData);
+    void statsTask1();
+
+private:
+    UsageEnvironment& fEnv;
+    FramedSource* fInput;
+    TaskToken fReadTask;
+
+    char* fHost;
+    unsigned fPort;
+    char* fApp;
+    char* fStreamName;
+    char* fTcUrl;
+
+    // Address of the host, written by the resolver thread until it is joined
+    struct sockaddr_in fAddress;
+    Boolean fNumericHost;
+    pthread_t fResolverThread;
+    Boolean fResolving;
+    Boolean fResolveOK;
+    EventTriggerId fResolvedTrigger;
+
+    // Access unit being built: FLV video tag header, then the NAL units
+    // with a 4 bytes length each
+    unsigned char* fAU;
+    unsigned fAUMax;
+    unsigned fAUSize;
+    Boolean fAUKeyframe;
+    unsigned char* fSPS;
+    unsigned fSPSSize;
+    unsigned char* fPPS;
+    unsigned fPPSSize;
+    Boolean fSequenceHeaderSent;
+    Boolean fWaitKeyframe;
+    int64_t fFirstUs;
+
+    // Connection
+    int fState;
+    int fSocket;
+    u_int32_t fStreamId;
+    unsigned char fHandshake[1 + 2 * RTMP_HANDSHAKE_SIZE];
+    unsigned fHandshakeReceived;
+    TaskToken fConnectTask;
+    unsigned fBackoffMs;
+    int64_t fPublishStartUs;
+
+    unsigned char* fQueue;
+    unsigned fQueueHead;
+    unsigned fQueueTail;
+
+    unsigned char fIn[RTMP_IN_BUFFER_SIZE];
+    unsigned fInSize;
+    unsigned fInChunkSize;
+    u_int32_t fBytesReceived;
+    u_int32_t fLastAck;
+    u_int32_t fWindowAckSize;
+
+    struct chunkStream {
+        unsigned csid;
+        u_int32_t timestamp;
+        unsigned length;
+        unsigned type;
+        u_int32_t streamId;
+        Boolean extended;
+        unsigned received;
+        unsigned char buffer[RTMP_IN_MESSAGE_SIZE];
+    } fChunkStreams[RTMP_IN_CHUNK_STREAMS];
+    unsigned fNumChunkStreams;
+
+    // Metrics
+    TaskToken fStatsTask;
+    unsigned fQueuePeak;
+    u_int64_t fBytesSent;
+    u_int64_t fLastBytesSent;
+    unsigned fFramesSent;
+    unsigned fFramesDropped;
+    unsigned fReconnects;
+};
+
+#endif
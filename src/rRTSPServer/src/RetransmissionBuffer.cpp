@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Short history of the RTP packets sent on a stream, used to answer
+ * RTCP generic NACKs (RFC 4585) with retransmissions.
+ */
+
+#include "RetransmissionBuffer.hh"
+
+RetransmissionBuffer::RetransmissionBuffer(unsigned numPackets, unsigned maxPacketSize)
+    : fNumPackets(numPackets < RETRANSMISSION_MAX_PACKETS ? numPackets : RETRANSMISSION_MAX_PACKETS), fMaxPacketSize(maxPacketSize),
+      fNumResent(0), fNumMissed(0) {
+    fData = new unsigned char[fNumPackets * fMaxPacketSize];
+    fSizes = new unsigned[fNumPackets];
+    fSeqNos = new u_int16_t[fNumPackets];
+    fLastResendTimes = new struct timeval[fNumPackets];
+
+    memset(fSizes, 0, fNumPackets * sizeof(unsigned));
+    memset(fSeqNos, 0, fNumPackets * sizeof(u_int16_t));
+    memset(fLastResendTimes, 0, fNumPackets * sizeof(struct timeval));
+}
+
+RetransmissionBuffer::~RetransmissionBuffer() {
+    delete[] fLastResendTimes;
+    delete[] fSeqNos;
+    delete[] fSizes;
+    delete[] fData;
+}
+
+void RetransmissionBuffer::addPacket(u_int16_t seqNo, unsigned char const* packet, unsigned packetSize) {
+    unsigned slot = seqNo % fNumPackets;
+
+    if (packetSize > fMaxPacketSize) {
+        // Can't happen with packets built by our own sink, but don't overflow
+        fSizes[slot] = 0;
+        return;
+    }
+
+    memcpy(&fData[slot * fMaxPacketSize], packet, packetSize);
+    fSizes[slot] = packetSize;
+    fSeqNos[slot] = seqNo;
+    fLastResendTimes[slot].tv_sec = 0;
+    fLastResendTimes[slot].tv_usec = 0;
+}
+
+unsigned char* RetransmissionBuffer::lookupForResend(u_int16_t seqNo, unsigned& packetSize) {
+    unsigned slot = seqNo % fNumPackets;
+    struct timeval timeNow;
+    long long usSinceLastResend;
+
+    if ((fSizes[slot] == 0) || (fSeqNos[slot] != seqNo)) {
+        // Already overwritten by a newer packet
+        fNumMissed++;
+        return NULL;
+    }
+
+    gettimeofday(&timeNow, NULL);
+    usSinceLastResend = (timeNow.tv_sec - fLastResendTimes[slot].tv_sec) * 1000000LL +
+                        (timeNow.tv_usec - fLastResendTimes[slot].tv_usec);
+    if (usSinceLastResend < RETRANSMISSION_HOLDOFF_US) return NULL;
+
+    fLastResendTimes[slot] = timeNow;
+    fNumResent++;
+    packetSize = fSizes[slot];
+
+    return &fData[slot * fMaxPacketSize];
+}
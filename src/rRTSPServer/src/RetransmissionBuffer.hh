@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Short history of the RTP packets sent on a stream, used to answer
+ * RTCP generic NACKs (RFC 4585) with retransmissions.
+ */
+
+#ifndef _RETRANSMISSION_BUFFER_HH
+#define _RETRANSMISSION_BUFFER_HH
+
+#include "liveMedia.hh"
+
+// A retransmitted packet is not sent again for this long, so that a burst of
+// NACKs for the same loss doesn't turn into a burst of duplicates.
+#define RETRANSMISSION_HOLDOFF_US 50000
+
+// Longest history: 1024 packets of 1456 bytes are about 1.5 MB per stream
+#define RETRANSMISSION_MAX_PACKETS 1024
+
+class RetransmissionBuffer {
+public:
+    RetransmissionBuffer(unsigned numPackets, unsigned maxPacketSize);
+    virtual ~RetransmissionBuffer();
+
+    // Stores a copy of an outgoing RTP packet (header included).
+    void addPacket(u_int16_t seqNo, unsigned char const* packet, unsigned packetSize);
+
+    // Returns the stored packet with sequence number "seqNo", or NULL if it
+    // is no longer in the history or was retransmitted very recently.
+    unsigned char* lookupForResend(u_int16_t seqNo, unsigned& packetSize);
+
+    unsigned numResent() const { return fNumResent; }
+    unsigned numMissed() const { return fNumMissed; }
+
+private:
+    unsigned fNumPackets;
+    unsigned fMaxPacketSize;
+    unsigned char* fData;
+    unsigned* fSizes;
+    u_int16_t* fSeqNos;
+    struct timeval* fLastResendTimes;
+    unsigned fNumResent;
+    unsigned fNumMissed;
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * In memory timeshift buffer.
+ */
+
+#include "TimeshiftBuffer.hh"
+#include "NALBufferPool.hh"
+
+#define TIMESHIFT_HEADER_SIZE 12
+#define TIMESHIFT_WRAP 0xFFFFFFFF
+#define NAL_TYPE_SPS 7
+
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+TimeshiftBuffer::TimeshiftBuffer(UsageEnvironment& env, FramedSource* input,
+                                 unsigned seconds, unsigned sizeBytes)
+    : fEnv(env), fInput(input), fSeconds(seconds),
+      fWritePos(0), fTailPos(0), fReadTask(NULL),
+      fKeyframeHead(0), fNumKeyframes(0), fNewestUs(0), fNumListeners(0) {
+    fSize = ALIGN4(sizeBytes);
+    fData = new unsigned char[fSize];
+
+    // A NAL unit is never split: the biggest one takes a quarter of the ring
+    fMaxNALSize = fSize / 4 - TIMESHIFT_HEADER_SIZE;
+    if (fMaxNALSize > NAL_BUFFER_MAX_SIZE) fMaxNALSize = NAL_BUFFER_MAX_SIZE;
+}
+
+TimeshiftBuffer::~TimeshiftBuffer() {
+    fEnv.taskScheduler().unscheduleDelayedTask(fReadTask);
+    Medium::close(fInput);
+    delete[] fData;
+}
+
+void TimeshiftBuffer::startRecording() {
+    readNext1();
+}
+
+u_int32_t TimeshiftBuffer::headerWord(int64_t pos, unsigned index) const {
+    u_int32_t word;
+
+    memcpy(&word, fData + pos % fSize + index * 4, 4);
+    return word;
+}
+
+void TimeshiftBuffer::evict(int64_t endPos) {
+    u_int32_t size;
+
+    // Drop the oldest NAL units until [endPos - fSize, endPos) is free
+    while ((fTailPos < fWritePos) && (fTailPos < endPos - fSize)) {
+        size = headerWord(fTailPos, 0);
+        if (size == TIMESHIFT_WRAP) {
+            fTailPos = (fTailPos / fSize + 1) * fSize;
+        } else {
+            fTailPos += TIMESHIFT_HEADER_SIZE + ALIGN4(size);
+        }
+    }
+}
+
+void TimeshiftBuffer::readNext(void* clientData) {
+    TimeshiftBuffer* buffer = (TimeshiftBuffer*) clientData;
+
+    buffer->fReadTask = NULL;
+    buffer->readNext1();
+}
+
+void TimeshiftBuffer::readNext1() {
+    unsigned offset = fWritePos % fSize;
+    u_int32_t wrap = TIMESHIFT_WRAP;
+
+    // Not enough room before the end of the ring: mark the rest as unused
+    if (fSize - offset < TIMESHIFT_HEADER_SIZE + fMaxNALSize) {
+        evict(fWritePos + fSize - offset);
+        memcpy(fData + offset, &wrap, 4);
+        fWritePos += fSize - offset;
+        offset = 0;
+    }
+    evict(fWritePos + TIMESHIFT_HEADER_SIZE + fMaxNALSize);
+
+    fInput->getNextFrame(fData + offset + TIMESHIFT_HEADER_SIZE, fMaxNALSize,
+                         afterGettingFrame, this, onInputClosure, this);
+}
+
+void TimeshiftBuffer::afterGettingFrame(void* clientData, unsigned frameSize,
+                                        unsigned /*numTruncatedBytes*/,
+                                        struct timeval presentationTime,
+                                        unsigned /*durationInMicroseconds*/) {
+    TimeshiftBuffer* buffer = (TimeshiftBuffer*) clientData;
+    buffer->afterGettingFrame1(frameSize, presentationTime);
+}
+
+void TimeshiftBuffer::afterGettingFrame1(unsigned frameSize, struct timeval presentationTime) {
+    unsigned offset = fWritePos % fSize;
+    u_int32_t header[3];
+    int64_t recordPos = fWritePos;
+    unsigned i, k;
+
+    header[0] = frameSize;
+    header[1] = presentationTime.tv_sec;
+    header[2] = presentationTime.tv_usec;
+    memcpy(fData + offset, header, TIMESHIFT_HEADER_SIZE);
+    fWritePos += TIMESHIFT_HEADER_SIZE + ALIGN4(frameSize);
+    fNewestUs = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec;
+
+    if ((frameSize > 0) && ((fData[offset + TIMESHIFT_HEADER_SIZE] & 0x1F) == NAL_TYPE_SPS)) {
+        if (fNumKeyframes == TIMESHIFT_MAX_KEYFRAMES) {
+            fKeyframeHead = (fKeyframeHead + 1) % TIMESHIFT_MAX_KEYFRAMES;
+            fNumKeyframes--;
+        }
+        k = (fKeyframeHead + fNumKeyframes) % TIMESHIFT_MAX_KEYFRAMES;
+        fKeyframes[k].pos = recordPos;
+        fKeyframes[k].timeUs = fNewestUs;
+        fNumKeyframes++;
+    }
+
+    for (i = 0; i < fNumListeners; i++) {
+        (*fListeners[i].func)(fListeners[i].clientData);
+    }
+
+    // Don't recurse if the input delivers synchronously
+    fReadTask = fEnv.taskScheduler().scheduleDelayedTask(0, readNext, this);
+}
+
+void TimeshiftBuffer::onInputClosure(void* clientData) {
+    TimeshiftBuffer* buffer = (TimeshiftBuffer*) clientData;
+
+    buffer->fEnv << "TimeshiftBuffer: input closed, recording stopped\n";
+}
+
+int64_t TimeshiftBuffer::keyframePosition(unsigned secondsAgo) const {
+    int64_t target = fNewestUs - secondsAgo * 1000000LL;
+    int64_t best = -1;
+    int64_t bestDistance = 0;
+    int64_t distance;
+    unsigned i, k;
+
+    for (i = 0; i < fNumKeyframes; i++) {
+        k = (fKeyframeHead + i) % TIMESHIFT_MAX_KEYFRAMES;
+        if (fKeyframes[k].pos < fTailPos) continue;
+
+        distance = fKeyframes[k].timeUs - target;
+        if (distance < 0) distance = -distance;
+        if ((best < 0) || (distance < bestDistance)) {
+            best = fKeyframes[k].pos;
+            bestDistance = distance;
+        }
+    }
+
+    return best;
+}
+
+int TimeshiftBuffer::readNAL(int64_t& pos, unsigned char* to, unsigned maxSize,
+                             unsigned& size, unsigned& numTruncatedBytes,
+                             struct timeval& presentationTime) const {
+    u_int32_t nalSize;
+
+    while (1) {
+        if (pos < fTailPos) return TIMESHIFT_LOST;
+        if (pos >= fWritePos) return TIMESHIFT_WAIT;
+
+        nalSize = headerWord(pos, 0);
+        if (nalSize != TIMESHIFT_WRAP) break;
+        pos = (pos / fSize + 1) * fSize;
+    }
+
+    size = (nalSize <= maxSize) ? nalSize : maxSize;
+    numTruncatedBytes = nalSize - size;
+    memcpy(to, fData + pos % fSize + TIMESHIFT_HEADER_SIZE, size);
+    presentationTime.tv_sec = headerWord(pos, 1);
+    presentationTime.tv_usec = headerWord(pos, 2);
+    pos += TIMESHIFT_HEADER_SIZE + ALIGN4(nalSize);
+
+    return TIMESHIFT_OK;
+}
+
+Boolean TimeshiftBuffer::addListener(TaskFunc* func, void* clientData) {
+    if (fNumListeners >= TIMESHIFT_MAX_LISTENERS) return False;
+
+    fListeners[fNumListeners].func = func;
+    fListeners[fNumListeners].clientData = clientData;
+    fNumListeners++;
+    return True;
+}
+
+void TimeshiftBuffer::removeListener(void* clientData) {
+    unsigned i;
+
+    for (i = 0; i < fNumListeners; i++) {
+        if (fListeners[i].clientData == clientData) {
+            fListeners[i] = fListeners[--fNumListeners];
+            return;
+        }
+    }
+}
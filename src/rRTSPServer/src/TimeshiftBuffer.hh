@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * In memory timeshift buffer: the last seconds of a stream kept in a
+ * ring of NAL units, with an index of the keyframes (the SPS that
+ * starts every IDR access unit).
+ * Each NAL unit is stored contiguously after a 12 bytes header (size
+ * and presentation time), positions are absolute byte counts so that
+ * the readers can tell when their data has been overwritten.
+ */
+
+#ifndef _TIMESHIFT_BUFFER_HH
+#define _TIMESHIFT_BUFFER_HH
+
+#include "liveMedia.hh"
+
+#define TIMESHIFT_MAX_KEYFRAMES 256
+#define TIMESHIFT_MAX_LISTENERS 8
+
+#define TIMESHIFT_OK   0
+#define TIMESHIFT_WAIT 1
+#define TIMESHIFT_LOST 2
+
+class TimeshiftBuffer {
+public:
+    // input delivers discrete NAL units, sizeBytes is the size of the ring
+    TimeshiftBuffer(UsageEnvironment& env, FramedSource* input, unsigned seconds, unsigned sizeBytes);
+    virtual ~TimeshiftBuffer();
+
+    void startRecording();
+
+    // Position of the keyframe nearest to secondsAgo before the newest
+    // NAL unit, -1 if there is none
+    int64_t keyframePosition(unsigned secondsAgo) const;
+    int64_t writePosition() const { return fWritePos; }
+
+    // Copies the NAL unit at pos and moves pos to the next one.
+    // Returns TIMESHIFT_WAIT at the end of the data and TIMESHIFT_LOST
+    // if the NAL unit has been overwritten.
+    int readNAL(int64_t& pos, unsigned char* to, unsigned maxSize,
+                unsigned& size, unsigned& numTruncatedBytes,
+                struct timeval& presentationTime) const;
+
+    // Called every time a NAL unit is added
+    Boolean addListener(TaskFunc* func, void* clientData);
+    void removeListener(void* clientData);
+
+    unsigned seconds() const { return fSeconds; }
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize,
+                                  unsigned numTruncatedBytes,
+                                  struct timeval presentationTime,
+                                  unsigned durationInMicroseconds);
+    void afterGettingFrame1(unsigned frameSize, struct timeval presentationTime);
+    static void onInputClosure(void* clientData);
+    static void readNext(void* clientData);
+    void readNext1();
+    void evict(int64_t endPos);
+    u_int32_t headerWord(int64_t pos, unsigned index) const;
+
+private:
+    UsageEnvironment& fEnv;
+    FramedSource* fInput;
+    unsigned fSeconds;
+    unsigned char* fData;
+    unsigned fSize;
+    unsigned fMaxNALSize;
+    int64_t fWritePos;
+    int64_t fTailPos;
+    TaskToken fReadTask;
+
+    struct keyframe {
+        int64_t pos;
+        int64_t timeUs;
+    } fKeyframes[TIMESHIFT_MAX_KEYFRAMES];
+    unsigned fKeyframeHead;
+    unsigned fNumKeyframes;
+    int64_t fNewestUs;
+
+    struct listener {
+        TaskFunc* func;
+        void* clientData;
+    } fListeners[TIMESHIFT_MAX_LISTENERS];
+    unsigned fNumListeners;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Subsession for the timeshift streams.
+ */
+
+#include "TimeshiftServerMediaSubsession.hh"
+#include "TimeshiftSource.hh"
+
+TimeshiftServerMediaSubsession* TimeshiftServerMediaSubsession::fSubsessions[TIMESHIFT_MAX_SUBSESSIONS];
+unsigned TimeshiftServerMediaSubsession::fNumSubsessions = 0;
+
+TimeshiftServerMediaSubsession* TimeshiftServerMediaSubsession::createNew(UsageEnvironment& env,
+                                                                          TimeshiftBuffer* buffer,
+                                                                          unsigned nackHistorySize) {
+    if (fNumSubsessions >= TIMESHIFT_MAX_SUBSESSIONS) return NULL;
+
+    return new TimeshiftServerMediaSubsession(env, buffer, nackHistorySize);
+}
+
+TimeshiftServerMediaSubsession* TimeshiftServerMediaSubsession::lookup(ServerMediaSubsession* subsession) {
+    unsigned i;
+
+    for (i = 0; i < fNumSubsessions; i++) {
+        if (fSubsessions[i] == subsession) return fSubsessions[i];
+    }
+    return NULL;
+}
+
+TimeshiftServerMediaSubsession::TimeshiftServerMediaSubsession(UsageEnvironment& env,
+                                                               TimeshiftBuffer* buffer,
+                                                               unsigned nackHistorySize)
+    // Every client has its own position in the buffer
+    : H264VideoLiveServerMediaSubsession(env, NULL, False, nackHistorySize, NULL),
+      fBuffer(buffer) {
+    fSources = HashTable::create(ONE_WORD_HASH_KEYS);
+    fSubsessions[fNumSubsessions++] = this;
+}
+
+TimeshiftServerMediaSubsession::~TimeshiftServerMediaSubsession() {
+    unsigned i;
+
+    for (i = 0; i < fNumSubsessions; i++) {
+        if (fSubsessions[i] == this) {
+            fSubsessions[i] = fSubsessions[--fNumSubsessions];
+            break;
+        }
+    }
+    delete fSources;
+}
+
+FramedSource* TimeshiftServerMediaSubsession::createNewStreamSource(unsigned clientSessionId,
+                                                                    unsigned& estBitrate) {
+    TimeshiftSource* source;
+
+    estBitrate = 500; // kbps, estimate
+
+    source = TimeshiftSource::createNew(envir(), fBuffer, fBuffer->seconds());
+    fSources->Add((char const*) (unsigned long) clientSessionId, source);
+
+    return source;
+}
+
+void TimeshiftServerMediaSubsession::closeStreamSource(FramedSource* inputSource) {
+    HashTable::Iterator* iter = HashTable::Iterator::create(*fSources);
+    char const* key;
+    void* source;
+
+    while ((source = iter->next(key)) != NULL) {
+        if (source == inputSource) {
+            fSources->Remove(key);
+            break;
+        }
+    }
+    delete iter;
+
+    Medium::close(inputSource);
+}
+
+void TimeshiftServerMediaSubsession::setSecondsAgo(unsigned clientSessionId, unsigned secondsAgo) {
+    TimeshiftSource* source;
+
+    source = (TimeshiftSource*) fSources->Lookup((char const*) (unsigned long) clientSessionId);
+    if (source != NULL) source->setSecondsAgo(secondsAgo);
+}
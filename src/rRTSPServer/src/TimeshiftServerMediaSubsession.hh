@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Subsession for the timeshift streams: every client gets its own
+ * TimeshiftSource reading the shared TimeshiftBuffer of the stream.
+ * A PLAY with "Range: npt=-N" starts N seconds ago, the default is the
+ * whole buffer.
+ */
+
+#ifndef _TIMESHIFT_SERVER_MEDIA_SUBSESSION_HH
+#define _TIMESHIFT_SERVER_MEDIA_SUBSESSION_HH
+
+#include "H264VideoLiveServerMediaSubsession.hh"
+#include "TimeshiftBuffer.hh"
+
+#define TIMESHIFT_MAX_SUBSESSIONS 4
+
+class TimeshiftServerMediaSubsession: public H264VideoLiveServerMediaSubsession {
+public:
+    static TimeshiftServerMediaSubsession* createNew(UsageEnvironment& env, TimeshiftBuffer* buffer,
+                                                     unsigned nackHistorySize = 0);
+
+    // The timeshift subsession behind subsession, or NULL
+    static TimeshiftServerMediaSubsession* lookup(ServerMediaSubsession* subsession);
+
+    // Called before the PLAY of the client session starts the stream
+    void setSecondsAgo(unsigned clientSessionId, unsigned secondsAgo);
+
+protected:
+    TimeshiftServerMediaSubsession(UsageEnvironment& env, TimeshiftBuffer* buffer,
+                                   unsigned nackHistorySize);
+    virtual ~TimeshiftServerMediaSubsession();
+
+protected: // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual void closeStreamSource(FramedSource* inputSource);
+
+private:
+    TimeshiftBuffer* fBuffer;
+    HashTable* fSources;
+
+    static TimeshiftServerMediaSubsession* fSubsessions[TIMESHIFT_MAX_SUBSESSIONS];
+    static unsigned fNumSubsessions;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Source of a timeshift session.
+ */
+
+#include "TimeshiftSource.hh"
+#include "GroupsockHelper.hh"
+
+#define NAL_TYPE_SPS 7
+
+static int64_t nowUs() {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+TimeshiftSource* TimeshiftSource::createNew(UsageEnvironment& env, TimeshiftBuffer* buffer,
+                                            unsigned secondsAgo) {
+    return new TimeshiftSource(env, buffer, secondsAgo);
+}
+
+TimeshiftSource::TimeshiftSource(UsageEnvironment& env, TimeshiftBuffer* buffer, unsigned secondsAgo)
+    : FramedSource(env), fBuffer(buffer), fSecondsAgo(secondsAgo),
+      fStarted(False), fWaitingForData(False), fWaitingForKeyframe(False), fLive(False), fPos(0),
+      fFirstRecordedUs(0), fOutputStartUs(0), fLastRecordedUs(0), fLastOutputUs(0), fLiveOffsetUs(0) {
+    fBuffer->addListener(newDataHandler, this);
+}
+
+TimeshiftSource::~TimeshiftSource() {
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    fBuffer->removeListener(this);
+}
+
+void TimeshiftSource::setSecondsAgo(unsigned secondsAgo) {
+    if (!fStarted) fSecondsAgo = secondsAgo;
+}
+
+void TimeshiftSource::doGetNextFrame() {
+    if (!fStarted) {
+        fStarted = True;
+        fPos = fBuffer->keyframePosition(fSecondsAgo);
+        if (fPos < 0) {
+            // Nothing recorded yet: start live at the next keyframe
+            fPos = fBuffer->writePosition();
+            fWaitingForKeyframe = True;
+        }
+    }
+
+    deliver();
+}
+
+void TimeshiftSource::doStopGettingFrames() {
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+    fWaitingForData = False;
+}
+
+void TimeshiftSource::newDataHandler(void* clientData) {
+    TimeshiftSource* source = (TimeshiftSource*) clientData;
+
+    if (source->fWaitingForData && source->isCurrentlyAwaitingData()) {
+        source->fWaitingForData = False;
+        source->deliver();
+    }
+}
+
+void TimeshiftSource::deliver() {
+    struct timeval presentationTime;
+    int64_t recordedUs, outputUs, delay;
+    int result;
+
+    while (1) {
+        result = fBuffer->readNAL(fPos, fTo, fMaxSize, fFrameSize, fNumTruncatedBytes, presentationTime);
+        if (result == TIMESHIFT_LOST) {
+            // We were too slow and the ring wrapped over us
+            envir() << "TimeshiftSource: data overwritten, jumping to the newest keyframe\n";
+            fPos = fBuffer->keyframePosition(0);
+            if (fPos < 0) {
+                fPos = fBuffer->writePosition();
+                fWaitingForKeyframe = True;
+            }
+            continue;
+        }
+        if (result == TIMESHIFT_WAIT) {
+            if (!fLive && (fFirstRecordedUs != 0)) {
+                // Caught up: follow the live stream from now on
+                fLive = True;
+                fLiveOffsetUs = fLastOutputUs - fLastRecordedUs;
+            }
+            fWaitingForData = True;
+            return;
+        }
+
+        if (fWaitingForKeyframe) {
+            if ((fFrameSize == 0) || ((fTo[0] & 0x1F) != NAL_TYPE_SPS)) continue;
+            fWaitingForKeyframe = False;
+        }
+        break;
+    }
+
+    recordedUs = presentationTime.tv_sec * 1000000LL + presentationTime.tv_usec;
+    if (fFirstRecordedUs == 0) {
+        fFirstRecordedUs = recordedUs;
+        fOutputStartUs = nowUs();
+    }
+
+    if (fLive) {
+        outputUs = recordedUs + fLiveOffsetUs;
+    } else {
+        // Replay the recorded frames at the catch up speed
+        outputUs = fOutputStartUs + (recordedUs - fFirstRecordedUs) * 100 / TIMESHIFT_CATCHUP_PERCENT;
+    }
+    if (outputUs < fLastOutputUs) outputUs = fLastOutputUs;
+    fLastRecordedUs = recordedUs;
+    fLastOutputUs = outputUs;
+
+    fPresentationTime.tv_sec = outputUs / 1000000;
+    fPresentationTime.tv_usec = outputUs % 1000000;
+    fDurationInMicroseconds = 0;
+
+    delay = fLive ? 0 : outputUs - nowUs();
+    if (delay < 0) delay = 0;
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(delay, (TaskFunc*) FramedSource::afterGetting, this);
+}
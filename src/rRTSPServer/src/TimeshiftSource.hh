@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Source of a timeshift session: it starts from the keyframe nearest to
+ * N seconds ago in a TimeshiftBuffer, plays a bit faster than real time
+ * until it catches up with the live stream, then follows it.
+ */
+
+#ifndef _TIMESHIFT_SOURCE_HH
+#define _TIMESHIFT_SOURCE_HH
+
+#include "TimeshiftBuffer.hh"
+
+// Catch up speed, in percent of the real time
+#define TIMESHIFT_CATCHUP_PERCENT 125
+
+class TimeshiftSource: public FramedSource {
+public:
+    static TimeshiftSource* createNew(UsageEnvironment& env, TimeshiftBuffer* buffer,
+                                      unsigned secondsAgo);
+
+    // Only before the first frame is delivered
+    void setSecondsAgo(unsigned secondsAgo);
+
+protected:
+    TimeshiftSource(UsageEnvironment& env, TimeshiftBuffer* buffer, unsigned secondsAgo);
+    virtual ~TimeshiftSource();
+
+protected: // redefined virtual functions
+    virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
+
+private:
+    static void newDataHandler(void* clientData);
+    void deliver();
+
+private:
+    TimeshiftBuffer* fBuffer;
+    unsigned fSecondsAgo;
+    Boolean fStarted;
+    Boolean fWaitingForData;
+    Boolean fWaitingForKeyframe;
+    Boolean fLive;
+    int64_t fPos;
+
+    int64_t fFirstRecordedUs;
+    int64_t fOutputStartUs;
+    int64_t fLastRecordedUs;
+    int64_t fLastOutputUs;
+    int64_t fLiveOffsetUs;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Separate "application/ulpfec" RTP stream carrying the XOR FEC packets
+ * of a video subsession (RFC 5109, section 7).
+ */
+
+#include "ULPFECServerMediaSubsession.hh"
+
+ULPFECServerMediaSubsession* ULPFECServerMediaSubsession::createNew(UsageEnvironment& env, ULPFECEncoder* encoder) {
+    return new ULPFECServerMediaSubsession(env, encoder);
+}
+
+ULPFECServerMediaSubsession::ULPFECServerMediaSubsession(UsageEnvironment& env, ULPFECEncoder* encoder)
+    // All the clients share the same FEC packets, like they share the video
+    : OnDemandServerMediaSubsession(env, True), fEncoder(encoder) {
+}
+
+ULPFECServerMediaSubsession::~ULPFECServerMediaSubsession() {
+}
+
+FramedSource* ULPFECServerMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate) {
+    // kbps, a small fraction of the video it protects
+    estBitrate = 100 + 2000 / fEncoder->groupSize();
+
+    return ULPFECSource::createNew(envir(), fEncoder);
+}
+
+RTPSink* ULPFECServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* /*inputSource*/) {
+    RTPSink* sink;
+    unsigned savedMaxSize;
+
+    // FEC packets are small, don't let the sink allocate a video sized buffer
+    savedMaxSize = OutPacketBuffer::maxSize;
+    OutPacketBuffer::maxSize = ULPFEC_QUEUE_LEN * ULPFEC_MAX_PACKET_SIZE;
+    sink = SimpleRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, 90000,
+                                    "application", "ulpfec", 1, False);
+    OutPacketBuffer::maxSize = savedMaxSize;
+
+    return sink;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Separate "application/ulpfec" RTP stream carrying the XOR FEC packets
+ * of a video subsession (RFC 5109, section 7).
+ */
+
+#ifndef _ULPFEC_SERVER_MEDIA_SUBSESSION_HH
+#define _ULPFEC_SERVER_MEDIA_SUBSESSION_HH
+
+#include "liveMedia.hh"
+#include "ULPFECSource.hh"
+
+class ULPFECServerMediaSubsession: public OnDemandServerMediaSubsession {
+public:
+    static ULPFECServerMediaSubsession* createNew(UsageEnvironment& env, ULPFECEncoder* encoder);
+
+protected:
+    ULPFECServerMediaSubsession(UsageEnvironment& env, ULPFECEncoder* encoder);
+    virtual ~ULPFECServerMediaSubsession();
+
+protected: // redefined virtual functions
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource);
+
+private:
+    ULPFECEncoder* fEncoder;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * XOR forward error correction (RFC 5109, "ulpfec") for the H.264 streams.
+ */
+
+#include "ULPFECSource.hh"
+
+////////// ULPFECEncoder //////////
+
+ULPFECEncoder::ULPFECEncoder(unsigned groupSize)
+    : fGroupSize(groupSize), fSource(NULL) {
+    if (fGroupSize < 2) fGroupSize = 2;
+    if (fGroupSize > ULPFEC_MAX_GROUP_SIZE) fGroupSize = ULPFEC_MAX_GROUP_SIZE;
+    resetGroup();
+}
+
+ULPFECEncoder::~ULPFECEncoder() {
+}
+
+void ULPFECEncoder::setSource(ULPFECSource* source) {
+    fSource = source;
+    resetGroup();
+}
+
+void ULPFECEncoder::resetGroup() {
+    fNumProtected = 0;
+    fSNBase = 0;
+    fMask = 0;
+    fRecoveryByte0 = 0;
+    fRecoveryByte1 = 0;
+    fTSRecovery = 0;
+    fLengthRecovery = 0;
+    fProtectionLength = 0;
+    memset(fPacket, 0, sizeof(fPacket));
+}
+
+void ULPFECEncoder::addMediaPacket(unsigned char const* packet, unsigned packetSize) {
+    unsigned char* payload = &fPacket[ULPFEC_HEADER_SIZE + ULPFEC_LEVEL_HEADER_SIZE];
+    u_int16_t seqNo;
+    u_int16_t offset;
+    unsigned length;
+    unsigned i;
+
+    // Nobody is receiving the FEC stream
+    if (fSource == NULL) return;
+
+    if ((packetSize < 12) || (packetSize > ULPFEC_MAX_MEDIA_PACKET_SIZE)) return;
+
+    seqNo = (packet[2] << 8) | packet[3];
+    if (fNumProtected == 0) {
+        fSNBase = seqNo;
+    }
+    offset = seqNo - fSNBase;
+    if (offset >= 16) {
+        // Gap in the sequence numbers, the mask can't describe it
+        flushGroup();
+        fSNBase = seqNo;
+        offset = 0;
+    }
+
+    length = packetSize - 12;
+    fRecoveryByte0 ^= packet[0];
+    fRecoveryByte1 ^= packet[1];
+    fTSRecovery ^= (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+    fLengthRecovery ^= length;
+    fMask |= 0x8000 >> offset;
+    for (i = 0; i < length; i++) {
+        payload[i] ^= packet[12 + i];
+    }
+    if (length > fProtectionLength) fProtectionLength = length;
+    fNumProtected++;
+
+    if (fNumProtected == fGroupSize) flushGroup();
+}
+
+void ULPFECEncoder::flushGroup() {
+    if ((fNumProtected > 0) && (fSource != NULL)) {
+        // FEC header: E = 0, L = 0 (16 bit mask), then the recovery fields
+        fPacket[0] = fRecoveryByte0 & 0x3F;
+        fPacket[1] = fRecoveryByte1;
+        fPacket[2] = fSNBase >> 8;
+        fPacket[3] = fSNBase & 0xFF;
+        fPacket[4] = fTSRecovery >> 24;
+        fPacket[5] = (fTSRecovery >> 16) & 0xFF;
+        fPacket[6] = (fTSRecovery >> 8) & 0xFF;
+        fPacket[7] = fTSRecovery & 0xFF;
+        fPacket[8] = fLengthRecovery >> 8;
+        fPacket[9] = fLengthRecovery & 0xFF;
+        // ULP level 0 header
+        fPacket[10] = fProtectionLength >> 8;
+        fPacket[11] = fProtectionLength & 0xFF;
+        fPacket[12] = fMask >> 8;
+        fPacket[13] = fMask & 0xFF;
+
+        fSource->deliverFECPacket(fPacket, ULPFEC_HEADER_SIZE + ULPFEC_LEVEL_HEADER_SIZE + fProtectionLength);
+    }
+    resetGroup();
+}
+
+////////// ULPFECSource //////////
+
+ULPFECSource* ULPFECSource::createNew(UsageEnvironment& env, ULPFECEncoder* encoder) {
+    return new ULPFECSource(env, encoder);
+}
+
+ULPFECSource::ULPFECSource(UsageEnvironment& env, ULPFECEncoder* encoder)
+    : FramedSource(env), fEncoder(encoder), fQueueHead(0), fQueueLen(0) {
+    fEncoder->setSource(this);
+}
+
+ULPFECSource::~ULPFECSource() {
+    fEncoder->setSource(NULL);
+}
+
+unsigned ULPFECSource::maxFrameSize() const {
+    return ULPFEC_MAX_PACKET_SIZE;
+}
+
+void ULPFECSource::deliverFECPacket(unsigned char const* packet, unsigned packetSize) {
+    unsigned tail;
+
+    if (fQueueLen == ULPFEC_QUEUE_LEN) {
+        // The sink is not keeping up: an old FEC packet is useless anyway
+        fQueueHead = (fQueueHead + 1) % ULPFEC_QUEUE_LEN;
+        fQueueLen--;
+    }
+    tail = (fQueueHead + fQueueLen) % ULPFEC_QUEUE_LEN;
+    memcpy(fQueue[tail], packet, packetSize);
+    fQueueSizes[tail] = packetSize;
+    fQueueLen++;
+
+    if (isCurrentlyAwaitingData()) deliverQueuedPacket();
+}
+
+void ULPFECSource::doGetNextFrame() {
+    if (fQueueLen > 0) deliverQueuedPacket();
+}
+
+void ULPFECSource::deliverQueuedPacket() {
+    unsigned packetSize = fQueueSizes[fQueueHead];
+
+    if (packetSize > fMaxSize) {
+        fNumTruncatedBytes = packetSize - fMaxSize;
+        packetSize = fMaxSize;
+    } else {
+        fNumTruncatedBytes = 0;
+    }
+    memcpy(fTo, fQueue[fQueueHead], packetSize);
+    fFrameSize = packetSize;
+    gettimeofday(&fPresentationTime, NULL);
+    fDurationInMicroseconds = 0;
+
+    fQueueHead = (fQueueHead + 1) % ULPFEC_QUEUE_LEN;
+    fQueueLen--;
+
+    FramedSource::afterGetting(this);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * XOR forward error correction (RFC 5109, "ulpfec") for the H.264 streams.
+ * The encoder is fed with the media packets sent by the video sink and the
+ * source delivers the resulting FEC packets to a separate RTP stream.
+ */
+
+#ifndef _ULPFEC_SOURCE_HH
+#define _ULPFEC_SOURCE_HH
+
+#include "liveMedia.hh"
+
+// A level 0 FEC header with a 16 bit mask protects at most 16 packets
+#define ULPFEC_MAX_GROUP_SIZE 16
+#define ULPFEC_HEADER_SIZE 10
+#define ULPFEC_LEVEL_HEADER_SIZE 4
+// Media packets are kept small enough that their FEC packet still fits
+// in a live555 sized RTP packet (1456 bytes)
+#define ULPFEC_MAX_MEDIA_PACKET_SIZE 1442
+#define ULPFEC_MAX_PACKET_SIZE (ULPFEC_HEADER_SIZE + ULPFEC_LEVEL_HEADER_SIZE + ULPFEC_MAX_MEDIA_PACKET_SIZE - 12)
+#define ULPFEC_QUEUE_LEN 8
+
+class ULPFECSource;
+
+class ULPFECEncoder {
+public:
+    ULPFECEncoder(unsigned groupSize);
+    virtual ~ULPFECEncoder();
+
+    // Protects an outgoing RTP packet (header included)
+    void addMediaPacket(unsigned char const* packet, unsigned packetSize);
+
+    // The FEC source currently streaming, or NULL if nobody is watching
+    void setSource(ULPFECSource* source);
+
+    unsigned groupSize() const { return fGroupSize; }
+
+private:
+    void resetGroup();
+    void flushGroup();
+
+private:
+    unsigned fGroupSize;
+    unsigned fNumProtected;
+    u_int16_t fSNBase;
+    u_int16_t fMask;
+    unsigned char fRecoveryByte0;
+    unsigned char fRecoveryByte1;
+    u_int32_t fTSRecovery;
+    u_int16_t fLengthRecovery;
+    unsigned fProtectionLength;
+    unsigned char fPacket[ULPFEC_MAX_PACKET_SIZE];
+    ULPFECSource* fSource;
+};
+
+class ULPFECSource: public FramedSource {
+public:
+    static ULPFECSource* createNew(UsageEnvironment& env, ULPFECEncoder* encoder);
+
+    void deliverFECPacket(unsigned char const* packet, unsigned packetSize);
+
+    virtual unsigned maxFrameSize() const;
+
+protected:
+    ULPFECSource(UsageEnvironment& env, ULPFECEncoder* encoder);
+    virtual ~ULPFECSource();
+
+private:
+    virtual void doGetNextFrame();
+    void deliverQueuedPacket();
+
+private:
+    ULPFECEncoder* fEncoder;
+    unsigned char fQueue[ULPFEC_QUEUE_LEN][ULPFEC_MAX_PACKET_SIZE];
+    unsigned fQueueSizes[ULPFEC_QUEUE_LEN];
+    unsigned fQueueHead;
+    unsigned fQueueLen;
+};
+
+#endif
@@ -20,16 +20,40 @@
 
 #include "liveMedia.hh"
 #include "BasicUsageEnvironment.hh"
+#include "H264VideoLiveServerMediaSubsession.hh"
+#include "ULPFECServerMediaSubsession.hh"
+#include "AdmissionRTSPServer.hh"
+#include "H264AdaptiveServerMediaSubsession.hh"
+#include "TimeshiftServerMediaSubsession.hh"
+#include "MJPEGServerMediaSubsession.hh"
+#include "LiveStreamInput.hh"
+#include "HotRestart.hh"
+#include "RTMPPublisher.hh"
+#include "HLSServer.hh"
+#include "RetransmissionBuffer.hh"
 
 #include <getopt.h>
 #include <errno.h>
 #include <limits.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 
 #define RESOLUTION_NONE 0
 #define RESOLUTION_LOW  360
 #define RESOLUTION_HIGH 1080
 #define RESOLUTION_BOTH 1440
 
+// Bitrates used by the admission control until the real ones are measured
+#define HIGH_ESTIMATED_KBPS 1500
+#define LOW_ESTIMATED_KBPS  300
+
+// NAL buffer sizes used until the biggest NAL unit of each stream is known
+#define HIGH_NAL_BUFFER_SIZE 150000
+#define LOW_NAL_BUFFER_SIZE  50000
+
+// Timeshift ring size per second of stream, 50% more than the estimate
+#define TIMESHIFT_BYTES_PER_SECOND(kbps) ((kbps) * 1000 / 8 * 3 / 2)
+
 UsageEnvironment* env;
 
 // To make the second and subsequent client for each stream reuse the same
@@ -52,13 +76,45 @@ static void announceStream(RTSPServer* rtspServer, ServerMediaSession* sms,
     delete[] url;
 }
 
+// Port a listening socket is bound to
+static int socketPort(int sock) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(sock, (struct sockaddr*) &addr, &len) < 0) return -1;
+    return ntohs(addr.sin_port);
+}
+
 void print_usage(char *progname)
 {
-    fprintf(stderr, "\nUsage: %s [-r RES] [-p PORT] [-d]\n\n", progname);
+    fprintf(stderr, "\nUsage: %s [-r RES] [-p PORT] [-n PACKETS] [-f GROUP] [-s SESSIONS] [-b KBPS] [-a ADDRESS] [-t SECONDS] [-j FPS] [-R URL] [-S RES] [-l PORT] [-H] [-d]\n\n", progname);
     fprintf(stderr, "\t-r RES,  --resolution RES\n");
     fprintf(stderr, "\t\tset resolution: low, high or both (default high)\n");
+    fprintf(stderr, "\t\tboth also adds the adaptive stream ch0_auto.h264\n");
     fprintf(stderr, "\t-p PORT, --port PORT\n");
     fprintf(stderr, "\t\tset TCP port (default 554)\n");
+    fprintf(stderr, "\t-n PACKETS, --nack PACKETS\n");
+    fprintf(stderr, "\t\tkeep the last PACKETS RTP packets to answer RTCP NACKs, up to 1024 (default 0, disabled)\n");
+    fprintf(stderr, "\t-f GROUP, --fec GROUP\n");
+    fprintf(stderr, "\t\tadd an ulpfec stream with 1 FEC packet every GROUP packets, 2 - 16 (default 0, disabled)\n");
+    fprintf(stderr, "\t-s SESSIONS, --max-sessions SESSIONS\n");
+    fprintf(stderr, "\t\tmax sessions per stream, N or HIGH,LOW (default 0, unlimited)\n");
+    fprintf(stderr, "\t-b KBPS, --bandwidth KBPS\n");
+    fprintf(stderr, "\t\ttotal bandwidth for all the sessions (default 0, unlimited)\n");
+    fprintf(stderr, "\t-a ADDRESS, --priority ADDRESS\n");
+    fprintf(stderr, "\t\tclient always admitted, e.g. the NVR, with one stream kept in the bandwidth (can be repeated)\n");
+    fprintf(stderr, "\t-t SECONDS, --timeshift SECONDS\n");
+    fprintf(stderr, "\t\tkeep the last SECONDS of video in RAM for the ch0_X_ts streams (default 0, disabled)\n");
+    fprintf(stderr, "\t-j FPS,  --mjpeg FPS\n");
+    fprintf(stderr, "\t\tadd the MJPEG stream ch0_1.mjpeg, one JPEG per keyframe up to FPS per second (default 0, disabled)\n");
+    fprintf(stderr, "\t-R URL,  --rtmp URL\n");
+    fprintf(stderr, "\t\tpush a stream to the RTMP relay URL, rtmp://host[:port]/app/stream (default disabled)\n");
+    fprintf(stderr, "\t-S RES,  --rtmp-stream RES\n");
+    fprintf(stderr, "\t\tstream pushed to the RTMP relay: low or high (default high)\n");
+    fprintf(stderr, "\t-l PORT, --hls PORT\n");
+    fprintf(stderr, "\t\tserve low latency HLS on the HTTP port PORT, /ch0_X/index.m3u8 (default 0, disabled)\n");
+    fprintf(stderr, "\t-H,      --hot-restart\n");
+    fprintf(stderr, "\t\ttake over the listening socket of a running server and let the next one take it\n");
     fprintf(stderr, "\t-d,      --debug\n");
     fprintf(stderr, "\t\tenable debug\n");
     fprintf(stderr, "\t-h,      --help\n");
@@ -77,13 +133,41 @@ int main(int argc, char** argv)
     // Setting default
     int resolution = RESOLUTION_HIGH;
     int port = 554;
+    int nack = 0;
+    int fec = 0;
+    unsigned maxSessionsHigh = 0;
+    unsigned maxSessionsLow = 0;
+    unsigned bandwidth = 0;
+    netAddressBits priorityAddresses[ADMISSION_MAX_PRIORITY_ADDRESSES];
+    int numPriorityAddresses = 0;
+    int timeshift = 0;
+    int mjpegFps = 0;
+    char rtmpUrl[256];
+    int rtmpResolution = RESOLUTION_HIGH;
+    int hlsPort = 0;
+    int hotRestart = 0;
+    int serverSocket = -1;
     int debug = 0;
+    int i;
+
+    rtmpUrl[0] = '\0';
 
     while (1) {
         static struct option long_options[] =
         {
             {"resolution",  required_argument, 0, 'r'},
             {"port",  required_argument, 0, 'p'},
+            {"nack",  required_argument, 0, 'n'},
+            {"fec",  required_argument, 0, 'f'},
+            {"max-sessions",  required_argument, 0, 's'},
+            {"bandwidth",  required_argument, 0, 'b'},
+            {"priority",  required_argument, 0, 'a'},
+            {"timeshift",  required_argument, 0, 't'},
+            {"mjpeg",  required_argument, 0, 'j'},
+            {"rtmp",  required_argument, 0, 'R'},
+            {"rtmp-stream",  required_argument, 0, 'S'},
+            {"hls",  required_argument, 0, 'l'},
+            {"hot-restart",  no_argument, 0, 'H'},
             {"debug",  no_argument, 0, 'd'},
             {"help",  no_argument, 0, 'h'},
             {0, 0, 0, 0}
@@ -91,7 +175,7 @@ int main(int argc, char** argv)
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "r:p:dh",
+        c = getopt_long (argc, argv, "r:p:n:f:s:b:a:t:j:R:S:l:Hdh",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -124,6 +208,75 @@ int main(int argc, char** argv)
             }
             break;
 
+        case 'n':
+        case 'f':
+        case 't':
+        case 'j':
+        case 'l':
+            errno = 0;    /* To distinguish success/failure after call */
+            nm = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno != 0) || (endptr == optarg) || (nm < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (c == 'n') {
+                nack = nm;
+            } else if (c == 'f') {
+                fec = nm;
+            } else if (c == 't') {
+                timeshift = nm;
+            } else if (c == 'j') {
+                mjpegFps = nm;
+            } else {
+                hlsPort = nm;
+            }
+            break;
+
+        case 's':
+            c = sscanf(optarg, "%u,%u", &maxSessionsHigh, &maxSessionsLow);
+            if (c == 1) {
+                maxSessionsLow = maxSessionsHigh;
+            } else if (c != 2) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'b':
+            if (sscanf(optarg, "%u", &bandwidth) != 1) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'a':
+            if ((numPriorityAddresses >= ADMISSION_MAX_PRIORITY_ADDRESSES) ||
+                    (inet_pton(AF_INET, optarg, &priorityAddresses[numPriorityAddresses]) != 1)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            numPriorityAddresses++;
+            break;
+
+        case 'R':
+            strncpy(rtmpUrl, optarg, sizeof(rtmpUrl) - 1);
+            rtmpUrl[sizeof(rtmpUrl) - 1] = '\0';
+            break;
+
+        case 'S':
+            if (strcasecmp("low", optarg) == 0) {
+                rtmpResolution = RESOLUTION_LOW;
+            } else if (strcasecmp("high", optarg) == 0) {
+                rtmpResolution = RESOLUTION_HIGH;
+            }
+            break;
+
+        case 'H':
+            hotRestart = 1;
+            break;
+
         case 'd':
             fprintf (stderr, "debug on\n");
             debug = 1;
@@ -161,6 +314,92 @@ int main(int argc, char** argv)
         port = nm;
     }
 
+    str = getenv("RRTSP_NACK");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        nack = nm;
+    }
+    if (nack > RETRANSMISSION_MAX_PACKETS) {
+        fprintf(stderr, "NACK history must be at most %d packets\n", RETRANSMISSION_MAX_PACKETS);
+        exit(EXIT_FAILURE);
+    }
+
+    str = getenv("RRTSP_FEC");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        fec = nm;
+    }
+    if ((fec == 1) || (fec > ULPFEC_MAX_GROUP_SIZE)) {
+        fprintf(stderr, "FEC group size must be between 2 and %d\n", ULPFEC_MAX_GROUP_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    str = getenv("RRTSP_TIMESHIFT");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        timeshift = nm;
+    }
+
+    str = getenv("RRTSP_MJPEG");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        mjpegFps = nm;
+    }
+
+    str = getenv("RRTSP_HLS_PORT");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm >= 0)) {
+        hlsPort = nm;
+    }
+
+    str = getenv("RRTSP_RTMP_URL");
+    if (str != NULL) {
+        strncpy(rtmpUrl, str, sizeof(rtmpUrl) - 1);
+        rtmpUrl[sizeof(rtmpUrl) - 1] = '\0';
+    }
+
+    str = getenv("RRTSP_RTMP_STREAM");
+    if (str != NULL) {
+        if (strcasecmp("low", str) == 0) {
+            rtmpResolution = RESOLUTION_LOW;
+        } else if (strcasecmp("high", str) == 0) {
+            rtmpResolution = RESOLUTION_HIGH;
+        }
+    }
+
+    str = getenv("RRTSP_HOT_RESTART");
+    if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm == 1)) {
+        hotRestart = nm;
+    }
+
+    str = getenv("RRTSP_MAX_SESSIONS");
+    if (str != NULL) {
+        nm = sscanf(str, "%u,%u", &maxSessionsHigh, &maxSessionsLow);
+        if (nm == 1) {
+            maxSessionsLow = maxSessionsHigh;
+        }
+    }
+
+    str = getenv("RRTSP_BANDWIDTH");
+    if (str != NULL) {
+        unsigned kbps;
+
+        if (sscanf(str, "%u", &kbps) == 1) {
+            bandwidth = kbps;
+        }
+    }
+
+    // Comma separated list of addresses
+    str = getenv("RRTSP_PRIORITY");
+    if (str != NULL) {
+        char addresses[256];
+        char *address;
+
+        strncpy(addresses, str, sizeof(addresses) - 1);
+        addresses[sizeof(addresses) - 1] = '\0';
+        for (address = strtok(addresses, ", "); address != NULL; address = strtok(NULL, ", ")) {
+            if (numPriorityAddresses >= ADMISSION_MAX_PRIORITY_ADDRESSES) break;
+            if (inet_pton(AF_INET, address, &priorityAddresses[numPriorityAddresses]) == 1) {
+                numPriorityAddresses++;
+            }
+        }
+    }
+
     str = getenv("RRTSP_DEBUG");
     if ((str != NULL) && (sscanf (str, "%i", &nm) == 1) && (nm == 1)) {
         debug = nm;
@@ -192,12 +431,34 @@ int main(int argc, char** argv)
         // access to the server.
     }
 
+    // Take the listening socket of the running server, if any: the port
+    // stays open while the old server exits
+    if (hotRestart) {
+        serverSocket = HotRestart::takeOver(HOT_RESTART_SOCKET, HOT_RESTART_DRAIN_SECONDS);
+        if ((serverSocket >= 0) && (socketPort(serverSocket) != port)) {
+            // The port has changed, the old one closes with the old server
+            close(serverSocket);
+            serverSocket = -1;
+        }
+    }
+
     // Create the RTSP server:
-    RTSPServer* rtspServer = RTSPServer::createNew(*env, port, authDB);
+    AdmissionRTSPServer* rtspServer;
+    if (serverSocket >= 0) {
+        rtspServer = AdmissionRTSPServer::createNewWithSocket(*env, serverSocket, port, authDB, bandwidth);
+    } else {
+        rtspServer = AdmissionRTSPServer::createNew(*env, port, authDB, bandwidth);
+    }
     if (rtspServer == NULL) {
         *env << "Failed to create RTSP server: " << env->getResultMsg() << "\n";
         exit(1);
     }
+    for (i = 0; i < numPriorityAddresses; i++) {
+        rtspServer->addPriorityAddress(priorityAddresses[i]);
+    }
+    // Keep one stream of the best resolution for each priority client
+    rtspServer->setPriorityReservation(numPriorityAddresses *
+            ((resolution == RESOLUTION_LOW) ? LOW_ESTIMATED_KBPS : HIGH_ESTIMATED_KBPS));
 
     char const* descriptionString = "Session streamed by \"rRTSPServer\"";
 
@@ -206,20 +467,35 @@ int main(int argc, char** argv)
     // "ServerMediaSession" object, plus one or more
     // "ServerMediaSubsession" objects for each audio/video substream.
 
+    // The RTP sinks take their NAL buffers from a pool shared by all the
+    // streams and sessions, sized per stream instead of a global 300 KB
+    NALBufferPool* bufferPool = new NALBufferPool();
+
+    H264VideoLiveServerMediaSubsession* subHigh = NULL;
+    H264VideoLiveServerMediaSubsession* subLow = NULL;
+    H264VideoLiveServerMediaSubsession* subAuto = NULL;
+
     // A H.264 video elementary stream:
     if ((resolution == RESOLUTION_HIGH) || (resolution == RESOLUTION_BOTH))
     {
         char const* streamName = "ch0_0.h264";
         char const* inputFileName = "/tmp/h264_high_fifo";
 
-        // First, make sure that the RTPSinks' buffers will be large enough to handle the huge size of DV frames (as big as 288000).
-        OutPacketBuffer::maxSize = 300000;
+        ULPFECEncoder* fecEncoder = NULL;
+        if (fec > 0) {
+            fecEncoder = new ULPFECEncoder(fec);
+        }
 
         ServerMediaSession* sms_high
         = ServerMediaSession::createNew(*env, streamName, streamName,
                                 descriptionString);
-        sms_high->addSubsession(H264VideoFileServerMediaSubsession
-                                ::createNew(*env, inputFileName, reuseFirstSource));
+        subHigh = H264VideoLiveServerMediaSubsession::createNew(*env, inputFileName,
+                                                                reuseFirstSource, nack, fecEncoder);
+        subHigh->setBufferSizing(bufferPool, HIGH_NAL_BUFFER_SIZE, "/tmp/rRTSPServer_high.nal");
+        sms_high->addSubsession(subHigh);
+        if (fecEncoder != NULL) {
+            sms_high->addSubsession(ULPFECServerMediaSubsession::createNew(*env, fecEncoder));
+        }
         rtspServer->addServerMediaSession(sms_high);
 
         announceStream(rtspServer, sms_high, streamName, inputFileName);
@@ -231,19 +507,167 @@ int main(int argc, char** argv)
         char const* streamName = "ch0_1.h264";
         char const* inputFileName = "/tmp/h264_low_fifo";
 
-        // First, make sure that the RTPSinks' buffers will be large enough to handle the huge size of DV frames (as big as 288000).
-        OutPacketBuffer::maxSize = 300000;
+        ULPFECEncoder* fecEncoder = NULL;
+        if (fec > 0) {
+            fecEncoder = new ULPFECEncoder(fec);
+        }
 
         ServerMediaSession* sms_low
         = ServerMediaSession::createNew(*env, streamName, streamName,
                                 descriptionString);
-        sms_low->addSubsession(H264VideoFileServerMediaSubsession
-                                ::createNew(*env, inputFileName, reuseFirstSource));
+        subLow = H264VideoLiveServerMediaSubsession::createNew(*env, inputFileName,
+                                                                reuseFirstSource, nack, fecEncoder);
+        subLow->setBufferSizing(bufferPool, LOW_NAL_BUFFER_SIZE, "/tmp/rRTSPServer_low.nal");
+        sms_low->addSubsession(subLow);
+        if (fecEncoder != NULL) {
+            sms_low->addSubsession(ULPFECServerMediaSubsession::createNew(*env, fecEncoder));
+        }
         rtspServer->addServerMediaSession(sms_low);
 
         announceStream(rtspServer, sms_low, streamName, inputFileName);
     }
 
+    // An adaptive stream, switching every client between high and low
+    if (resolution == RESOLUTION_BOTH)
+    {
+        char const* streamName = "ch0_auto.h264";
+        char const* inputFileName = "/tmp/h264_high_fifo";
+
+        ServerMediaSession* sms_auto
+        = ServerMediaSession::createNew(*env, streamName, streamName,
+                                descriptionString);
+        subAuto = H264AdaptiveServerMediaSubsession::createNew(*env, inputFileName,
+                                                               "/tmp/h264_low_fifo", nack);
+        subAuto->setBufferSizing(bufferPool, HIGH_NAL_BUFFER_SIZE, "/tmp/rRTSPServer_high.nal");
+        sms_auto->addSubsession(subAuto);
+        rtspServer->addServerMediaSession(sms_auto);
+
+        announceStream(rtspServer, sms_auto, streamName, inputFileName);
+    }
+
+    // Timeshift streams, recording all the time
+    if (timeshift > 0)
+    {
+        int r;
+
+        for (r = 0; r < 2; r++) {
+            int high = (r == 0);
+            if (high && (resolution == RESOLUTION_LOW)) continue;
+            if (!high && (resolution == RESOLUTION_HIGH)) continue;
+
+            char const* streamName = high ? "ch0_0_ts.h264" : "ch0_1_ts.h264";
+            char const* inputFileName = high ? "/tmp/h264_high_fifo" : "/tmp/h264_low_fifo";
+            unsigned kbps = high ? HIGH_ESTIMATED_KBPS : LOW_ESTIMATED_KBPS;
+
+            LiveStreamInput* input = LiveStreamInput::forFile(*env, inputFileName);
+            if (input == NULL) {
+                *env << "No free input for " << inputFileName << ", timeshift disabled\n";
+                continue;
+            }
+            FramedSource* replica = input->createReplica();
+            if (replica == NULL) {
+                *env << "Failed to open " << inputFileName << " for the timeshift buffer\n";
+                continue;
+            }
+            TimeshiftBuffer* buffer = new TimeshiftBuffer(*env, replica, timeshift,
+                                                          timeshift * TIMESHIFT_BYTES_PER_SECOND(kbps));
+            buffer->startRecording();
+
+            ServerMediaSession* sms_ts
+            = ServerMediaSession::createNew(*env, streamName, streamName,
+                                    descriptionString);
+            TimeshiftServerMediaSubsession* subTs = TimeshiftServerMediaSubsession::createNew(*env, buffer, nack);
+            subTs->setBufferSizing(bufferPool, high ? HIGH_NAL_BUFFER_SIZE : LOW_NAL_BUFFER_SIZE,
+                                   high ? "/tmp/rRTSPServer_high.nal" : "/tmp/rRTSPServer_low.nal");
+            sms_ts->addSubsession(subTs);
+            rtspServer->addServerMediaSession(sms_ts);
+            rtspServer->setStreamLimits(streamName, high ? maxSessionsHigh : maxSessionsLow, kbps, subTs);
+
+            announceStream(rtspServer, sms_ts, streamName, inputFileName);
+        }
+    }
+
+    // MJPEG for the clients without H.264, from the low stream if there is one
+    if (mjpegFps > 0)
+    {
+        char const* streamName = "ch0_1.mjpeg";
+        char const* inputFileName = (resolution == RESOLUTION_HIGH) ? "/tmp/h264_high_fifo" : "/tmp/h264_low_fifo";
+
+        ServerMediaSession* sms_mjpeg
+        = ServerMediaSession::createNew(*env, streamName, streamName,
+                                descriptionString);
+        sms_mjpeg->addSubsession(MJPEGServerMediaSubsession::createNew(*env, inputFileName, mjpegFps,
+                (resolution == RESOLUTION_HIGH) ? HIGH_NAL_BUFFER_SIZE : LOW_NAL_BUFFER_SIZE));
+        rtspServer->addServerMediaSession(sms_mjpeg);
+
+        announceStream(rtspServer, sms_mjpeg, streamName, inputFileName);
+    }
+
+    // Admission control: the clients that don't fit in the high stream
+    // are moved to the low one
+    if (subHigh != NULL) {
+        rtspServer->setStreamLimits("ch0_0.h264", maxSessionsHigh, HIGH_ESTIMATED_KBPS,
+                                    subHigh, (subLow != NULL) ? "ch0_1.h264" : NULL);
+    }
+    if (subLow != NULL) {
+        rtspServer->setStreamLimits("ch0_1.h264", maxSessionsLow, LOW_ESTIMATED_KBPS, subLow);
+    }
+    if (subAuto != NULL) {
+        rtspServer->setStreamLimits("ch0_auto.h264", maxSessionsHigh, HIGH_ESTIMATED_KBPS,
+                                    subAuto, "ch0_1.h264");
+    }
+
+    // One copy of the stream to the RTMP relay, which serves the viewers
+    if (rtmpUrl[0] != '\0') {
+        if ((rtmpResolution == RESOLUTION_HIGH) && (resolution == RESOLUTION_LOW)) rtmpResolution = RESOLUTION_LOW;
+        if ((rtmpResolution == RESOLUTION_LOW) && (resolution == RESOLUTION_HIGH)) rtmpResolution = RESOLUTION_HIGH;
+
+        char const* inputFileName = (rtmpResolution == RESOLUTION_HIGH) ? "/tmp/h264_high_fifo" : "/tmp/h264_low_fifo";
+        LiveStreamInput* input = LiveStreamInput::forFile(*env, inputFileName);
+        if (input == NULL) {
+            *env << "No free input for " << inputFileName << ", RTMP disabled\n";
+        } else {
+            RTMPPublisher* publisher = RTMPPublisher::createNew(*env, input->createReplica(), rtmpUrl,
+                    (rtmpResolution == RESOLUTION_HIGH) ? HIGH_NAL_BUFFER_SIZE : LOW_NAL_BUFFER_SIZE);
+            if (publisher != NULL) publisher->start();
+        }
+    }
+
+    // LL-HLS for the browsers, packaged from the same inputs
+    if (hlsPort > 0) {
+        HLSServer* hlsServer = HLSServer::createNew(*env, hlsPort);
+        int r;
+
+        if (hlsServer == NULL) {
+            *env << "Failed to create the HLS server on port " << hlsPort << "\n";
+        }
+        for (r = 0; (hlsServer != NULL) && (r < 2); r++) {
+            int high = (r == 0);
+            if (high && (resolution == RESOLUTION_LOW)) continue;
+            if (!high && (resolution == RESOLUTION_HIGH)) continue;
+
+            char const* inputFileName = high ? "/tmp/h264_high_fifo" : "/tmp/h264_low_fifo";
+            LiveStreamInput* input = LiveStreamInput::forFile(*env, inputFileName);
+            if (input == NULL) {
+                *env << "No free input for " << inputFileName << ", HLS disabled\n";
+                continue;
+            }
+            HLSPackager* packager = HLSPackager::createNew(*env, input->createReplica(),
+                    high ? HIGH_NAL_BUFFER_SIZE : LOW_NAL_BUFFER_SIZE);
+            if (packager == NULL) {
+                *env << "Failed to open " << inputFileName << " for HLS\n";
+                continue;
+            }
+            hlsServer->addStream(high ? "ch0_0" : "ch0_1", packager);
+            packager->start();
+            *env << "HLS stream: http://<camera>:" << hlsPort << (high ? "/ch0_0" : "/ch0_1") << "/index.m3u8\n";
+        }
+    }
+
+    if (hotRestart) {
+        HotRestart::createNew(*env, HOT_RESTART_SOCKET, rtspServer, HOT_RESTART_DRAIN_SECONDS);
+    }
+
     // Also, attempt to create a HTTP server for RTSP-over-HTTP tunneling.
     // Try first with the default HTTP port (80), and then with the alternative HTTP
     // port numbers (8000 and 8080).
@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Times the stages of a snapshot on H.264 keyframes (SPS, PPS and IDR
+ * with start codes): decode, copy to NV12, watermark, JPEG encode, in
+ * the default, optimized, progressive and target size modes, and the
+ * whole snapshot_jpeg(). For each stage it reports the first run,
+ * which every imggrabber pays, the average of the next ones, which is
+ * what snapshotd pays, the peak heap and the size of the output.
+ *     make -C src/snapshot/bench bench
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <getopt.h>
+#include <malloc.h>
+
+#include "snapshot.h"
+#include "convert2jpg.h"
+#include "yuv.h"
+
+#define WM_RES_DIR "../snapshot/wm_res"
+
+#define STAGE_DECODE    0
+#define STAGE_NV12      1
+#define STAGE_WATERMARK 2
+#define STAGE_JPEG      3
+#define STAGE_JPEG_OPTIMIZE    4
+#define STAGE_JPEG_PROGRESSIVE 5
+#define STAGE_JPEG_TARGET      6
+#define STAGE_SNAPSHOT  7
+#define STAGES          8
+
+const char *stage_names[STAGES] = { "decode", "nv12", "watermark", "jpeg", "jpeg optimize",
+                                    "jpeg progressive", "jpeg target", "snapshot_jpeg" };
+
+typedef struct {
+    int runs;
+    long long first_us;
+    // Sum of the runs after the first one
+    long long next_us;
+    // Most bytes allocated on top of what was in use when a run started
+    long peak;
+    long output;
+} stage;
+
+int debug = 0;
+
+long long current_timestamp_us()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000000LL + te.tv_usec;
+}
+
+////////// Heap accounting //////////
+
+/*
+ * glibc lets the program replace malloc() and friends, also for the
+ * calls made by libavcodec and libjpeg: the replacements keep the count
+ * of the bytes in use and of its peak.
+ */
+#if defined(__GLIBC__) && !defined(__UCLIBC__)
+#define HEAP_ACCOUNTING
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static long heap_used;
+static long heap_peak;
+
+static void heap_add(void *ptr)
+{
+    long used;
+
+    if (ptr == NULL) return;
+    used = __sync_add_and_fetch(&heap_used, (long) malloc_usable_size(ptr));
+    if (used > heap_peak) heap_peak = used;
+}
+
+static void heap_sub(void *ptr)
+{
+    if (ptr == NULL) return;
+    __sync_sub_and_fetch(&heap_used, (long) malloc_usable_size(ptr));
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    heap_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+
+    heap_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    long old_size = (ptr != NULL) ? (long) malloc_usable_size(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+
+    // On failure the old block is still there
+    if ((new_ptr != NULL) || (size == 0)) {
+        __sync_sub_and_fetch(&heap_used, old_size);
+        heap_add(new_ptr);
+    }
+    return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+
+    heap_add(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr = memalign(alignment, size);
+
+    if (ptr == NULL) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr)
+{
+    heap_sub(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+////////// Stages //////////
+
+static long long stage_begin(long *heap_base)
+{
+#ifdef HEAP_ACCOUNTING
+    *heap_base = heap_used;
+    heap_peak = heap_used;
+#else
+    *heap_base = 0;
+#endif
+    return current_timestamp_us();
+}
+
+static void stage_end(stage *st, long long start, long heap_base)
+{
+    long long t = current_timestamp_us() - start;
+
+    if (st->runs == 0) st->first_us = t;
+    else st->next_us += t;
+    st->runs++;
+#ifdef HEAP_ACCOUNTING
+    if (heap_peak - heap_base > st->peak) st->peak = heap_peak - heap_base;
+#else
+    st->peak = -1;
+#endif
+}
+
+void print_stages(stage *stages)
+{
+    char peak[24], next[24];
+    int i;
+
+    printf("%-17s %10s %10s %13s %13s\n", "stage", "first ms", "next ms", "peak heap KB", "output bytes");
+    for (i = 0; i < STAGES; i++) {
+        if (stages[i].runs == 0) continue;
+        if (stages[i].peak >= 0) snprintf(peak, sizeof(peak), "%ld", (stages[i].peak + 1023) / 1024);
+        else strcpy(peak, "-");
+        if (stages[i].runs > 1) snprintf(next, sizeof(next), "%.2f", stages[i].next_us / 1000.0 / (stages[i].runs - 1));
+        else strcpy(next, "-");
+        printf("%-17s %10.2f %10s %13s %13ld\n", stage_names[i], stages[i].first_us / 1000.0,
+                next, peak, stages[i].output);
+    }
+}
+
+// Encodes yuv with options as the stage st, returns < 0 on error
+int bench_jpeg(stage *st, unsigned char *yuv, int width, int height, const jpeg_options *options)
+{
+    unsigned char *jpeg;
+    unsigned long jpeg_len;
+    long long start;
+    long heap_base;
+    int ret;
+
+    JPGSetOptions(options);
+    start = stage_begin(&heap_base);
+    ret = YUVtoJPGMem(&jpeg, &jpeg_len, yuv, width, height, width, height);
+    if (ret >= 0) free(jpeg);
+    stage_end(st, start, heap_base);
+    if (ret < 0) return ret;
+    st->output = jpeg_len;
+
+    return 0;
+}
+
+////////// Fixtures //////////
+
+// Glyphs from the wm_res directory of the sources instead of the installed one
+int load_watermark(snapshot_ctx *s, const char *wm_dir)
+{
+    char path[256];
+    int slot;
+
+    for (slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        snprintf(path, sizeof(path), "%s/%s/%s", wm_dir, (slot == 0) ? "low" : "high", WM_ATLAS_FILE);
+        if (wm_atlas_open(&s->atlas[slot], path) < 0) {
+            snprintf(path, sizeof(path), "%s/%s/wm_540p_", wm_dir, (slot == 0) ? "low" : "high");
+            if (WMInit(&s->wm[slot], path) < 0) return -1;
+        }
+        s->wm_loaded[slot] = 1;
+    }
+
+    return 0;
+}
+
+unsigned char *read_fixture(const char *path, int *size)
+{
+    FILE *f;
+    unsigned char *buffer;
+    long len;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer = (unsigned char *) malloc(len > 0 ? len : 1);
+    if ((buffer == NULL) || (len <= 0) || (fread(buffer, 1, len, f) != (size_t) len)) {
+        fprintf(stderr, "Unable to read %s\n", path);
+        free(buffer);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *size = len;
+
+    return buffer;
+}
+
+/*
+ * Runs the stages iterations times on the keyframe in path, one after
+ * the other as imggrabber does. snapshot_jpeg() has its own context,
+ * created by the first run. The JPEG stages start from the options in
+ * jpeg, the target size mode aims at jpeg->target_size or, if it is 0,
+ * at half the size of the default one. Returns < 0 on error.
+ */
+int bench_fixture(const char *path, int iterations, int watermark, const char *wm_dir, const jpeg_options *jpeg_opts)
+{
+    stage stages[STAGES];
+    snapshot_ctx s, e;
+    jpeg_options o;
+    unsigned char *h264, *yuv = NULL, *jpeg;
+    unsigned long jpeg_len;
+    int h264_size, width, height;
+    int i, ret = 0;
+    long long start;
+    long heap_base;
+
+    h264 = read_fixture(path, &h264_size);
+    if (h264 == NULL) return -1;
+
+    memset(stages, 0, sizeof(stages));
+    snapshot_init(&s);
+    snapshot_init(&e);
+    // The whole snapshot in the default mode
+    e.jpeg = *jpeg_opts;
+    e.jpeg.target_size = 0;
+
+    for (i = 0; i < iterations; i++) {
+        start = stage_begin(&heap_base);
+        ret = snapshot_decode(&s, 0, h264, h264_size, &width, &height);
+        stage_end(&stages[STAGE_DECODE], start, heap_base);
+        if (ret < 0) break;
+        stages[STAGE_DECODE].output = width * height * 3 / 2;
+
+        if (yuv == NULL) {
+            yuv = (unsigned char *) malloc(width * height * 3 / 2);
+            if (yuv == NULL) {
+                fprintf(stderr, "Unable to allocate memory\n");
+                ret = -4;
+                break;
+            }
+        }
+        start = stage_begin(&heap_base);
+        h264dec_nv12(s.dec[0], yuv);
+        stage_end(&stages[STAGE_NV12], start, heap_base);
+        stages[STAGE_NV12].output = width * height * 3 / 2;
+
+        if (watermark) {
+            start = stage_begin(&heap_base);
+            ret = s.wm_loaded[0] ? 0 : load_watermark(&s, wm_dir);
+            if (ret == 0) ret = snapshot_watermark(&s, yuv, width, height);
+            stage_end(&stages[STAGE_WATERMARK], start, heap_base);
+            if (ret < 0) {
+                fprintf(stderr, "Unable to load the watermark from %s\n", wm_dir);
+                break;
+            }
+            stages[STAGE_WATERMARK].output = width * height * 3 / 2;
+        }
+
+        // The stages encode the same picture: the watermark is drawn once
+        o = *jpeg_opts;
+        o.target_size = 0;
+        ret = bench_jpeg(&stages[STAGE_JPEG], yuv, width, height, &o);
+        if (ret < 0) break;
+        o.optimize = 1;
+        ret = bench_jpeg(&stages[STAGE_JPEG_OPTIMIZE], yuv, width, height, &o);
+        if (ret < 0) break;
+        o.optimize = 0;
+        o.progressive = 1;
+        ret = bench_jpeg(&stages[STAGE_JPEG_PROGRESSIVE], yuv, width, height, &o);
+        if (ret < 0) break;
+        o = *jpeg_opts;
+        if (o.target_size == 0) o.target_size = stages[STAGE_JPEG].output / 2;
+        ret = bench_jpeg(&stages[STAGE_JPEG_TARGET], yuv, width, height, &o);
+        if (ret < 0) break;
+
+        start = stage_begin(&heap_base);
+        ret = (watermark && !e.wm_loaded[0]) ? load_watermark(&e, wm_dir) : 0;
+        if (ret == 0) ret = snapshot_jpeg(&e, 0, h264, h264_size, watermark, NULL, 0, 0, &jpeg, &jpeg_len);
+        if (ret >= 0) free(jpeg);
+        stage_end(&stages[STAGE_SNAPSHOT], start, heap_base);
+        if (ret < 0) break;
+        stages[STAGE_SNAPSHOT].output = jpeg_len;
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "%s: error %d\n", path, ret);
+    } else {
+        printf("%s: %dx%d, %d bytes, %d runs\n", path, width, height, h264_size, iterations);
+        print_stages(stages);
+        printf("\n");
+    }
+
+    free(yuv);
+    free(h264);
+    snapshot_free(&s);
+    snapshot_free(&e);
+
+    return (ret < 0) ? -1 : 0;
+}
+
+void print_usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [options] KEYFRAME...\n", prog_name);
+    fprintf(stderr, "\t-i, --iterations N               Runs of each stage (default 20)\n");
+    fprintf(stderr, "\t-n, --no-watermark               Leave out the watermark\n");
+    fprintf(stderr, "\t-q, --quality N                  JPEG quality (default %d)\n", JPEG_QUALITY);
+    fprintf(stderr, "\t-T, --target-size BYTES          Size of the target size mode (default half the default JPEG)\n");
+    fprintf(stderr, "\t-r, --wm-res DIR                 Watermark glyphs (default %s)\n", WM_RES_DIR);
+    fprintf(stderr, "\t-d, --debug                      Enable debug\n");
+    fprintf(stderr, "\t-h, --help                       Show this help\n");
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20;
+    int watermark = 1;
+    char *wm_dir = WM_RES_DIR;
+    jpeg_options jpeg;
+    int c, errors = 0;
+
+    JPGDefaultOptions(&jpeg);
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"iterations",  required_argument, 0, 'i'},
+            {"no-watermark",  no_argument, 0, 'n'},
+            {"quality",  required_argument, 0, 'q'},
+            {"target-size",  required_argument, 0, 'T'},
+            {"wm-res",  required_argument, 0, 'r'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "i:nq:T:r:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+
+        case 'n':
+            watermark = 0;
+            break;
+
+        case 'q':
+            jpeg.quality = atoi(optarg);
+            break;
+
+        case 'T':
+            jpeg.target_size = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            wm_dir = optarg;
+            break;
+
+        case 'd':
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if ((iterations < 1) || (optind >= argc)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    printf("YUV kernels: %s, heap accounting: %s\n\n", yuv_get_kernels()->name,
+#ifdef HEAP_ACCOUNTING
+            "yes");
+#else
+            "no");
+#endif
+
+    for (; optind < argc; optind++) {
+        if (bench_fixture(argv[optind], iterations, watermark, wm_dir, &jpeg) < 0) errors++;
+    }
+
+    return (errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Burst capture: the main thread follows the ring and decodes, the
+ * encoder thread draws the watermark, encodes and writes. They share
+ * BURST_PICTURES NV12 buffers.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "burst.h"
+
+extern int debug;
+
+typedef struct {
+    unsigned char *yuv;
+    int yuv_size;
+    int width;
+    int height;
+    // Decoded and not yet encoded
+    int full;
+} burst_picture;
+
+typedef struct {
+    snapshot_ctx *s;
+    const burst_params *p;
+    burst_picture pictures[BURST_PICTURES];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    // No more pictures will be queued
+    int done;
+    int written;
+    // The pictures can't be written: the decoder stops
+    int error;
+} burst_ctx;
+
+// The file name pattern must have one %d and nothing else to convert
+static int valid_pattern(const char *pattern)
+{
+    const char *p;
+    int conversions = 0;
+
+    for (p = pattern; *p != '\0'; p++) {
+        if (*p != '%') continue;
+        p++;
+        if (*p == '%') continue;
+        // Flags and width
+        while ((*p == '-') || ((*p >= '0') && (*p <= '9'))) p++;
+        if (*p != 'd') return 0;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
+// One part of the multipart stream on stdout, < 0 if it can't be written
+static int write_part(unsigned char *jpeg, unsigned long jpeg_size)
+{
+    printf("--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\n\r\n", BURST_BOUNDARY, jpeg_size);
+    if ((fwrite(jpeg, 1, jpeg_size, stdout) != jpeg_size) || (printf("\r\n") < 0) || (fflush(stdout) != 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Encodes the picture straight to its file.
+ * Returns -1 if the file can't be created, -2 if the picture can't be
+ * encoded or written.
+ */
+static int write_file(burst_ctx *b, burst_picture *pic, int index)
+{
+    char path[PATH_MAX];
+    int fd, ret;
+
+    snprintf(path, sizeof(path), b->p->output, index);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return -1;
+    }
+    ret = snapshot_encode_fd(b->s, pic->yuv, pic->width, pic->height, b->p->watermark,
+            b->p->width, b->p->height, fd);
+    if ((close(fd) < 0) || (ret < 0)) {
+        unlink(path);
+        return -2;
+    }
+    if (debug) fprintf(stderr, "%lld - written %s\n", current_timestamp(), path);
+
+    return 0;
+}
+
+static void *encoder_thread(void *arg)
+{
+    burst_ctx *b = (burst_ctx *) arg;
+    burst_picture *pic;
+    unsigned char *jpeg;
+    unsigned long jpeg_size;
+    int i = 0;
+    int ret;
+
+    for (;;) {
+        pic = &b->pictures[i];
+
+        pthread_mutex_lock(&b->mutex);
+        while (!pic->full && !b->done) pthread_cond_wait(&b->cond, &b->mutex);
+        pthread_mutex_unlock(&b->mutex);
+        if (!pic->full) break;
+
+        if (b->p->output != NULL) {
+            ret = write_file(b, pic, b->written);
+        } else if (snapshot_encode(b->s, pic->yuv, pic->width, pic->height, b->p->watermark,
+                b->p->width, b->p->height, &jpeg, &jpeg_size) < 0) {
+            ret = -2;
+        } else {
+            // The part header needs the size: the stream is encoded in memory
+            ret = write_part(jpeg, jpeg_size);
+            free(jpeg);
+        }
+        // A picture that can't be encoded is skipped
+        if (ret == -2) fprintf(stderr, "Error encoding picture %d\n", b->written);
+
+        pthread_mutex_lock(&b->mutex);
+        if (ret == 0) b->written++;
+        else if (ret == -1) b->error = 1;
+        pic->full = 0;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->mutex);
+
+        i = (i + 1) % BURST_PICTURES;
+    }
+
+    return NULL;
+}
+
+// Copies the region of the picture of the decoder to buffer i when the encoder is done with it
+static int queue_picture(burst_ctx *b, int i, h264dec *dec, const snapshot_rect *rect)
+{
+    burst_picture *pic = &b->pictures[i];
+    int width = rect->width;
+    int height = rect->height;
+    int error;
+
+    pthread_mutex_lock(&b->mutex);
+    while (pic->full && !b->error) pthread_cond_wait(&b->cond, &b->mutex);
+    error = b->error;
+    pthread_mutex_unlock(&b->mutex);
+    if (error) return -1;
+
+    if (width * height * 3 / 2 > pic->yuv_size) {
+        free(pic->yuv);
+        pic->yuv_size = width * height * 3 / 2;
+        pic->yuv = (unsigned char *) malloc(pic->yuv_size);
+        if (pic->yuv == NULL) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            pic->yuv_size = 0;
+            return -4;
+        }
+    }
+    h264dec_nv12_rect(dec, pic->yuv, rect->x, rect->y, width, height);
+    pic->width = width;
+    pic->height = height;
+
+    pthread_mutex_lock(&b->mutex);
+    pic->full = 1;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+
+    return 0;
+}
+
+int burst_run(ring *r, snapshot_ctx *s, const burst_params *p)
+{
+    burst_ctx b;
+    pthread_t encoder;
+    ring_cursor cur;
+    snapshot_rect rect;
+    unsigned char *buffer = NULL;
+    int buffer_size = 0;
+    int length = 0;
+    int slot = (p->resolution == RESOLUTION_LOW) ? 0 : 1;
+    int type, width, height, i;
+    int ret = 0;
+    // Pictures decoded since the burst started and pictures queued
+    int frames = 0;
+    int queued = 0;
+    // The P-frames can be decoded only after a keyframe
+    int keyframe = 0;
+    long long start, now, last = 0;
+
+    if ((p->output != NULL) && !valid_pattern(p->output)) {
+        fprintf(stderr, "The output must have one %%d for the picture number\n");
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.s = s;
+    b.p = p;
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_cond_init(&b.cond, NULL);
+    if (pthread_create(&encoder, NULL, encoder_thread, &b) != 0) {
+        fprintf(stderr, "Could not start the encoder thread\n");
+        return -1;
+    }
+
+    // The last keyframe in the ring: the first picture doesn't wait for the next one
+    ring_follow(r, p->resolution, &cur, 1);
+    start = current_timestamp();
+
+    while (((p->count == 0) || (queued < p->count)) &&
+            ((p->duration == 0) || (current_timestamp() - start < p->duration))) {
+        type = ring_next_frame(r, p->resolution, &cur, &buffer, &buffer_size, &length);
+        if (type == 0) {
+            usleep(MILLIS_10);
+            continue;
+        }
+        if (type == -4) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            ret = -4;
+            break;
+        }
+        if (type < 0) {
+            // Left behind: go on from the newest frame, with the next keyframe
+            ring_follow(r, p->resolution, &cur, 0);
+            length = 0;
+            keyframe = 0;
+            continue;
+        }
+
+        // SPS and PPS go to the decoder with their IDR
+        if ((type == NAL_TYPE_SPS) || (type == NAL_TYPE_PPS)) continue;
+        if (type == NAL_TYPE_IDR) {
+            keyframe = 1;
+        } else if ((p->every == 0) || !keyframe) {
+            length = 0;
+            continue;
+        }
+
+        i = snapshot_decode(s, slot, buffer, length, &width, &height);
+        length = 0;
+        if (i < 0) {
+            keyframe = 0;
+            continue;
+        }
+
+        now = current_timestamp();
+        i = (p->every == 0) || (frames % p->every == 0);
+        frames++;
+        if (!i || ((queued > 0) && (now - last < p->interval))) continue;
+
+        memset(&rect, 0, sizeof(rect));
+        if (p->crop != NULL) rect = *p->crop;
+        if (snapshot_fit_rect(&rect, width, height) < 0) {
+            fprintf(stderr, "The crop is outside the %dx%d picture\n", width, height);
+            ret = -8;
+            break;
+        }
+
+        if (debug) fprintf(stderr, "%lld - queueing picture %d, frame %d\n", now, queued, frames - 1);
+        ret = queue_picture(&b, queued % BURST_PICTURES, s->dec[slot], &rect);
+        if (ret < 0) break;
+        last = now;
+        queued++;
+    }
+
+    pthread_mutex_lock(&b.mutex);
+    b.done = 1;
+    pthread_cond_broadcast(&b.cond);
+    pthread_mutex_unlock(&b.mutex);
+    pthread_join(encoder, NULL);
+
+    free(buffer);
+    for (i = 0; i < BURST_PICTURES; i++) {
+        free(b.pictures[i].yuv);
+    }
+    pthread_cond_destroy(&b.cond);
+    pthread_mutex_destroy(&b.mutex);
+
+    if (ret < 0) return ret;
+    if (b.error) return -1;
+
+    return b.written;
+}
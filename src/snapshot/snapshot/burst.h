@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Burst and time-lapse capture: follows the frames in the ring with one
+ * decoder open and turns a sequence of them into JPEGs. The encoding of
+ * a picture runs in its own thread while the next frames are decoded.
+ */
+
+#ifndef BURST_H
+#define BURST_H
+
+#include "ring.h"
+#include "snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Decoded pictures waiting for the encoder
+#define BURST_PICTURES 2
+
+// Boundary of the multipart stream
+#define BURST_BOUNDARY "snapshotburst"
+
+typedef struct {
+    int resolution;
+    // Milliseconds to capture, 0 for no limit
+    int duration;
+    // Pictures to capture, 0 for no limit
+    int count;
+    // 0: every keyframe, N: every N frames, decoding the P-frames in between
+    int every;
+    // Minimum milliseconds between two pictures
+    int interval;
+    int watermark;
+    // Region of the picture to keep, NULL for all of it
+    const snapshot_rect *crop;
+    int width;
+    int height;
+    // printf pattern of the file names with one %d, NULL for a
+    // multipart/x-mixed-replace stream on stdout
+    const char *output;
+} burst_params;
+
+/*
+ * Runs a burst on the frames of p->resolution.
+ * Returns the number of pictures written, < 0 on error.
+ */
+int burst_run(ring *r, snapshot_ctx *s, const burst_params *p);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
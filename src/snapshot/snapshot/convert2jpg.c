@@ -18,29 +18,383 @@
  * Reads the YUV file and converts it to jpg.
  */
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <setjmp.h>
+
 #include "convert2jpg.h"
+#include "yuv.h"
+
+#include <jerror.h>
 
 extern int camera_dbg_en;
 
-/**
- * Converts a YUYV raw buffer to a JPEG buffer.
- * Input is YUYV (YUV 420SP NV12). Output is JPEG binary.
+static jpeg_options options = { JPEG_QUALITY, 0, 0, 0 };
+
+void JPGDefaultOptions(jpeg_options *o)
+{
+    o->quality = JPEG_QUALITY;
+    o->optimize = 0;
+    o->progressive = 0;
+    o->target_size = 0;
+}
+
+void JPGSetOptions(const jpeg_options *o)
+{
+    options = *o;
+    if (options.quality < 1) options.quality = 1;
+    if (options.quality > 100) options.quality = 100;
+}
+
+static void set_options(j_compress_ptr cinfo, int quality)
+{
+    jpeg_set_quality(cinfo, quality, TRUE);
+    cinfo->optimize_coding = options.optimize ? TRUE : FALSE;
+    if (options.progressive) jpeg_simple_progression(cinfo);
+}
+
+/*
+ * libjpeg error manager that returns to the encoder instead of calling
+ * exit() as the one of jpeg_std_error() does: the optimized, progressive
+ * and target size modes allocate megabytes, which may fail in the
+ * daemons. The encoder sets setjmp_buffer, cleans up and returns -1.
  */
-int YUVtoJPG(char *output_file, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height)
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} jmp_error_mgr;
+
+static void jmp_error_exit(j_common_ptr cinfo)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_ptr[1];
-    int row_stride;
+    jmp_error_mgr *err = (jmp_error_mgr *) cinfo->err;
 
-    FILE *fp;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+static struct jpeg_error_mgr *jpeg_jmp_error(jmp_error_mgr *err)
+{
+    jpeg_std_error(&err->pub);
+    err->pub.error_exit = jmp_error_exit;
+    return &err->pub;
+}
+
+/*
+ * libjpeg destination in a buffer allocated with malloc() that doubles
+ * when full. Unlike with jpeg_mem_dest() the buffer is always in the
+ * struct, so it can be freed after an error.
+ */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    unsigned char *buffer;
+    unsigned long size;
+    unsigned long len;
+} mem_destination_mgr;
+
+static void mem_init_destination(j_compress_ptr cinfo)
+{
+    mem_destination_mgr *dest = (mem_destination_mgr *) cinfo->dest;
+
+    dest->size = JPEG_MEM_INITIAL_SIZE;
+    dest->buffer = (unsigned char *) malloc(dest->size);
+    if (dest->buffer == NULL) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = dest->size;
+}
+
+static boolean mem_empty_output_buffer(j_compress_ptr cinfo)
+{
+    mem_destination_mgr *dest = (mem_destination_mgr *) cinfo->dest;
+    unsigned char *buffer;
+
+    // Full, whatever free_in_buffer says
+    buffer = (unsigned char *) realloc(dest->buffer, dest->size * 2);
+    if (buffer == NULL) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 11);
+    dest->buffer = buffer;
+    dest->pub.next_output_byte = buffer + dest->size;
+    dest->pub.free_in_buffer = dest->size;
+    dest->size *= 2;
+
+    return TRUE;
+}
+
+static void mem_term_destination(j_compress_ptr cinfo)
+{
+    mem_destination_mgr *dest = (mem_destination_mgr *) cinfo->dest;
+
+    dest->len = dest->size - dest->pub.free_in_buffer;
+}
+
+static void jpeg_grow_mem_dest(j_compress_ptr cinfo, mem_destination_mgr *dest)
+{
+    dest->pub.init_destination = mem_init_destination;
+    dest->pub.empty_output_buffer = mem_empty_output_buffer;
+    dest->pub.term_destination = mem_term_destination;
+    dest->buffer = NULL;
+    dest->size = 0;
+    dest->len = 0;
+    cinfo->dest = &dest->pub;
+}
+
+/*
+ * libjpeg destination that writes to a file descriptor JPEG_FD_CHUNK bytes
+ * at a time, instead of growing a buffer to the whole image.
+ * A write error doesn't abort the process as ERREXIT() would: the rest of
+ * the image is discarded and the encoder returns -1.
+ */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    int fd;
+    unsigned long written;
+    int error;
+    JOCTET buffer[JPEG_FD_CHUNK];
+} fd_destination_mgr;
+
+static void fd_write(fd_destination_mgr *dest, size_t len)
+{
+    JOCTET *p = dest->buffer;
+    ssize_t n;
+
+    while ((len > 0) && !dest->error) {
+        n = write(dest->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            dest->error = 1;
+            break;
+        }
+        p += n;
+        len -= n;
+        dest->written += n;
+    }
+}
+
+static void fd_init_destination(j_compress_ptr cinfo)
+{
+    fd_destination_mgr *dest = (fd_destination_mgr *) cinfo->dest;
+
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_FD_CHUNK;
+}
+
+static boolean fd_empty_output_buffer(j_compress_ptr cinfo)
+{
+    fd_destination_mgr *dest = (fd_destination_mgr *) cinfo->dest;
+
+    // libjpeg calls it with the buffer full, whatever free_in_buffer says
+    fd_write(dest, JPEG_FD_CHUNK);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = JPEG_FD_CHUNK;
+
+    return TRUE;
+}
+
+static void fd_term_destination(j_compress_ptr cinfo)
+{
+    fd_destination_mgr *dest = (fd_destination_mgr *) cinfo->dest;
+
+    fd_write(dest, JPEG_FD_CHUNK - dest->pub.free_in_buffer);
+}
+
+static void jpeg_fd_dest(j_compress_ptr cinfo, fd_destination_mgr *dest, int fd)
+{
+    dest->pub.init_destination = fd_init_destination;
+    dest->pub.empty_output_buffer = fd_empty_output_buffer;
+    dest->pub.term_destination = fd_term_destination;
+    dest->fd = fd;
+    dest->written = 0;
+    dest->error = 0;
+    cinfo->dest = &dest->pub;
+}
+
+/*
+ * The JPEG of *input with its DCT coefficients requantized for quality,
+ * in a buffer allocated with malloc(). Only the entropy decoding and
+ * coding are done again, not the color conversion and the DCT.
+ * Returns the size, 0 on error.
+ */
+static unsigned long requantize(unsigned char *input, unsigned long input_len, int quality, unsigned char **output)
+{
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    jmp_error_mgr jerr;
+    mem_destination_mgr mem;
+    jvirt_barray_ptr *coefs;
+    jpeg_component_info *comp;
+    JQUANT_TBL *old_table, *new_table;
+    JBLOCKARRAY rows;
+    JCOEFPTR block;
+    // old step / new step in 16.16 fixed point: no division per coefficient
+    int32_t ratio[DCTSIZE2];
+    unsigned int row, col;
+    int ci, k;
+    int64_t v;
+
+    *output = NULL;
+
+    // Both share the error manager, destroying one not created yet does nothing
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    src.err = jpeg_jmp_error(&jerr);
+    dst.err = &jerr.pub;
+    memset(&mem, 0, sizeof(mem));
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        free(mem.buffer);
+        return 0;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_mem_src(&src, input, input_len);
+    jpeg_read_header(&src, TRUE);
+    coefs = jpeg_read_coefficients(&src);
+
+    jpeg_create_compress(&dst);
+    jpeg_grow_mem_dest(&dst, &mem);
+    jpeg_copy_critical_parameters(&src, &dst);
+    set_options(&dst, quality);
+
+    for (ci = 0; ci < src.num_components; ci++) {
+        comp = &src.comp_info[ci];
+        old_table = comp->quant_table;
+        new_table = dst.quant_tbl_ptrs[dst.comp_info[ci].quant_tbl_no];
+        // Both tables are in natural order, as the blocks
+        for (k = 0; k < DCTSIZE2; k++) {
+            ratio[k] = ((int32_t) old_table->quantval[k] << 16) / new_table->quantval[k];
+        }
+        for (row = 0; row < comp->height_in_blocks; row++) {
+            rows = (*src.mem->access_virt_barray)((j_common_ptr) &src, coefs[ci], row, 1, TRUE);
+            for (col = 0; col < comp->width_in_blocks; col++) {
+                block = rows[0][col];
+                // Most of them are 0 already
+                for (k = 0; k < DCTSIZE2; k++) {
+                    if (block[k] == 0) continue;
+                    v = (int64_t) block[k] * ratio[k];
+                    if (v >= 0) block[k] = (JCOEF) ((v + 0x8000) >> 16);
+                    else block[k] = (JCOEF) -((-v + 0x8000) >> 16);
+                }
+            }
+        }
+    }
+
+    jpeg_write_coefficients(&dst, coefs);
+    jpeg_finish_compress(&dst);
+    jpeg_destroy_compress(&dst);
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_decompress(&src);
+
+    *output = mem.buffer;
+    return mem.len;
+}
+
+/*
+ * Replaces the JPEG in *buffer with the one of the highest quality below
+ * options.quality that fits options.target_size, found by bisection on
+ * the coefficients of the first one. If none fits it is the one at
+ * JPEG_MIN_QUALITY.
+ * Returns < 0 if the memory is short, *buffer is unchanged.
+ */
+static int fit_target_size(unsigned char **buffer, unsigned long *len)
+{
+    unsigned char *best = NULL, *smallest = NULL, *tmp;
+    unsigned long best_len = 0, smallest_len = 0;
+    int low = JPEG_MIN_QUALITY;
+    int high = options.quality - 1;
+    unsigned long n;
+    int quality;
+
+    if (*len <= options.target_size) return 0;
+
+    while (low <= high) {
+        quality = (low + high) / 2;
+        n = requantize(*buffer, *len, quality, &tmp);
+        if (n == 0) {
+            free(best);
+            free(smallest);
+            return -1;
+        }
+        if (n <= options.target_size) {
+            free(best);
+            best = tmp;
+            best_len = n;
+            low = quality + 1;
+        } else {
+            free(smallest);
+            smallest = tmp;
+            smallest_len = n;
+            high = quality - 1;
+        }
+    }
+
+    // None fits: the last one tried, at JPEG_MIN_QUALITY
+    if (best == NULL) {
+        if (smallest == NULL) return 0;
+        best = smallest;
+        best_len = smallest_len;
+    } else {
+        free(smallest);
+    }
+    free(*buffer);
+    *buffer = best;
+    *len = best_len;
+
+    return 0;
+}
+
+/*
+ * Last step of the encoders: with a target size the JPEG has been made
+ * in memory, it is fitted and then handed to the caller or written to
+ * fd, otherwise it already is in *output or has been written to fd.
+ * Returns the size, < 0 on error.
+ */
+static int finish_output(int fd, fd_destination_mgr *dest, unsigned char *buffer, unsigned long len,
+                         unsigned char **output, unsigned long *output_len)
+{
+    unsigned long written = 0;
+    ssize_t n;
+
+    if ((fd >= 0) && (buffer == NULL)) return dest->error ? -1 : dest->written;
+
+    if ((options.target_size > 0) && (fit_target_size(&buffer, &len) < 0)) {
+        free(buffer);
+        return -1;
+    }
 
-    uint8_t* outbuffer = NULL;
-    unsigned long outlen = 0;
+    if (fd < 0) {
+        *output = buffer;
+        *output_len = len;
+        return len;
+    }
 
-    unsigned int wsl, hsl, i, j;
-    unsigned int offset;
-    unsigned int uv;
+    while (written < len) {
+        n = write(fd, buffer + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    free(buffer);
+
+    return (written == len) ? len : -1;
+}
+
+/*
+ * Crops the center of the picture to dest_width x dest_height and
+ * encodes it scaled by scale_num/8 in the DCT.
+ * The JPEG goes to fd if it is >= 0, to *output otherwise.
+ */
+static int yuv_to_jpg(int fd, unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height, const int scale_num)
+{
+    struct jpeg_compress_struct cinfo;
+    jmp_error_mgr jerr;
+    fd_destination_mgr dest;
+    mem_destination_mgr mem;
+
+    const yuv_kernels *k = yuv_get_kernels();
+    unsigned int wsl, hsl;
+    unsigned int line;
 
     // width != dest_width currently not supported
     if (width < dest_width) return -1;
@@ -57,9 +411,17 @@ int YUVtoJPG(char *output_file, unsigned char *input, const int width, const int
     // height - dest_height must be even
     if ((hsl % 2) == 1) return -1;
 
-    cinfo.err = jpeg_std_error(&jerr);
+    cinfo.err = jpeg_jmp_error(&jerr);
+    memset(&mem, 0, sizeof(mem));
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(mem.buffer);
+        return -1;
+    }
     jpeg_create_compress(&cinfo);
-    jpeg_mem_dest(&cinfo, &outbuffer, &outlen);
+    // A JPEG that must fit a size is made in memory first
+    if ((fd >= 0) && (options.target_size == 0)) jpeg_fd_dest(&cinfo, &dest, fd);
+    else jpeg_grow_mem_dest(&cinfo, &mem);
 
     // jrow is a libjpeg row of samples array of 1 row pointer
     cinfo.image_width = dest_width & -1;
@@ -68,7 +430,11 @@ int YUVtoJPG(char *output_file, unsigned char *input, const int width, const int
     cinfo.in_color_space = JCS_YCbCr; //libJPEG expects YUV 3bytes, 24bit
 
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, JPEG_QUALITY, TRUE);
+    set_options(&cinfo, options.quality);
+#if JPEG_LIB_VERSION >= 70
+    cinfo.scale_num = scale_num;
+    cinfo.scale_denom = 8;
+#endif
     jpeg_start_compress(&cinfo, TRUE);
 
     uint8_t tmprowbuf[dest_width * 3];
@@ -77,53 +443,283 @@ int YUVtoJPG(char *output_file, unsigned char *input, const int width, const int
     row_pointer[0] = &tmprowbuf[0];
 
     while (cinfo.next_scanline < cinfo.image_height) {
-        offset = (cinfo.next_scanline + hsl/2) * width + wsl/2;                 //offset to the correct y row
-        uv = width * (height - (cinfo.next_scanline + hsl/2 + 1) / 2) + wsl/2;  //offset to the correct uv row
-
-        for (i = 0, j = 0; i < cinfo.image_width; i += 2, j += 6) { //input strides by 2 bytes, output strides by 6 (2 pixels)
-            tmprowbuf[j + 0] = input[offset + i];          // Y (unique to this pixel)
-            tmprowbuf[j + 1] = input[offset + uv + i];     // U (shared between pixels)
-            tmprowbuf[j + 2] = input[offset + uv + i + 1]; // V (shared between pixels)
-            tmprowbuf[j + 3] = input[offset + i + 1];      // Y (unique to this pixel)
-            tmprowbuf[j + 4] = input[offset + uv + i];     // U (shared between pixels)
-            tmprowbuf[j + 5] = input[offset + uv + i + 1]; // V (shared between pixels)
-        }
+        line = cinfo.next_scanline + hsl/2;
+        // Y Cb Cr for each pixel, the chroma is shared by 2 pixels
+        k->nv12_to_ycbcr(tmprowbuf, input + line * width + wsl/2,
+                input + width * height + (line / 2) * width + wsl/2, cinfo.image_width);
         jpeg_write_scanlines(&cinfo, row_pointer, 1);
     }
 
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
 
-    if (strcmp("stdout", output_file) == 0)
-        fwrite(outbuffer, 1, outlen, stdout);
-    else {
-        fp = fopen(output_file, "wb");
-        if (fp == NULL)
+    return finish_output(fd, &dest, mem.buffer, mem.len, output, output_len);
+}
+
+/*
+ * Encodes a 4:2:0 picture passing the planes to libjpeg as they are
+ * (raw_data_in): no YCbCr rows to expand and no downsampling in libjpeg.
+ * uv_step is 1 if u and v are separate planes (I420), 2 if they are
+ * interleaved (NV12, v = u + 1): the chroma is split 8 rows at a time.
+ * The JPEG goes to fd if it is >= 0, to *output otherwise.
+ */
+static int raw_to_jpg(int fd, unsigned char **output, unsigned long *output_len,
+                          unsigned char *y, int y_stride, unsigned char *u, unsigned char *v, int uv_stride, int uv_step,
+                          const int width, const int height)
+{
+    struct jpeg_compress_struct cinfo;
+    jmp_error_mgr jerr;
+    fd_destination_mgr dest;
+    mem_destination_mgr mem;
+
+    JSAMPROW y_rows[2 * DCTSIZE];
+    JSAMPROW u_rows[DCTSIZE];
+    JSAMPROW v_rows[DCTSIZE];
+    JSAMPARRAY planes[3];
+
+    // libjpeg reads whole blocks: rows that end in the middle of one are copied and padded
+    int y_width = (width + DCTSIZE - 1) & ~(DCTSIZE - 1);
+    int c_width = (width / 2 + DCTSIZE - 1) & ~(DCTSIZE - 1);
+    int copy_y = (y_width != width);
+    int copy_c = (c_width != width / 2) || (uv_step != 1);
+    unsigned char *y_tmp = NULL;
+    unsigned char *c_tmp = NULL;
+    unsigned char *src, *dst;
+    const yuv_kernels *k = yuv_get_kernels();
+    int row, r, line;
+
+    if ((width % 2) || (height % 2)) return -1;
+
+    if (copy_y) {
+        y_tmp = (unsigned char *) malloc(2 * DCTSIZE * y_width);
+        if (y_tmp == NULL) return -1;
+    }
+    if (copy_c) {
+        c_tmp = (unsigned char *) malloc(2 * DCTSIZE * c_width);
+        if (c_tmp == NULL) {
+            free(y_tmp);
             return -1;
-        fwrite(outbuffer, 1, outlen, fp);
-        fclose(fp);
+        }
+    }
+
+    cinfo.err = jpeg_jmp_error(&jerr);
+    memset(&mem, 0, sizeof(mem));
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(mem.buffer);
+        free(y_tmp);
+        free(c_tmp);
+        return -1;
+    }
+    jpeg_create_compress(&cinfo);
+    // A JPEG that must fit a size is made in memory first
+    if ((fd >= 0) && (options.target_size == 0)) jpeg_fd_dest(&cinfo, &dest, fd);
+    else jpeg_grow_mem_dest(&cinfo, &mem);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+
+    // The defaults are 2x2 for Y and 1x1 for Cb and Cr: 4:2:0 as the planes
+    jpeg_set_defaults(&cinfo);
+    set_options(&cinfo, options.quality);
+    cinfo.raw_data_in = TRUE;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    planes[0] = y_rows;
+    planes[1] = u_rows;
+    planes[2] = v_rows;
+
+    for (row = 0; row < height; row += 2 * DCTSIZE) {
+        // The rows after the bottom repeat the last one
+        for (r = 0; r < 2 * DCTSIZE; r++) {
+            line = (row + r < height) ? row + r : height - 1;
+            src = y + line * y_stride;
+            if (copy_y) {
+                dst = y_tmp + r * y_width;
+                memcpy(dst, src, width);
+                memset(dst + width, src[width - 1], y_width - width);
+                y_rows[r] = dst;
+            } else {
+                y_rows[r] = src;
+            }
+        }
+        for (r = 0; r < DCTSIZE; r++) {
+            line = (row / 2 + r < height / 2) ? row / 2 + r : height / 2 - 1;
+            if (copy_c) {
+                u_rows[r] = c_tmp + r * c_width;
+                v_rows[r] = c_tmp + (DCTSIZE + r) * c_width;
+                if (uv_step == 2) {
+                    k->split_uv(u_rows[r], v_rows[r], u + line * uv_stride, width / 2);
+                } else {
+                    memcpy(u_rows[r], u + line * uv_stride, width / 2);
+                    memcpy(v_rows[r], v + line * uv_stride, width / 2);
+                }
+                memset(u_rows[r] + width / 2, u_rows[r][width / 2 - 1], c_width - width / 2);
+                memset(v_rows[r] + width / 2, v_rows[r][width / 2 - 1], c_width - width / 2);
+            } else {
+                u_rows[r] = u + line * uv_stride;
+                v_rows[r] = v + line * uv_stride;
+            }
+        }
+        jpeg_write_raw_data(&cinfo, planes, 2 * DCTSIZE);
     }
 
-    return outlen;
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(y_tmp);
+    free(c_tmp);
+
+    return finish_output(fd, &dest, mem.buffer, mem.len, output, output_len);
+}
+
+// Crops the center of an NV12 picture, see YUVtoJPGMem()
+static int nv12_to_jpg(int fd, unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height)
+{
+    unsigned int wsl, hsl;
+
+    // width != dest_width currently not supported
+    if (width < dest_width) return -1;
+
+    // height < dest_height currently not supported
+    if (height < dest_height) return -1;
+
+    wsl = width - dest_width;
+    hsl = height - dest_height;
+
+    // width - dest_width must be even
+    if ((wsl % 2) == 1) return -1;
+
+    // height - dest_height must be even
+    if ((hsl % 2) == 1) return -1;
+
+    // Crop the center
+    return raw_to_jpg(fd, output, output_len,
+            input + (hsl / 2) * width + wsl / 2,
+            width,
+            input + width * height + (hsl / 4) * width + (wsl / 4) * 2,
+            input + width * height + (hsl / 4) * width + (wsl / 4) * 2 + 1,
+            width, 2, dest_width, dest_height);
+}
+
+/**
+ * Converts a YUYV raw buffer to a JPEG buffer.
+ * Input is YUYV (YUV 420SP NV12). Output is JPEG binary, allocated with
+ * malloc() in *output.
+ */
+int YUVtoJPGMem(unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height)
+{
+    return nv12_to_jpg(-1, output, output_len, input, width, height, dest_width, dest_height);
+}
+
+/**
+ * YUVtoJPGMem() writing the JPEG to fd as it is encoded.
+ * Returns the bytes written, < 0 on error.
+ */
+int YUVtoJPGFd(int fd, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height)
+{
+    return nv12_to_jpg(fd, NULL, NULL, input, width, height, dest_width, dest_height);
+}
+
+/**
+ * Converts the planes of a YUV 420P (I420) picture, as the decoder gives
+ * them, to a JPEG buffer allocated with malloc() in *output.
+ */
+int I420toJPGMem(unsigned char **output, unsigned long *output_len, unsigned char *planes[3], int strides[3], const int width, const int height)
+{
+    // The encoder wants the same stride for Cb and Cr
+    if (strides[1] != strides[2]) return -1;
+
+    return raw_to_jpg(-1, output, output_len, planes[0], strides[0], planes[1], planes[2], strides[1], 1, width, height);
+}
+
+/**
+ * I420toJPGMem() writing the JPEG to fd as it is encoded.
+ * Returns the bytes written, < 0 on error.
+ */
+int I420toJPGFd(int fd, unsigned char *planes[3], int strides[3], const int width, const int height)
+{
+    if (strides[1] != strides[2]) return -1;
+
+    return raw_to_jpg(fd, NULL, NULL, planes[0], strides[0], planes[1], planes[2], strides[1], 1, width, height);
+}
+
+/**
+ * Converts a YUYV raw buffer to a JPEG buffer of (width x height) * scale_num / 8,
+ * letting libjpeg scale in the DCT. Needs libjpeg 7 or later.
+ */
+int YUVtoJPGMemDCT(unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int scale_num)
+{
+#if JPEG_LIB_VERSION >= 70
+    if ((scale_num < 1) || (scale_num > 16)) return -1;
+
+    return yuv_to_jpg(-1, output, output_len, input, width, height, width, height, scale_num);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * YUVtoJPGMemDCT() writing the JPEG to fd as it is encoded.
+ * Returns the bytes written, < 0 on error.
+ */
+int YUVtoJPGFdDCT(int fd, unsigned char *input, const int width, const int height, const int scale_num)
+{
+#if JPEG_LIB_VERSION >= 70
+    if ((scale_num < 1) || (scale_num > 16)) return -1;
+
+    return yuv_to_jpg(fd, NULL, NULL, input, width, height, width, height, scale_num);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Converts a YUYV raw buffer to a JPEG file, or to stdout.
+ */
+int YUVtoJPG(char *output_file, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height)
+{
+    int fd, ret;
+
+    if (strcmp("stdout", output_file) == 0)
+        return YUVtoJPGFd(STDOUT_FILENO, input, width, height, dest_width, dest_height);
+
+    fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    ret = YUVtoJPGFd(fd, input, width, height, dest_width, dest_height);
+    if (close(fd) < 0)
+        ret = -1;
+
+    return ret;
 }
 
 int convert2jpg(char *output_file, char *input_file, const int width, const int height, const int dest_width, const int dest_height)
 {
     FILE *fp;
-    char *buffer;
-    int size;
+    unsigned char *buffer;
+    int size, ret;
 
-    fp = fopen(input_file, "wb");
+    fp = fopen(input_file, "rb");
     if (fp == NULL)
         return -1;
 
     size = width * height * 3 / 2;
     buffer = (unsigned char *) malloc(size * sizeof(unsigned char));
-    if (fread(buffer, 1, size, fp) != size)
+    if (buffer == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    if (fread(buffer, 1, size, fp) != size) {
+        free(buffer);
+        fclose(fp);
         return -2;
+    }
+    fclose(fp);
 
-    YUVtoJPG(output_file, buffer, width, height, dest_width, dest_height);
+    ret = YUVtoJPG(output_file, buffer, width, height, dest_width, dest_height);
     free(buffer);
 
-    fclose(fp);
+    return ret;
 }
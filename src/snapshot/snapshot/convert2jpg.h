@@ -18,14 +18,67 @@
  * Reads the YUV buffer, extracts the last frame and converts it to jpg.
  */
 
+#ifndef CONVERT2JPG_H
+#define CONVERT2JPG_H
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 #include <jpeglib.h>
 
 #define JPEG_QUALITY 90
 
+// The search for a target size doesn't go below this quality
+#define JPEG_MIN_QUALITY 10
+
+// Bytes written at a time by the *Fd() encoders
+#define JPEG_FD_CHUNK 4096
+
+// First size of the buffer of the *Mem() encoders, it doubles as needed
+#define JPEG_MEM_INITIAL_SIZE 65536
+
+/*
+ * Biggest picture for the optimize, progressive and target size modes:
+ * they keep the DCT blocks of the whole picture, 3 bytes a pixel in
+ * 4:2:0, and the target size twice. 1280x720 is under 6 MB at worst.
+ */
+#define JPEG_BUFFERED_MAX_PIXELS (1280 * 720)
+
+typedef struct {
+    // 1 to 100
+    int quality;
+    // Huffman tables made for the image: one more pass on the DCT blocks of the whole image
+    int optimize;
+    // Progressive scans, with optimized tables: more passes
+    int progressive;
+    // If > 0, the quality goes down until the JPEG fits, not below JPEG_MIN_QUALITY
+    unsigned long target_size;
+} jpeg_options;
+
+/*
+ * Options of the encoders below, for all the images that follow.
+ * The defaults are JPEG_QUALITY, baseline and standard Huffman tables.
+ */
+void JPGDefaultOptions(jpeg_options *options);
+void JPGSetOptions(const jpeg_options *options);
+
+int YUVtoJPGMem(unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height);
+int I420toJPGMem(unsigned char **output, unsigned long *output_len, unsigned char *planes[3], int strides[3], const int width, const int height);
+int YUVtoJPGMemDCT(unsigned char **output, unsigned long *output_len, unsigned char *input, const int width, const int height, const int scale_num);
+int YUVtoJPGFd(int fd, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height);
+int I420toJPGFd(int fd, unsigned char *planes[3], int strides[3], const int width, const int height);
+int YUVtoJPGFdDCT(int fd, unsigned char *input, const int width, const int height, const int scale_num);
 int YUVtoJPG(char * output_file, unsigned char *input, const int width, const int height, const int dest_width, const int dest_height);
 int convert2jpg(char *output_file, char *input_file, const int width, const int height, const int dest_width, const int dest_height);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
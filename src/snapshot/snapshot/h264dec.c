@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * H.264 decoder context kept open across frames.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef HAVE_AV_CONFIG_H
+#undef HAVE_AV_CONFIG_H
+#endif
+
+#include "libavcodec/avcodec.h"
+
+#include "h264dec.h"
+#include "yuv.h"
+
+#define FF_INPUT_BUFFER_PADDING_SIZE 32
+
+struct h264dec {
+    AVCodecContext *c;
+    AVFrame *picture;
+    uint8_t *inbuf;
+    int inbuf_size;
+    int got_picture;
+};
+
+h264dec *h264dec_open(void)
+{
+    AVCodec *codec;
+    h264dec *dec;
+
+    codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec) return NULL;
+
+    dec = (h264dec *) calloc(1, sizeof(h264dec));
+    if (dec == NULL) return NULL;
+
+    dec->c = avcodec_alloc_context3(codec);
+    dec->picture = av_frame_alloc();
+    if ((dec->c == NULL) || (dec->picture == NULL)) {
+        h264dec_close(dec);
+        return NULL;
+    }
+
+    if((codec->capabilities) & AV_CODEC_CAP_TRUNCATED)
+        (dec->c->flags) |= AV_CODEC_FLAG_TRUNCATED;
+    // The stream has no B frames: every picture comes out of its own packet
+    (dec->c->flags) |= AV_CODEC_FLAG_LOW_DELAY;
+
+    if (avcodec_open2(dec->c, codec, NULL) < 0) {
+        av_free(dec->c);
+        dec->c = NULL;
+        h264dec_close(dec);
+        return NULL;
+    }
+
+    return dec;
+}
+
+void h264dec_close(h264dec *dec)
+{
+    if (dec == NULL) return;
+
+    if (dec->picture != NULL) av_frame_free(&dec->picture);
+    if (dec->c != NULL) {
+        avcodec_close(dec->c);
+        av_free(dec->c);
+    }
+    free(dec->inbuf);
+    free(dec);
+}
+
+int h264dec_decode(h264dec *dec, unsigned char *p, int length, int *width, int *height)
+{
+    AVPacket avpkt;
+    int len;
+
+    dec->got_picture = 0;
+
+    // The input buffer is kept and grows with the biggest frame
+    if (length + FF_INPUT_BUFFER_PADDING_SIZE > dec->inbuf_size) {
+        uint8_t *inbuf = (uint8_t *) realloc(dec->inbuf, length + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (inbuf == NULL) return -2;
+        dec->inbuf = inbuf;
+        dec->inbuf_size = length + FF_INPUT_BUFFER_PADDING_SIZE;
+    }
+    memcpy(dec->inbuf, p, length);
+    memset(dec->inbuf + length, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    av_init_packet(&avpkt);
+    avpkt.size = length;
+    avpkt.data = dec->inbuf;
+
+    len = avcodec_send_packet(dec->c, &avpkt);
+    if (len < 0 && len != AVERROR(EAGAIN) && len != AVERROR_EOF) {
+        return -2;
+    }
+    len = avcodec_receive_frame(dec->c, dec->picture);
+    if (len < 0) {
+        return -2;
+    }
+
+    dec->got_picture = 1;
+    if (width != NULL) *width = dec->c->width;
+    if (height != NULL) *height = dec->c->height;
+
+    return 0;
+}
+
+int h264dec_nv12(h264dec *dec, unsigned char *outbuffer)
+{
+    return h264dec_nv12_rect(dec, outbuffer, 0, 0, dec->c->width, dec->c->height);
+}
+
+int h264dec_nv12_rect(h264dec *dec, unsigned char *outbuffer, int x, int y, int width, int height)
+{
+    AVFrame *picture = dec->picture;
+    const yuv_kernels *k = yuv_get_kernels();
+    int i;
+
+    if (!dec->got_picture) return -1;
+    if ((x | y | width | height) & 1) return -1;
+    if ((x < 0) || (y < 0) || (width <= 0) || (height <= 0) ||
+            (x + width > dec->c->width) || (y + height > dec->c->height)) return -1;
+
+    for(i=0; i<height; i++) {
+        memcpy(outbuffer + width * i, picture->data[0] + (y + i) * picture->linesize[0] + x, width);
+    }
+    for(i=0; i<height/2; i++) {
+        k->interleave_uv(outbuffer + width * height + width * i,
+                picture->data[1] + (y / 2 + i) * picture->linesize[1] + x / 2,
+                picture->data[2] + (y / 2 + i) * picture->linesize[2] + x / 2, width / 2);
+    }
+
+    return 0;
+}
+
+int h264dec_planes(h264dec *dec, unsigned char *planes[3], int strides[3])
+{
+    int i;
+
+    if (!dec->got_picture) return -1;
+
+    for (i = 0; i < 3; i++) {
+        planes[i] = dec->picture->data[i];
+        strides[i] = dec->picture->linesize[i];
+    }
+
+    return 0;
+}
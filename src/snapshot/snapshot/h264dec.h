@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * H.264 decoder context kept open across frames, so a resident process
+ * pays avcodec_find_decoder/avcodec_open2 only once.
+ */
+
+#ifndef H264DEC_H
+#define H264DEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct h264dec h264dec;
+
+/* Returns NULL if the decoder can't be opened */
+h264dec *h264dec_open(void);
+void h264dec_close(h264dec *dec);
+
+/*
+ * Decodes one access unit (Annex B, with start codes).
+ * Returns 0 and the size of the picture if a picture is ready, < 0 otherwise.
+ */
+int h264dec_decode(h264dec *dec, unsigned char *p, int length, int *width, int *height);
+
+/* Copies the last decoded picture to outbuffer as NV12 (width * height * 3 / 2) */
+int h264dec_nv12(h264dec *dec, unsigned char *outbuffer);
+
+/*
+ * Copies the region of width x height at x, y (even values) of the last
+ * decoded picture to outbuffer as NV12 (width * height * 3 / 2).
+ * Returns < 0 if it isn't inside the picture.
+ */
+int h264dec_nv12_rect(h264dec *dec, unsigned char *outbuffer, int x, int y, int width, int height);
+
+/*
+ * Y, U and V planes (I420) of the last decoded picture, without copying:
+ * they belong to the decoder and are valid until the next decode.
+ */
+int h264dec_planes(h264dec *dec, unsigned char *planes[3], int strides[3]);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -17,7 +17,11 @@
 /*
  * Read the last h264 i-frame from the buffer and convert it using libavcodec
  * and libjpeg.
- * The position of the frame is written in /tmp/iframe.idx
+ * If snapshotd is running the snapshot is asked to it, which keeps the
+ * decoder open, otherwise the whole pipeline runs here.
+ * In burst mode it captures a sequence of pictures, see burst.h.
+ * With a frame offset or a time it shows a frame still in the ring: the
+ * frames from its keyframe are decoded up to it.
  */
 
 #define _GNU_SOURCE
@@ -25,269 +29,100 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <stdint.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/time.h>
 #include <getopt.h>
-#include <signal.h>
-
-#ifdef HAVE_AV_CONFIG_H
-#undef HAVE_AV_CONFIG_H
-#endif
-
-#include "libavcodec/avcodec.h"
-
-#include "convert2jpg.h"
-#include "add_water.h"
-
-#define FF_INPUT_BUFFER_PADDING_SIZE 32
-
-#define PATH_RES_HIGH "/home/yi-hack/etc/wm_res/high/wm_540p_"
-#define PATH_RES_LOW  "/home/yi-hack/etc/wm_res/low/wm_540p_"
-
-// yi_home
-#define TABLE_HIGH_OFFSET_YI_HOME 0x10
-#define TABLE_LOW_OFFSET_YI_HOME 0x12E0
-#define TABLE_RECORD_SIZE_YI_HOME 32
-#define TABLE_RECORD_NUM_YI_HOME 150
-#define BUF_SIZE_YI_HOME 648000
-#define STREAM_HIGH_OFFSET_YI_HOME 0x4B40
-#define STREAM_LOW_OFFSET_YI_HOME 0x68B40
-#define FRAME_COUNTER_OFFSET_YI_HOME 18
-#define FRAME_OFFSET_OFFSET_YI_HOME 4
-#define FRAME_LENGTH_OFFSET_YI_HOME 8
-#define FRAME_TYPE_OFFSET_YI_HOME 16
-#define W_LOW_YI_HOME 640
-#define H_LOW_YI_HOME 360
-#define W_HIGH_YI_HOME 1280
-#define H_HIGH_YI_HOME 720
-
-// yi_home_1080p
-#define TABLE_HIGH_OFFSET_YI_HOME_1080P 0x10
-#define TABLE_LOW_OFFSET_YI_HOME_1080P 0x25A0
-#define TABLE_RECORD_SIZE_YI_HOME_1080P 32
-#define TABLE_RECORD_NUM_YI_HOME_1080P 300
-#define BUF_SIZE_YI_HOME_1080P 1586752
-#define STREAM_HIGH_OFFSET_YI_HOME_1080P 0x9640
-#define STREAM_LOW_OFFSET_YI_HOME_1080P 0x109640
-#define FRAME_COUNTER_OFFSET_YI_HOME_1080P 18
-#define FRAME_OFFSET_OFFSET_YI_HOME_1080P 4
-#define FRAME_LENGTH_OFFSET_YI_HOME_1080P 8
-#define FRAME_TYPE_OFFSET_YI_HOME_1080P 16
-#define W_LOW_YI_HOME_1080P 640
-#define H_LOW_YI_HOME_1080P 360
-#define W_HIGH_YI_HOME_1080P 1920
-#define H_HIGH_YI_HOME_1080P 1080
-
-// yi_dome_720p
-#define TABLE_HIGH_OFFSET_YI_DOME_720P 0x10
-#define TABLE_LOW_OFFSET_YI_DOME_720P 0x1920
-#define TABLE_RECORD_SIZE_YI_DOME_720P 32
-#define TABLE_RECORD_NUM_YI_DOME_720P 200
-#define BUF_SIZE_YI_DOME_720P 654400
-#define STREAM_HIGH_OFFSET_YI_DOME_720P 0x6440
-#define STREAM_LOW_OFFSET_YI_DOME_720P 0x6A440
-#define FRAME_COUNTER_OFFSET_YI_DOME_720P 18
-#define FRAME_OFFSET_OFFSET_YI_DOME_720P 4
-#define FRAME_LENGTH_OFFSET_YI_DOME_720P 8
-#define FRAME_TYPE_OFFSET_YI_DOME_720P 16
-#define W_LOW_YI_DOME_720P 640
-#define H_LOW_YI_DOME_720P 360
-#define W_HIGH_YI_DOME_720P 1280
-#define H_HIGH_YI_DOME_720P 720
-
-// yi_outdoor
-#define TABLE_HIGH_OFFSET_YI_OUTDOOR 0x10
-#define TABLE_LOW_OFFSET_YI_OUTDOOR 0x25A0
-#define TABLE_RECORD_SIZE_YI_OUTDOOR 32
-#define TABLE_RECORD_NUM_YI_OUTDOOR 300
-#define BUF_SIZE_YI_OUTDOOR 1586752
-#define STREAM_HIGH_OFFSET_YI_OUTDOOR 0x9640
-#define STREAM_LOW_OFFSET_YI_OUTDOOR 0x109640
-#define FRAME_COUNTER_OFFSET_YI_OUTDOOR 18
-#define FRAME_OFFSET_OFFSET_YI_OUTDOOR 4
-#define FRAME_LENGTH_OFFSET_YI_OUTDOOR 8
-#define FRAME_TYPE_OFFSET_YI_OUTDOOR 16
-#define W_LOW_YI_OUTDOOR 640
-#define H_LOW_YI_OUTDOOR 360
-#define W_HIGH_YI_OUTDOOR 1280
-#define H_HIGH_YI_OUTDOOR 720
-
-#define MILLIS_10 10000
-
-#define RESOLUTION_NONE 0
-#define RESOLUTION_LOW  360
-#define RESOLUTION_HIGH 1080
-
-#define BUFFER_FILE "/tmp/view"
-
-typedef struct {
-    int sps_addr;
-    int sps_len;
-    int pps_addr;
-    int pps_len;
-    int idr_addr;
-    int idr_len;
-} frame;
+#include <errno.h>
+#include <limits.h>
 
-int debug = 0;
-unsigned char *addr;
-
-long long current_timestamp() {
-    struct timeval te;
-    gettimeofday(&te, NULL); // get current time
-    long long milliseconds = te.tv_sec*1000LL + te.tv_usec/1000; // calculate milliseconds
+#include "ring.h"
+#include "snapshot.h"
+#include "burst.h"
 
-    return milliseconds;
-}
+int debug = 0;
 
-int frame_decode(unsigned char *outbuffer, unsigned char *p, int length)
+/*
+ * Asks the snapshot to snapshotd and writes it to stdout.
+ * Returns -1 if the daemon is not running, < -1 on other errors.
+ */
+int daemon_snapshot(int resolution, int watermark, int mode, int offset, const snapshot_rect *crop, int width, int height,
+                    const jpeg_options *jpeg)
 {
-    AVCodec *codec;
-    AVCodecContext *c= NULL;
-    AVFrame *picture;
-    int got_picture, len;
-    FILE *fOut;
-    uint8_t *inbuf;
-    AVPacket avpkt;
-    int i, j, size;
-
-//////////////////////////////////////////////////////////
-//                    Reading H264                      //
-//////////////////////////////////////////////////////////
-
-    if (debug) fprintf(stderr, "Starting decode\n");
-
-    av_init_packet(&avpkt);
-
-    codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-    if (!codec) {
-        if (debug) fprintf(stderr, "Codec h264 not found\n");
-        return -2;
-    }
-
-    c = avcodec_alloc_context3(codec);
-    picture = av_frame_alloc();
-
-    if((codec->capabilities) & AV_CODEC_CAP_TRUNCATED)
-        (c->flags) |= AV_CODEC_FLAG_TRUNCATED;
-
-    if (avcodec_open2(c, codec, NULL) < 0) {
-        if (debug) fprintf(stderr, "Could not open codec h264\n");
-        av_free(c);
-        return -2;
+    struct sockaddr_un addr;
+    char request[320];
+    char offset_param[24];
+    char crop_param[64];
+    char buffer[4096];
+    char *body;
+    int sock, len, header_len, header_done;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, SNAPSHOTD_SOCKET, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
     }
 
-    inbuf = (uint8_t *) malloc(length + FF_INPUT_BUFFER_PADDING_SIZE);
-    if (inbuf == NULL) {
-        if (debug) fprintf(stderr, "Error allocating memory\n");
-        avcodec_close(c);
-        av_free(c);
+    // Without offset the daemon uses the keyframe of mode, without crop the whole picture
+    offset_param[0] = '\0';
+    if (offset >= 0) sprintf(offset_param, "&offset=%d", offset);
+    crop_param[0] = '\0';
+    if (crop->width > 0) sprintf(crop_param, "&crop=%d,%d,%d,%d", crop->x, crop->y, crop->width, crop->height);
+
+    len = snprintf(request, sizeof(request), "GET /snapshot.jpg?res=%s&watermark=%s&mode=%s%s%s&width=%d&height=%d"
+            "&quality=%d&optimize=%s&progressive=%s&max_size=%lu HTTP/1.0\r\n\r\n",
+            (resolution == RESOLUTION_LOW) ? "low" : "high", watermark ? "yes" : "no",
+            (mode == RING_NEXT) ? "next" : "latest", offset_param, crop_param, width, height,
+            jpeg->quality, jpeg->optimize ? "yes" : "no", jpeg->progressive ? "yes" : "no", jpeg->target_size);
+    if (write(sock, request, len) != len) {
+        close(sock);
         return -2;
     }
-    memset(inbuf + length, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-    // Get only 1 frame
-    memcpy(inbuf, p, length);
-    avpkt.size = length;
-    avpkt.data = inbuf;
 
-    // Decode frame
-    if (debug) fprintf(stderr, "Decode frame\n");
-    if (c->codec_type == AVMEDIA_TYPE_VIDEO ||
-         c->codec_type == AVMEDIA_TYPE_AUDIO) {
-
-        len = avcodec_send_packet(c, &avpkt);
-        if (len < 0 && len != AVERROR(EAGAIN) && len != AVERROR_EOF) {
-            if (debug) fprintf(stderr, "Error decoding frame\n");
-            return -2;
-        } else {
-            if (len >= 0)
-                avpkt.size = 0;
-            len = avcodec_receive_frame(c, picture);
-            if (len >= 0)
-                got_picture = 1;
+    // Skip the header, then copy the JPEG
+    header_len = 0;
+    header_done = 0;
+    while ((len = read(sock, buffer + header_len, sizeof(buffer) - 1 - header_len)) > 0) {
+        if (header_done) {
+            fwrite(buffer, 1, len, stdout);
+            continue;
         }
-    }
-    if(!got_picture) {
-        if (debug) fprintf(stderr, "No input frame\n");
-        free(inbuf);
-        av_frame_free(&picture);
-        avcodec_close(c);
-        av_free(c);
-        return -2;
-    }
-
-    if (debug) fprintf(stderr, "Writing yuv buffer\n");
-    memset(outbuffer, 0x80, c->width * c->height * 3 / 2);
-    memcpy(outbuffer, picture->data[0], c->width * c->height);
-    for(i=0; i<c->height/2; i++) {
-        for(j=0; j<c->width/2; j++) {
-            outbuffer[c->width * c->height + c->width * i +  2 * j] = *(picture->data[1] + i * picture->linesize[1] + j);
-            outbuffer[c->width * c->height + c->width * i +  2 * j + 1] = *(picture->data[2] + i * picture->linesize[2] + j);
+        header_len += len;
+        buffer[header_len] = '\0';
+        body = strstr(buffer, "\r\n\r\n");
+        if (body == NULL) {
+            if (header_len >= sizeof(buffer) - 1) break;
+            continue;
         }
-    }
-
-    // Clean memory
-    if (debug) fprintf(stderr, "Cleaning ffmpeg memory\n");
-    free(inbuf);
-    av_frame_free(&picture);
-    avcodec_close(c);
-    av_free(c);
-
-    return 0;
-}
-
-int add_watermark(char *buffer, int width, int height)
-{
-    int w_res, h_res;
-    char path_res[1024];
-    FILE *fBuf;
-    WaterMarkInfo WM_info;
-
-    w_res = width;
-    h_res = height;
-    if (width == 640) {
-        strcpy(path_res, PATH_RES_LOW);
-    } else if (width == 1280) {
-        strcpy(path_res, PATH_RES_LOW);
-    } else {
-        strcpy(path_res, PATH_RES_HIGH);
-    }
-
-    if (WMInit(&WM_info, path_res) < 0) {
-        fprintf(stderr, "water mark init error\n");
-        free(buffer);
-        return -1;
-    } else {
-        if (width == 640) {
-            AddWM(&WM_info, width, height, buffer,
-                buffer + width*height, width-230, height-20, NULL);
-        } else if (width == 1280) {
-            AddWM(&WM_info, w_res, h_res, buffer,
-                buffer + width*height, width-345, height-30, NULL);
-        } else {
-            AddWM(&WM_info, w_res, h_res, buffer,
-                buffer + width*height, width-460, height-40, NULL);
+        if (strncmp(buffer, "HTTP/1.0 200", 12) != 0) {
+            if (debug) fprintf(stderr, "snapshotd error: %.*s\n", (int) (strchr(buffer, '\r') - buffer), buffer);
+            close(sock);
+            return -3;
         }
-        WMRelease(&WM_info);
+        body += 4;
+        fwrite(body, 1, header_len - (body - buffer), stdout);
+        header_done = 1;
+        header_len = 0;
     }
+    close(sock);
 
-    return 0;
+    return header_done ? 0 : -3;
 }
 
 void print_usage(char *prog_name)
 {
     fprintf(stderr, "Usage: %s [options]\n", prog_name);
-    fprintf(stderr, "\t-r, --res RES                    Set resolution: \"low\" or \"high\" (default \"high\")\n");
+    fprintf(stderr, "\t-r, --res RES                    Set resolution: \"low\" or \"high\" (default \"high\", or \"low\" if the size fits it)\n");
     fprintf(stderr, "\t    --width WIDTH                Set width in pixel (alternative to res)\n");
     fprintf(stderr, "\t    --height HIGHT               Set height in pixel (alternative to res)\n");
-    fprintf(stderr, "\t-r, --model MODEL                Select cam model: yi_home, yi_home_1080, yi_dome_720p or yi_outdoor\n");
+    fprintf(stderr, "\t-m, --model MODEL                Select cam model: yi_home, yi_home_1080, yi_dome_720p or yi_outdoor\n");
     fprintf(stderr, "\t    --table_offset VAL           Set the offset of the table for the resolution selected\n");
     fprintf(stderr, "\t    --table_record_size VAL      Set the size of the record in the table\n");
     fprintf(stderr, "\t    --table_record_num VAL       Set the number of record in the table\n");
@@ -296,68 +131,66 @@ void print_usage(char *prog_name)
     fprintf(stderr, "\t    --frame_counter_offset VAL   Set the offset of the frame counter in the record\n");
     fprintf(stderr, "\t    --frame_offset_offset VAL    Set the offset of the frame offset in the record\n");
     fprintf(stderr, "\t    --frame_length_offset VAL    Set  offset of the frame lenght in the record\n");
+    fprintf(stderr, "\t    --frame_type_offset VAL      Set the offset of the frame type in the record\n");
+    fprintf(stderr, "\t-s, --size WxH                   Resize the image: \"320x180\", \"320\" or \"x180\" keep the aspect ratio\n");
+    fprintf(stderr, "\t-C, --crop X,Y,W,H               Keep only the region of W x H pixels at X,Y of the picture (default res \"high\")\n");
+    fprintf(stderr, "\t-D, --dct-scaling                Let libjpeg resize when the size is N/8 of the image\n");
+    fprintf(stderr, "\t-q, --quality N                  Set the JPEG quality, 1 to 100 (default %d)\n", JPEG_QUALITY);
+    fprintf(stderr, "\t-O, --optimize                   Make Huffman tables for the image: smaller, a bit slower\n");
+    fprintf(stderr, "\t-P, --progressive                Encode a progressive JPEG: smaller again, slower\n");
+    fprintf(stderr, "\t-S, --max-size BYTES             Lower the quality until the JPEG fits BYTES (not below %d)\n", JPEG_MIN_QUALITY);
+    fprintf(stderr, "\t                                 snapshotd does -O, -P and -S up to 1280x720, use -n above\n");
     fprintf(stderr, "\t-w, --watermark                  Add watermark to image\n");
+    fprintf(stderr, "\t-l, --label TEXT                 Write TEXT before the date of the watermark\n");
+    fprintf(stderr, "\t-b, --burst SECONDS              Capture pictures for SECONDS instead of one\n");
+    fprintf(stderr, "\t-c, --count N                    Capture N pictures instead of one (with -b, at most N)\n");
+    fprintf(stderr, "\t-e, --every N                    In burst mode, capture every N frames instead of every keyframe\n");
+    fprintf(stderr, "\t-i, --interval MS                In burst mode, at least MS milliseconds between pictures\n");
+    fprintf(stderr, "\t-o, --output PATTERN             In burst mode, write the pictures to files, e.g. /tmp/sd/snap_%%04d.jpg\n");
+    fprintf(stderr, "\t                                 (default: multipart stream on stdout)\n");
+    fprintf(stderr, "\t-W, --wait                       Wait for the next keyframe instead of using the last one\n");
+    fprintf(stderr, "\t-f, --frame-offset N             Show the frame N frames before the newest one\n");
+    fprintf(stderr, "\t-t, --time MS                    Show the frame at MS milliseconds since the epoch, if still in the ring\n");
+    fprintf(stderr, "\t-n, --no-daemon                  Don't ask snapshotd, decode in this process\n");
     fprintf(stderr, "\t-d, --debug                      Enable debug\n");
     fprintf(stderr, "\t-h, --help                       Show this help\n");
 }
 
 int main(int argc, char **argv) {
-    unsigned char *frame_ptr;
-    unsigned int frame_offset;
-    unsigned int frame_length;
-    unsigned char *record_ptr, *next_record_ptr;
-
-    FILE *fFid = NULL;
-
-    int current_frame, frame_counter, frame_type, frame_counter_tmp, next_frame_counter, next_frame_type;
-    int frame_type_sum;
-    int table_offset, stream_offset;
-
-    int i, c, i_tmp;
-    mode_t mode = 0755;
+    int c, i_tmp;
     char *endptr;
-
-    int table_high_offset;
-    int table_low_offset;
-    int table_record_size;
-    int table_record_num;
-    int buf_size;
-    int stream_high_offset;
-    int stream_low_offset;
-    int frame_counter_offset;
-    int frame_offset_offset;
-    int frame_length_offset;
-    int frame_type_offset;
-    int width, height;
-    int w_low, h_low, w_high, h_high;
-
-    unsigned char *addr;
-    int resolution = RESOLUTION_HIGH;
-    int debug = 0;
+    int ret;
+
+    ring r;
+    ring_model model;
+    snapshot_ctx snapshot;
+
+    int resolution = RESOLUTION_NONE;
+    int out_width = 0;
+    int out_height = 0;
+    snapshot_rect crop;
+    int dct_scaling = 0;
+    jpeg_options jpeg;
     int watermark = 0;
-
-    unsigned char *bufferh264, *bufferyuv;
+    char *label = NULL;
+    int use_daemon = 1;
+    int mode = RING_LATEST;
+    // Frames before the newest one, -1 for the keyframe of mode
+    int offset = -1;
+    long long time_ms = 0;
+    burst_params burst;
+    long long start;
+
+    unsigned char *bufferh264;
     int bufferh264_size;
+    int *frame_ends;
+    int frame_count;
 
     // Settings default
-    table_high_offset = TABLE_HIGH_OFFSET_YI_HOME_1080P;
-    table_low_offset = TABLE_LOW_OFFSET_YI_HOME_1080P;
-    table_record_size = TABLE_RECORD_SIZE_YI_HOME_1080P;
-    table_record_num = TABLE_RECORD_NUM_YI_HOME_1080P;
-    buf_size = BUF_SIZE_YI_HOME_1080P;
-    stream_high_offset = STREAM_HIGH_OFFSET_YI_HOME_1080P;
-    stream_low_offset = STREAM_LOW_OFFSET_YI_HOME_1080P;
-    frame_counter_offset = FRAME_COUNTER_OFFSET_YI_HOME_1080P;
-    frame_offset_offset = FRAME_OFFSET_OFFSET_YI_HOME_1080P;
-    frame_length_offset = FRAME_LENGTH_OFFSET_YI_HOME_1080P;
-    frame_type_offset = FRAME_TYPE_OFFSET_YI_HOME_1080P;
-    w_low = W_LOW_YI_HOME_1080P;
-    h_low = H_LOW_YI_HOME_1080P;
-    w_high = W_HIGH_YI_HOME_1080P;
-    h_high = H_HIGH_YI_HOME_1080P;
-
-    table_offset = TABLE_HIGH_OFFSET_YI_HOME_1080P;
-    stream_offset = STREAM_HIGH_OFFSET_YI_HOME_1080P;
+    ring_model_by_name(&model, "yi_home_1080p");
+    memset(&burst, 0, sizeof(burst));
+    memset(&crop, 0, sizeof(crop));
+    JPGDefaultOptions(&jpeg);
 
     while (1) {
         static struct option long_options[] =
@@ -375,7 +208,24 @@ int main(int argc, char **argv) {
             {"frame_offset_offset",  required_argument, 0, '6'},
             {"frame_length_offset",  required_argument, 0, '7'},
             {"frame_type_offset",  required_argument, 0, '8'},
+            {"size",  required_argument, 0, 's'},
+            {"crop",  required_argument, 0, 'C'},
+            {"dct-scaling",  no_argument, 0, 'D'},
+            {"quality",  required_argument, 0, 'q'},
+            {"optimize",  no_argument, 0, 'O'},
+            {"progressive",  no_argument, 0, 'P'},
+            {"max-size",  required_argument, 0, 'S'},
             {"watermark",  no_argument, 0, 'w'},
+            {"label",  required_argument, 0, 'l'},
+            {"burst",  required_argument, 0, 'b'},
+            {"count",  required_argument, 0, 'c'},
+            {"every",  required_argument, 0, 'e'},
+            {"interval",  required_argument, 0, 'i'},
+            {"output",  required_argument, 0, 'o'},
+            {"wait",  no_argument, 0, 'W'},
+            {"frame-offset",  required_argument, 0, 'f'},
+            {"time",  required_argument, 0, 't'},
+            {"no-daemon",  no_argument, 0, 'n'},
             {"debug",  no_argument, 0, 'd'},
             {"help",  no_argument, 0, 'h'},
             {0, 0, 0, 0}
@@ -383,7 +233,7 @@ int main(int argc, char **argv) {
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "r:9:a:m:0:1:2:3:4:5:6:7:8:wdh",
+        c = getopt_long (argc, argv, "r:9:a:m:0:1:2:3:4:5:6:7:8:s:C:Dq:OPS:wl:b:c:e:i:o:Wf:t:ndh",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -400,70 +250,53 @@ int main(int argc, char **argv) {
             break;
 
         case 'm':
-            if (strcasecmp("yi_home", optarg) == 0) {
-                table_high_offset = TABLE_HIGH_OFFSET_YI_HOME;
-                table_low_offset = TABLE_LOW_OFFSET_YI_HOME;
-                table_record_size = TABLE_RECORD_SIZE_YI_HOME;
-                table_record_num = TABLE_RECORD_NUM_YI_HOME;
-                buf_size = BUF_SIZE_YI_HOME;
-                stream_high_offset = STREAM_HIGH_OFFSET_YI_HOME;
-                stream_low_offset = STREAM_LOW_OFFSET_YI_HOME;
-                frame_counter_offset = FRAME_COUNTER_OFFSET_YI_HOME;
-                frame_offset_offset = FRAME_OFFSET_OFFSET_YI_HOME;
-                frame_length_offset = FRAME_LENGTH_OFFSET_YI_HOME;
-                frame_type_offset = FRAME_TYPE_OFFSET_YI_HOME;
-                w_low = W_LOW_YI_HOME;
-                h_low = H_LOW_YI_HOME;
-                w_high = W_HIGH_YI_HOME;
-                h_high = H_HIGH_YI_HOME;
-            } else if (strcasecmp("yi_home_1080p", optarg) == 0) {
-                table_high_offset = TABLE_HIGH_OFFSET_YI_HOME_1080P;
-                table_low_offset = TABLE_LOW_OFFSET_YI_HOME_1080P;
-                table_record_size = TABLE_RECORD_SIZE_YI_HOME_1080P;
-                table_record_num = TABLE_RECORD_NUM_YI_HOME_1080P;
-                buf_size = BUF_SIZE_YI_HOME_1080P;
-                stream_high_offset = STREAM_HIGH_OFFSET_YI_HOME_1080P;
-                stream_low_offset = STREAM_LOW_OFFSET_YI_HOME_1080P;
-                frame_counter_offset = FRAME_COUNTER_OFFSET_YI_HOME_1080P;
-                frame_offset_offset = FRAME_OFFSET_OFFSET_YI_HOME_1080P;
-                frame_length_offset = FRAME_LENGTH_OFFSET_YI_HOME_1080P;
-                frame_type_offset = FRAME_TYPE_OFFSET_YI_HOME_1080P;
-                w_low = W_LOW_YI_HOME_1080P;
-                h_low = H_LOW_YI_HOME_1080P;
-                w_high = W_HIGH_YI_HOME_1080P;
-                h_high = H_HIGH_YI_HOME_1080P;
-            } else if (strcasecmp("yi_dome_720p", optarg) == 0) {
-                table_high_offset = TABLE_HIGH_OFFSET_YI_DOME_720P;
-                table_low_offset = TABLE_LOW_OFFSET_YI_DOME_720P;
-                table_record_size = TABLE_RECORD_SIZE_YI_DOME_720P;
-                table_record_num = TABLE_RECORD_NUM_YI_DOME_720P;
-                buf_size = BUF_SIZE_YI_DOME_720P;
-                stream_high_offset = STREAM_HIGH_OFFSET_YI_DOME_720P;
-                stream_low_offset = STREAM_LOW_OFFSET_YI_DOME_720P;
-                frame_counter_offset = FRAME_COUNTER_OFFSET_YI_DOME_720P;
-                frame_offset_offset = FRAME_OFFSET_OFFSET_YI_DOME_720P;
-                frame_length_offset = FRAME_LENGTH_OFFSET_YI_DOME_720P;
-                frame_type_offset = FRAME_TYPE_OFFSET_YI_DOME_720P;
-                w_low = W_LOW_YI_DOME_720P;
-                h_low = H_LOW_YI_DOME_720P;
-                w_high = W_HIGH_YI_DOME_720P;
-                h_high = H_HIGH_YI_DOME_720P;
-            } else if (strcasecmp("yi_outdoor", optarg) == 0) {
-                table_high_offset = TABLE_HIGH_OFFSET_YI_OUTDOOR;
-                table_low_offset = TABLE_LOW_OFFSET_YI_OUTDOOR;
-                table_record_size = TABLE_RECORD_SIZE_YI_OUTDOOR;
-                table_record_num = TABLE_RECORD_NUM_YI_OUTDOOR;
-                buf_size = BUF_SIZE_YI_OUTDOOR;
-                stream_high_offset = STREAM_HIGH_OFFSET_YI_OUTDOOR;
-                stream_low_offset = STREAM_LOW_OFFSET_YI_OUTDOOR;
-                frame_counter_offset = FRAME_COUNTER_OFFSET_YI_OUTDOOR;
-                frame_offset_offset = FRAME_OFFSET_OFFSET_YI_OUTDOOR;
-                frame_length_offset = FRAME_LENGTH_OFFSET_YI_OUTDOOR;
-                frame_type_offset = FRAME_TYPE_OFFSET_YI_OUTDOOR;
-                w_low = W_LOW_YI_OUTDOOR;
-                h_low = H_LOW_YI_OUTDOOR;
-                w_high = W_HIGH_YI_OUTDOOR;
-                h_high = H_HIGH_YI_OUTDOOR;
+            ring_model_by_name(&model, optarg);
+            break;
+
+        case 's':
+            if (optarg[0] == 'x') {
+                i_tmp = sscanf(optarg, "x%d", &out_height);
+            } else {
+                i_tmp = sscanf(optarg, "%dx%d", &out_width, &out_height);
+            }
+            if ((i_tmp < 1) || (out_width < 0) || (out_height < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'C':
+            if (snapshot_parse_rect(&crop, optarg) < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'D':
+            dct_scaling = 1;
+            break;
+
+        case 'q':
+            jpeg.quality = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (jpeg.quality < 1) || (jpeg.quality > 100)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'O':
+            jpeg.optimize = 1;
+            break;
+
+        case 'P':
+            jpeg.progressive = 1;
+            break;
+
+        case 'S':
+            jpeg.target_size = strtoul(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (jpeg.target_size == 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
             }
             break;
 
@@ -471,6 +304,57 @@ int main(int argc, char **argv) {
             watermark = 1;
             break;
 
+        case 'l':
+            label = optarg;
+            // snapshotd has its own label
+            use_daemon = 0;
+            break;
+
+        case 'b':
+            burst.duration = atoi(optarg) * 1000;
+            break;
+
+        case 'c':
+            burst.count = atoi(optarg);
+            break;
+
+        case 'e':
+            burst.every = atoi(optarg);
+            break;
+
+        case 'i':
+            burst.interval = atoi(optarg);
+            break;
+
+        case 'o':
+            burst.output = optarg;
+            break;
+
+        case 'W':
+            mode = RING_NEXT;
+            break;
+
+        case 'f':
+            offset = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (offset < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 't':
+            time_ms = strtoll(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (time_ms <= 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            offset = ring_time_offset(time_ms);
+            break;
+
+        case 'n':
+            use_daemon = 0;
+            break;
+
         case '0':
         case '1':
         case '2':
@@ -495,32 +379,35 @@ int main(int argc, char **argv) {
                 exit(EXIT_FAILURE);
             }
 
+            // The daemon doesn't know about a custom layout
+            use_daemon = 0;
+
             if (c == '0') {
-                table_high_offset = i_tmp;
-                table_low_offset = i_tmp;
+                model.table_high_offset = i_tmp;
+                model.table_low_offset = i_tmp;
             } else if (c == '1') {
-                table_record_size = i_tmp;
+                model.table_record_size = i_tmp;
             } else if (c == '2') {
-                table_record_num = i_tmp;
+                model.table_record_num = i_tmp;
             } else if (c == '3') {
-                buf_size = i_tmp;
+                model.buf_size = i_tmp;
             } else if (c == '4') {
-                stream_high_offset = i_tmp;
-                stream_low_offset = i_tmp;
+                model.stream_high_offset = i_tmp;
+                model.stream_low_offset = i_tmp;
             } else if (c == '5') {
-                frame_counter_offset = i_tmp;
+                model.frame_counter_offset = i_tmp;
             } else if (c == '6') {
-                frame_offset_offset = i_tmp;
+                model.frame_offset_offset = i_tmp;
             } else if (c == '7') {
-                frame_length_offset = i_tmp;
+                model.frame_length_offset = i_tmp;
             } else if (c == '8') {
-                frame_type_offset = i_tmp;
+                model.frame_type_offset = i_tmp;
             } else if (c == '9') {
-                w_low = i_tmp;
-                w_high = i_tmp;
+                model.w_low = i_tmp;
+                model.w_high = i_tmp;
             } else if (c == 'a') {
-                h_low = i_tmp;
-                h_high = i_tmp;
+                model.h_low = i_tmp;
+                model.h_high = i_tmp;
             }
 
             break;
@@ -547,174 +434,99 @@ int main(int argc, char **argv) {
 
     if (debug) fprintf(stderr, "Starting program\n");
 
+    // The crop is in pixels of the high resolution, unless another one is chosen
+    if ((resolution == RESOLUTION_NONE) && (crop.width > 0)) {
+        resolution = RESOLUTION_HIGH;
+    }
+
+    // A thumbnail doesn't need the high resolution decode
+    if (resolution == RESOLUTION_NONE) {
+        resolution = ring_fit_resolution(&model, out_width, out_height);
+    }
+
     if (resolution == RESOLUTION_LOW) {
-        table_offset = table_low_offset;
-        stream_offset = stream_low_offset;
-        width = w_low;
-        height = h_low;
         fprintf(stderr, "Resolution low\n");
     } else if (resolution == RESOLUTION_HIGH) {
-        table_offset = table_high_offset;
-        stream_offset = stream_high_offset;
-        width = w_high;
-        height = h_high;
         fprintf(stderr, "Resolution high\n");
     }
 
-    // Opening an existing file
-    fFid = fopen(BUFFER_FILE, "r") ;
-    if ( fFid == NULL ) {
-        fprintf(stderr, "Could not open file %s\n", BUFFER_FILE) ;
-        return -1;
+    if ((burst.duration < 0) || (burst.count < 0) || (burst.every < 0) || (burst.interval < 0)) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
     }
 
-    // Map file to memory
-    addr = (unsigned char*) mmap(NULL, buf_size, PROT_READ, MAP_SHARED, fileno(fFid), 0);
-    if (addr == MAP_FAILED) {
-        fprintf(stderr, "Error mapping file %s\n", BUFFER_FILE);
-        fclose(fFid);
-        return -2;
-    }
-    if (debug) fprintf(stderr, "%lld - mapping file %s, size %d, to %08x\n", current_timestamp(), BUFFER_FILE, buf_size, (unsigned int) addr);
-
-    // Closing the file
-    if (debug) fprintf(stderr, "%lld - closing the file %s\n", current_timestamp(), BUFFER_FILE) ;
-    fclose(fFid) ;
-
-    bufferh264 = NULL;
-    bufferh264_size = 0;
-    frame_type_sum = 0;
-
-    // Find the record with the largest frame_counter
-    current_frame = -1;
-    frame_counter = -1;
-    for (i = 0; i < table_record_num; i++) {
-        // Get pointer to the record
-        record_ptr = addr + table_offset + (i * table_record_size);
-        // Get the frame counter
-        frame_counter_tmp = (((int) *(record_ptr + frame_counter_offset + 1)) << 8) +
-                    ((int) *(record_ptr + frame_counter_offset));
-#if 0
-        frame_type = (int) *(record_ptr + frame_type_offset);
-        if (debug) fprintf(stderr, "%lld - frame_type %d\n", current_timestamp(), frame_type);
-        if (frame_type == 7) {
-            current_frame = i;
-            break;
+    if ((burst.duration > 0) || (burst.count > 0)) {
+        if (ring_open(&r, &model) < 0) {
+            return -2;
         }
-#endif
-        // Check if the is the largest frame_counter
-        if (frame_counter_tmp > frame_counter) {
-            frame_counter = frame_counter_tmp;
-        } else {
-            current_frame = i;
-            break;
+        burst.resolution = resolution;
+        burst.watermark = watermark;
+        burst.crop = &crop;
+        burst.width = out_width;
+        burst.height = out_height;
+        snapshot_init(&snapshot);
+        snapshot.dct_scaling = dct_scaling;
+        snapshot.label = label;
+        snapshot.jpeg = jpeg;
+        ret = burst_run(&r, &snapshot, &burst);
+        snapshot_free(&snapshot);
+        ring_close(&r);
+        if (ret < 0) {
+            fprintf(stderr, "Error in burst mode\n");
+            return ret;
         }
+        if (debug) fprintf(stderr, "%d pictures written\n", ret);
+        return 0;
     }
-    if (debug) fprintf(stderr, "%lld - found latest frame: id %d, frame_counter %d\n", current_timestamp(), current_frame, frame_counter);
-
-    // Wait for the next record to arrive and read the frame
-    for (;;) {
-        // Get pointer to the record
-        record_ptr = addr + table_offset + (current_frame * table_record_size);
-        if (debug) fprintf(stderr, "%lld - processing frame %d\n", current_timestamp(), current_frame);
-        // Check if we are at the end of the table
-        if (current_frame == table_record_num - 1) {
-            next_record_ptr = addr + table_offset;
-            if (debug) fprintf(stderr, "%lld - rewinding circular table\n", current_timestamp());
-        } else {
-            next_record_ptr = record_ptr + table_record_size;
-        }
-        // Get the frame counter of the next record
-        next_frame_counter = ((int) *(next_record_ptr + frame_counter_offset + 1)) * 256 + ((int) *(next_record_ptr + frame_counter_offset));
-        // Check if the frame counter is valid
-        if (next_frame_counter >= frame_counter + 1) {
-            // Get the frame type of the record
-            frame_type = (int) *(record_ptr + frame_type_offset);
-            // SPS, PPS or I-FRAME
-            if ((frame_type == 7) || (frame_type == 8) || (frame_type == 5)) {
-                frame_type_sum += frame_type;
-                // Get the offset of the stream
-                frame_offset = (((int) *(record_ptr + frame_offset_offset + 3)) << 24) +
-                            (((int) *(record_ptr + frame_offset_offset + 2)) << 16) +
-                            (((int) *(record_ptr + frame_offset_offset + 1)) << 8) +
-                            ((int) *(record_ptr + frame_offset_offset));
-                // Get the pointer to the frame address
-                frame_ptr = addr + stream_offset + frame_offset;
-                // Get the length of the frame
-                frame_length = (((int) *(record_ptr + frame_length_offset + 3)) << 24) +
-                            (((int) *(record_ptr + frame_length_offset + 2)) << 16) +
-                            (((int) *(record_ptr + frame_length_offset + 1)) << 8) +
-                            ((int) *(record_ptr + frame_length_offset));
-                if (debug) fprintf(stderr, "%lld - writing frame: frame_offset %d, frame_ptr %08x, frame_length %d\n", current_timestamp(), frame_offset, (unsigned int) frame_ptr, frame_length);
-                // Write the frame
-                bufferh264 = (unsigned char *) realloc(bufferh264, bufferh264_size + frame_length);
-                memcpy(&bufferh264[bufferh264_size], frame_ptr, frame_length);
-                bufferh264_size += frame_length;
-
-                if (frame_type_sum == 20) {
-                    if (debug) fprintf(stderr, "%lld - frame found, exit loop\n", current_timestamp);
-                    // We saved SPS, PPS and I-FRAME: exit loop and create JPEG image
-                    break;
-                }
-            } else {
-                if (bufferh264 != NULL) {
-                    free(bufferh264);
-                    bufferh264_size = 0;
-                }
-                frame_type_sum = 0;
-            }
 
-            // Check if we are at the end of the table
-            if (current_frame == table_record_num - 1) {
-                current_frame = 0;
-            } else {
-                current_frame++;
-            }
+    if (use_daemon) {
+        ret = daemon_snapshot(resolution, watermark, mode, offset, &crop, out_width, out_height, &jpeg);
+        if (ret == 0) return 0;
+        if (ret < -1) {
+            fprintf(stderr, "Error getting the snapshot from snapshotd\n");
+            return -8;
         }
+        if (debug) fprintf(stderr, "snapshotd not running\n");
+    }
 
-        // Wait 10 milliseconds
-        usleep(MILLIS_10);
+    if (ring_open(&r, &model) < 0) {
+        return -2;
     }
 
-    if (bufferh264 == NULL) {
+    start = current_timestamp();
+    if (offset >= 0) {
+        if (ring_find_frame(&r, resolution, offset, &bufferh264, &bufferh264_size, &frame_ends, &frame_count, NULL) < 0) {
+            fprintf(stderr, "The frame is no longer in the buffer\n");
+            ring_close(&r);
+            return -3;
+        }
+    } else if (ring_get_keyframe(&r, resolution, mode, &bufferh264, &bufferh264_size, NULL) < 0) {
         fprintf(stderr, "Error, buffer is empty\n");
+        ring_close(&r);
         return -3;
     }
-
-    bufferyuv = (unsigned char *) malloc(width * height * 3 / 2);
-    if (bufferyuv == NULL) {
-        fprintf(stderr, "Unable to allocate memory\n");
-        return -4;
-    }
-
-    if (debug) fprintf(stderr, "Decoding h264 frame\n");
-    if(frame_decode(bufferyuv, bufferh264, bufferh264_size) < 0) {
-        fprintf(stderr, "Error decoding h264 frame\n");
-        return -5;
+    ring_close(&r);
+    if (debug) fprintf(stderr, "%lld - frames ready in %lld ms\n", current_timestamp(), current_timestamp() - start);
+
+    snapshot_init(&snapshot);
+    snapshot.dct_scaling = dct_scaling;
+    snapshot.label = label;
+    snapshot.jpeg = jpeg;
+    // The JPEG goes to stdout while it is encoded
+    if (offset >= 0) {
+        // The watermark shows when the frame was taken
+        snapshot.time = (time_ms > 0) ? time_ms / 1000 : (start - (long long) offset * 1000 / RING_FPS) / 1000;
+        ret = snapshot_jpeg_frames_fd(&snapshot, (resolution == RESOLUTION_LOW) ? 0 : 1,
+                bufferh264, frame_ends, frame_count, watermark, &crop, out_width, out_height, STDOUT_FILENO);
+        free(frame_ends);
+    } else {
+        ret = snapshot_jpeg_fd(&snapshot, (resolution == RESOLUTION_LOW) ? 0 : 1,
+                bufferh264, bufferh264_size, watermark, &crop, out_width, out_height, STDOUT_FILENO);
     }
     free(bufferh264);
-
-    if (watermark) {
-        if (debug) fprintf(stderr, "Adding watermark\n");
-        if (add_watermark(bufferyuv, width, height) < 0) {
-            fprintf(stderr, "Error adding watermark\n");
-            return -6;
-        }
-    }
-
-    if (debug) fprintf(stderr, "Encoding jpeg image\n");
-    if(YUVtoJPG("stdout", bufferyuv, width, height, width, height) < 0) {
-        fprintf(stderr, "Error encoding jpeg file\n");
-        return -7;
-    }
-
-    free(bufferyuv);
-
-    // Unmap file from memory
-    if (munmap(addr, buf_size) == -1) {
-        if (debug) fprintf(stderr, "Error munmapping file\n");
-    } else {
-        if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %08x\n", BUFFER_FILE, buf_size, (unsigned int) addr);
+    snapshot_free(&snapshot);
+    if (ret < 0) {
+        return ret;
     }
 
     return 0;
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame differences on a grid of cells: the sad16 kernel adds the
+ * differences of a row to the sums of the cells it crosses, so a picture
+ * costs one kernel call every MOTION_ROW_STEP rows.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "motion.h"
+
+void motion_default_params(motion_params *p)
+{
+    memset(p, 0, sizeof(motion_params));
+    p->threshold = motion_threshold("medium");
+    p->min_cells = 2;
+    p->start_frames = 2;
+    p->stop_ms = 5000;
+}
+
+int motion_threshold(const char *sensitivity)
+{
+    char *endptr;
+    long s;
+
+    if (strcasecmp(sensitivity, "low") == 0) s = 25;
+    else if (strcasecmp(sensitivity, "medium") == 0) s = 50;
+    else if (strcasecmp(sensitivity, "high") == 0) s = 75;
+    else {
+        s = strtol(sensitivity, &endptr, 10);
+        if ((*endptr != '\0') || (s < 1) || (s > 100)) return -1;
+    }
+
+    return MOTION_THRESHOLD_MAX - (s - 1) * (MOTION_THRESHOLD_MAX - MOTION_THRESHOLD_MIN) / 99;
+}
+
+static int inside(const snapshot_rect *r, int x, int y)
+{
+    return (x >= r->x) && (x < r->x + r->width) && (y >= r->y) && (y < r->y + r->height);
+}
+
+// Adds the rect b to the bounding box a, which may be empty
+static void add_rect(snapshot_rect *a, const snapshot_rect *b)
+{
+    int x2, y2;
+
+    if ((a->width <= 0) || (a->height <= 0)) {
+        *a = *b;
+        return;
+    }
+    x2 = (a->x + a->width > b->x + b->width) ? a->x + a->width : b->x + b->width;
+    y2 = (a->y + a->height > b->y + b->height) ? a->y + a->height : b->y + b->height;
+    if (b->x < a->x) a->x = b->x;
+    if (b->y < a->y) a->y = b->y;
+    a->width = x2 - a->x;
+    a->height = y2 - a->y;
+}
+
+int motion_init(motion_ctx *m, const motion_params *p, int width, int height)
+{
+    int row, col, i, j, cx, cy, cw, ch;
+
+    memset(m, 0, sizeof(motion_ctx));
+    m->p = *p;
+    m->k = yuv_get_kernels();
+    m->width = width;
+    m->height = height;
+    m->cols = (width + MOTION_CELL - 1) / MOTION_CELL;
+    m->rows = (height + MOTION_CELL - 1) / MOTION_CELL;
+
+    m->mask = (unsigned char *) malloc(m->cols * m->rows);
+    m->pixels = (int *) malloc(m->cols * m->rows * sizeof(int));
+    m->sums = (unsigned int *) malloc(m->cols * m->rows * sizeof(unsigned int));
+    m->ref = (unsigned char *) malloc(width * height);
+    if ((m->mask == NULL) || (m->pixels == NULL) || (m->sums == NULL) || (m->ref == NULL)) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        motion_free(m);
+        return -4;
+    }
+
+    // A cell is analysed if its center is in a zone and not in an excluded one
+    for (row = 0; row < m->rows; row++) {
+        for (col = 0; col < m->cols; col++) {
+            i = row * m->cols + col;
+            cw = (width - col * MOTION_CELL < MOTION_CELL) ? width - col * MOTION_CELL : MOTION_CELL;
+            ch = (height - row * MOTION_CELL < MOTION_CELL) ? height - row * MOTION_CELL : MOTION_CELL;
+            cx = col * MOTION_CELL + cw / 2;
+            cy = row * MOTION_CELL + ch / 2;
+            m->pixels[i] = cw * ((ch + MOTION_ROW_STEP - 1) / MOTION_ROW_STEP);
+
+            m->mask[i] = (p->zones_num == 0);
+            for (j = 0; j < p->zones_num; j++) {
+                if (inside(&p->zones[j], cx, cy)) m->mask[i] = 1;
+            }
+            for (j = 0; j < p->excludes_num; j++) {
+                if (inside(&p->excludes[j], cx, cy)) m->mask[i] = 0;
+            }
+            m->mask_cells += m->mask[i];
+        }
+    }
+
+    if (m->mask_cells == 0) {
+        fprintf(stderr, "No cell of the %dx%d picture is in the zones\n", width, height);
+        motion_free(m);
+        return -1;
+    }
+
+    return 0;
+}
+
+void motion_free(motion_ctx *m)
+{
+    free(m->mask);
+    free(m->pixels);
+    free(m->sums);
+    free(m->ref);
+    memset(m, 0, sizeof(motion_ctx));
+}
+
+int motion_analyse(motion_ctx *m, const unsigned char *y, int stride, long long time)
+{
+    snapshot_rect cell;
+    int row, col, i, j;
+
+    // Only the rows that are compared are kept
+    if (!m->has_ref) {
+        for (j = 0; j < m->height; j += MOTION_ROW_STEP) {
+            memcpy(m->ref + j * m->width, y + j * stride, m->width);
+        }
+        m->has_ref = 1;
+        return MOTION_NONE;
+    }
+
+    memset(m->sums, 0, m->cols * m->rows * sizeof(unsigned int));
+    for (j = 0; j < m->height; j += MOTION_ROW_STEP) {
+        m->k->sad16(m->sums + (j / MOTION_CELL) * m->cols, y + j * stride, m->ref + j * m->width, m->width);
+        memcpy(m->ref + j * m->width, y + j * stride, m->width);
+    }
+
+    m->changed = 0;
+    memset(&m->box, 0, sizeof(snapshot_rect));
+    for (row = 0; row < m->rows; row++) {
+        for (col = 0; col < m->cols; col++) {
+            i = row * m->cols + col;
+            if (!m->mask[i] || (m->sums[i] <= (unsigned int) (m->p.threshold * m->pixels[i]))) continue;
+            m->changed++;
+            cell.x = col * MOTION_CELL;
+            cell.y = row * MOTION_CELL;
+            cell.width = (m->width - cell.x < MOTION_CELL) ? m->width - cell.x : MOTION_CELL;
+            cell.height = (m->height - cell.y < MOTION_CELL) ? m->height - cell.y : MOTION_CELL;
+            add_rect(&m->box, &cell);
+        }
+    }
+
+    // A change of the whole picture is the light: neither motion nor stillness
+    if (m->changed * 100 > m->mask_cells * MOTION_GLOBAL_CHANGE) {
+        m->changed = 0;
+        memset(&m->box, 0, sizeof(snapshot_rect));
+        return MOTION_NONE;
+    }
+
+    if (m->changed >= m->p.min_cells) {
+        m->frames_with_motion++;
+        m->last_motion = time;
+        if (m->active) {
+            add_rect(&m->event_box, &m->box);
+        } else if (m->frames_with_motion >= m->p.start_frames) {
+            m->active = 1;
+            m->start_time = time;
+            m->event_box = m->box;
+            return MOTION_START;
+        }
+    } else {
+        m->frames_with_motion = 0;
+        if (m->active && (time - m->last_motion >= m->p.stop_ms)) {
+            m->active = 0;
+            return MOTION_STOP;
+        }
+    }
+
+    return MOTION_NONE;
+}
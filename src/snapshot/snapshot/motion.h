@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Motion detection on the Y plane: each picture is compared with the
+ * previous one analysed, cell by cell, and a cell has changed when the
+ * mean difference of its pixels is over the threshold. Enough changed
+ * cells inside the zones start a motion event, no changed cells for a
+ * while stop it.
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "snapshot.h"
+#include "yuv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Width and height of a cell in pixels, the width is the one of the sad16 kernel
+#define MOTION_CELL 16
+// Only one row of pixels every MOTION_ROW_STEP is compared
+#define MOTION_ROW_STEP 2
+
+#define MOTION_ZONES 8
+
+// Mean difference of a pixel for sensitivity 100 and 1
+#define MOTION_THRESHOLD_MIN 4
+#define MOTION_THRESHOLD_MAX 36
+
+// Over this % of the cells changed it's the light, e.g. the IR switch, not motion
+#define MOTION_GLOBAL_CHANGE 70
+
+#define MOTION_NONE  0
+#define MOTION_START 1
+#define MOTION_STOP  2
+
+typedef struct {
+    // Mean difference of a pixel, 1 to 255, over which a cell has changed
+    int threshold;
+    // Changed cells for motion
+    int min_cells;
+    // Pictures with motion in a row before the start event
+    int start_frames;
+    // Milliseconds without motion before the stop event
+    int stop_ms;
+    // Regions of the picture analysed, all of it if there is none
+    snapshot_rect zones[MOTION_ZONES];
+    int zones_num;
+    // Regions left out, e.g. a road or a tree
+    snapshot_rect excludes[MOTION_ZONES];
+    int excludes_num;
+} motion_params;
+
+typedef struct {
+    motion_params p;
+    const yuv_kernels *k;
+    int width;
+    int height;
+    // Grid of cells
+    int cols;
+    int rows;
+    // 1 for the cells analysed
+    unsigned char *mask;
+    int mask_cells;
+    // Pixels compared in each cell
+    int *pixels;
+    unsigned int *sums;
+    // Y plane of the previous picture analysed
+    unsigned char *ref;
+    int has_ref;
+    // Changed cells of the last picture and their bounding box
+    int changed;
+    snapshot_rect box;
+    // State of the event
+    int active;
+    int frames_with_motion;
+    long long start_time;
+    long long last_motion;
+    // Bounding box of all the motion of the event
+    snapshot_rect event_box;
+} motion_ctx;
+
+/* Sensitivity "medium", 2 pictures of 2 cells, 5 s, all the picture */
+void motion_default_params(motion_params *p);
+
+/*
+ * Threshold of a sensitivity: "low", "medium", "high" as the stock
+ * settings or 1 (least sensitive) to 100. Returns < 0 if it isn't valid.
+ */
+int motion_threshold(const char *sensitivity);
+
+/*
+ * Prepares the grid and the mask of the zones for width x height
+ * pictures. Returns < 0 if the memory can't be allocated or no cell is
+ * left to analyse.
+ */
+int motion_init(motion_ctx *m, const motion_params *p, int width, int height);
+void motion_free(motion_ctx *m);
+
+/*
+ * Compares the Y plane y (stride bytes a row) with the previous picture,
+ * which it replaces. time is in milliseconds.
+ * Returns MOTION_START with the box of the picture in m->box,
+ * MOTION_STOP with the box of the whole event in m->event_box, or
+ * MOTION_NONE.
+ */
+int motion_analyse(motion_ctx *m, const unsigned char *y, int stride, long long time);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Resident motion detection: follows the low resolution stream in
+ * /tmp/view, decodes it and compares a picture every --every frames with
+ * the previous one analysed, see motion.h.
+ *
+ * Each event is a line on stdout, with the time in milliseconds since
+ * the epoch and the bounding box in pixels of the low resolution:
+ *
+ *     TIME start X,Y,W,H
+ *     TIME stop X,Y,W,H DURATION
+ *
+ * and, with --command, runs "COMMAND start X,Y,W,H" or
+ * "COMMAND stop X,Y,W,H DURATION" without waiting for it.
+ *
+ * The P-frames can't be decoded without the ones before them, so the CPU
+ * budget is kept by skipping frames up to the next keyframe: when the
+ * decode and the analysis have used --budget % of the last second, only
+ * the next keyframe is decoded. --keyframes decodes only the keyframes.
+ * The cost of each stage is in STATS_FILE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "ring.h"
+#include "h264dec.h"
+#include "motion.h"
+
+#define STATS_FILE "/tmp/motiond.stats"
+// Milliseconds between two updates of STATS_FILE
+#define STATS_INTERVAL 10000
+
+// Length of the window of the CPU budget, in milliseconds
+#define BUDGET_WINDOW 1000
+#define BUDGET_DEFAULT 25
+#define EVERY_DEFAULT 4
+
+int debug = 0;
+
+ring r;
+ring_model model;
+
+// Cost of the stages, in microseconds
+struct {
+    unsigned decoded;
+    unsigned analysed;
+    unsigned skipped;
+    unsigned events;
+    long long decode_us;
+    long long decode_max_us;
+    long long analyse_us;
+    long long analyse_max_us;
+    // CPU used in the last window, % of one core
+    int cpu;
+} stats;
+
+long long current_timestamp_us()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000000LL + te.tv_usec;
+}
+
+void write_stats(const motion_ctx *m, int budget)
+{
+    FILE *fp;
+
+    fp = fopen(STATS_FILE, "w");
+    if (fp == NULL) return;
+    fprintf(fp, "frames: %u decoded, %u analysed, %u skipped\n", stats.decoded, stats.analysed, stats.skipped);
+    fprintf(fp, "decode: avg %.2f ms, max %.2f ms\n",
+            (stats.decoded > 0) ? stats.decode_us / 1000.0 / stats.decoded : 0, stats.decode_max_us / 1000.0);
+    fprintf(fp, "analyse: avg %.2f ms, max %.2f ms\n",
+            (stats.analysed > 0) ? stats.analyse_us / 1000.0 / stats.analysed : 0, stats.analyse_max_us / 1000.0);
+    fprintf(fp, "cpu: %d%%, budget %d%%\n", stats.cpu, budget);
+    fprintf(fp, "motion: %s, %u events\n", m->active ? "yes" : "no", stats.events);
+    fclose(fp);
+}
+
+// Runs "command args" in the background
+void run_command(const char *command, const char *args)
+{
+    char *line;
+    pid_t pid;
+
+    line = (char *) malloc(strlen(command) + strlen(args) + 2);
+    if (line == NULL) return;
+    sprintf(line, "%s %s", command, args);
+
+    pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", line, (char *) NULL);
+        _exit(127);
+    }
+    if (pid < 0) fprintf(stderr, "Unable to run %s\n", command);
+    free(line);
+}
+
+void report_event(int event, const motion_ctx *m, long long now, const char *command)
+{
+    const snapshot_rect *b;
+    char args[64];
+
+    if (event == MOTION_START) {
+        b = &m->box;
+        snprintf(args, sizeof(args), "start %d,%d,%d,%d", b->x, b->y, b->width, b->height);
+    } else {
+        b = &m->event_box;
+        snprintf(args, sizeof(args), "stop %d,%d,%d,%d %lld", b->x, b->y, b->width, b->height,
+                m->last_motion - m->start_time);
+    }
+    printf("%lld %s\n", now, args);
+    fflush(stdout);
+    stats.events++;
+
+    if (command != NULL) run_command(command, args);
+}
+
+int parse_zone(motion_params *p, int exclude, const char *s)
+{
+    snapshot_rect *zones = exclude ? p->excludes : p->zones;
+    int *num = exclude ? &p->excludes_num : &p->zones_num;
+
+    if (*num >= MOTION_ZONES) return -1;
+    if (snapshot_parse_rect(&zones[*num], s) < 0) return -1;
+    (*num)++;
+
+    return 0;
+}
+
+void print_usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog_name);
+    fprintf(stderr, "\t-m, --model MODEL                Select cam model: yi_home, yi_home_1080p, yi_dome_720p or yi_outdoor\n");
+    fprintf(stderr, "\t-s, --sensitivity S              \"low\", \"medium\", \"high\" or 1 to 100 (default \"medium\")\n");
+    fprintf(stderr, "\t-z, --zone X,Y,W,H               Analyse only this region, in pixels of the low resolution (up to %d)\n", MOTION_ZONES);
+    fprintf(stderr, "\t-x, --exclude X,Y,W,H            Leave out this region (up to %d)\n", MOTION_ZONES);
+    fprintf(stderr, "\t-n, --cells N                    Changed cells of %dx%d pixels for motion (default 2)\n", MOTION_CELL, MOTION_CELL);
+    fprintf(stderr, "\t-f, --frames N                   Pictures with motion in a row before the start event (default 2)\n");
+    fprintf(stderr, "\t-t, --stop MS                    Milliseconds without motion before the stop event (default 5000)\n");
+    fprintf(stderr, "\t-e, --every N                    Analyse a picture every N frames (default %d)\n", EVERY_DEFAULT);
+    fprintf(stderr, "\t-k, --keyframes                  Decode and analyse only the keyframes\n");
+    fprintf(stderr, "\t-b, --budget PERCENT             CPU for the decode and the analysis, 0 for no limit (default %d)\n", BUDGET_DEFAULT);
+    fprintf(stderr, "\t-c, --command CMD                Run \"CMD start X,Y,W,H\" and \"CMD stop X,Y,W,H DURATION\"\n");
+    fprintf(stderr, "\t-d, --debug                      Enable debug\n");
+    fprintf(stderr, "\t-h, --help                       Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *endptr;
+    motion_params params;
+    motion_ctx m;
+    int every = EVERY_DEFAULT;
+    int keyframes_only = 0;
+    int budget = BUDGET_DEFAULT;
+    char *command = NULL;
+
+    h264dec *dec;
+    ring_cursor cur;
+    unsigned char *buffer = NULL;
+    int buffer_size = 0;
+    int length = 0;
+    unsigned char *planes[3];
+    int strides[3];
+    int type, width, height, event, ret;
+    // The P-frames can be decoded only after a keyframe
+    int keyframe = 0;
+    // Frames decoded since the last analysis
+    int since = 0;
+    long long now, start, decode_us, analyse_us;
+    long long window_start, window_us = 0, last_stats = 0;
+
+    // Settings default
+    ring_model_by_name(&model, "yi_home_1080p");
+    motion_default_params(&params);
+    memset(&m, 0, sizeof(m));
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"model",  required_argument, 0, 'm'},
+            {"sensitivity",  required_argument, 0, 's'},
+            {"zone",  required_argument, 0, 'z'},
+            {"exclude",  required_argument, 0, 'x'},
+            {"cells",  required_argument, 0, 'n'},
+            {"frames",  required_argument, 0, 'f'},
+            {"stop",  required_argument, 0, 't'},
+            {"every",  required_argument, 0, 'e'},
+            {"keyframes",  no_argument, 0, 'k'},
+            {"budget",  required_argument, 0, 'b'},
+            {"command",  required_argument, 0, 'c'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "m:s:z:x:n:f:t:e:kb:c:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'm':
+            if (ring_model_by_name(&model, optarg) < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 's':
+            params.threshold = motion_threshold(optarg);
+            if (params.threshold < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'z':
+        case 'x':
+            if (parse_zone(&params, c == 'x', optarg) < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'n':
+            params.min_cells = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (params.min_cells < 1)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'f':
+            params.start_frames = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (params.start_frames < 1)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 't':
+            params.stop_ms = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (params.stop_ms < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'e':
+            every = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (every < 1)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'k':
+            keyframes_only = 1;
+            break;
+
+        case 'b':
+            budget = strtol(optarg, &endptr, 10);
+            if ((*endptr != '\0') || (budget < 0) || (budget > 100)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'c':
+            command = optarg;
+            break;
+
+        case 'd':
+            fprintf(stderr, "Debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // The commands are not waited for
+    signal(SIGCHLD, SIG_IGN);
+
+    dec = h264dec_open();
+    if (dec == NULL) {
+        fprintf(stderr, "Unable to open the h264 decoder\n");
+        return -1;
+    }
+
+    // The ring is created by the stock firmware, it may not exist yet
+    while (ring_open(&r, &model) < 0) {
+        sleep(1);
+    }
+
+    ring_follow(&r, RESOLUTION_LOW, &cur, 0);
+    window_start = current_timestamp();
+
+    while (1) {
+        type = ring_next_frame(&r, RESOLUTION_LOW, &cur, &buffer, &buffer_size, &length);
+        if (type == 0) {
+            usleep(MILLIS_10);
+            continue;
+        }
+        if (type == -4) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            break;
+        }
+        if (type < 0) {
+            // Left behind: go on from the newest frame, with the next keyframe
+            if (debug) fprintf(stderr, "%lld - left behind, waiting for the next keyframe\n", current_timestamp());
+            ring_follow(&r, RESOLUTION_LOW, &cur, 0);
+            length = 0;
+            keyframe = 0;
+            continue;
+        }
+
+        // SPS and PPS go to the decoder with their IDR
+        if ((type == NAL_TYPE_SPS) || (type == NAL_TYPE_PPS)) continue;
+
+        now = current_timestamp();
+        if (now - window_start >= BUDGET_WINDOW) {
+            stats.cpu = window_us / 10 / (now - window_start);
+            window_start = now;
+            window_us = 0;
+        }
+
+        if (type == NAL_TYPE_IDR) {
+            keyframe = 1;
+        } else if (!keyframe || keyframes_only) {
+            length = 0;
+            stats.skipped++;
+            continue;
+        }
+
+        start = current_timestamp_us();
+        ret = h264dec_decode(dec, buffer, length, &width, &height);
+        length = 0;
+        decode_us = current_timestamp_us() - start;
+        if (ret < 0) {
+            keyframe = 0;
+            continue;
+        }
+        stats.decoded++;
+        stats.decode_us += decode_us;
+        if (decode_us > stats.decode_max_us) stats.decode_max_us = decode_us;
+        window_us += decode_us;
+
+        since++;
+        if ((since >= every) || (type == NAL_TYPE_IDR)) {
+            since = 0;
+
+            if ((m.width != width) || (m.height != height)) {
+                if (m.mask != NULL) motion_free(&m);
+                if (motion_init(&m, &params, width, height) < 0) break;
+                if (debug) fprintf(stderr, "%lld - %dx%d pictures, %d cells analysed of %dx%d\n",
+                        now, width, height, m.mask_cells, m.cols, m.rows);
+            }
+
+            start = current_timestamp_us();
+            h264dec_planes(dec, planes, strides);
+            event = motion_analyse(&m, planes[0], strides[0], now);
+            analyse_us = current_timestamp_us() - start;
+            stats.analysed++;
+            stats.analyse_us += analyse_us;
+            if (analyse_us > stats.analyse_max_us) stats.analyse_max_us = analyse_us;
+            window_us += analyse_us;
+
+            if (debug) fprintf(stderr, "%lld - %s: decode %.2f ms, analyse %.2f ms, %d cells changed\n",
+                    now, (type == NAL_TYPE_IDR) ? "keyframe" : "frame", decode_us / 1000.0, analyse_us / 1000.0, m.changed);
+
+            if (event != MOTION_NONE) {
+                report_event(event, &m, now, command);
+                write_stats(&m, budget);
+            }
+        }
+
+        // Over budget: nothing more until the next keyframe
+        if ((budget > 0) && (window_us > budget * BUDGET_WINDOW * 10LL)) {
+            if (debug) fprintf(stderr, "%lld - %lld ms of CPU in %lld ms, skipping to the next keyframe\n",
+                    now, window_us / 1000, now - window_start);
+            keyframe = 0;
+        }
+
+        if (now - last_stats >= STATS_INTERVAL) {
+            write_stats(&m, budget);
+            last_stats = now;
+        }
+    }
+
+    free(buffer);
+    motion_free(&m);
+    h264dec_close(dec);
+    ring_close(&r);
+
+    return -1;
+}
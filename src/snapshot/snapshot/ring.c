@@ -0,0 +1,651 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Access to the frame ring written by the stock firmware in /tmp/view.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "ring.h"
+
+extern int debug;
+
+// yi_home
+#define TABLE_HIGH_OFFSET_YI_HOME 0x10
+#define TABLE_LOW_OFFSET_YI_HOME 0x12E0
+#define TABLE_RECORD_SIZE_YI_HOME 32
+#define TABLE_RECORD_NUM_YI_HOME 150
+#define BUF_SIZE_YI_HOME 648000
+#define STREAM_HIGH_OFFSET_YI_HOME 0x4B40
+#define STREAM_LOW_OFFSET_YI_HOME 0x68B40
+#define FRAME_COUNTER_OFFSET_YI_HOME 18
+#define FRAME_OFFSET_OFFSET_YI_HOME 4
+#define FRAME_LENGTH_OFFSET_YI_HOME 8
+#define FRAME_TYPE_OFFSET_YI_HOME 16
+#define W_LOW_YI_HOME 640
+#define H_LOW_YI_HOME 360
+#define W_HIGH_YI_HOME 1280
+#define H_HIGH_YI_HOME 720
+
+// yi_home_1080p
+#define TABLE_HIGH_OFFSET_YI_HOME_1080P 0x10
+#define TABLE_LOW_OFFSET_YI_HOME_1080P 0x25A0
+#define TABLE_RECORD_SIZE_YI_HOME_1080P 32
+#define TABLE_RECORD_NUM_YI_HOME_1080P 300
+#define BUF_SIZE_YI_HOME_1080P 1586752
+#define STREAM_HIGH_OFFSET_YI_HOME_1080P 0x9640
+#define STREAM_LOW_OFFSET_YI_HOME_1080P 0x109640
+#define FRAME_COUNTER_OFFSET_YI_HOME_1080P 18
+#define FRAME_OFFSET_OFFSET_YI_HOME_1080P 4
+#define FRAME_LENGTH_OFFSET_YI_HOME_1080P 8
+#define FRAME_TYPE_OFFSET_YI_HOME_1080P 16
+#define W_LOW_YI_HOME_1080P 640
+#define H_LOW_YI_HOME_1080P 360
+#define W_HIGH_YI_HOME_1080P 1920
+#define H_HIGH_YI_HOME_1080P 1080
+
+// yi_dome_720p
+#define TABLE_HIGH_OFFSET_YI_DOME_720P 0x10
+#define TABLE_LOW_OFFSET_YI_DOME_720P 0x1920
+#define TABLE_RECORD_SIZE_YI_DOME_720P 32
+#define TABLE_RECORD_NUM_YI_DOME_720P 200
+#define BUF_SIZE_YI_DOME_720P 654400
+#define STREAM_HIGH_OFFSET_YI_DOME_720P 0x6440
+#define STREAM_LOW_OFFSET_YI_DOME_720P 0x6A440
+#define FRAME_COUNTER_OFFSET_YI_DOME_720P 18
+#define FRAME_OFFSET_OFFSET_YI_DOME_720P 4
+#define FRAME_LENGTH_OFFSET_YI_DOME_720P 8
+#define FRAME_TYPE_OFFSET_YI_DOME_720P 16
+#define W_LOW_YI_DOME_720P 640
+#define H_LOW_YI_DOME_720P 360
+#define W_HIGH_YI_DOME_720P 1280
+#define H_HIGH_YI_DOME_720P 720
+
+// yi_outdoor
+#define TABLE_HIGH_OFFSET_YI_OUTDOOR 0x10
+#define TABLE_LOW_OFFSET_YI_OUTDOOR 0x25A0
+#define TABLE_RECORD_SIZE_YI_OUTDOOR 32
+#define TABLE_RECORD_NUM_YI_OUTDOOR 300
+#define BUF_SIZE_YI_OUTDOOR 1586752
+#define STREAM_HIGH_OFFSET_YI_OUTDOOR 0x9640
+#define STREAM_LOW_OFFSET_YI_OUTDOOR 0x109640
+#define FRAME_COUNTER_OFFSET_YI_OUTDOOR 18
+#define FRAME_OFFSET_OFFSET_YI_OUTDOOR 4
+#define FRAME_LENGTH_OFFSET_YI_OUTDOOR 8
+#define FRAME_TYPE_OFFSET_YI_OUTDOOR 16
+#define W_LOW_YI_OUTDOOR 640
+#define H_LOW_YI_OUTDOOR 360
+#define W_HIGH_YI_OUTDOOR 1280
+#define H_HIGH_YI_OUTDOOR 720
+
+#define RING_MODEL(M) { \
+    TABLE_HIGH_OFFSET_##M, TABLE_LOW_OFFSET_##M, TABLE_RECORD_SIZE_##M, TABLE_RECORD_NUM_##M, \
+    BUF_SIZE_##M, STREAM_HIGH_OFFSET_##M, STREAM_LOW_OFFSET_##M, FRAME_COUNTER_OFFSET_##M, \
+    FRAME_OFFSET_OFFSET_##M, FRAME_LENGTH_OFFSET_##M, FRAME_TYPE_OFFSET_##M, \
+    W_LOW_##M, H_LOW_##M, W_HIGH_##M, H_HIGH_##M }
+
+static const struct {
+    const char *name;
+    ring_model model;
+} models[] = {
+    { "yi_home", RING_MODEL(YI_HOME) },
+    { "yi_home_1080p", RING_MODEL(YI_HOME_1080P) },
+    { "yi_dome_720p", RING_MODEL(YI_DOME_720P) },
+    { "yi_outdoor", RING_MODEL(YI_OUTDOOR) },
+    { NULL }
+};
+
+long long current_timestamp() {
+    struct timeval te;
+    gettimeofday(&te, NULL); // get current time
+    long long milliseconds = te.tv_sec*1000LL + te.tv_usec/1000; // calculate milliseconds
+
+    return milliseconds;
+}
+
+int ring_model_by_name(ring_model *model, const char *name)
+{
+    int i;
+
+    for (i = 0; models[i].name != NULL; i++) {
+        if (strcasecmp(models[i].name, name) == 0) {
+            *model = models[i].model;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int ring_fit_resolution(const ring_model *model, int width, int height)
+{
+    if ((width <= 0) && (height <= 0)) return RESOLUTION_HIGH;
+    if (width > model->w_low) return RESOLUTION_HIGH;
+    if (height > model->h_low) return RESOLUTION_HIGH;
+
+    return RESOLUTION_LOW;
+}
+
+int ring_open(ring *r, const ring_model *model)
+{
+    FILE *fFid;
+
+    r->model = *model;
+    r->addr = NULL;
+
+    // Opening an existing file
+    fFid = fopen(BUFFER_FILE, "r") ;
+    if ( fFid == NULL ) {
+        fprintf(stderr, "Could not open file %s\n", BUFFER_FILE) ;
+        return -1;
+    }
+
+    // Map file to memory
+    r->addr = (unsigned char*) mmap(NULL, r->model.buf_size, PROT_READ, MAP_SHARED, fileno(fFid), 0);
+    if (r->addr == MAP_FAILED) {
+        fprintf(stderr, "Error mapping file %s\n", BUFFER_FILE);
+        fclose(fFid);
+        r->addr = NULL;
+        return -2;
+    }
+    if (debug) fprintf(stderr, "%lld - mapping file %s, size %d, to %p\n", current_timestamp(), BUFFER_FILE, r->model.buf_size, (void *) r->addr);
+
+    // Closing the file
+    if (debug) fprintf(stderr, "%lld - closing the file %s\n", current_timestamp(), BUFFER_FILE) ;
+    fclose(fFid) ;
+
+    return 0;
+}
+
+void ring_close(ring *r)
+{
+    if (r->addr == NULL) return;
+
+    // Unmap file from memory
+    if (munmap(r->addr, r->model.buf_size) == -1) {
+        if (debug) fprintf(stderr, "Error munmapping file\n");
+    } else {
+        if (debug) fprintf(stderr, "Unmapping file %s, size %d, from %p\n", BUFFER_FILE, r->model.buf_size, (void *) r->addr);
+    }
+    r->addr = NULL;
+}
+
+void ring_size(ring *r, int resolution, int *width, int *height)
+{
+    if (resolution == RESOLUTION_LOW) {
+        *width = r->model.w_low;
+        *height = r->model.h_low;
+    } else {
+        *width = r->model.w_high;
+        *height = r->model.h_high;
+    }
+}
+
+int ring_stream_size(ring *r, int resolution)
+{
+    // The high stream region ends where the low one starts
+    if (resolution == RESOLUTION_LOW) {
+        return r->model.buf_size - r->model.stream_low_offset;
+    } else {
+        return r->model.stream_low_offset - r->model.stream_high_offset;
+    }
+}
+
+unsigned char *ring_record(ring *r, int resolution, int i)
+{
+    int table_offset = (resolution == RESOLUTION_LOW) ? r->model.table_low_offset : r->model.table_high_offset;
+
+    return r->addr + table_offset + (i * r->model.table_record_size);
+}
+
+int ring_frame_counter(ring *r, unsigned char *record)
+{
+    return (((int) *(record + r->model.frame_counter_offset + 1)) << 8) +
+            ((int) *(record + r->model.frame_counter_offset));
+}
+
+int ring_frame_type(ring *r, unsigned char *record)
+{
+    return (int) *(record + r->model.frame_type_offset);
+}
+
+unsigned char *ring_frame_ptr(ring *r, int resolution, unsigned char *record)
+{
+    int stream_offset = (resolution == RESOLUTION_LOW) ? r->model.stream_low_offset : r->model.stream_high_offset;
+    unsigned int frame_offset;
+
+    // Get the offset of the stream
+    frame_offset = (((int) *(record + r->model.frame_offset_offset + 3)) << 24) +
+                (((int) *(record + r->model.frame_offset_offset + 2)) << 16) +
+                (((int) *(record + r->model.frame_offset_offset + 1)) << 8) +
+                ((int) *(record + r->model.frame_offset_offset));
+
+    return r->addr + stream_offset + frame_offset;
+}
+
+unsigned int ring_frame_length(ring *r, unsigned char *record)
+{
+    return (((int) *(record + r->model.frame_length_offset + 3)) << 24) +
+            (((int) *(record + r->model.frame_length_offset + 2)) << 16) +
+            (((int) *(record + r->model.frame_length_offset + 1)) << 8) +
+            ((int) *(record + r->model.frame_length_offset));
+}
+
+int ring_newest(ring *r, int resolution)
+{
+    int table_record_num = r->model.table_record_num;
+    int i, counter, next_counter;
+
+    // The newest record is the first one not followed by its successor.
+    // The counter is 16 bit and wraps.
+    counter = ring_frame_counter(r, ring_record(r, resolution, 0));
+    for (i = 0; i < table_record_num - 1; i++) {
+        next_counter = ring_frame_counter(r, ring_record(r, resolution, i + 1));
+        if (((next_counter - counter) & 0xFFFF) != 1) {
+            return i;
+        }
+        counter = next_counter;
+    }
+
+    return table_record_num - 1;
+}
+
+// Bytes written in the stream region from the start of record first to
+// the end of record last, including the holes left at the end of the region
+static int ring_distance(ring *r, int resolution, int first, int last)
+{
+    int table_record_num = r->model.table_record_num;
+    int stream_size = ring_stream_size(r, resolution);
+    unsigned char *record_ptr, *next_record_ptr;
+    int offset, next_offset;
+    int distance = 0;
+    int i;
+
+    for (i = first; i != last; i = (i + 1) % table_record_num) {
+        record_ptr = ring_record(r, resolution, i);
+        next_record_ptr = ring_record(r, resolution, (i + 1) % table_record_num);
+        offset = ring_frame_ptr(r, resolution, record_ptr) - r->addr;
+        next_offset = ring_frame_ptr(r, resolution, next_record_ptr) - r->addr;
+        if (next_offset >= offset) {
+            distance += next_offset - offset;
+        } else {
+            distance += stream_size - (offset - next_offset);
+        }
+    }
+
+    return distance + ring_frame_length(r, ring_record(r, resolution, last));
+}
+
+// Index of the SPS of the most recent keyframe still in the stream region,
+// -1 if there is none
+static int ring_locate_keyframe(ring *r, int resolution, int newest)
+{
+    int table_record_num = r->model.table_record_num;
+    int idr, sps, i;
+
+    // The newest record may still be written: start from the one before
+    for (i = 1; i < table_record_num - 2; i++) {
+        idr = (newest - i + table_record_num) % table_record_num;
+        if (ring_frame_type(r, ring_record(r, resolution, idr)) != NAL_TYPE_IDR) continue;
+
+        sps = (idr - 2 + table_record_num) % table_record_num;
+        if ((ring_frame_type(r, ring_record(r, resolution, sps)) != NAL_TYPE_SPS) ||
+                (ring_frame_type(r, ring_record(r, resolution, (sps + 1) % table_record_num)) != NAL_TYPE_PPS)) {
+            // Keyframe without its parameter sets
+            continue;
+        }
+
+        // The frames must not have been overwritten by the newer ones
+        if (ring_distance(r, resolution, sps, newest) + RING_WRITE_MARGIN > ring_stream_size(r, resolution)) {
+            if (debug) fprintf(stderr, "%lld - keyframe %d already overwritten\n", current_timestamp(), idr);
+            return -1;
+        }
+
+        return sps;
+    }
+
+    return -1;
+}
+
+int ring_latest_keyframe(ring *r, int resolution)
+{
+    int sps;
+
+    sps = ring_locate_keyframe(r, resolution, ring_newest(r, resolution));
+    if (sps < 0) return -1;
+
+    return ring_frame_counter(r, ring_record(r, resolution, (sps + 2) % r->model.table_record_num));
+}
+
+int ring_find_keyframe(ring *r, int resolution, unsigned char **buffer, int *size, int *keyframe_counter)
+{
+    int table_record_num = r->model.table_record_num;
+    unsigned char *record_ptr[3];
+    unsigned int frame_length[3];
+    int counter[3];
+    int newest, sps, j, k;
+    unsigned char *bufferh264;
+    int bufferh264_size;
+
+    newest = ring_newest(r, resolution);
+    sps = ring_locate_keyframe(r, resolution, newest);
+    if (sps < 0) return -1;
+
+    for (j = 0; j < 3; j++) {
+        record_ptr[j] = ring_record(r, resolution, (sps + j) % table_record_num);
+        counter[j] = ring_frame_counter(r, record_ptr[j]);
+        frame_length[j] = ring_frame_length(r, record_ptr[j]);
+    }
+
+    bufferh264_size = frame_length[0] + frame_length[1] + frame_length[2];
+    bufferh264 = (unsigned char *) malloc(bufferh264_size);
+    if (bufferh264 == NULL) return -4;
+    k = 0;
+    for (j = 0; j < 3; j++) {
+        memcpy(&bufferh264[k], ring_frame_ptr(r, resolution, record_ptr[j]), frame_length[j]);
+        k += frame_length[j];
+    }
+
+    // Check again: the firmware could have written over them while we copied
+    newest = ring_newest(r, resolution);
+    for (j = 0; j < 3; j++) {
+        if (ring_frame_counter(r, record_ptr[j]) != counter[j]) break;
+    }
+    if ((j < 3) || (ring_distance(r, resolution, sps, newest) + RING_WRITE_MARGIN > ring_stream_size(r, resolution))) {
+        if (debug) fprintf(stderr, "%lld - keyframe %d overwritten while copying\n", current_timestamp(), (sps + 2) % table_record_num);
+        free(bufferh264);
+        return -1;
+    }
+
+    if (debug) fprintf(stderr, "%lld - found keyframe %d, %d frames old\n", current_timestamp(), (sps + 2) % table_record_num,
+            (ring_frame_counter(r, ring_record(r, resolution, newest)) - counter[2]) & 0xFFFF);
+
+    *buffer = bufferh264;
+    *size = bufferh264_size;
+    if (keyframe_counter != NULL) *keyframe_counter = counter[2];
+
+    return 0;
+}
+
+int ring_read_keyframe(ring *r, int resolution, unsigned char **buffer, int *size, int *keyframe_counter)
+{
+    unsigned char *frame_ptr, *frame_ptr_tmp;
+    unsigned int frame_length;
+    unsigned char *record_ptr, *next_record_ptr;
+    int current_frame, frame_counter, frame_type, frame_counter_tmp, next_frame_counter;
+    int frame_type_sum;
+    int table_record_num = r->model.table_record_num;
+    long long start = current_timestamp();
+
+    unsigned char *bufferh264 = NULL;
+    int bufferh264_size = 0;
+
+    frame_type_sum = 0;
+
+    // Start after the newest record: frame_counter is the counter it gets
+    // when it's written, 16 bit and wrapping
+    current_frame = ring_newest(r, resolution);
+    frame_counter = (ring_frame_counter(r, ring_record(r, resolution, current_frame)) + 1) & 0xFFFF;
+    if (debug) fprintf(stderr, "%lld - found latest frame: id %d, frame_counter %d\n", current_timestamp(), current_frame, frame_counter - 1);
+    current_frame = (current_frame + 1) % table_record_num;
+
+    // Wait for the next record to arrive and read the frame
+    for (;;) {
+        // Get pointer to the record
+        record_ptr = ring_record(r, resolution, current_frame);
+        if (debug) fprintf(stderr, "%lld - processing frame %d\n", current_timestamp(), current_frame);
+        // Check if we are at the end of the table
+        if (current_frame == table_record_num - 1) {
+            next_record_ptr = ring_record(r, resolution, 0);
+            if (debug) fprintf(stderr, "%lld - rewinding circular table\n", current_timestamp());
+        } else {
+            next_record_ptr = record_ptr + r->model.table_record_size;
+        }
+        // Get the frame counter of the next record
+        next_frame_counter = ring_frame_counter(r, next_record_ptr);
+        // The record is complete when the next one is written
+        if (((next_frame_counter - frame_counter) & 0xFFFF) == 1) {
+            // Get the frame type of the record
+            frame_type = ring_frame_type(r, record_ptr);
+            // SPS, PPS or I-FRAME
+            if ((frame_type == NAL_TYPE_SPS) || (frame_type == NAL_TYPE_PPS) || (frame_type == NAL_TYPE_IDR)) {
+                frame_type_sum += frame_type;
+                // Get the pointer to the frame address
+                frame_ptr = ring_frame_ptr(r, resolution, record_ptr);
+                // Get the length of the frame
+                frame_length = ring_frame_length(r, record_ptr);
+                if (debug) fprintf(stderr, "%lld - writing frame: frame_ptr %p, frame_length %d\n", current_timestamp(), (void *) frame_ptr, frame_length);
+                // Write the frame
+                frame_ptr_tmp = (unsigned char *) realloc(bufferh264, bufferh264_size + frame_length);
+                if (frame_ptr_tmp == NULL) {
+                    free(bufferh264);
+                    return -4;
+                }
+                bufferh264 = frame_ptr_tmp;
+                memcpy(&bufferh264[bufferh264_size], frame_ptr, frame_length);
+                bufferh264_size += frame_length;
+                frame_counter_tmp = ring_frame_counter(r, record_ptr);
+
+                if (frame_type_sum == NAL_TYPE_SPS + NAL_TYPE_PPS + NAL_TYPE_IDR) {
+                    if (debug) fprintf(stderr, "%lld - frame found, exit loop\n", current_timestamp());
+                    // We saved SPS, PPS and I-FRAME: exit loop and create JPEG image
+                    break;
+                }
+            } else {
+                if (bufferh264 != NULL) {
+                    free(bufferh264);
+                    bufferh264 = NULL;
+                    bufferh264_size = 0;
+                }
+                frame_type_sum = 0;
+            }
+
+            // Check if we are at the end of the table
+            if (current_frame == table_record_num - 1) {
+                current_frame = 0;
+            } else {
+                current_frame++;
+            }
+            frame_counter = (frame_counter + 1) & 0xFFFF;
+        }
+
+        // The stream may be stopped: don't wait forever
+        if (current_timestamp() - start > RING_KEYFRAME_TIMEOUT) {
+            fprintf(stderr, "Timeout waiting for a keyframe\n");
+            free(bufferh264);
+            return -5;
+        }
+
+        // Wait 10 milliseconds
+        usleep(MILLIS_10);
+    }
+
+    if (bufferh264 == NULL) {
+        fprintf(stderr, "Error, buffer is empty\n");
+        return -3;
+    }
+
+    *buffer = bufferh264;
+    *size = bufferh264_size;
+    if (keyframe_counter != NULL) *keyframe_counter = frame_counter_tmp;
+
+    return 0;
+}
+
+void ring_follow(ring *r, int resolution, ring_cursor *cur, int from_keyframe)
+{
+    int newest, sps = -1;
+
+    newest = ring_newest(r, resolution);
+    if (from_keyframe) sps = ring_locate_keyframe(r, resolution, newest);
+
+    cur->index = (sps >= 0) ? sps : newest;
+    cur->counter = ring_frame_counter(r, ring_record(r, resolution, cur->index));
+    if (debug) fprintf(stderr, "%lld - following from frame %d, counter %d\n", current_timestamp(), cur->index, cur->counter);
+}
+
+int ring_next_frame(ring *r, int resolution, ring_cursor *cur,
+                    unsigned char **buffer, int *buffer_size, int *length)
+{
+    int table_record_num = r->model.table_record_num;
+    int next = (cur->index + 1) % table_record_num;
+    unsigned char *record_ptr = ring_record(r, resolution, cur->index);
+    unsigned char *tmp;
+    unsigned int frame_length;
+    int frame_type;
+
+    // The frame is complete when the firmware has started the next one
+    if (ring_frame_counter(r, ring_record(r, resolution, next)) != ((cur->counter + 1) & 0xFFFF)) {
+        if (ring_frame_counter(r, record_ptr) != cur->counter) return -1;
+        return 0;
+    }
+
+    frame_type = ring_frame_type(r, record_ptr);
+    frame_length = ring_frame_length(r, record_ptr);
+    if (*length + frame_length > *buffer_size) {
+        tmp = (unsigned char *) realloc(*buffer, *length + frame_length);
+        if (tmp == NULL) return -4;
+        *buffer = tmp;
+        *buffer_size = *length + frame_length;
+    }
+    memcpy(*buffer + *length, ring_frame_ptr(r, resolution, record_ptr), frame_length);
+
+    // Check after the copy: the firmware could have written over it
+    if ((ring_frame_counter(r, record_ptr) != cur->counter) ||
+            (ring_distance(r, resolution, cur->index, ring_newest(r, resolution)) + RING_WRITE_MARGIN > ring_stream_size(r, resolution))) {
+        if (debug) fprintf(stderr, "%lld - frame %d overwritten\n", current_timestamp(), cur->index);
+        return -1;
+    }
+
+    *length += frame_length;
+    cur->index = next;
+    cur->counter = (cur->counter + 1) & 0xFFFF;
+
+    return frame_type;
+}
+
+int ring_time_offset(long long time)
+{
+    long long age = current_timestamp() - time;
+
+    if (age <= 0) return 0;
+    return (int) (age * RING_FPS / 1000);
+}
+
+// Index of the record of the picture offset pictures before the newest one
+// and of the SPS of its keyframe, -1 if they aren't both in the ring
+static int ring_locate_frame(ring *r, int resolution, int offset, int *frame, int *pictures)
+{
+    int table_record_num = r->model.table_record_num;
+    int newest, i, j, type, n;
+
+    newest = ring_newest(r, resolution);
+    *frame = -1;
+    n = 0;
+
+    // The newest record may still be written: start from the one before.
+    // Going back the counters must decrease one by one, or the table wrapped.
+    for (j = 1; j < table_record_num - 2; j++) {
+        i = (newest - j + table_record_num) % table_record_num;
+        if (((ring_frame_counter(r, ring_record(r, resolution, (i + 1) % table_record_num)) -
+                ring_frame_counter(r, ring_record(r, resolution, i))) & 0xFFFF) != 1) break;
+
+        type = ring_frame_type(r, ring_record(r, resolution, i));
+        if ((type != NAL_TYPE_SLICE) && (type != NAL_TYPE_IDR)) continue;
+
+        if (*frame < 0) {
+            if (offset-- > 0) continue;
+            *frame = i;
+        }
+        n++;
+        if (type != NAL_TYPE_IDR) continue;
+
+        i = (i - 2 + table_record_num) % table_record_num;
+        if ((ring_frame_type(r, ring_record(r, resolution, i)) != NAL_TYPE_SPS) ||
+                (ring_frame_type(r, ring_record(r, resolution, (i + 1) % table_record_num)) != NAL_TYPE_PPS)) {
+            // Keyframe without its parameter sets: the P-frames before it can't be decoded from here
+            if (debug) fprintf(stderr, "%lld - keyframe %d without SPS and PPS\n", current_timestamp(), (i + 2) % table_record_num);
+            return -1;
+        }
+        if (ring_distance(r, resolution, i, newest) + RING_WRITE_MARGIN > ring_stream_size(r, resolution)) {
+            if (debug) fprintf(stderr, "%lld - keyframe %d already overwritten\n", current_timestamp(), (i + 2) % table_record_num);
+            return -1;
+        }
+        *pictures = n;
+        return i;
+    }
+
+    if (debug) fprintf(stderr, "%lld - %s not in the ring\n", current_timestamp(), (*frame < 0) ? "frame" : "keyframe");
+    return -1;
+}
+
+int ring_find_frame(ring *r, int resolution, int offset, unsigned char **buffer, int *size,
+                    int **ends, int *count, int *frame_counter)
+{
+    ring_cursor cur;
+    unsigned char *bufferh264 = NULL;
+    int bufferh264_size = 0;
+    int length = 0;
+    int *frame_ends;
+    int sps, frame, pictures, type, n;
+
+    sps = ring_locate_frame(r, resolution, offset, &frame, &pictures);
+    if (sps < 0) return -1;
+
+    frame_ends = (int *) malloc(pictures * sizeof(int));
+    if (frame_ends == NULL) return -4;
+
+    // All the frames are complete: ring_next_frame() fails only if they are overwritten
+    cur.index = sps;
+    cur.counter = ring_frame_counter(r, ring_record(r, resolution, sps));
+    n = 0;
+    while (n < pictures) {
+        type = ring_next_frame(r, resolution, &cur, &bufferh264, &bufferh264_size, &length);
+        if (type <= 0) {
+            if (debug) fprintf(stderr, "%lld - frame %d overwritten while copying\n", current_timestamp(), cur.index);
+            free(bufferh264);
+            free(frame_ends);
+            return (type == -4) ? -4 : -1;
+        }
+        if ((type == NAL_TYPE_SLICE) || (type == NAL_TYPE_IDR)) frame_ends[n++] = length;
+    }
+
+    if (debug) fprintf(stderr, "%lld - found frame %d, %d pictures from its keyframe\n", current_timestamp(), frame, pictures);
+
+    *buffer = bufferh264;
+    *size = length;
+    *ends = frame_ends;
+    *count = pictures;
+    if (frame_counter != NULL) *frame_counter = ring_frame_counter(r, ring_record(r, resolution, frame));
+
+    return 0;
+}
+
+int ring_get_keyframe(ring *r, int resolution, int mode, unsigned char **buffer, int *size, int *keyframe_counter)
+{
+    if ((mode == RING_LATEST) && (ring_find_keyframe(r, resolution, buffer, size, keyframe_counter) == 0)) {
+        return 0;
+    }
+
+    return ring_read_keyframe(r, resolution, buffer, size, keyframe_counter);
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Access to the frame ring written by the stock firmware in /tmp/view:
+ * a table of records per resolution and the stream region the records
+ * point to. The layout depends on the cam model.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define BUFFER_FILE "/tmp/view"
+
+#define RESOLUTION_NONE 0
+#define RESOLUTION_LOW  360
+#define RESOLUTION_HIGH 1080
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+#define MILLIS_10 10000
+
+// Max wait for the next keyframe, in milliseconds
+#define RING_KEYFRAME_TIMEOUT 10000
+
+// Frame rate of the streams: the records have no time, a time is a number of frames
+#define RING_FPS 20
+
+// Room left for the frame the firmware may be writing while we copy
+#define RING_WRITE_MARGIN 65536
+
+#define RING_LATEST 0
+#define RING_NEXT   1
+
+typedef struct {
+    int table_high_offset;
+    int table_low_offset;
+    int table_record_size;
+    int table_record_num;
+    int buf_size;
+    int stream_high_offset;
+    int stream_low_offset;
+    int frame_counter_offset;
+    int frame_offset_offset;
+    int frame_length_offset;
+    int frame_type_offset;
+    int w_low;
+    int h_low;
+    int w_high;
+    int h_high;
+} ring_model;
+
+typedef struct {
+    ring_model model;
+    unsigned char *addr;
+} ring;
+
+// Position of a reader that follows the frames one by one
+typedef struct {
+    int index;
+    int counter;
+} ring_cursor;
+
+long long current_timestamp();
+
+/* Fills model with the layout of a cam model, returns -1 if unknown */
+int ring_model_by_name(ring_model *model, const char *name);
+
+/*
+ * The resolution to decode for a picture of width x height (<= 0 if not
+ * set): the low one if the size fits it.
+ */
+int ring_fit_resolution(const ring_model *model, int width, int height);
+
+/* Maps BUFFER_FILE, returns < 0 on error */
+int ring_open(ring *r, const ring_model *model);
+void ring_close(ring *r);
+
+void ring_size(ring *r, int resolution, int *width, int *height);
+int ring_stream_size(ring *r, int resolution);
+
+/* Fields of the record i of the table of a resolution */
+unsigned char *ring_record(ring *r, int resolution, int i);
+int ring_frame_counter(ring *r, unsigned char *record);
+int ring_frame_type(ring *r, unsigned char *record);
+unsigned char *ring_frame_ptr(ring *r, int resolution, unsigned char *record);
+unsigned int ring_frame_length(ring *r, unsigned char *record);
+
+/* Index of the newest record of the table of a resolution */
+int ring_newest(ring *r, int resolution);
+
+/* Frame counter of the keyframe ring_find_keyframe() would copy, -1 if none */
+int ring_latest_keyframe(ring *r, int resolution);
+
+/*
+ * Copies the most recent SPS, PPS and IDR of a resolution that are still
+ * in the stream region, in a buffer allocated with malloc().
+ * keyframe_counter, if not NULL, gets the counter of the IDR.
+ * Returns 0 on success, < 0 if there is none.
+ */
+int ring_find_keyframe(ring *r, int resolution, unsigned char **buffer, int *size, int *keyframe_counter);
+
+/*
+ * Waits for the next SPS, PPS and IDR of a resolution and copies them in
+ * a buffer allocated with malloc().
+ * Returns 0 on success.
+ */
+int ring_read_keyframe(ring *r, int resolution, unsigned char **buffer, int *size, int *keyframe_counter);
+
+/*
+ * ring_find_keyframe() with RING_LATEST, falling back to
+ * ring_read_keyframe(), which is the only one used with RING_NEXT.
+ */
+int ring_get_keyframe(ring *r, int resolution, int mode, unsigned char **buffer, int *size, int *keyframe_counter);
+
+/*
+ * Pictures between the newest frame and the one shown at time, in
+ * milliseconds since the epoch, at RING_FPS. 0 if time isn't past.
+ */
+int ring_time_offset(long long time);
+
+/*
+ * Copies the frames the picture offset pictures before the newest one
+ * needs, from its keyframe (SPS, PPS and IDR) to the picture, in a buffer
+ * allocated with malloc(). ends, also allocated with malloc(), gets the
+ * end of each picture in the buffer and count the number of pictures.
+ * frame_counter, if not NULL, gets the counter of the picture.
+ * Returns 0 on success, < 0 if the picture or its keyframe is gone.
+ */
+int ring_find_frame(ring *r, int resolution, int offset, unsigned char **buffer, int *size,
+                    int **ends, int *count, int *frame_counter);
+
+/*
+ * Sets cur on the SPS of the most recent keyframe still in the stream
+ * region if from_keyframe is set and there is one, on the newest frame
+ * otherwise.
+ */
+void ring_follow(ring *r, int resolution, ring_cursor *cur, int from_keyframe);
+
+/*
+ * Appends the frame at cur to *buffer at offset *length, growing it with
+ * realloc() (*buffer_size is its size), adds the frame length to *length
+ * and moves cur to the next frame.
+ * Returns the NAL type of the frame, 0 if it isn't complete yet, < 0 if
+ * it has been overwritten: the reader is too slow and must follow again.
+ */
+int ring_next_frame(ring *r, int resolution, ring_cursor *cur,
+                    unsigned char **buffer, int *buffer_size, int *length);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * NV12 resize: box filter to shrink, bilinear otherwise.
+ * 16.16 fixed point, the ARM926 has no FPU and no divider. The row passes
+ * are yuv kernels, the column passes plain C: the cam has no NEON and
+ * runs the scalar set.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "scale.h"
+#include "yuv.h"
+
+/*
+ * Averages the source pixels that fall in each destination pixel.
+ * comps is 1 for the Y plane, 2 for the interleaved UV plane.
+ */
+static int box_plane(const yuv_kernels *k, const unsigned char *src, int sw, int sh,
+                     unsigned char *dst, int dw, int dh, int comps)
+{
+    unsigned int *sum;
+    int *xs;
+    unsigned int *inv;
+    int x, y, c, i, y0, y1, xmax, rows;
+    unsigned int acc;
+
+    sum = (unsigned int *) malloc(sw * comps * sizeof(unsigned int));
+    xs = (int *) malloc((dw + 1) * sizeof(int));
+    // Columns per destination pixel are at most sw / dw + 1
+    xmax = sw / dw + 1;
+    inv = (unsigned int *) malloc((xmax + 1) * sizeof(unsigned int));
+    if ((sum == NULL) || (xs == NULL) || (inv == NULL)) {
+        free(sum);
+        free(xs);
+        free(inv);
+        return -1;
+    }
+
+    for (x = 0; x <= dw; x++) {
+        xs[x] = x * sw / dw;
+    }
+
+    for (y = 0; y < dh; y++) {
+        y0 = y * sh / dh;
+        y1 = (y + 1) * sh / dh;
+        rows = y1 - y0;
+
+        // Sum the rows first, then the columns
+        memset(sum, 0, sw * comps * sizeof(unsigned int));
+        for (i = y0; i < y1; i++) {
+            k->accumulate(sum, src + i * sw * comps, sw * comps);
+        }
+
+        // Reciprocals: 16.16, rounded
+        for (i = 1; i <= xmax; i++) {
+            inv[i] = (65536 + i * rows / 2) / (i * rows);
+        }
+
+        for (x = 0; x < dw; x++) {
+            for (c = 0; c < comps; c++) {
+                acc = 0;
+                for (i = xs[x]; i < xs[x + 1]; i++) {
+                    acc += sum[i * comps + c];
+                }
+                *dst++ = (acc * inv[xs[x + 1] - xs[x]] + 32768) >> 16;
+            }
+        }
+    }
+
+    free(sum);
+    free(xs);
+    free(inv);
+
+    return 0;
+}
+
+/*
+ * Bilinear filter with the pixel centers aligned.
+ * comps is 1 for the Y plane, 2 for the interleaved UV plane.
+ * The rows are blended first, then the columns: the sums are exact, the
+ * bytes are the same as the other way round.
+ */
+static int bilinear_plane(const yuv_kernels *k, const unsigned char *src, int sw, int sh,
+                          unsigned char *dst, int dw, int dh, int comps)
+{
+    int *xs;
+    unsigned char *xw;
+    unsigned short *v;
+    const unsigned char *r0, *r1;
+    int x, y, c, sx, sy, x0, wy, i;
+    int xstep = (sw << 16) / dw;
+    int ystep = (sh << 16) / dh;
+
+    xs = (int *) malloc(dw * sizeof(int));
+    xw = (unsigned char *) malloc(dw);
+    v = (unsigned short *) calloc((sw + 1) * comps, sizeof(unsigned short));
+    if ((xs == NULL) || (xw == NULL) || (v == NULL)) {
+        free(xs);
+        free(xw);
+        free(v);
+        return -1;
+    }
+
+    // Source column and weight (8 bits) of each destination column
+    for (x = 0; x < dw; x++) {
+        sx = x * xstep + xstep / 2 - 32768;
+        if (sx < 0) sx = 0;
+        x0 = sx >> 16;
+        if (sw == 1) {
+            // The chroma of a 2 pixel wide picture: the right one is padding
+            xs[x] = 0;
+            xw[x] = 0;
+        } else if (x0 >= sw - 1) {
+            xs[x] = sw - 2;
+            xw[x] = 255;
+        } else {
+            xs[x] = x0;
+            xw[x] = (sx >> 8) & 0xFF;
+        }
+    }
+
+    for (y = 0; y < dh; y++) {
+        sy = y * ystep + ystep / 2 - 32768;
+        if (sy < 0) sy = 0;
+        if ((sy >> 16) >= sh - 1) {
+            r0 = src + (sh - 1) * sw * comps;
+            r1 = r0;
+            wy = 0;
+        } else {
+            r0 = src + (sy >> 16) * sw * comps;
+            r1 = r0 + sw * comps;
+            wy = (sy >> 8) & 0xFF;
+        }
+
+        k->lerp_rows(v, r0, r1, wy, sw * comps);
+        for (x = 0; x < dw; x++) {
+            for (c = 0; c < comps; c++) {
+                i = xs[x] * comps + c;
+                *dst++ = (v[i] * (256 - xw[x]) + v[i + comps] * xw[x] + 32768) >> 16;
+            }
+        }
+    }
+
+    free(xs);
+    free(xw);
+    free(v);
+
+    return 0;
+}
+
+int nv12_scale(const unsigned char *src, int src_width, int src_height,
+               unsigned char *dst, int dst_width, int dst_height)
+{
+    const yuv_kernels *k = yuv_get_kernels();
+    int (*plane)(const yuv_kernels *, const unsigned char *, int, int, unsigned char *, int, int, int);
+
+    if ((src_width < 2) || (src_height < 2) || (dst_width < 2) || (dst_height < 2) ||
+            (src_width % 2) || (src_height % 2) || (dst_width % 2) || (dst_height % 2)) {
+        return -1;
+    }
+
+    if ((src_width == dst_width) && (src_height == dst_height)) {
+        memcpy(dst, src, src_width * src_height * 3 / 2);
+        return 0;
+    }
+
+    if ((src_width >= 2 * dst_width) && (src_height >= 2 * dst_height)) {
+        plane = box_plane;
+    } else {
+        plane = bilinear_plane;
+    }
+
+    if (plane(k, src, src_width, src_height, dst, dst_width, dst_height, 1) < 0) return -1;
+
+    return plane(k, src + src_width * src_height, src_width / 2, src_height / 2,
+            dst + dst_width * dst_height, dst_width / 2, dst_height / 2, 2);
+}
+
+void scale_size(int src_width, int src_height, int *width, int *height)
+{
+    if ((*width <= 0) && (*height <= 0)) {
+        *width = src_width;
+        *height = src_height;
+        return;
+    }
+
+    if (*width > src_width * 16) *width = src_width * 16;
+    if (*height > src_height * 16) *height = src_height * 16;
+
+    if (*width <= 0) {
+        *width = (*height * src_width + src_height / 2) / src_height;
+    } else if (*height <= 0) {
+        *height = (*width * src_height + src_width / 2) / src_width;
+    }
+
+    *width &= ~1;
+    *height &= ~1;
+    if (*width < 2) *width = 2;
+    if (*height < 2) *height = 2;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Resizes NV12 pictures before the JPEG encoding, so a thumbnail costs
+ * a pass over the decoded frame instead of a full size encode.
+ */
+
+#ifndef SCALE_H
+#define SCALE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Resizes an NV12 picture (Y plane followed by the interleaved UV plane).
+ * Shrinking by 2 or more averages the source pixels (box filter), other
+ * sizes use a bilinear filter. The sizes must be even.
+ * Returns 0 on success.
+ */
+int nv12_scale(const unsigned char *src, int src_width, int src_height,
+               unsigned char *dst, int dst_width, int dst_height);
+
+/*
+ * Completes the output size: a size <= 0 follows the aspect ratio of the
+ * source, both <= 0 keep the source size. The result is even and at most
+ * the source size times 16.
+ */
+void scale_size(int src_width, int src_height, int *width, int *height);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
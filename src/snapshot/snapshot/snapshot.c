@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Snapshot pipeline: H.264 keyframe -> YUV -> watermark -> JPEG.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "snapshot.h"
+#include "convert2jpg.h"
+#include "scale.h"
+
+extern int debug;
+
+// Characters of "YYYY-MM-DD HH:MM:SS"
+#define WM_DATE_LENGTH 19
+// Space between the date and the corner of a picture that isn't a stream size
+#define WM_MARGIN 4
+
+void snapshot_init(snapshot_ctx *s)
+{
+    memset(s, 0, sizeof(snapshot_ctx));
+    JPGDefaultOptions(&s->jpeg);
+}
+
+void snapshot_free(snapshot_ctx *s)
+{
+    int i;
+
+    for (i = 0; i < SNAPSHOT_SLOTS; i++) {
+        h264dec_close(s->dec[i]);
+        if (s->atlas[i].addr != NULL) wm_atlas_close(&s->atlas[i]);
+        else if (s->wm_loaded[i]) WMRelease(&s->wm[i]);
+    }
+    free(s->yuv);
+    free(s->scaled);
+    memset(s, 0, sizeof(snapshot_ctx));
+}
+
+// Date and time, after the label if any, with the glyphs of the atlas
+static void add_atlas_text(snapshot_ctx *s, int slot, unsigned char *buffer, int width, int height,
+                           int x, int y)
+{
+    char text[128];
+    time_t rawtime;
+    int len = 0;
+
+    if ((s->label != NULL) && (s->label[0] != '\0')) {
+        len = snprintf(text, sizeof(text) - 20, "%s ", s->label);
+        if (len > sizeof(text) - 21) len = sizeof(text) - 21;
+    }
+    rawtime = (s->time != 0) ? s->time : time(NULL);
+    strftime(text + len, sizeof(text) - len, "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
+
+    // The date stays where the stock watermark puts it, the label goes on its left
+    x -= len * s->atlas[slot].header->width;
+    wm_atlas_draw(&s->atlas[slot], width, height, buffer, buffer + width * height, x, y, text);
+}
+
+int snapshot_watermark(snapshot_ctx *s, unsigned char *buffer, int width, int height)
+{
+    int slot, x, y, glyph_width, glyph_height;
+
+    // The 1080p image uses the big glyphs, a crop up to 1280 pixels the small ones
+    slot = (width <= 1280) ? 0 : 1;
+
+    if (!s->wm_loaded[slot]) {
+        if ((wm_atlas_open(&s->atlas[slot], (slot == 0) ? PATH_ATLAS_LOW : PATH_ATLAS_HIGH) < 0) &&
+                (WMInit(&s->wm[slot], (slot == 0) ? PATH_RES_LOW : PATH_RES_HIGH) < 0)) {
+            fprintf(stderr, "water mark init error\n");
+            return -1;
+        }
+        s->wm_loaded[slot] = 1;
+    }
+
+    // The stock positions on the stream sizes, the bottom right corner on a crop
+    if (width == 640) {
+        x = width-230;
+        y = height-20;
+    } else if (width == 1280) {
+        x = width-345;
+        y = height-30;
+    } else if (width == 1920) {
+        x = width-460;
+        y = height-40;
+    } else {
+        glyph_width = (s->atlas[slot].addr != NULL) ? s->atlas[slot].header->width : s->wm[slot].width;
+        glyph_height = (s->atlas[slot].addr != NULL) ? s->atlas[slot].header->height : s->wm[slot].height;
+        x = (width - WM_DATE_LENGTH * glyph_width - WM_MARGIN) & ~1;
+        y = (height - glyph_height - WM_MARGIN) & ~1;
+        if ((x < 0) || (y < 0)) {
+            if (debug) fprintf(stderr, "No room for the watermark in %dx%d\n", width, height);
+            return 0;
+        }
+    }
+
+    if (s->atlas[slot].addr != NULL) {
+        add_atlas_text(s, slot, buffer, width, height, x, y);
+    } else if (s->time != 0) {
+        // AddWM() takes the year with the century in tm_year
+        struct tm tm = *localtime(&s->time);
+
+        tm.tm_year += 1900;
+        AddWM(&s->wm[slot], width, height, buffer,
+            buffer + width*height, x, y, &tm);
+    } else {
+        AddWM(&s->wm[slot], width, height, buffer,
+            buffer + width*height, x, y, NULL);
+    }
+
+    return 0;
+}
+
+int snapshot_fit_rect(snapshot_rect *r, int width, int height)
+{
+    if ((r->width <= 0) || (r->height <= 0)) {
+        r->x = 0;
+        r->y = 0;
+        r->width = width;
+        r->height = height;
+        return 0;
+    }
+
+    if (r->x < 0) {
+        r->width += r->x;
+        r->x = 0;
+    }
+    if (r->y < 0) {
+        r->height += r->y;
+        r->y = 0;
+    }
+    if (r->x + r->width > width) r->width = width - r->x;
+    if (r->y + r->height > height) r->height = height - r->y;
+
+    // The chroma is shared by 2 x 2 pixels: start and end on even values
+    if (r->x & 1) {
+        r->x--;
+        r->width++;
+    }
+    if (r->y & 1) {
+        r->y--;
+        r->height++;
+    }
+    r->width &= ~1;
+    r->height &= ~1;
+
+    return ((r->width > 0) && (r->height > 0)) ? 0 : -1;
+}
+
+int snapshot_parse_rect(snapshot_rect *r, const char *s)
+{
+    char c;
+
+    if (sscanf(s, "%d,%d,%d,%d%c", &r->x, &r->y, &r->width, &r->height, &c) != 4) return -1;
+    if ((r->width <= 0) || (r->height <= 0)) return -1;
+
+    return 0;
+}
+
+// Grows *buffer to size, returns < 0 if out of memory
+static int reserve(unsigned char **buffer, int *buffer_size, int size)
+{
+    // The buffer grows to the biggest resolution and stays
+    if (size > *buffer_size) {
+        free(*buffer);
+        *buffer_size = size;
+        *buffer = (unsigned char *) malloc(size);
+        if (*buffer == NULL) {
+            fprintf(stderr, "Unable to allocate memory\n");
+            *buffer_size = 0;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns N if width x height is the picture scaled by N/8, 0 otherwise
+static int dct_scale(int src_width, int src_height, int width, int height)
+{
+    int n;
+
+    for (n = 1; n <= 16; n++) {
+        if ((src_width * n == width * 8) && (src_height * n == height * 8)) return n;
+    }
+
+    return 0;
+}
+
+int snapshot_decode(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int *width, int *height)
+{
+    if (s->dec[slot] == NULL) {
+        if (debug) fprintf(stderr, "Opening h264 decoder %d\n", slot);
+        s->dec[slot] = h264dec_open();
+        if (s->dec[slot] == NULL) {
+            fprintf(stderr, "Could not open codec h264\n");
+            return -5;
+        }
+    }
+
+    if (debug) fprintf(stderr, "Decoding h264 frame\n");
+    if (h264dec_decode(s->dec[slot], h264, h264_size, width, height) < 0) {
+        fprintf(stderr, "Error decoding h264 frame\n");
+        return -5;
+    }
+
+    return 0;
+}
+
+/*
+ * Watermark, resize and encode of snapshot_encode(), to fd if it is >= 0,
+ * to *jpeg otherwise. Returns < 0 on error.
+ */
+static int encode(snapshot_ctx *s, unsigned char *yuv, int width, int height, int watermark,
+                  int dest_width, int dest_height, int fd, unsigned char **jpeg, unsigned long *jpeg_len)
+{
+    int n, ret;
+
+    scale_size(width, height, &dest_width, &dest_height);
+    JPGSetOptions(&s->jpeg);
+
+    if (watermark) {
+        if (debug) fprintf(stderr, "Adding watermark\n");
+        if (snapshot_watermark(s, yuv, width, height) < 0) {
+            fprintf(stderr, "Error adding watermark\n");
+            return -6;
+        }
+    }
+
+    if ((dest_width == width) && (dest_height == height)) {
+        if (debug) fprintf(stderr, "Encoding jpeg image\n");
+        if (fd >= 0) ret = YUVtoJPGFd(fd, yuv, width, height, width, height);
+        else ret = YUVtoJPGMem(jpeg, jpeg_len, yuv, width, height, width, height);
+        if (ret < 0) {
+            fprintf(stderr, "Error encoding jpeg file\n");
+            return -7;
+        }
+        return 0;
+    }
+
+    // The encoder can shrink by N/8 for free
+    n = s->dct_scaling ? dct_scale(width, height, dest_width, dest_height) : 0;
+    if (n > 0) {
+        if (fd >= 0) ret = YUVtoJPGFdDCT(fd, yuv, width, height, n);
+        else ret = YUVtoJPGMemDCT(jpeg, jpeg_len, yuv, width, height, n);
+        if (ret >= 0) {
+            if (debug) fprintf(stderr, "Encoded jpeg image scaled %d/8 in the DCT\n", n);
+            return 0;
+        }
+    }
+
+    if (debug) fprintf(stderr, "Scaling to %dx%d\n", dest_width, dest_height);
+    if (reserve(&s->scaled, &s->scaled_size, dest_width * dest_height * 3 / 2) < 0) {
+        return -4;
+    }
+    if (nv12_scale(yuv, width, height, s->scaled, dest_width, dest_height) < 0) {
+        fprintf(stderr, "Error scaling the image\n");
+        return -7;
+    }
+
+    if (debug) fprintf(stderr, "Encoding jpeg image\n");
+    if (fd >= 0) ret = YUVtoJPGFd(fd, s->scaled, dest_width, dest_height, dest_width, dest_height);
+    else ret = YUVtoJPGMem(jpeg, jpeg_len, s->scaled, dest_width, dest_height, dest_width, dest_height);
+    if (ret < 0) {
+        fprintf(stderr, "Error encoding jpeg file\n");
+        return -7;
+    }
+
+    return 0;
+}
+
+// snapshot_jpeg_frames() to fd if it is >= 0, to *jpeg otherwise
+static int decode_encode(snapshot_ctx *s, int slot, unsigned char *h264, const int *ends, int count, int watermark,
+                         const snapshot_rect *crop, int dest_width, int dest_height,
+                         int fd, unsigned char **jpeg, unsigned long *jpeg_len)
+{
+    snapshot_rect rect = { 0, 0, 0, 0 };
+    int width, height, ret, i;
+
+    if (count < 1) return -5;
+    for (i = 0; i < count; i++) {
+        ret = snapshot_decode(s, slot, h264 + ((i > 0) ? ends[i - 1] : 0),
+                ends[i] - ((i > 0) ? ends[i - 1] : 0), &width, &height);
+        if (ret < 0) return ret;
+    }
+
+    if (crop != NULL) rect = *crop;
+    if (snapshot_fit_rect(&rect, width, height) < 0) {
+        fprintf(stderr, "The crop is outside the %dx%d picture\n", width, height);
+        return -8;
+    }
+    if (debug && (crop != NULL)) fprintf(stderr, "Cropping %dx%d at %d,%d\n", rect.width, rect.height, rect.x, rect.y);
+
+    scale_size(rect.width, rect.height, &dest_width, &dest_height);
+
+    // Nothing to draw or resize: the decoder planes go straight to libjpeg
+    if (!watermark && (dest_width == rect.width) && (dest_height == rect.height)) {
+        unsigned char *planes[3];
+        int strides[3];
+
+        if (debug) fprintf(stderr, "Encoding jpeg image\n");
+        JPGSetOptions(&s->jpeg);
+        if (h264dec_planes(s->dec[slot], planes, strides) < 0) {
+            ret = -1;
+        } else {
+            // The region starts inside the planes
+            planes[0] += rect.y * strides[0] + rect.x;
+            planes[1] += (rect.y / 2) * strides[1] + rect.x / 2;
+            planes[2] += (rect.y / 2) * strides[2] + rect.x / 2;
+            if (fd >= 0) {
+                ret = I420toJPGFd(fd, planes, strides, rect.width, rect.height);
+            } else {
+                ret = I420toJPGMem(jpeg, jpeg_len, planes, strides, rect.width, rect.height);
+            }
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Error encoding jpeg file\n");
+            return -7;
+        }
+        return 0;
+    }
+
+    // The watermark and the scaler work on NV12: only the region is copied
+    if (reserve(&s->yuv, &s->yuv_size, rect.width * rect.height * 3 / 2) < 0) {
+        return -4;
+    }
+    h264dec_nv12_rect(s->dec[slot], s->yuv, rect.x, rect.y, rect.width, rect.height);
+
+    return encode(s, s->yuv, rect.width, rect.height, watermark, dest_width, dest_height, fd, jpeg, jpeg_len);
+}
+
+int snapshot_jpeg(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int watermark,
+                  const snapshot_rect *crop, int dest_width, int dest_height, unsigned char **jpeg, unsigned long *jpeg_len)
+{
+    return decode_encode(s, slot, h264, &h264_size, 1, watermark, crop, dest_width, dest_height, -1, jpeg, jpeg_len);
+}
+
+int snapshot_jpeg_fd(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int watermark,
+                     const snapshot_rect *crop, int dest_width, int dest_height, int fd)
+{
+    return decode_encode(s, slot, h264, &h264_size, 1, watermark, crop, dest_width, dest_height, fd, NULL, NULL);
+}
+
+int snapshot_jpeg_frames(snapshot_ctx *s, int slot, unsigned char *h264, const int *ends, int count, int watermark,
+                         const snapshot_rect *crop, int dest_width, int dest_height, unsigned char **jpeg, unsigned long *jpeg_len)
+{
+    return decode_encode(s, slot, h264, ends, count, watermark, crop, dest_width, dest_height, -1, jpeg, jpeg_len);
+}
+
+int snapshot_jpeg_frames_fd(snapshot_ctx *s, int slot, unsigned char *h264, const int *ends, int count, int watermark,
+                            const snapshot_rect *crop, int dest_width, int dest_height, int fd)
+{
+    return decode_encode(s, slot, h264, ends, count, watermark, crop, dest_width, dest_height, fd, NULL, NULL);
+}
+
+int snapshot_encode(snapshot_ctx *s, unsigned char *yuv, int width, int height, int watermark,
+                    int dest_width, int dest_height, unsigned char **jpeg, unsigned long *jpeg_len)
+{
+    return encode(s, yuv, width, height, watermark, dest_width, dest_height, -1, jpeg, jpeg_len);
+}
+
+int snapshot_encode_fd(snapshot_ctx *s, unsigned char *yuv, int width, int height, int watermark,
+                       int dest_width, int dest_height, int fd)
+{
+    return encode(s, yuv, width, height, watermark, dest_width, dest_height, fd, NULL, NULL);
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Snapshot pipeline: H.264 keyframe -> YUV -> watermark -> JPEG.
+ * The context keeps the decoders, the YUV buffer and the watermark
+ * glyphs between snapshots, so a resident process pays only the decode
+ * and the encode for each one.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <time.h>
+
+#include "h264dec.h"
+#include "convert2jpg.h"
+#include "add_water.h"
+#include "wm_atlas.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define PATH_RES_HIGH "/home/yi-hack/etc/wm_res/high/wm_540p_"
+#define PATH_RES_LOW  "/home/yi-hack/etc/wm_res/low/wm_540p_"
+#define PATH_ATLAS_HIGH "/home/yi-hack/etc/wm_res/high/" WM_ATLAS_FILE
+#define PATH_ATLAS_LOW  "/home/yi-hack/etc/wm_res/low/" WM_ATLAS_FILE
+
+// Where snapshotd answers, HTTP/1.0 GET /snapshot.jpg?res=low|high&watermark=yes|no
+#define SNAPSHOTD_SOCKET "/tmp/snapshotd.sock"
+
+// Decoders and watermarks: 0 low resolution, 1 high resolution
+#define SNAPSHOT_SLOTS 2
+
+// Region of the decoded picture, in pixels
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} snapshot_rect;
+
+typedef struct {
+    h264dec *dec[SNAPSHOT_SLOTS];
+    unsigned char *yuv;
+    int yuv_size;
+    // Resized picture
+    unsigned char *scaled;
+    int scaled_size;
+    // Let libjpeg resize in the DCT when the size is an N/8 multiple
+    int dct_scaling;
+    // Glyphs: the atlas if there is one, the stock BMPs otherwise
+    wm_atlas atlas[SNAPSHOT_SLOTS];
+    WaterMarkInfo wm[SNAPSHOT_SLOTS];
+    int wm_loaded[SNAPSHOT_SLOTS];
+    // Text before the date, e.g. the cam name (atlas only)
+    const char *label;
+    // Date of the watermark, 0 for the current one
+    time_t time;
+    // Quality, Huffman tables, scans and size of the JPEG
+    jpeg_options jpeg;
+} snapshot_ctx;
+
+void snapshot_init(snapshot_ctx *s);
+void snapshot_free(snapshot_ctx *s);
+
+/*
+ * Clips r to a width x height picture and rounds it to even values, as
+ * 4:2:0 needs. A rect without width or height is the whole picture.
+ * Returns < 0 if nothing is left.
+ */
+int snapshot_fit_rect(snapshot_rect *r, int width, int height);
+
+/* Parses "X,Y,W,H", returns < 0 if it isn't valid */
+int snapshot_parse_rect(snapshot_rect *r, const char *s);
+
+/*
+ * Converts a keyframe (SPS, PPS and IDR with start codes) to JPEG.
+ * slot selects the decoder: 0 for the low resolution, 1 for the high one.
+ * crop, if not NULL, is the region of the picture to keep: only its rows
+ * are copied, watermarked and encoded.
+ * width and height set the size of the JPEG, see scale_size(): 0 keeps
+ * the size of the region.
+ * The JPEG is allocated with malloc() in *jpeg.
+ * Returns 0 on success.
+ */
+int snapshot_jpeg(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int watermark,
+                  const snapshot_rect *crop, int width, int height, unsigned char **jpeg, unsigned long *jpeg_len);
+
+/*
+ * snapshot_jpeg() writing the JPEG to fd while it is encoded, a few KB at
+ * a time, without a buffer for the whole image.
+ */
+int snapshot_jpeg_fd(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int watermark,
+                     const snapshot_rect *crop, int width, int height, int fd);
+
+/*
+ * snapshot_jpeg() and snapshot_jpeg_fd() of the last picture of a
+ * sequence of access units: a keyframe and the frames up to the picture,
+ * decoded one by one. ends[i] is the end of the access unit i in h264.
+ */
+int snapshot_jpeg_frames(snapshot_ctx *s, int slot, unsigned char *h264, const int *ends, int count, int watermark,
+                         const snapshot_rect *crop, int width, int height, unsigned char **jpeg, unsigned long *jpeg_len);
+int snapshot_jpeg_frames_fd(snapshot_ctx *s, int slot, unsigned char *h264, const int *ends, int count, int watermark,
+                            const snapshot_rect *crop, int width, int height, int fd);
+
+/*
+ * Draws the date, after the label if any, on a width x height NV12
+ * picture, loading the glyphs the first time.
+ * Returns < 0 if they can't be loaded.
+ */
+int snapshot_watermark(snapshot_ctx *s, unsigned char *yuv, int width, int height);
+
+/*
+ * The two halves of snapshot_jpeg(), for a caller that decodes frames
+ * that aren't keyframes or encodes in another thread.
+ * snapshot_decode() feeds an access unit to the decoder of slot and
+ * gives the size of the picture, which h264dec_nv12(s->dec[slot], ...)
+ * or h264dec_nv12_rect() copy out.
+ * snapshot_encode() draws the watermark on yuv (NV12, modified), resizes
+ * and encodes. It uses the watermark and the resize buffer of s but not
+ * the decoders: one thread can decode while another one encodes.
+ */
+int snapshot_decode(snapshot_ctx *s, int slot, unsigned char *h264, int h264_size, int *width, int *height);
+int snapshot_encode(snapshot_ctx *s, unsigned char *yuv, int width, int height, int watermark,
+                    int dest_width, int dest_height, unsigned char **jpeg, unsigned long *jpeg_len);
+int snapshot_encode_fd(snapshot_ctx *s, unsigned char *yuv, int width, int height, int watermark,
+                       int dest_width, int dest_height, int fd);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
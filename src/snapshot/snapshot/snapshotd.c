@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Resident snapshot service: keeps /tmp/view mapped and the decoders,
+ * the buffers and the watermark glyphs loaded, and answers snapshot
+ * requests on a Unix socket and optionally on a TCP port.
+ *
+ * GET /snapshot.jpg?res=low|high&watermark=yes|no&mode=latest|next&offset=N|time=MS&crop=X,Y,W,H&width=W&height=H
+ *     &quality=Q&optimize=yes|no&progressive=yes|no&max_size=BYTES HTTP/1.0
+ *
+ * crop keeps only a region of the decoded picture, width and height
+ * resize what is kept, if only one is set the other follows the aspect
+ * ratio. Without res the low resolution is decoded when the size fits
+ * it and there is no crop.
+ *
+ * mode=latest (the default) uses the last keyframe in the ring, next
+ * waits for a new one. offset=N shows the frame N frames before the
+ * newest one and time=MS (milliseconds since the epoch) the frame shown
+ * then, decoding the frames from their keyframe: 404 if it is no longer
+ * in the ring. These are never cached.
+ *
+ * quality goes from 1 to 100, optimize makes Huffman tables for the
+ * image, progressive encodes progressive scans and max_size lowers the
+ * quality until the JPEG fits, not below JPEG_MIN_QUALITY. These three
+ * keep the whole picture in the encoder: they are refused with 400 for
+ * a JPEG over JPEG_BUFFERED_MAX_PIXELS, ask for the low resolution or a
+ * smaller width and height.
+ *
+ * Requests with the same parameters that are pending together are
+ * answered with a single decode and encode, and the JPEG is kept for
+ * --ttl milliseconds as long as the latest keyframe in the ring is the
+ * one it was made from.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "ring.h"
+#include "snapshot.h"
+
+#define REQUEST_MAX_SIZE 2048
+#define REQUEST_TIMEOUT 2
+#define MAX_CLIENTS 16
+#define LISTEN_FDS 2
+
+#define CACHE_TTL_DEFAULT 5000
+
+#define STATS_FILE "/tmp/snapshotd.stats"
+
+int debug = 0;
+
+ring r;
+ring_model model;
+snapshot_ctx snapshot;
+
+// Parameters of a snapshot request
+typedef struct {
+    int resolution;
+    int watermark;
+    int mode;
+    // Frames before the newest one, -1 for the keyframe of mode
+    int offset;
+    // Or the frame shown at this time in ms since the epoch, 0 if not set
+    long long time;
+    snapshot_rect crop;
+    int width;
+    int height;
+    jpeg_options jpeg;
+} request_params;
+
+typedef struct {
+    int sock;
+    char request[REQUEST_MAX_SIZE];
+    int request_len;
+    long long start;
+    int ready;
+    request_params params;
+} client;
+
+client clients[MAX_CLIENTS];
+int clients_num = 0;
+int listen_fds[LISTEN_FDS];
+int listen_fds_num = 0;
+
+// Last JPEG for each resolution, with and without watermark
+typedef struct {
+    int counter;
+    snapshot_rect crop;
+    int width;
+    int height;
+    jpeg_options options;
+    long long time;
+    unsigned char *jpeg;
+    unsigned long jpeg_size;
+} cache_entry;
+
+cache_entry cache[SNAPSHOT_SLOTS][2];
+int cache_ttl = CACHE_TTL_DEFAULT;
+
+// Time to get the keyframe, for each mode
+struct {
+    unsigned count;
+    long long total_ms;
+    long long max_ms;
+} stats[2];
+unsigned stats_cache_hits;
+unsigned stats_coalesced;
+
+void update_stats(int mode, long long ms)
+{
+    stats[mode].count++;
+    stats[mode].total_ms += ms;
+    if (ms > stats[mode].max_ms) stats[mode].max_ms = ms;
+}
+
+void write_stats()
+{
+    FILE *fp;
+    int i;
+
+    fp = fopen(STATS_FILE, "w");
+    if (fp == NULL) return;
+    for (i = 0; i < 2; i++) {
+        fprintf(fp, "%s: %u snapshots, keyframe wait avg %lld ms, max %lld ms\n",
+                (i == RING_NEXT) ? "next" : "latest", stats[i].count,
+                (stats[i].count > 0) ? stats[i].total_ms / stats[i].count : 0, stats[i].max_ms);
+    }
+    fprintf(fp, "cache: %u hits, %u coalesced requests\n", stats_cache_hits, stats_coalesced);
+    fclose(fp);
+}
+
+int listen_unix(const char *path)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if ((bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(sock, 8) < 0)) {
+        close(sock);
+        return -1;
+    }
+    // The cgi scripts don't run as root
+    chmod(path, 0666);
+
+    return sock;
+}
+
+int listen_tcp(int port)
+{
+    struct sockaddr_in addr;
+    int sock, on = 1;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ((bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(sock, 8) < 0)) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+int write_all(int sock, const void *buffer, int size)
+{
+    const char *p = (const char *) buffer;
+    int len;
+
+    while (size > 0) {
+        len = write(sock, p, size);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+void send_error(int sock, const char *status)
+{
+    char response[256];
+    int len;
+
+    len = snprintf(response, sizeof(response),
+            "HTTP/1.0 %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s\n",
+            status, (int) strlen(status) + 1, status);
+    write_all(sock, response, len);
+}
+
+// Copies the value of name from the query string, returns 0 if found
+int query_param(const char *query, const char *name, char *value, int size)
+{
+    const char *p = query;
+    int name_len = strlen(name);
+    int len;
+
+    while ((p != NULL) && (*p != '\0')) {
+        if ((strncmp(p, name, name_len) == 0) && (p[name_len] == '=')) {
+            p += name_len + 1;
+            len = strcspn(p, "&");
+            if (len >= size) len = size - 1;
+            memcpy(value, p, len);
+            value[len] = '\0';
+            return 0;
+        }
+        p = strchr(p, '&');
+        if (p != NULL) p++;
+    }
+
+    return -1;
+}
+
+// Decimal number from min to max in *n, returns < 0 if value isn't one
+int parse_long(const char *value, long min, long max, long *n)
+{
+    char *endptr;
+
+    errno = 0;
+    *n = strtol(value, &endptr, 10);
+    if ((errno != 0) || (endptr == value) || (*endptr != '\0') || (*n < min) || (*n > max)) return -1;
+
+    return 0;
+}
+
+// Pixels of the JPEG that p asks for, the size before the resize is the crop or the resolution
+long long output_pixels(const request_params *p)
+{
+    long long w, h;
+
+    if (p->crop.width > 0) {
+        w = p->crop.width;
+        h = p->crop.height;
+    } else if (p->resolution == RESOLUTION_LOW) {
+        w = model.w_low;
+        h = model.h_low;
+    } else {
+        w = model.w_high;
+        h = model.h_high;
+    }
+
+    if ((p->width > 0) && (p->height > 0)) return (long long) p->width * p->height;
+    if (p->width > 0) return p->width * (h * p->width / w);
+    if (p->height > 0) return (w * p->height / h) * p->height;
+    return w * h;
+}
+
+// Parses the request of c, returns 0 if it's a valid snapshot request
+int parse_request(client *c)
+{
+    char value[32];
+    char *path, *query, *end, *endptr;
+    long n;
+
+    if (strncmp(c->request, "GET ", 4) != 0) {
+        send_error(c->sock, "400 Bad Request");
+        return -1;
+    }
+    path = c->request + 4;
+    end = strchr(path, ' ');
+    if (end == NULL) {
+        send_error(c->sock, "400 Bad Request");
+        return -1;
+    }
+    *end = '\0';
+    query = strchr(path, '?');
+    if (query != NULL) *query++ = '\0';
+
+    if ((strcmp(path, "/snapshot.jpg") != 0) && (strcmp(path, "/") != 0)) {
+        send_error(c->sock, "404 Not Found");
+        return -1;
+    }
+
+    c->params.resolution = RESOLUTION_NONE;
+    c->params.watermark = 0;
+    c->params.mode = RING_LATEST;
+    c->params.offset = -1;
+    c->params.time = 0;
+    memset(&c->params.crop, 0, sizeof(c->params.crop));
+    c->params.width = 0;
+    c->params.height = 0;
+    JPGDefaultOptions(&c->params.jpeg);
+    if (query_param(query, "res", value, sizeof(value)) == 0) {
+        if (strcasecmp("low", value) == 0) {
+            c->params.resolution = RESOLUTION_LOW;
+        } else if (strcasecmp("high", value) == 0) {
+            c->params.resolution = RESOLUTION_HIGH;
+        } else {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+    }
+    if (query_param(query, "watermark", value, sizeof(value)) == 0) {
+        c->params.watermark = ((strcasecmp("yes", value) == 0) || (strcmp("1", value) == 0));
+    }
+    if (query_param(query, "mode", value, sizeof(value)) == 0) {
+        c->params.mode = (strcasecmp("next", value) == 0) ? RING_NEXT : RING_LATEST;
+    }
+    if (query_param(query, "offset", value, sizeof(value)) == 0) {
+        if (parse_long(value, 0, INT_MAX, &n) < 0) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+        c->params.offset = n;
+    }
+    // Converted to an offset when the request is served, it may wait
+    if (query_param(query, "time", value, sizeof(value)) == 0) {
+        errno = 0;
+        c->params.time = strtoll(value, &endptr, 10);
+        if ((errno != 0) || (endptr == value) || (*endptr != '\0') || (c->params.time <= 0)) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+    }
+    if ((query_param(query, "crop", value, sizeof(value)) == 0) &&
+            (snapshot_parse_rect(&c->params.crop, value) < 0)) {
+        send_error(c->sock, "400 Bad Request");
+        return -1;
+    }
+    if (query_param(query, "width", value, sizeof(value)) == 0) {
+        if (parse_long(value, 0, INT_MAX, &n) < 0) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+        c->params.width = n;
+    }
+    if (query_param(query, "height", value, sizeof(value)) == 0) {
+        if (parse_long(value, 0, INT_MAX, &n) < 0) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+        c->params.height = n;
+    }
+    if (query_param(query, "quality", value, sizeof(value)) == 0) {
+        if (parse_long(value, 1, 100, &n) < 0) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+        c->params.jpeg.quality = n;
+    }
+    if (query_param(query, "optimize", value, sizeof(value)) == 0) {
+        c->params.jpeg.optimize = ((strcasecmp("yes", value) == 0) || (strcmp("1", value) == 0));
+    }
+    if (query_param(query, "progressive", value, sizeof(value)) == 0) {
+        c->params.jpeg.progressive = ((strcasecmp("yes", value) == 0) || (strcmp("1", value) == 0));
+    }
+    if (query_param(query, "max_size", value, sizeof(value)) == 0) {
+        if (parse_long(value, 0, LONG_MAX, &n) < 0) {
+            send_error(c->sock, "400 Bad Request");
+            return -1;
+        }
+        c->params.jpeg.target_size = n;
+    }
+
+    // The crop is in pixels of the high resolution, unless another one is asked
+    if ((c->params.resolution == RESOLUTION_NONE) && (c->params.crop.width > 0)) {
+        c->params.resolution = RESOLUTION_HIGH;
+    }
+
+    // A thumbnail doesn't need the high resolution decode
+    if (c->params.resolution == RESOLUTION_NONE) {
+        c->params.resolution = ring_fit_resolution(&model, c->params.width, c->params.height);
+    }
+
+    if ((c->params.jpeg.optimize || c->params.jpeg.progressive || (c->params.jpeg.target_size > 0)) &&
+            (output_pixels(&c->params) > JPEG_BUFFERED_MAX_PIXELS)) {
+        send_error(c->sock, "400 Bad Request");
+        return -1;
+    }
+
+    return 0;
+}
+
+void remove_client(int i)
+{
+    close(clients[i].sock);
+    clients_num--;
+    if (i < clients_num) {
+        memmove(&clients[i], &clients[i + 1], (clients_num - i) * sizeof(client));
+    }
+}
+
+// Reads what is available of the request, returns < 0 if the client is gone
+int read_client(client *c)
+{
+    int len;
+
+    len = recv(c->sock, c->request + c->request_len, sizeof(c->request) - 1 - c->request_len, MSG_DONTWAIT);
+    if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return 0;
+    if (len <= 0) return -1;
+    c->request_len += len;
+    c->request[c->request_len] = '\0';
+    if (strstr(c->request, "\r\n\r\n") != NULL) {
+        if (parse_request(c) < 0) return -1;
+        c->ready = 1;
+    } else if (c->request_len >= sizeof(c->request) - 1) {
+        send_error(c->sock, "400 Bad Request");
+        return -1;
+    }
+
+    return 0;
+}
+
+void accept_client(int listen_fd)
+{
+    struct timeval timeout;
+    client *c;
+    int sock;
+
+    sock = accept(listen_fd, NULL, NULL);
+    if (sock < 0) return;
+    if (clients_num == MAX_CLIENTS) {
+        send_error(sock, "503 Service Unavailable");
+        close(sock);
+        return;
+    }
+
+    // A slow client must not block the others for long
+    timeout.tv_sec = REQUEST_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    c = &clients[clients_num++];
+    c->sock = sock;
+    c->request_len = 0;
+    c->start = current_timestamp();
+    c->ready = 0;
+
+    // Usually the request is already there
+    if (read_client(c) < 0) remove_client(clients_num - 1);
+}
+
+/*
+ * Accepts the new clients and reads the pending requests, waiting at most
+ * timeout ms. Requests that are too slow are dropped.
+ */
+void poll_clients(int timeout)
+{
+    struct pollfd fds[LISTEN_FDS + MAX_CLIENTS];
+    int nfds, n, i;
+    long long now;
+
+    nfds = 0;
+    for (i = 0; i < listen_fds_num; i++) {
+        fds[nfds].fd = listen_fds[i];
+        fds[nfds++].events = POLLIN;
+    }
+    n = 0;
+    for (i = 0; i < clients_num; i++) {
+        if (clients[i].ready) continue;
+        n++;
+        fds[nfds].fd = clients[i].sock;
+        fds[nfds++].events = POLLIN;
+    }
+    // Wake up to drop the slow requests
+    if ((n > 0) && ((timeout < 0) || (timeout > REQUEST_TIMEOUT * 1000))) {
+        timeout = REQUEST_TIMEOUT * 1000;
+    }
+
+    if (poll(fds, nfds, timeout) < 0) return;
+
+    // Clients first: accepting moves them around
+    for (i = clients_num - 1; i >= 0; i--) {
+        if (clients[i].ready) continue;
+        for (n = listen_fds_num; n < nfds; n++) {
+            if (fds[n].fd == clients[i].sock) break;
+        }
+        if ((n < nfds) && (fds[n].revents & (POLLIN | POLLHUP | POLLERR))) {
+            if (read_client(&clients[i]) < 0) remove_client(i);
+        }
+    }
+    now = current_timestamp();
+    for (i = clients_num - 1; i >= 0; i--) {
+        if (!clients[i].ready && (now - clients[i].start > REQUEST_TIMEOUT * 1000)) {
+            remove_client(i);
+        }
+    }
+    for (i = 0; i < listen_fds_num; i++) {
+        if (fds[i].revents & POLLIN) accept_client(listen_fds[i]);
+    }
+}
+
+int same_rect(const snapshot_rect *a, const snapshot_rect *b)
+{
+    return (a->x == b->x) && (a->y == b->y) && (a->width == b->width) && (a->height == b->height);
+}
+
+int same_jpeg(const jpeg_options *a, const jpeg_options *b)
+{
+    return (a->quality == b->quality) && (a->optimize == b->optimize) &&
+            (a->progressive == b->progressive) && (a->target_size == b->target_size);
+}
+
+// Sends the snapshot, or the error if jpeg is NULL, to the clients waiting for it
+void reply_clients(const request_params *p, const char *status,
+                   unsigned char *jpeg, unsigned long jpeg_size)
+{
+    char header[256];
+    int len, i, n;
+
+    n = 0;
+    for (i = clients_num - 1; i >= 0; i--) {
+        if (!clients[i].ready || (clients[i].params.resolution != p->resolution) ||
+                (clients[i].params.watermark != p->watermark) || (clients[i].params.mode != p->mode) ||
+                (clients[i].params.offset != p->offset) || (clients[i].params.time != p->time) ||
+                !same_rect(&clients[i].params.crop, &p->crop) || !same_jpeg(&clients[i].params.jpeg, &p->jpeg) ||
+                (clients[i].params.width != p->width) || (clients[i].params.height != p->height)) {
+            continue;
+        }
+        if (jpeg == NULL) {
+            send_error(clients[i].sock, status);
+        } else {
+            len = snprintf(header, sizeof(header),
+                    "HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %lu\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+                    jpeg_size);
+            if (write_all(clients[i].sock, header, len) == 0) {
+                write_all(clients[i].sock, jpeg, jpeg_size);
+            }
+        }
+        remove_client(i);
+        n++;
+    }
+    if ((jpeg != NULL) && (n > 1)) stats_coalesced += n - 1;
+}
+
+// Serves the clients that asked for the same frame before the newest one as c
+void serve_past(client *c)
+{
+    request_params p = c->params;
+    int slot = (p.resolution == RESOLUTION_LOW) ? 0 : 1;
+    long long start, done;
+    unsigned char *bufferh264;
+    int bufferh264_size;
+    int *frame_ends;
+    int frame_count, counter, offset, ret;
+    unsigned char *jpeg;
+    unsigned long jpeg_size;
+
+    start = current_timestamp();
+    if ((r.addr == NULL) && (ring_open(&r, &model) < 0)) {
+        reply_clients(&p, "503 Service Unavailable", NULL, 0);
+        return;
+    }
+
+    offset = (p.time > 0) ? ring_time_offset(p.time) : p.offset;
+    if (ring_find_frame(&r, p.resolution, offset, &bufferh264, &bufferh264_size,
+            &frame_ends, &frame_count, &counter) < 0) {
+        reply_clients(&p, "404 Not Found", NULL, 0);
+        return;
+    }
+
+    // The watermark shows when the frame was taken
+    snapshot.time = (start - (long long) offset * 1000 / RING_FPS) / 1000;
+    snapshot.jpeg = p.jpeg;
+    ret = snapshot_jpeg_frames(&snapshot, slot, bufferh264, frame_ends, frame_count, p.watermark,
+            &p.crop, p.width, p.height, &jpeg, &jpeg_size);
+    snapshot.time = 0;
+    free(frame_ends);
+    free(bufferh264);
+    if (ret < 0) {
+        reply_clients(&p, (ret == -8) ? "400 Bad Request" : "500 Internal Server Error", NULL, 0);
+        return;
+    }
+    done = current_timestamp();
+
+    reply_clients(&p, NULL, jpeg, jpeg_size);
+    free(jpeg);
+
+    if (debug) fprintf(stderr, "%lld - snapshot %s, frame %d, %d frames back: %d frames decoded and encoded in %lld ms, %lu bytes\n",
+            done, (p.resolution == RESOLUTION_LOW) ? "low" : "high", counter, offset, frame_count, done - start, jpeg_size);
+}
+
+// Serves all the clients that asked for the same snapshot as c
+void serve(client *c)
+{
+    request_params p = c->params;
+    int resolution = p.resolution;
+    int watermark = p.watermark;
+    int mode = p.mode;
+    int slot = (resolution == RESOLUTION_LOW) ? 0 : 1;
+    cache_entry *entry = &cache[slot][watermark];
+    long long start, ready, done;
+    int counter, ret;
+
+    unsigned char *bufferh264;
+    int bufferh264_size;
+    unsigned char *jpeg;
+    unsigned long jpeg_size;
+
+    if ((p.offset >= 0) || (p.time > 0)) {
+        serve_past(c);
+        return;
+    }
+
+    start = current_timestamp();
+
+    // The ring is created by the stock firmware, it may not exist yet
+    if ((r.addr == NULL) && (ring_open(&r, &model) < 0)) {
+        reply_clients(&p, "503 Service Unavailable", NULL, 0);
+        return;
+    }
+
+    // Same keyframe and still fresh: nothing to decode
+    if ((mode == RING_LATEST) && (entry->jpeg != NULL) && (start - entry->time < cache_ttl) &&
+            same_rect(&entry->crop, &p.crop) && (entry->width == p.width) && (entry->height == p.height) &&
+            same_jpeg(&entry->options, &p.jpeg) &&
+            (ring_latest_keyframe(&r, resolution) == entry->counter)) {
+        stats_cache_hits++;
+        reply_clients(&p, NULL, entry->jpeg, entry->jpeg_size);
+        if (debug) fprintf(stderr, "%lld - snapshot %s from cache, keyframe %d\n",
+                current_timestamp(), (resolution == RESOLUTION_LOW) ? "low" : "high", entry->counter);
+        write_stats();
+        return;
+    }
+
+    if (ring_get_keyframe(&r, resolution, mode, &bufferh264, &bufferh264_size, &counter) < 0) {
+        reply_clients(&p, "503 Service Unavailable", NULL, 0);
+        return;
+    }
+    ready = current_timestamp();
+    update_stats(mode, ready - start);
+
+    snapshot.jpeg = p.jpeg;
+    ret = snapshot_jpeg(&snapshot, slot, bufferh264, bufferh264_size, watermark,
+            &p.crop, p.width, p.height, &jpeg, &jpeg_size);
+    if (ret < 0) {
+        free(bufferh264);
+        // A crop outside the picture is the only error of the client
+        reply_clients(&p, (ret == -8) ? "400 Bad Request" : "500 Internal Server Error", NULL, 0);
+        return;
+    }
+    free(bufferh264);
+    done = current_timestamp();
+
+    // Let the requests that arrived in the meantime share this one
+    poll_clients(0);
+    reply_clients(&p, NULL, jpeg, jpeg_size);
+
+    if (cache_ttl > 0) {
+        free(entry->jpeg);
+        entry->counter = counter;
+        entry->crop = p.crop;
+        entry->width = p.width;
+        entry->height = p.height;
+        entry->options = p.jpeg;
+        entry->time = done;
+        entry->jpeg = jpeg;
+        entry->jpeg_size = jpeg_size;
+    } else {
+        free(jpeg);
+    }
+    write_stats();
+
+    if (debug) fprintf(stderr, "%lld - snapshot %s, %s, keyframe %d: keyframe wait %lld ms, decode and encode %lld ms, %lu bytes\n",
+            done, (resolution == RESOLUTION_LOW) ? "low" : "high", (mode == RING_NEXT) ? "next" : "latest",
+            counter, ready - start, done - ready, jpeg_size);
+}
+
+void print_usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog_name);
+    fprintf(stderr, "\t-m, --model MODEL                Select cam model: yi_home, yi_home_1080p, yi_dome_720p or yi_outdoor\n");
+    fprintf(stderr, "\t-s, --socket PATH                Unix socket (default %s)\n", SNAPSHOTD_SOCKET);
+    fprintf(stderr, "\t-p, --port PORT                  Also answer on the TCP port PORT (default 0, disabled)\n");
+    fprintf(stderr, "\t-l, --label TEXT                 Write TEXT before the date of the watermark\n");
+    fprintf(stderr, "\t-D, --dct-scaling                Let libjpeg resize when the size is N/8 of the image\n");
+    fprintf(stderr, "\t-t, --ttl MS                     Keep the last JPEG for MS milliseconds (default %d, 0 disabled)\n", CACHE_TTL_DEFAULT);
+    fprintf(stderr, "\t-d, --debug                      Enable debug\n");
+    fprintf(stderr, "\t-h, --help                       Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    int c, i;
+    char *endptr;
+    char *socket_path = SNAPSHOTD_SOCKET;
+    int port = 0;
+    int dct_scaling = 0;
+    char *label = NULL;
+
+    // Settings default
+    ring_model_by_name(&model, "yi_home_1080p");
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"model",  required_argument, 0, 'm'},
+            {"socket",  required_argument, 0, 's'},
+            {"port",  required_argument, 0, 'p'},
+            {"ttl",  required_argument, 0, 't'},
+            {"dct-scaling",  no_argument, 0, 'D'},
+            {"label",  required_argument, 0, 'l'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "m:s:p:t:Dl:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'm':
+            if (ring_model_by_name(&model, optarg) < 0) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 's':
+            socket_path = optarg;
+            break;
+
+        case 'p':
+            errno = 0;    /* To distinguish success/failure after call */
+            port = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno != 0) || (endptr == optarg) || (port < 0) || (port > 65535)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 't':
+            errno = 0;    /* To distinguish success/failure after call */
+            cache_ttl = strtol(optarg, &endptr, 10);
+
+            /* Check for various possible errors */
+            if ((errno != 0) || (endptr == optarg) || (cache_ttl < 0)) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'D':
+            dct_scaling = 1;
+            break;
+
+        case 'l':
+            label = optarg;
+            break;
+
+        case 'd':
+            fprintf(stderr, "Debug on\n");
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    r.addr = NULL;
+    ring_open(&r, &model);
+    snapshot_init(&snapshot);
+    snapshot.dct_scaling = dct_scaling;
+    snapshot.label = label;
+
+    listen_fds[listen_fds_num] = listen_unix(socket_path);
+    if (listen_fds[listen_fds_num] < 0) {
+        fprintf(stderr, "Unable to listen on %s\n", socket_path);
+        return -1;
+    }
+    listen_fds_num++;
+    if (port > 0) {
+        listen_fds[listen_fds_num] = listen_tcp(port);
+        if (listen_fds[listen_fds_num] < 0) {
+            fprintf(stderr, "Unable to listen on port %d\n", port);
+            return -1;
+        }
+        listen_fds_num++;
+    }
+
+    // One snapshot at a time: the pipeline is the bottleneck anyway
+    while (1) {
+        // The oldest ready request first
+        for (i = 0; i < clients_num; i++) {
+            if (clients[i].ready) break;
+        }
+        if (i < clients_num) {
+            serve(&clients[i]);
+            poll_clients(0);
+        } else {
+            poll_clients(-1);
+        }
+    }
+
+    snapshot_free(&snapshot);
+    ring_close(&r);
+
+    return 0;
+}
@@ -45,6 +45,12 @@ typedef struct ShowWaterMarkParam
     unsigned char     id_list[MAX_PIC];  //the index of the picture of the waterMark
 }ShowWaterMarkParam;
 
+void yuv420sp_blending (unsigned int bg_width, unsigned int bg_height,
+            unsigned int left, unsigned int top,
+            unsigned int fg_width, unsigned int fg_height,
+            unsigned char *bg_y, unsigned char *bg_c,
+            unsigned char *fg_y, unsigned char *fg_c,
+            unsigned char *alph);
 void argb2yuv420sp(unsigned char *src_p, unsigned char *alph, unsigned int width, unsigned int height,
                     unsigned char *dest_y, unsigned char *dest_c);
 int watermark_blending(BackGroudLayerInfo *bg_info, WaterMarkInfo *wm_info, ShowWaterMarkParam *wm_Param);
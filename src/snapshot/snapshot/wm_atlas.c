@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Watermark glyph atlas.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "wm_atlas.h"
+#include "water_mark.h"
+
+extern int debug;
+
+int wm_atlas_open(wm_atlas *a, const char *path)
+{
+    struct stat st;
+    int fd, glyph_size;
+
+    memset(a, 0, sizeof(wm_atlas));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if ((fstat(fd, &st) < 0) || (st.st_size < sizeof(wm_atlas_header))) {
+        close(fd);
+        return -2;
+    }
+
+    a->addr = (unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (a->addr == MAP_FAILED) {
+        a->addr = NULL;
+        return -3;
+    }
+    a->size = st.st_size;
+    a->header = (const wm_atlas_header *) a->addr;
+    a->glyphs = a->addr + sizeof(wm_atlas_header);
+
+    // Even sizes: the chroma is shared by 2x2 pixels
+    glyph_size = a->header->width * a->header->height * 5 / 2;
+    if ((memcmp(a->header->magic, WM_ATLAS_MAGIC, 4) != 0) ||
+            (a->header->width == 0) || (a->header->width % 2) ||
+            (a->header->height == 0) || (a->header->height % 2) ||
+            (sizeof(wm_atlas_header) + a->header->count * glyph_size > a->size)) {
+        fprintf(stderr, "Invalid watermark atlas %s\n", path);
+        wm_atlas_close(a);
+        return -4;
+    }
+
+    if (debug) fprintf(stderr, "Watermark atlas %s: %d glyphs %dx%d\n", path,
+            a->header->count, a->header->width, a->header->height);
+
+    return 0;
+}
+
+void wm_atlas_close(wm_atlas *a)
+{
+    if (a->addr != NULL) munmap(a->addr, a->size);
+    memset(a, 0, sizeof(wm_atlas));
+}
+
+int wm_atlas_text_width(const wm_atlas *a, const char *text)
+{
+    return strlen(text) * a->header->width;
+}
+
+void wm_atlas_draw(const wm_atlas *a, unsigned int width, unsigned int height,
+                   unsigned char *y, unsigned char *c, int x, int top, const char *text)
+{
+    unsigned int gw = a->header->width;
+    unsigned int gh = a->header->height;
+    unsigned int glyph_size = gw * gh * 5 / 2;
+    const unsigned char *glyph;
+    const unsigned char *p;
+    int id;
+
+    // The chroma of a glyph must start on a CbCr pair
+    x &= ~1;
+    top &= ~1;
+    if ((top < 0) || (top + gh > height)) return;
+
+    for (p = (const unsigned char *) text; *p != '\0'; p++, x += gw) {
+        if (x < 0) continue;
+        if (x + gw > width) break;
+
+        id = a->header->map[*p];
+        if ((id == WM_ATLAS_NONE) || (id >= a->header->count)) continue;
+
+        glyph = a->glyphs + id * glyph_size;
+        yuv420sp_blending(width, height, x, top, gw, gh, y, c,
+                (unsigned char *) glyph, (unsigned char *) glyph + 2 * gw * gh,
+                (unsigned char *) glyph + gw * gh);
+    }
+}
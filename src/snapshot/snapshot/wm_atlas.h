@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Watermark glyphs packed in one file, converted to YUV and alpha at
+ * build time by wmatlas and mapped at run time: nothing to load or
+ * convert for each snapshot, and any text the font has can be drawn.
+ */
+
+#ifndef WM_ATLAS_H
+#define WM_ATLAS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define WM_ATLAS_FILE "wm_atlas.bin"
+#define WM_ATLAS_MAGIC "WMA1"
+#define WM_ATLAS_NONE 0xFF
+
+/*
+ * File layout: the header, then for each glyph the Y plane, the alpha
+ * plane (width * height each) and the interleaved CbCr plane
+ * (width * height / 2), as SinglePicture of water_mark.h.
+ */
+typedef struct {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+    uint16_t count;
+    uint16_t reserved;
+    // Glyph of each character, WM_ATLAS_NONE if the font doesn't have it
+    uint8_t map[256];
+} wm_atlas_header;
+
+typedef struct {
+    unsigned char *addr;
+    int size;
+    const wm_atlas_header *header;
+    const unsigned char *glyphs;
+} wm_atlas;
+
+/* Maps the atlas file, returns < 0 if it's missing or not valid */
+int wm_atlas_open(wm_atlas *a, const char *path);
+void wm_atlas_close(wm_atlas *a);
+
+/* Width in pixel of text */
+int wm_atlas_text_width(const wm_atlas *a, const char *text);
+
+/*
+ * Blends text on an NV12 picture with the top left corner at x, y.
+ * The characters without a glyph are left blank, the text that doesn't
+ * fit is cut.
+ */
+void wm_atlas_draw(const wm_atlas *a, unsigned int width, unsigned int height,
+                   unsigned char *y, unsigned char *c, int x, int top, const char *text);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Build host tool: packs the watermark glyphs in an atlas for wm_atlas.c.
+ * The digits, space, '-' and ':' come from the stock BMPs, so the date
+ * looks the same; the other printable ASCII characters are rendered with
+ * FreeType from a TTF font to the same cell.
+ *     make wmatlas CC=gcc
+ *     ./wmatlas -b wm_res/low/wm_540p_ -f DejaVuSansMono-Bold.ttf -o wm_res/low/wm_atlas.bin
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "wm_atlas.h"
+#include "water_mark.h"
+
+#define BMP_GLYPHS 13
+
+int debug = 0;
+
+// Characters of the stock BMPs, by file number
+const char bmp_chars[BMP_GLYPHS] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ' ', '-', ':' };
+
+// ARGB (BGRA in memory) cells, width * height * 4 each
+unsigned char *cells[256];
+int cell_width = 0;
+int cell_height = 0;
+
+int read_bmp(const char *filename, unsigned char **argb)
+{
+    FILE *fp;
+    int start = 0, width = 0, height = 0;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s\n", filename);
+        return -1;
+    }
+    fseek(fp, 10, SEEK_SET);
+    fread(&start, 1, 4, fp);
+    fseek(fp, 18, SEEK_SET);
+    fread(&width, 1, 4, fp);
+    fread(&height, 1, 4, fp);
+    // The glyphs are top down: negative height
+    height = -height;
+
+    if (cell_width == 0) {
+        cell_width = width;
+        cell_height = height;
+    }
+    if ((width != cell_width) || (height != cell_height)) {
+        fprintf(stderr, "%s: %dx%d, the other glyphs are %dx%d\n", filename, width, height, cell_width, cell_height);
+        fclose(fp);
+        return -1;
+    }
+
+    *argb = (unsigned char *) malloc(width * height * 4);
+    fseek(fp, start, SEEK_SET);
+    if ((*argb == NULL) || (fread(*argb, width * height * 4, 1, fp) != 1)) {
+        fprintf(stderr, "Unable to read %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+// First and last row with some alpha
+void alpha_rows(const unsigned char *argb, int *first, int *last)
+{
+    int x, y;
+
+    *first = -1;
+    *last = -1;
+    for (y = 0; y < cell_height; y++) {
+        for (x = 0; x < cell_width; x++) {
+            if (argb[(y * cell_width + x) * 4 + 3] != 0) break;
+        }
+        if (x == cell_width) continue;
+        if (*first < 0) *first = y;
+        *last = y;
+    }
+}
+
+/*
+ * Renders the missing printable characters with the font, sized so that
+ * its '0' is as tall as the one of the BMPs and on the same baseline.
+ */
+int render_font(const char *font_file)
+{
+    FT_Library library;
+    FT_Face face;
+    FT_GlyphSlot slot;
+    unsigned char *cell;
+    int first, last, digit_height, baseline;
+    int size, ch, x, y, cx, cy;
+
+    alpha_rows(cells['0'], &first, &last);
+    if (first < 0) return -1;
+    digit_height = last - first + 1;
+    baseline = last + 1;
+
+    if (FT_Init_FreeType(&library) || FT_New_Face(library, font_file, 0, &face)) {
+        fprintf(stderr, "Unable to load %s\n", font_file);
+        return -1;
+    }
+    slot = face->glyph;
+
+    for (size = digit_height; size < 4 * cell_height; size++) {
+        FT_Set_Pixel_Sizes(face, 0, size);
+        if (FT_Load_Char(face, '0', FT_LOAD_RENDER)) break;
+        if ((int) slot->bitmap.rows >= digit_height) break;
+    }
+    if (debug) fprintf(stderr, "Font size %d px for digits %d px high\n", size, digit_height);
+
+    for (ch = 33; ch < 127; ch++) {
+        if (cells[ch] != NULL) continue;
+        if (FT_Load_Char(face, ch, FT_LOAD_RENDER)) continue;
+
+        cell = (unsigned char *) calloc(cell_width * cell_height, 4);
+        if (cell == NULL) return -1;
+        // Centered in the cell, white
+        cx = (cell_width - (slot->advance.x >> 6)) / 2 + slot->bitmap_left;
+        cy = baseline - slot->bitmap_top;
+        for (y = 0; y < (int) slot->bitmap.rows; y++) {
+            for (x = 0; x < (int) slot->bitmap.width; x++) {
+                if ((cx + x < 0) || (cx + x >= cell_width) || (cy + y < 0) || (cy + y >= cell_height)) continue;
+                unsigned char *p = cell + ((cy + y) * cell_width + cx + x) * 4;
+                p[0] = 0xFF;
+                p[1] = 0xFF;
+                p[2] = 0xFF;
+                p[3] = slot->bitmap.buffer[y * slot->bitmap.pitch + x];
+            }
+        }
+        cells[ch] = cell;
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+
+    return 0;
+}
+
+int write_atlas(const char *filename)
+{
+    wm_atlas_header header;
+    unsigned char *glyph;
+    int glyph_size = cell_width * cell_height * 5 / 2;
+    FILE *fp;
+    int ch;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WM_ATLAS_MAGIC, 4);
+    header.width = cell_width;
+    header.height = cell_height;
+    memset(header.map, WM_ATLAS_NONE, sizeof(header.map));
+    for (ch = 0; ch < 256; ch++) {
+        if (cells[ch] != NULL) header.map[ch] = header.count++;
+    }
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to create %s\n", filename);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+
+    glyph = (unsigned char *) malloc(glyph_size);
+    for (ch = 0; ch < 256; ch++) {
+        if (cells[ch] == NULL) continue;
+        // Y, alpha, CbCr as the blending wants them
+        argb2yuv420sp(cells[ch], glyph + cell_width * cell_height, cell_width, cell_height,
+                glyph, glyph + 2 * cell_width * cell_height);
+        fwrite(glyph, glyph_size, 1, fp);
+    }
+    free(glyph);
+    fclose(fp);
+
+    fprintf(stderr, "%s: %d glyphs %dx%d\n", filename, header.count, cell_width, cell_height);
+
+    return 0;
+}
+
+void print_usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog_name);
+    fprintf(stderr, "\t-b, --bmp PREFIX                 Stock glyphs PREFIX0.bmp ... PREFIX12.bmp\n");
+    fprintf(stderr, "\t-f, --font FILE                  TTF font for the other characters\n");
+    fprintf(stderr, "\t-o, --output FILE                Atlas to write\n");
+    fprintf(stderr, "\t-d, --debug                      Enable debug\n");
+    fprintf(stderr, "\t-h, --help                       Show this help\n");
+}
+
+int main(int argc, char **argv)
+{
+    char filename[1024];
+    char *bmp_prefix = NULL;
+    char *font_file = NULL;
+    char *output_file = NULL;
+    int c, i;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"bmp",  required_argument, 0, 'b'},
+            {"font",  required_argument, 0, 'f'},
+            {"output",  required_argument, 0, 'o'},
+            {"debug",  no_argument, 0, 'd'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "b:f:o:dh",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            bmp_prefix = optarg;
+            break;
+
+        case 'f':
+            font_file = optarg;
+            break;
+
+        case 'o':
+            output_file = optarg;
+            break;
+
+        case 'd':
+            debug = 1;
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if ((bmp_prefix == NULL) || (output_file == NULL)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    for (i = 0; i < BMP_GLYPHS; i++) {
+        snprintf(filename, sizeof(filename), "%s%d.bmp", bmp_prefix, i);
+        if (read_bmp(filename, &cells[(unsigned char) bmp_chars[i]]) < 0) return -2;
+    }
+    if ((cell_width % 2) || (cell_height % 2)) {
+        fprintf(stderr, "The glyph size must be even\n");
+        return -2;
+    }
+
+    if ((font_file != NULL) && (render_font(font_file) < 0)) {
+        return -3;
+    }
+
+    return (write_atlas(output_file) < 0) ? -4 : 0;
+}
@@ -0,0 +1,692 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Byte kernels with compile time and run time dispatch.
+ * The vector loops do the multiples of their width, the scalar ones
+ * finish the tail.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV_NEON
+#include <arm_neon.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#if defined(__SSE2__)
+#define YUV_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(YUV_SSE2) && (defined(__clang__) || (__GNUC__ >= 5))
+// Built with target("avx2"), used only if the CPU has it
+#define YUV_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#include "yuv.h"
+
+////////// Scalar //////////
+
+static void interleave_uv_c(unsigned char *uv, const unsigned char *u, const unsigned char *v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+}
+
+static void split_uv_c(unsigned char *u, unsigned char *v, const unsigned char *uv, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+static void nv12_to_ycbcr_c(unsigned char *out, const unsigned char *y, const unsigned char *uv, int width)
+{
+    int i;
+
+    for (i = 0; i + 1 < width; i += 2) {
+        out[0] = y[i];
+        out[1] = uv[i];
+        out[2] = uv[i + 1];
+        out[3] = y[i + 1];
+        out[4] = uv[i];
+        out[5] = uv[i + 1];
+        out += 6;
+    }
+    if (i < width) {
+        out[0] = y[i];
+        out[1] = uv[i];
+        out[2] = uv[i + 1];
+    }
+}
+
+static void blend_c(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = ((256 - a[i]) * dst[i] + fg[i] * a[i]) >> 8;
+    }
+}
+
+static void blend_inverse_c(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = ((256 - a[i]) * dst[i] + (256 - fg[i]) * a[i]) >> 8;
+    }
+}
+
+static unsigned int sum_c(const unsigned char *src, int n)
+{
+    unsigned int s = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        s += src[i];
+    }
+
+    return s;
+}
+
+static void sad16_c(unsigned int *sums, const unsigned char *a, const unsigned char *b, int n)
+{
+    unsigned int s;
+    int i, j, d;
+
+    for (i = 0; i < n; i += 16) {
+        s = 0;
+        for (j = i; (j < i + 16) && (j < n); j++) {
+            // abs() without a branch
+            d = a[j] - b[j];
+            s += (d ^ (d >> 31)) - (d >> 31);
+        }
+        sums[i >> 4] += s;
+    }
+}
+
+static void accumulate_c(unsigned int *sums, const unsigned char *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sums[i] += src[i];
+    }
+}
+
+static void lerp_rows_c(unsigned short *dst, const unsigned char *a, const unsigned char *b, int w, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] * (256 - w) + b[i] * w;
+    }
+}
+
+static const yuv_kernels kernels_c = {
+    "scalar",
+    interleave_uv_c,
+    split_uv_c,
+    nv12_to_ycbcr_c,
+    blend_c,
+    blend_inverse_c,
+    sum_c,
+    sad16_c,
+    accumulate_c,
+    lerp_rows_c
+};
+
+////////// NEON //////////
+
+#ifdef YUV_NEON
+
+static void interleave_uv_neon(unsigned char *uv, const unsigned char *u, const unsigned char *v, int n)
+{
+    uint8x16x2_t t;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        t.val[0] = vld1q_u8(u + i);
+        t.val[1] = vld1q_u8(v + i);
+        vst2q_u8(uv + 2 * i, t);
+    }
+    interleave_uv_c(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static void split_uv_neon(unsigned char *u, unsigned char *v, const unsigned char *uv, int n)
+{
+    uint8x16x2_t t;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        t = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, t.val[0]);
+        vst1q_u8(v + i, t.val[1]);
+    }
+    split_uv_c(u + i, v + i, uv + 2 * i, n - i);
+}
+
+static void nv12_to_ycbcr_neon(unsigned char *out, const unsigned char *y, const unsigned char *uv, int width)
+{
+    uint8x8x2_t c;
+    uint8x16x3_t t;
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+        // 8 Cb and 8 Cr, each one for 2 pixels
+        c = vld2_u8(uv + i);
+        t.val[0] = vld1q_u8(y + i);
+        t.val[1] = vcombine_u8(vzip_u8(c.val[0], c.val[0]).val[0], vzip_u8(c.val[0], c.val[0]).val[1]);
+        t.val[2] = vcombine_u8(vzip_u8(c.val[1], c.val[1]).val[0], vzip_u8(c.val[1], c.val[1]).val[1]);
+        vst3q_u8(out + 3 * i, t);
+    }
+    nv12_to_ycbcr_c(out + 3 * i, y + i, uv + i, width - i);
+}
+
+/*
+ * 256 - a doesn't fit a byte: (256 - a) * d = (255 - a) * d + d, so the
+ * products stay 8 x 8 bit and the sums fit 16 bit.
+ * Glyph rows are short, 8 pixels at a time leave a small tail.
+ */
+static void blend_neon(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    uint8x8_t d, f, al;
+    uint16x8_t t;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        d = vld1_u8(dst + i);
+        f = vld1_u8(fg + i);
+        al = vld1_u8(a + i);
+        t = vmull_u8(d, vmvn_u8(al));
+        t = vmlal_u8(t, f, al);
+        t = vaddw_u8(t, d);
+        vst1_u8(dst + i, vshrn_n_u16(t, 8));
+    }
+    blend_c(dst + i, fg + i, a + i, n - i);
+}
+
+static void blend_inverse_neon(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    uint8x8_t d, f, al;
+    uint16x8_t t;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        d = vld1_u8(dst + i);
+        f = vld1_u8(fg + i);
+        al = vld1_u8(a + i);
+        t = vmull_u8(d, vmvn_u8(al));
+        t = vmlal_u8(t, vmvn_u8(f), al);
+        t = vaddw_u8(t, d);
+        t = vaddw_u8(t, al);
+        vst1_u8(dst + i, vshrn_n_u16(t, 8));
+    }
+    blend_inverse_c(dst + i, fg + i, a + i, n - i);
+}
+
+static unsigned int sum_neon(const unsigned char *src, int n)
+{
+    uint32x4_t s = vdupq_n_u32(0);
+    uint64x2_t s2;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = vpadalq_u16(s, vpaddlq_u8(vld1q_u8(src + i)));
+    }
+    s2 = vpaddlq_u32(s);
+
+    return (unsigned int) (vgetq_lane_u64(s2, 0) + vgetq_lane_u64(s2, 1)) + sum_c(src + i, n - i);
+}
+
+static void sad16_neon(unsigned int *sums, const unsigned char *a, const unsigned char *b, int n)
+{
+    uint64x2_t s;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)))));
+        sums[i >> 4] += (unsigned int) (vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+    }
+    sad16_c(sums + (i >> 4), a + i, b + i, n - i);
+}
+
+static void accumulate_neon(unsigned int *sums, const unsigned char *src, int n)
+{
+    uint8x16_t s;
+    uint16x8_t lo, hi;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = vld1q_u8(src + i);
+        lo = vmovl_u8(vget_low_u8(s));
+        hi = vmovl_u8(vget_high_u8(s));
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(lo)));
+        vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(lo)));
+        vst1q_u32(sums + i + 8, vaddw_u16(vld1q_u32(sums + i + 8), vget_low_u16(hi)));
+        vst1q_u32(sums + i + 12, vaddw_u16(vld1q_u32(sums + i + 12), vget_high_u16(hi)));
+    }
+    accumulate_c(sums + i, src + i, n - i);
+}
+
+static void lerp_rows_neon(unsigned short *dst, const unsigned char *a, const unsigned char *b, int w, int n)
+{
+    uint16x8_t t;
+    int i;
+
+    // 256 doesn't fit the byte multiplies: 16 bits, at most 255 * 256
+    for (i = 0; i + 8 <= n; i += 8) {
+        t = vmulq_n_u16(vmovl_u8(vld1_u8(a + i)), (uint16_t) (256 - w));
+        t = vmlaq_n_u16(t, vmovl_u8(vld1_u8(b + i)), (uint16_t) w);
+        vst1q_u16(dst + i, t);
+    }
+    lerp_rows_c(dst + i, a + i, b + i, w, n - i);
+}
+
+static const yuv_kernels kernels_neon = {
+    "neon",
+    interleave_uv_neon,
+    split_uv_neon,
+    nv12_to_ycbcr_neon,
+    blend_neon,
+    blend_inverse_neon,
+    sum_neon,
+    sad16_neon,
+    accumulate_neon,
+    lerp_rows_neon
+};
+
+#endif
+
+////////// SSE2 //////////
+
+#ifdef YUV_SSE2
+
+static void interleave_uv_sse2(unsigned char *uv, const unsigned char *u, const unsigned char *v, int n)
+{
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = _mm_loadu_si128((const __m128i *) (u + i));
+        b = _mm_loadu_si128((const __m128i *) (v + i));
+        _mm_storeu_si128((__m128i *) (uv + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *) (uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    interleave_uv_c(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static void split_uv_sse2(unsigned char *u, unsigned char *v, const unsigned char *uv, int n)
+{
+    __m128i mask = _mm_set1_epi16(0x00FF);
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = _mm_loadu_si128((const __m128i *) (uv + 2 * i));
+        b = _mm_loadu_si128((const __m128i *) (uv + 2 * i + 16));
+        _mm_storeu_si128((__m128i *) (u + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i *) (v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    split_uv_c(u + i, v + i, uv + 2 * i, n - i);
+}
+
+// The 16 bit products of 256 - a and a byte fit, as their sum
+static void blend_sse2(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i c256 = _mm_set1_epi16(256);
+    __m128i d, f, al, t;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dst + i)), zero);
+        f = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (fg + i)), zero);
+        al = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (a + i)), zero);
+        t = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(c256, al), d), _mm_mullo_epi16(f, al));
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(_mm_srli_epi16(t, 8), zero));
+    }
+    blend_c(dst + i, fg + i, a + i, n - i);
+}
+
+static void blend_inverse_sse2(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i c256 = _mm_set1_epi16(256);
+    __m128i d, f, al, t;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dst + i)), zero);
+        f = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (fg + i)), zero);
+        al = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (a + i)), zero);
+        t = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(c256, al), d),
+                _mm_mullo_epi16(_mm_sub_epi16(c256, f), al));
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(_mm_srli_epi16(t, 8), zero));
+    }
+    blend_inverse_c(dst + i, fg + i, a + i, n - i);
+}
+
+static unsigned int sum_sse2(const unsigned char *src, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i s = zero;
+    int i;
+
+    // Sum of absolute differences with 0: 2 sums of 8 bytes
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = _mm_add_epi64(s, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (src + i)), zero));
+    }
+
+    return (unsigned int) (_mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8))) + sum_c(src + i, n - i);
+}
+
+static void sad16_sse2(unsigned int *sums, const unsigned char *a, const unsigned char *b, int n)
+{
+    __m128i s;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (a + i)), _mm_loadu_si128((const __m128i *) (b + i)));
+        sums[i >> 4] += _mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+    }
+    sad16_c(sums + (i >> 4), a + i, b + i, n - i);
+}
+
+static void accumulate_sse2(unsigned int *sums, const unsigned char *src, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i s, lo, hi;
+    __m128i *p;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        s = _mm_loadu_si128((const __m128i *) (src + i));
+        lo = _mm_unpacklo_epi8(s, zero);
+        hi = _mm_unpackhi_epi8(s, zero);
+        p = (__m128i *) (sums + i);
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(p + 2, _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(p + 3, _mm_add_epi32(_mm_loadu_si128(p + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+    accumulate_c(sums + i, src + i, n - i);
+}
+
+static void lerp_rows_sse2(unsigned short *dst, const unsigned char *a, const unsigned char *b, int w, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i wa = _mm_set1_epi16(256 - w);
+    __m128i wb = _mm_set1_epi16(w);
+    __m128i va, vb;
+    int i;
+
+    // At most 255 * 256: the low 16 bits of the products are enough
+    for (i = 0; i + 16 <= n; i += 16) {
+        va = _mm_loadu_si128((const __m128i *) (a + i));
+        vb = _mm_loadu_si128((const __m128i *) (b + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)));
+        _mm_storeu_si128((__m128i *) (dst + i + 8), _mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)));
+    }
+    lerp_rows_c(dst + i, a + i, b + i, w, n - i);
+}
+
+// SSE2 has no byte shuffle for the 3 byte pixels: the scalar loop does them
+static const yuv_kernels kernels_sse2 = {
+    "sse2",
+    interleave_uv_sse2,
+    split_uv_sse2,
+    nv12_to_ycbcr_c,
+    blend_sse2,
+    blend_inverse_sse2,
+    sum_sse2,
+    sad16_sse2,
+    accumulate_sse2,
+    lerp_rows_sse2
+};
+
+#endif
+
+////////// AVX2 //////////
+
+#ifdef YUV_AVX2
+
+__attribute__((target("avx2")))
+static void interleave_uv_avx2(unsigned char *uv, const unsigned char *u, const unsigned char *v, int n)
+{
+    __m256i a, b, lo, hi;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *) (u + i));
+        b = _mm256_loadu_si256((const __m256i *) (v + i));
+        // The unpacks work inside the 128 bit lanes
+        lo = _mm256_unpacklo_epi8(a, b);
+        hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256((__m256i *) (uv + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *) (uv + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave_uv_c(uv + 2 * i, u + i, v + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void split_uv_avx2(unsigned char *u, unsigned char *v, const unsigned char *uv, int n)
+{
+    __m256i mask = _mm256_set1_epi16(0x00FF);
+    __m256i a, b;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *) (uv + 2 * i));
+        b = _mm256_loadu_si256((const __m256i *) (uv + 2 * i + 32));
+        // The packs work inside the 128 bit lanes: put the quadwords back in order
+        _mm256_storeu_si256((__m256i *) (u + i), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), 0xD8));
+        _mm256_storeu_si256((__m256i *) (v + i), _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8));
+    }
+    split_uv_c(u + i, v + i, uv + 2 * i, n - i);
+}
+
+/*
+ * Output byte k of a group of 16 pixels is Y, Cb or Cr of pixel k / 3:
+ * each 16 byte part is a shuffle of the Y bytes or'ed with a shuffle of
+ * the CbCr bytes (-128 gives 0). Every lane does its own 16 pixels.
+ */
+#define YUV_Y(p)   (p)
+#define YUV_CB(p)  (((p) & ~1))
+#define YUV_CR(p)  (((p) & ~1) + 1)
+#define YUV_NO     -128
+
+__attribute__((target("avx2")))
+static void nv12_to_ycbcr_avx2(unsigned char *out, const unsigned char *y, const unsigned char *uv, int width)
+{
+    static const signed char ymask[3][16] = {
+        { YUV_Y(0), YUV_NO, YUV_NO, YUV_Y(1), YUV_NO, YUV_NO, YUV_Y(2), YUV_NO,
+          YUV_NO, YUV_Y(3), YUV_NO, YUV_NO, YUV_Y(4), YUV_NO, YUV_NO, YUV_Y(5) },
+        { YUV_NO, YUV_NO, YUV_Y(6), YUV_NO, YUV_NO, YUV_Y(7), YUV_NO, YUV_NO,
+          YUV_Y(8), YUV_NO, YUV_NO, YUV_Y(9), YUV_NO, YUV_NO, YUV_Y(10), YUV_NO },
+        { YUV_NO, YUV_Y(11), YUV_NO, YUV_NO, YUV_Y(12), YUV_NO, YUV_NO, YUV_Y(13),
+          YUV_NO, YUV_NO, YUV_Y(14), YUV_NO, YUV_NO, YUV_Y(15), YUV_NO, YUV_NO }
+    };
+    static const signed char cmask[3][16] = {
+        { YUV_NO, YUV_CB(0), YUV_CR(0), YUV_NO, YUV_CB(1), YUV_CR(1), YUV_NO, YUV_CB(2),
+          YUV_CR(2), YUV_NO, YUV_CB(3), YUV_CR(3), YUV_NO, YUV_CB(4), YUV_CR(4), YUV_NO },
+        { YUV_CB(5), YUV_CR(5), YUV_NO, YUV_CB(6), YUV_CR(6), YUV_NO, YUV_CB(7), YUV_CR(7),
+          YUV_NO, YUV_CB(8), YUV_CR(8), YUV_NO, YUV_CB(9), YUV_CR(9), YUV_NO, YUV_CB(10) },
+        { YUV_CR(10), YUV_NO, YUV_CB(11), YUV_CR(11), YUV_NO, YUV_CB(12), YUV_CR(12), YUV_NO,
+          YUV_CB(13), YUV_CR(13), YUV_NO, YUV_CB(14), YUV_CR(14), YUV_NO, YUV_CB(15), YUV_CR(15) }
+    };
+    __m256i ym[3], cm[3], r[3];
+    __m256i yv, cv;
+    int i, j;
+
+    for (j = 0; j < 3; j++) {
+        ym[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) ymask[j]));
+        cm[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) cmask[j]));
+    }
+
+    for (i = 0; i + 32 <= width; i += 32) {
+        yv = _mm256_loadu_si256((const __m256i *) (y + i));
+        cv = _mm256_loadu_si256((const __m256i *) (uv + i));
+        for (j = 0; j < 3; j++) {
+            r[j] = _mm256_or_si256(_mm256_shuffle_epi8(yv, ym[j]), _mm256_shuffle_epi8(cv, cm[j]));
+        }
+        // Lane 0 has pixels 0-15, lane 1 pixels 16-31
+        _mm256_storeu_si256((__m256i *) (out + 3 * i), _mm256_permute2x128_si256(r[0], r[1], 0x20));
+        _mm256_storeu_si256((__m256i *) (out + 3 * i + 32), _mm256_permute2x128_si256(r[2], r[0], 0x30));
+        _mm256_storeu_si256((__m256i *) (out + 3 * i + 64), _mm256_permute2x128_si256(r[1], r[2], 0x31));
+    }
+    nv12_to_ycbcr_c(out + 3 * i, y + i, uv + i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void sad16_avx2(unsigned int *sums, const unsigned char *a, const unsigned char *b, int n)
+{
+    __m256i s;
+    int i;
+
+    // 4 sums of 8 bytes: 2 cells
+    for (i = 0; i + 32 <= n; i += 32) {
+        s = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (a + i)), _mm256_loadu_si256((const __m256i *) (b + i)));
+        sums[i >> 4] += _mm256_extract_epi32(s, 0) + _mm256_extract_epi32(s, 2);
+        sums[(i >> 4) + 1] += _mm256_extract_epi32(s, 4) + _mm256_extract_epi32(s, 6);
+    }
+    sad16_sse2(sums + (i >> 4), a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(unsigned int *sums, const unsigned char *src, int n)
+{
+    __m256i *p;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        p = (__m256i *) (sums + i);
+        _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p),
+                _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)))));
+        _mm256_storeu_si256(p + 1, _mm256_add_epi32(_mm256_loadu_si256(p + 1),
+                _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i + 8)))));
+    }
+    accumulate_sse2(sums + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void lerp_rows_avx2(unsigned short *dst, const unsigned char *a, const unsigned char *b, int w, int n)
+{
+    __m256i wa = _mm256_set1_epi16(256 - w);
+    __m256i wb = _mm256_set1_epi16(w);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi16(
+                _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i))), wa),
+                _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i))), wb)));
+    }
+    lerp_rows_c(dst + i, a + i, b + i, w, n - i);
+}
+
+// The watermark rows are a few dozen pixels: the SSE2 blending is as fast
+static const yuv_kernels kernels_avx2 = {
+    "avx2",
+    interleave_uv_avx2,
+    split_uv_avx2,
+    nv12_to_ycbcr_avx2,
+    blend_sse2,
+    blend_inverse_sse2,
+    sum_sse2,
+    sad16_avx2,
+    accumulate_avx2,
+    lerp_rows_avx2
+};
+
+#endif
+
+////////// Dispatch //////////
+
+const yuv_kernels *yuv_kernels_list[] = {
+    &kernels_c,
+#ifdef YUV_NEON
+    &kernels_neon,
+#endif
+#ifdef YUV_SSE2
+    &kernels_sse2,
+#endif
+#ifdef YUV_AVX2
+    &kernels_avx2,
+#endif
+    NULL
+};
+
+// The CPU can run the set k
+static int supported(const yuv_kernels *k)
+{
+#ifdef YUV_AVX2
+    if (k == &kernels_avx2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 1;
+}
+
+const yuv_kernels *yuv_kernels_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; yuv_kernels_list[i] != NULL; i++) {
+        if (strcmp(yuv_kernels_list[i]->name, name) == 0) {
+            return supported(yuv_kernels_list[i]) ? yuv_kernels_list[i] : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+const yuv_kernels *yuv_get_kernels(void)
+{
+    static const yuv_kernels *kernels = NULL;
+    const char *name;
+    int i;
+
+    if (kernels != NULL) return kernels;
+
+    name = getenv("YUV_KERNELS");
+    if (name != NULL) kernels = yuv_kernels_by_name(name);
+
+    if (kernels == NULL) {
+        // The last one built is the fastest
+        for (i = 0; yuv_kernels_list[i] != NULL; i++) {
+            if (supported(yuv_kernels_list[i])) kernels = yuv_kernels_list[i];
+        }
+    }
+
+    return kernels;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Byte kernels of the snapshot pipeline: chroma interleave and split
+ * between I420 and NV12, NV12 to the YCbCr rows of libjpeg, the alpha
+ * blending of the watermark, the frame differences of motion detection
+ * and the row passes of the resize.
+ * Every kernel has a scalar reference, the vector versions must give the
+ * same bytes for any length and alignment.
+ */
+
+#ifndef YUV_H
+#define YUV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct {
+    const char *name;
+    /* uv[2 * i] = u[i], uv[2 * i + 1] = v[i], i < n */
+    void (*interleave_uv)(unsigned char *uv, const unsigned char *u, const unsigned char *v, int n);
+    /* u[i] = uv[2 * i], v[i] = uv[2 * i + 1], i < n */
+    void (*split_uv)(unsigned char *u, unsigned char *v, const unsigned char *uv, int n);
+    /* out[3 * i] = y[i], out[3 * i + 1] = uv[i & ~1], out[3 * i + 2] = uv[(i & ~1) + 1], i < width */
+    void (*nv12_to_ycbcr)(unsigned char *out, const unsigned char *y, const unsigned char *uv, int width);
+    /* dst[i] = ((256 - a[i]) * dst[i] + fg[i] * a[i]) >> 8, i < n */
+    void (*blend)(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n);
+    /* dst[i] = ((256 - a[i]) * dst[i] + (256 - fg[i]) * a[i]) >> 8, i < n */
+    void (*blend_inverse)(unsigned char *dst, const unsigned char *fg, const unsigned char *a, int n);
+    /* Sum of src[i], i < n */
+    unsigned int (*sum)(const unsigned char *src, int n);
+    /* sums[i / 16] += |a[i] - b[i]|, i < n */
+    void (*sad16)(unsigned int *sums, const unsigned char *a, const unsigned char *b, int n);
+    /* sums[i] += src[i], i < n */
+    void (*accumulate)(unsigned int *sums, const unsigned char *src, int n);
+    /* dst[i] = a[i] * (256 - w) + b[i] * w, i < n, 0 <= w <= 256 */
+    void (*lerp_rows)(unsigned short *dst, const unsigned char *a, const unsigned char *b, int w, int n);
+} yuv_kernels;
+
+/*
+ * The kernels for this CPU: NEON if the compiler targets it, AVX2 or SSE2
+ * on x86 if the CPU has them, scalar otherwise.
+ * YUV_KERNELS=name in the environment forces a set.
+ */
+const yuv_kernels *yuv_get_kernels(void);
+
+/* The kernel set called name, NULL if it isn't built or the CPU lacks it */
+const yuv_kernels *yuv_kernels_by_name(const char *name);
+
+/* NULL terminated list of the sets built in, the scalar one first */
+extern const yuv_kernels *yuv_kernels_list[];
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2021 roleo.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the vector kernels of yuv.c against the scalar ones and times
+ * them on a frame and on the watermark. Runs on the cam and on the build host:
+ *     make yuvbench CC=gcc && ./yuvbench
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <getopt.h>
+
+#include "yuv.h"
+
+#define CHECK_MAX_LENGTH 200
+#define CHECK_OFFSETS 4
+
+long long current_timestamp_us()
+{
+    struct timeval te;
+
+    gettimeofday(&te, NULL);
+    return te.tv_sec * 1000000LL + te.tv_usec;
+}
+
+void fill_random(unsigned char *p, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        p[i] = rand() & 0xFF;
+    }
+}
+
+/*
+ * Compares the kernels of k with the scalar ones on every length up to
+ * CHECK_MAX_LENGTH and on unaligned buffers.
+ * Returns the number of mismatches.
+ */
+int check_kernels(const yuv_kernels *k, const yuv_kernels *ref)
+{
+    unsigned char src[3][2 * CHECK_MAX_LENGTH + CHECK_OFFSETS];
+    unsigned char out[2][3 * CHECK_MAX_LENGTH + 2 * CHECK_OFFSETS];
+    unsigned char out_ref[2][3 * CHECK_MAX_LENGTH + 2 * CHECK_OFFSETS];
+    unsigned int sums[2 * CHECK_MAX_LENGTH / 16 + 1], sums_ref[2 * CHECK_MAX_LENGTH / 16 + 1];
+    unsigned int acc[CHECK_MAX_LENGTH + 1], acc_ref[CHECK_MAX_LENGTH + 1];
+    unsigned short lerp[CHECK_MAX_LENGTH + 1], lerp_ref[CHECK_MAX_LENGTH + 1];
+    int n, off, w, errors = 0;
+
+    for (n = 0; n <= CHECK_MAX_LENGTH; n++) {
+        for (off = 0; off < CHECK_OFFSETS; off++) {
+            fill_random(&src[0][0], sizeof(src));
+            // Same guard bytes in both outputs: they must stay untouched
+            fill_random(&out[0][0], sizeof(out));
+            memcpy(out_ref, out, sizeof(out));
+
+            k->interleave_uv(out[0] + off, src[0] + off, src[1], n);
+            ref->interleave_uv(out_ref[0] + off, src[0] + off, src[1], n);
+            if (memcmp(out, out_ref, sizeof(out)) != 0) {
+                fprintf(stderr, "%s: interleave_uv differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            k->split_uv(out[0] + off, out[1], src[0] + off, n);
+            ref->split_uv(out_ref[0] + off, out_ref[1], src[0] + off, n);
+            if (memcmp(out, out_ref, sizeof(out)) != 0) {
+                fprintf(stderr, "%s: split_uv differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            k->nv12_to_ycbcr(out[0] + off, src[0], src[1] + off, n);
+            ref->nv12_to_ycbcr(out_ref[0] + off, src[0], src[1] + off, n);
+            if (memcmp(out, out_ref, sizeof(out)) != 0) {
+                fprintf(stderr, "%s: nv12_to_ycbcr differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            // Transparent and opaque pixels too
+            src[2][off] = 0;
+            src[2][off + 1] = 255;
+            k->blend(out[0] + off, src[0], src[2] + off, n);
+            ref->blend(out_ref[0] + off, src[0], src[2] + off, n);
+            if (memcmp(out, out_ref, sizeof(out)) != 0) {
+                fprintf(stderr, "%s: blend differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            k->blend_inverse(out[0] + off, src[0] + off, src[2], n);
+            ref->blend_inverse(out_ref[0] + off, src[0] + off, src[2], n);
+            if (memcmp(out, out_ref, sizeof(out)) != 0) {
+                fprintf(stderr, "%s: blend_inverse differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            if (k->sum(src[0] + off, 2 * n) != ref->sum(src[0] + off, 2 * n)) {
+                fprintf(stderr, "%s: sum differs, length %d, offset %d\n", k->name, 2 * n, off);
+                errors++;
+            }
+
+            // The sums are added to, not set
+            fill_random((unsigned char *) sums, sizeof(sums));
+            memcpy(sums_ref, sums, sizeof(sums));
+            k->sad16(sums, src[0] + off, src[1], 2 * n);
+            ref->sad16(sums_ref, src[0] + off, src[1], 2 * n);
+            if (memcmp(sums, sums_ref, sizeof(sums)) != 0) {
+                fprintf(stderr, "%s: sad16 differs, length %d, offset %d\n", k->name, 2 * n, off);
+                errors++;
+            }
+
+            fill_random((unsigned char *) acc, sizeof(acc));
+            memcpy(acc_ref, acc, sizeof(acc));
+            k->accumulate(acc, src[0] + off, n);
+            ref->accumulate(acc_ref, src[0] + off, n);
+            if (memcmp(acc, acc_ref, sizeof(acc)) != 0) {
+                fprintf(stderr, "%s: accumulate differs, length %d, offset %d\n", k->name, n, off);
+                errors++;
+            }
+
+            // The end weights too
+            w = (off == 0) ? 0 : (off == 1) ? 256 : rand() % 257;
+            fill_random((unsigned char *) lerp, sizeof(lerp));
+            memcpy(lerp_ref, lerp, sizeof(lerp));
+            k->lerp_rows(lerp, src[0] + off, src[1], w, n);
+            ref->lerp_rows(lerp_ref, src[0] + off, src[1], w, n);
+            if (memcmp(lerp, lerp_ref, sizeof(lerp)) != 0) {
+                fprintf(stderr, "%s: lerp_rows differs, length %d, offset %d, weight %d\n", k->name, n, off, w);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/*
+ * Microseconds per frame of each kernel, row by row as the pipeline does.
+ * The watermark kernels do the rows of the big date watermark
+ * (19 glyphs of 24x32) and its brightness check, sad16 the Y plane
+ * against another one as motion detection does, accumulate and lerp_rows
+ * the rows of the Y plane as the resize does.
+ */
+void bench_kernels(const yuv_kernels *k, int width, int height, int iterations)
+{
+    unsigned char *y, *uv, *u, *v, *row, *fg, *alpha;
+    unsigned int *sums, *acc;
+    unsigned short *lerp;
+    volatile unsigned int sum = 0;
+    long long start, t[8];
+    int i, j, wm_width = 19 * 24, wm_height = 32;
+
+    if (wm_width > width) wm_width = width;
+    if (wm_height > height) wm_height = height;
+
+    y = (unsigned char *) malloc(width * height);
+    uv = (unsigned char *) malloc(width * height / 2);
+    u = (unsigned char *) malloc(width * height / 4);
+    v = (unsigned char *) malloc(width * height / 4);
+    row = (unsigned char *) malloc(width * 3);
+    fg = (unsigned char *) malloc(wm_width * wm_height);
+    alpha = (unsigned char *) malloc(wm_width * wm_height);
+    sums = (unsigned int *) calloc((width + 15) / 16, sizeof(unsigned int));
+    acc = (unsigned int *) calloc(width, sizeof(unsigned int));
+    lerp = (unsigned short *) malloc(width * sizeof(unsigned short));
+    if ((y == NULL) || (uv == NULL) || (u == NULL) || (v == NULL) || (row == NULL) ||
+            (fg == NULL) || (alpha == NULL) || (sums == NULL) || (acc == NULL) || (lerp == NULL)) {
+        fprintf(stderr, "Unable to allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    fill_random(y, width * height);
+    fill_random(u, width * height / 4);
+    fill_random(v, width * height / 4);
+    fill_random(fg, wm_width * wm_height);
+    fill_random(alpha, wm_width * wm_height);
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height / 2; j++) {
+            k->interleave_uv(uv + j * width, u + j * width / 2, v + j * width / 2, width / 2);
+        }
+    }
+    t[0] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height / 2; j++) {
+            k->split_uv(u + j * width / 2, v + j * width / 2, uv + j * width, width / 2);
+        }
+    }
+    t[1] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height; j++) {
+            k->nv12_to_ycbcr(row, y + j * width, uv + (j / 2) * width, width);
+        }
+    }
+    t[2] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < wm_height; j++) {
+            k->blend(y + j * width, fg + j * wm_width, alpha + j * wm_width, wm_width);
+            if ((j & 1) == 0) k->blend(uv + (j / 2) * width, fg + j * wm_width, alpha + j * wm_width, wm_width);
+        }
+    }
+    t[3] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < wm_height; j++) {
+            sum += k->sum(y + j * width, wm_width);
+        }
+    }
+    t[4] = current_timestamp_us() - start;
+
+    // The Y plane against the chroma planes, which are as large
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height / 2; j++) {
+            k->sad16(sums, y + j * width, uv + j * width, width);
+            k->sad16(sums, y + (height / 2 + j) * width, uv + j * width, width);
+        }
+    }
+    t[5] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height; j++) {
+            k->accumulate(acc, y + j * width, width);
+        }
+    }
+    t[6] = current_timestamp_us() - start;
+
+    start = current_timestamp_us();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < height - 1; j++) {
+            k->lerp_rows(lerp, y + j * width, y + (j + 1) * width, j & 0xFF, width);
+        }
+    }
+    t[7] = current_timestamp_us() - start;
+
+    printf("%-8s %14lld %10lld %15lld %7.2f %7.2f %7lld %10lld %9lld\n", k->name,
+            t[0] / iterations, t[1] / iterations, t[2] / iterations,
+            (double) t[3] / iterations, (double) t[4] / iterations, t[5] / iterations,
+            t[6] / iterations, t[7] / iterations);
+
+    free(y);
+    free(uv);
+    free(u);
+    free(v);
+    free(row);
+    free(fg);
+    free(alpha);
+    free(sums);
+    free(acc);
+    free(lerp);
+}
+
+void print_usage(char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog_name);
+    fprintf(stderr, "\t-W, --width WIDTH                Frame width (default 1920)\n");
+    fprintf(stderr, "\t-H, --height HEIGHT              Frame height (default 1080)\n");
+    fprintf(stderr, "\t-i, --iterations N               Frames to time (default 50)\n");
+    fprintf(stderr, "\t-h, --help                       Show this help\n");
+}
+
+int main(int argc, char **argv)
+{
+    const yuv_kernels *ref, *k;
+    int width = 1920;
+    int height = 1080;
+    int iterations = 50;
+    int c, i, errors = 0;
+
+    while (1) {
+        static struct option long_options[] =
+        {
+            {"width",  required_argument, 0, 'W'},
+            {"height",  required_argument, 0, 'H'},
+            {"iterations",  required_argument, 0, 'i'},
+            {"help",  no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "W:H:i:h",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'W':
+            width = atoi(optarg) & ~1;
+            break;
+
+        case 'H':
+            height = atoi(optarg) & ~1;
+            break;
+
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0]);
+            return -1;
+            break;
+
+        case '?':
+            /* getopt_long already printed an error message. */
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if ((width < 2) || (height < 2) || (iterations < 1)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    ref = yuv_kernels_by_name("scalar");
+    printf("Default kernels: %s\n", yuv_get_kernels()->name);
+    printf("%dx%d, us per frame:\n", width, height);
+    printf("%-8s %14s %10s %15s %7s %7s %7s %10s %9s\n", "kernels", "interleave_uv", "split_uv", "nv12_to_ycbcr",
+            "blend", "sum", "sad16", "accumulate", "lerp_rows");
+    for (i = 0; yuv_kernels_list[i] != NULL; i++) {
+        k = yuv_kernels_by_name(yuv_kernels_list[i]->name);
+        if (k == NULL) {
+            printf("%-8s not supported by this CPU\n", yuv_kernels_list[i]->name);
+            continue;
+        }
+        if (k != ref) errors += check_kernels(k, ref);
+        bench_kernels(k, width, height, iterations);
+    }
+
+    if (errors > 0) {
+        printf("%d mismatches with the scalar kernels\n", errors);
+        return 1;
+    }
+    printf("All kernels match the scalar ones\n");
+
+    return 0;
+}
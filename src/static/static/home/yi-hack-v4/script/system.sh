@@ -74,6 +74,14 @@ if [[ $(get_config MQTT) == "yes" ]] ; then
     mqttv4 &
 fi
 
+if [[ $(get_config SNAPSHOT) == "yes" ]] ; then
+    snapshotd -m $(cat /home/app/.camver) &
+fi
+
+if [[ $(get_config MOTION) == "yes" ]] ; then
+    motiond -m $(cat /home/app/.camver) -s $(get_config MOTION_SENSITIVITY) > /dev/null &
+fi
+
 if [[ $(get_config RTSP) == "yes" ]] ; then
 #    if [[ -f "$YI_HACK_PREFIX/bin/viewd" && -f "$YI_HACK_PREFIX/bin/rtspv4" ]]
 #        viewd -D -S
@@ -84,7 +92,7 @@ if [[ $(get_config RTSP) == "yes" ]] ; then
 	CAMVER=$(cat /home/app/.camver)
 	h264grabber -r low -m $CAMVER -f &
 	h264grabber -r high -m $CAMVER -f &
-	rRTSPServer -r both &
+	rRTSPServer -r both -H &
 #fi
 fi
 